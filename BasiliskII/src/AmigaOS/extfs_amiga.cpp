@@ -315,6 +315,32 @@ ssize_t extfs_write(int fd, void *buffer, size_t length)
 	return write(fd, buffer, length);
 }
 
+/*
+ *  Read "length" bytes at file position "offset" to "buffer",
+ *  returns number of bytes read (or -1 on error)
+ */
+
+ssize_t extfs_pread(int fd, void *buffer, size_t length, loff_t offset)
+{
+	if (lseek(fd, offset, SEEK_SET) < 0)
+		return -1;
+	return extfs_read(fd, buffer, length);
+}
+
+
+/*
+ *  Write "length" bytes from "buffer" to file position "offset",
+ *  returns number of bytes written (or -1 on error)
+ */
+
+ssize_t extfs_pwrite(int fd, void *buffer, size_t length, loff_t offset)
+{
+	if (lseek(fd, offset, SEEK_SET) < 0)
+		return -1;
+	return extfs_write(fd, buffer, length);
+}
+
+
 
 /*
  *  Remove file/directory (and associated helper files),
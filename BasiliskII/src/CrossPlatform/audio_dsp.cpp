@@ -0,0 +1,335 @@
+/*
+ *  audio_dsp.cpp - Audio output, sample conversion, resampling and mixing
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "sysdeps.h"
+#include "audio_dsp.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AUDIO_DSP_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef WORDS_BIGENDIAN
+#define HOST_BIG_ENDIAN true
+#else
+#define HOST_BIG_ENDIAN false
+#endif
+
+// Resampler filter design
+const int MAX_PHASES = 1024;			// Upper limit for L, beyond that the rate ratio is rounded
+const double CUTOFF = 0.90;				// Cutoff relative to the lower Nyquist frequency
+const double KAISER_BETA = 8.0;			// Kaiser window parameter (about 80 dB stopband)
+const double PI = 3.14159265358979323846;
+
+static inline int16 saturate16(int32 x)
+{
+	return x > 32767 ? 32767 : (x < -32768 ? -32768 : x);
+}
+
+
+/*
+ *  Convert 8 bit unsigned or 16 bit signed, mono or stereo samples to the
+ *  internal format
+ */
+
+static inline int16 swap16(int16 x)
+{
+	return (int16)(((uint16)x >> 8) | ((uint16)x << 8));
+}
+
+void Audio_convert(int16 * dest, const uint8 * source, int frames, int sample_size, int channels, bool big_endian)
+{
+	bool swap = big_endian != HOST_BIG_ENDIAN;
+	int i = 0;
+
+	if (sample_size == 16 && channels == 2) {
+		const int16 *src = (const int16 *)source;
+		int n = frames * 2;
+		if (!swap) {
+			memcpy(dest, src, n * 2);
+			return;
+		}
+#if AUDIO_DSP_SSE2
+		for (; i + 8 <= n; i += 8) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+			v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+			_mm_storeu_si128((__m128i *)(dest + i), v);
+		}
+#endif
+		for (; i < n; i++)
+			dest[i] = swap16(src[i]);
+
+	} else if (sample_size == 16 && channels == 1) {
+		const int16 *src = (const int16 *)source;
+#if AUDIO_DSP_SSE2
+		for (; i + 8 <= frames; i += 8) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+			if (swap)
+				v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+			_mm_storeu_si128((__m128i *)(dest + 2 * i), _mm_unpacklo_epi16(v, v));
+			_mm_storeu_si128((__m128i *)(dest + 2 * i + 8), _mm_unpackhi_epi16(v, v));
+		}
+#endif
+		for (; i < frames; i++)
+			dest[2 * i] = dest[2 * i + 1] = swap ? swap16(src[i]) : src[i];
+
+	} else if (sample_size == 8 && channels == 2) {
+		int n = frames * 2;
+#if AUDIO_DSP_SSE2
+		const __m128i sign = _mm_set1_epi8((char)0x80), zero = _mm_setzero_si128();
+		for (; i + 16 <= n; i += 16) {
+			__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(source + i)), sign);
+			_mm_storeu_si128((__m128i *)(dest + i), _mm_unpacklo_epi8(zero, v));
+			_mm_storeu_si128((__m128i *)(dest + i + 8), _mm_unpackhi_epi8(zero, v));
+		}
+#endif
+		for (; i < n; i++)
+			dest[i] = (int16)((source[i] ^ 0x80) << 8);
+
+	} else if (sample_size == 8 && channels == 1) {
+#if AUDIO_DSP_SSE2
+		const __m128i sign = _mm_set1_epi8((char)0x80), zero = _mm_setzero_si128();
+		for (; i + 16 <= frames; i += 16) {
+			__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(source + i)), sign);
+			__m128i lo = _mm_unpacklo_epi8(zero, v), hi = _mm_unpackhi_epi8(zero, v);
+			_mm_storeu_si128((__m128i *)(dest + 2 * i), _mm_unpacklo_epi16(lo, lo));
+			_mm_storeu_si128((__m128i *)(dest + 2 * i + 8), _mm_unpackhi_epi16(lo, lo));
+			_mm_storeu_si128((__m128i *)(dest + 2 * i + 16), _mm_unpacklo_epi16(hi, hi));
+			_mm_storeu_si128((__m128i *)(dest + 2 * i + 24), _mm_unpackhi_epi16(hi, hi));
+		}
+#endif
+		for (; i < frames; i++)
+			dest[2 * i] = dest[2 * i + 1] = (int16)((source[i] ^ 0x80) << 8);
+
+	} else
+		memset(dest, 0, frames * 4);
+}
+
+
+/*
+ *  Polyphase resampler: a windowed sinc low-pass with AUDIO_RESAMPLER_TAPS
+ *  taps, evaluated at L = out_rate / gcd(in_rate, out_rate) phases between
+ *  two input samples. If L > MAX_PHASES, the nearest of MAX_PHASES phases is
+ *  used; the rate itself stays exact. All the usual combinations of 11025,
+ *  22050, 44100 and 48000 Hz get exact phases.
+ */
+
+static int gcd(int a, int b)
+{
+	while (b) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// Zeroth order modified Bessel function of the first kind
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 50; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+bool Audio_resampler_init(AudioResampler & r, int in_rate, int out_rate)
+{
+	Audio_resampler_exit(r);
+	r.in_rate = in_rate;
+	r.out_rate = out_rate;
+	if (in_rate <= 0 || out_rate <= 0 || in_rate == out_rate)
+		return true;	// Pass-through
+
+	int g = gcd(in_rate, out_rate);
+	int L = out_rate / g;
+	r.den = L;
+	r.step = in_rate / g;
+	if (L > MAX_PHASES)
+		L = MAX_PHASES;
+	r.coeffs = (int16 *)malloc(L * AUDIO_RESAMPLER_TAPS * sizeof(int16));
+	if (r.coeffs == NULL)
+		return false;
+	r.phases = L;
+
+	// Cutoff in cycles per input sample
+	double fc = 0.5 * CUTOFF;
+	if (out_rate < in_rate)
+		fc = fc * out_rate / in_rate;
+	const int half = AUDIO_RESAMPLER_TAPS / 2;
+	const double i0_beta = bessel_i0(KAISER_BETA);
+	double h[AUDIO_RESAMPLER_TAPS];
+	for (int p = 0; p < L; p++) {
+
+		// Phase p produces the output half - 1 + p/L input frames after its first tap
+		double sum = 0.0;
+		for (int k = 0; k < AUDIO_RESAMPLER_TAPS; k++) {
+			double x = half - 1 + (double)p / L - k;
+			double t = x / half;
+			double w = bessel_i0(KAISER_BETA * sqrt(t < 1.0 ? 1.0 - t * t : 0.0)) / i0_beta;
+			double s = x == 0.0 ? 1.0 : sin(2 * PI * fc * x) / (2 * PI * fc * x);
+			h[k] = 2 * fc * s * w;
+			sum += h[k];
+		}
+
+		// Normalize to unity DC gain
+		int16 *c = r.coeffs + p * AUDIO_RESAMPLER_TAPS;
+		for (int k = 0; k < AUDIO_RESAMPLER_TAPS; k++)
+			c[k] = saturate16((int32)floor(h[k] / sum * 32768.0 + 0.5));
+	}
+
+	// Start with silence in the history, that's the filter delay
+	r.hist_size = 4096;
+	r.hist[0] = (int16 *)calloc(r.hist_size, sizeof(int16));
+	r.hist[1] = (int16 *)calloc(r.hist_size, sizeof(int16));
+	if (r.hist[0] == NULL || r.hist[1] == NULL) {
+		Audio_resampler_exit(r);
+		return false;
+	}
+	r.hist_len = AUDIO_RESAMPLER_TAPS - 1;
+	r.pos = 0;
+	r.phase = 0;
+	return true;
+}
+
+void Audio_resampler_exit(AudioResampler & r)
+{
+	free(r.coeffs);
+	free(r.hist[0]);
+	free(r.hist[1]);
+	r.coeffs = r.hist[0] = r.hist[1] = NULL;
+	r.phases = 0;
+	r.hist_size = r.hist_len = 0;
+}
+
+// Upper limit of the number of frames Audio_resample() returns for in_frames
+int Audio_resampler_max_output(AudioResampler const & r, int in_frames)
+{
+	if (r.phases == 0)
+		return in_frames;
+	return (int)((int64)(r.hist_len + in_frames) * r.den / r.step) + 1;
+}
+
+static inline int32 dot_taps(const int16 * x, const int16 * c)
+{
+#if AUDIO_DSP_SSE2
+	__m128i acc = _mm_setzero_si128();
+	for (int k = 0; k < AUDIO_RESAMPLER_TAPS; k += 8)
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(x + k)), _mm_loadu_si128((const __m128i *)(c + k))));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(acc);
+#else
+	int32 sum = 0;
+	for (int k = 0; k < AUDIO_RESAMPLER_TAPS; k++)
+		sum += x[k] * c[k];
+	return sum;
+#endif
+}
+
+// Resample in_frames frames, returns the number of frames stored in dest
+int Audio_resample(AudioResampler & r, int16 * dest, const int16 * source, int in_frames)
+{
+	if (r.phases == 0) {
+		memcpy(dest, source, in_frames * 4);
+		return in_frames;
+	}
+
+	// Append input to the history
+	if (r.hist_len + in_frames > r.hist_size) {
+		int size = r.hist_len + in_frames;
+		int16 *l = (int16 *)realloc(r.hist[0], size * sizeof(int16));
+		if (l)
+			r.hist[0] = l;
+		int16 *rr = (int16 *)realloc(r.hist[1], size * sizeof(int16));
+		if (rr)
+			r.hist[1] = rr;
+		if (l == NULL || rr == NULL)
+			return 0;
+		r.hist_size = size;
+	}
+	int16 *l = r.hist[0] + r.hist_len, *rr = r.hist[1] + r.hist_len;
+	for (int i = 0; i < in_frames; i++) {
+		l[i] = source[2 * i];
+		rr[i] = source[2 * i + 1];
+	}
+	r.hist_len += in_frames;
+
+	// Compute all output frames the history covers
+	int out = 0;
+	while (r.pos + AUDIO_RESAMPLER_TAPS <= r.hist_len) {
+		int p = r.phases == r.den ? r.phase : (int)((int64)r.phase * r.phases / r.den);
+		const int16 *c = r.coeffs + p * AUDIO_RESAMPLER_TAPS;
+		dest[2 * out] = saturate16((dot_taps(r.hist[0] + r.pos, c) + 0x4000) >> 15);
+		dest[2 * out + 1] = saturate16((dot_taps(r.hist[1] + r.pos, c) + 0x4000) >> 15);
+		out++;
+		r.phase += r.step;
+		r.pos += r.phase / r.den;
+		r.phase %= r.den;
+	}
+
+	// Drop what is no longer needed
+	int drop = r.pos < r.hist_len ? r.pos : r.hist_len;
+	memmove(r.hist[0], r.hist[0] + drop, (r.hist_len - drop) * sizeof(int16));
+	memmove(r.hist[1], r.hist[1] + drop, (r.hist_len - drop) * sizeof(int16));
+	r.hist_len -= drop;
+	r.pos -= drop;
+	return out;
+}
+
+
+/*
+ *  Mix two streams with volume, either may be NULL (silence)
+ */
+
+void Audio_mix(int16 * dest, const int16 * a, int vol_a, const int16 * b, int vol_b, int frames)
+{
+	int n = frames * 2, i = 0;
+	if (a == NULL)
+		vol_a = 0;
+	if (b == NULL)
+		vol_b = 0;
+
+#if AUDIO_DSP_SSE2
+	const __m128i vol = _mm_set1_epi32((vol_b << 16) | (vol_a & 0xffff));
+	const __m128i round = _mm_set1_epi32(0x80);
+	for (; i + 8 <= n; i += 8) {
+		__m128i va = a ? _mm_loadu_si128((const __m128i *)(a + i)) : _mm_setzero_si128();
+		__m128i vb = b ? _mm_loadu_si128((const __m128i *)(b + i)) : _mm_setzero_si128();
+		__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(va, vb), vol);
+		__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(va, vb), vol);
+		lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 8);
+		hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 8);
+		_mm_storeu_si128((__m128i *)(dest + i), _mm_packs_epi32(lo, hi));
+	}
+#endif
+	for (; i < n; i++) {
+		int32 x = (a ? a[i] * vol_a : 0) + (b ? b[i] * vol_b : 0);
+		dest[i] = saturate16((x + 0x80) >> 8);
+	}
+}
@@ -0,0 +1,54 @@
+/*
+ *  audio_dsp.h - Audio output, sample conversion, resampling and mixing
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef AUDIO_DSP_H
+#define AUDIO_DSP_H
+
+/*
+ *  All functions work on interleaved stereo 16-bit samples in host byte
+ *  order ("frames" are pairs of samples). Volumes are 8.8 fixed point,
+ *  0x0100 meaning unity gain.
+ */
+
+// Polyphase resampler state, zero it before the first Audio_resampler_init()
+struct AudioResampler {
+	int		in_rate, out_rate;		// Sample rates [Hz]
+	int		phases;					// Number of filter phases
+	int		den;					// Phase resolution (out_rate / gcd of the rates)
+	int		step;					// Input advance per output frame [1/den input frames]
+	int16 *	coeffs;					// Filter, phases * AUDIO_RESAMPLER_TAPS, Q15
+	int16 *	hist[2];				// Planar input history per channel
+	int		hist_size;				// Allocated history [frames]
+	int		hist_len;				// Buffered input [frames]
+	int		pos;					// Input frame of the first tap of the next output frame
+	int		phase;					// Phase of the next output frame [1/den input frames]
+};
+
+const int AUDIO_RESAMPLER_TAPS = 32;	// Filter taps per phase
+
+// Prototypes
+extern void Audio_convert(int16 * dest, const uint8 * source, int frames, int sample_size, int channels, bool big_endian);
+extern bool Audio_resampler_init(AudioResampler & r, int in_rate, int out_rate);
+extern void Audio_resampler_exit(AudioResampler & r);
+extern int Audio_resampler_max_output(AudioResampler const & r, int in_frames);
+extern int Audio_resample(AudioResampler & r, int16 * dest, const int16 * source, int in_frames);
+extern void Audio_mix(int16 * dest, const int16 * a, int vol_a, const int16 * b, int vol_b, int frames);
+
+#endif /* AUDIO_DSP_H */
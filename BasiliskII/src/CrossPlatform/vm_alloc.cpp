@@ -44,6 +44,10 @@
 #include <sys/utsname.h>
 #endif
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
 #ifdef HAVE_MACH_VM
 #ifndef HAVE_MACH_TASK_SELF
 #ifdef HAVE_TASK_SELF
@@ -86,6 +90,10 @@ typedef unsigned long vm_uintptr_t;
 
 #define MAP_EXTRA_FLAGS (MAP_32BIT)
 
+/* Large page policy for VM_MAP_HUGE mappings.  */
+static bool huge_pages_enabled = true;
+static bool huge_pages_prefault = false;
+
 #ifdef HAVE_MMAP_VM
 #if (defined(__linux__) && defined(__i386__)) || defined(__sun__) || defined(__FreeBSD__) || defined(__NetBSD__) || HAVE_LINKER_SCRIPT
 /* Force a reasonnable address below 0x80000000 on x86 so that we
@@ -180,6 +188,83 @@ static int vm_error(kern_return_t ret_code)
 }
 #endif
 
+/* Return the size of explicit huge pages, 0 if there are none.  */
+
+#if defined(HAVE_MMAP_VM) && defined(MAP_HUGETLB)
+static size_t get_huge_page_size(void)
+{
+	static size_t huge_page_size = (size_t)-1;
+	if (huge_page_size == (size_t)-1) {
+		huge_page_size = 0;
+		FILE *f = fopen("/proc/meminfo", "r");
+		if (f) {
+			char line[128];
+			unsigned long kb;
+			while (fgets(line, sizeof(line), f))
+				if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+					huge_page_size = (size_t)kb * 1024;
+					break;
+				}
+			fclose(f);
+		}
+	}
+	return huge_page_size;
+}
+#endif
+
+/* Map SIZE bytes with MMAP_FLAGS, taking VM_MAP_HUGE from OPTIONS into
+   account. Returns MAP_FAILED for errors.  */
+
+#ifdef HAVE_MMAP_VM
+static void * mmap_region(void * addr, size_t size, int mmap_flags, int options)
+{
+	void * ret = MAP_FAILED;
+	bool huge = (options & VM_MAP_HUGE) && huge_pages_enabled;
+
+#ifdef MAP_HUGETLB
+	// Explicit huge pages must be reserved by the administrator, so this
+	// fails quickly on most systems
+	size_t huge_size = huge ? get_huge_page_size() : 0;
+	if (huge_size && zero_fd == -1 && size % huge_size == 0 &&
+		(!(mmap_flags & MAP_FIXED) || (vm_uintptr_t)addr % huge_size == 0)) {
+		ret = mmap((caddr_t)addr, size, VM_PAGE_DEFAULT, mmap_flags | MAP_HUGETLB, zero_fd, 0);
+		if (ret != MAP_FAILED)
+			huge = false;
+	}
+#endif
+	if (ret == MAP_FAILED) {
+		ret = mmap((caddr_t)addr, size, VM_PAGE_DEFAULT, mmap_flags, zero_fd, 0);
+		if (ret == MAP_FAILED)
+			return ret;
+	}
+
+#ifdef MADV_HUGEPAGE
+	// Otherwise, have the kernel collapse the region into huge pages
+	if (huge)
+		madvise(ret, size, MADV_HUGEPAGE);
+#endif
+
+	if ((options & VM_MAP_HUGE) && huge_pages_enabled && huge_pages_prefault) {
+#if defined(__linux__) && defined(SYS_getcpu) && defined(SYS_mbind)
+		// Prefer the NUMA node we are running on
+		unsigned int cpu, node;
+		unsigned long nodes[16];
+		const int bits_per_long = 8 * sizeof(unsigned long);
+		if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0 && node < 16 * bits_per_long) {
+			memset(nodes, 0, sizeof(nodes));
+			nodes[node / bits_per_long] = 1UL << (node % bits_per_long);
+			syscall(SYS_mbind, ret, size, 1 /* MPOL_PREFERRED */, nodes, 16 * bits_per_long + 1, 0);
+		}
+#endif
+		const size_t page_size = getpagesize();
+		for (size_t i = 0; i < size; i += page_size)
+			((volatile char *)ret)[i] = 0;
+	}
+
+	return ret;
+}
+#endif
+
 /* Initialize the VM system. Returns 0 if successful, -1 for errors.  */
 
 int vm_init(void)
@@ -224,20 +309,27 @@ void vm_exit(void)
 }
 
 static void *reserved_buf;
-static const size_t RESERVED_SIZE = 80 * 1024 * 1024; // for 6K Retina
 
 void *vm_acquire_reserved(size_t size) {
-	assert(reserved_buf && size <= RESERVED_SIZE);
+	assert(reserved_buf && size <= VM_RESERVED_SIZE);
 	return reserved_buf;
 }
 
 int vm_init_reserved(void *hostAddress) {
-    int result = vm_acquire_fixed(hostAddress, RESERVED_SIZE);
+    int result = vm_acquire_fixed(hostAddress, VM_RESERVED_SIZE);
     if (result >= 0)
         reserved_buf = hostAddress;
     return result;
 }
 
+bool vm_has_reserved(size_t size) {
+	return reserved_buf && size <= VM_RESERVED_SIZE;
+}
+
+bool vm_is_reserved(void *addr) {
+	return reserved_buf && addr == reserved_buf;
+}
+
 /* Allocate zero-filled memory of SIZE bytes. The mapping is private
    and default protection bits are read / write. The return value
    is the actual mapping address chosen or VM_MAP_FAILED for errors.  */
@@ -259,7 +351,7 @@ void * vm_acquire(size_t size, int options)
 
 #if defined(HAVE_MACH_VM)
 	// vm_allocate() returns a zero-filled memory region
-	kern_return_t ret_code = vm_allocate(mach_task_self(), (vm_address_t *)&addr, reserved_buf ? size : size + RESERVED_SIZE, TRUE);
+	kern_return_t ret_code = vm_allocate(mach_task_self(), (vm_address_t *)&addr, reserved_buf ? size : size + VM_RESERVED_SIZE, TRUE);
 	if (ret_code != KERN_SUCCESS) {
 		errno = vm_error(ret_code);
 		return VM_MAP_FAILED;
@@ -267,15 +359,14 @@ void * vm_acquire(size_t size, int options)
 	if (!reserved_buf)
 		reserved_buf = (char *)addr + size;
 #elif defined(HAVE_MMAP_VM)
-	int fd = zero_fd;
 	int the_map_flags = translate_map_flags(options) | map_flags;
 #ifdef __aarch64__
-	if ((addr = mmap((caddr_t)next_address, reserved_buf ? size : size + RESERVED_SIZE, VM_PAGE_DEFAULT, the_map_flags, fd, 0)) == (void *)MAP_FAILED)
+	if ((addr = mmap((caddr_t)next_address, reserved_buf ? size : size + VM_RESERVED_SIZE, VM_PAGE_DEFAULT, the_map_flags, zero_fd, 0)) == (void *)MAP_FAILED)
 		return VM_MAP_FAILED;
 	if (!reserved_buf)
 		reserved_buf = (char *)addr + size;
 #else
-	if ((addr = mmap((caddr_t)next_address, size, VM_PAGE_DEFAULT, the_map_flags, fd, 0)) == (void *)MAP_FAILED)
+	if ((addr = mmap_region(next_address, size, the_map_flags, options)) == (void *)MAP_FAILED)
 		return VM_MAP_FAILED;
 #endif
 #if USE_JIT
@@ -331,10 +422,9 @@ int vm_acquire_fixed(void * addr, size_t size, int options)
 		return -1;
 	}
 #elif defined(HAVE_MMAP_VM)
-	int fd = zero_fd;
 	int the_map_flags = translate_map_flags(options) | map_flags | MAP_FIXED;
 
-	if (mmap((caddr_t)addr, size, VM_PAGE_DEFAULT, the_map_flags, fd, 0) == (void *)MAP_FAILED)
+	if (mmap_region(addr, size, the_map_flags, options) == (void *)MAP_FAILED)
 		return -1;
 #elif defined(HAVE_WIN32_VM)
 	// Windows cannot allocate Low Memory
@@ -478,6 +568,112 @@ int vm_get_page_size(void)
 #endif
 }
 
+/* Set up how VM_MAP_HUGE mappings are made.  */
+
+void vm_set_huge_pages(bool enable, bool prefault)
+{
+	huge_pages_enabled = enable;
+	huge_pages_prefault = prefault;
+}
+
+/* Returns the size of the pages backing the mapping at ADDR, and in
+   HUGE_BYTES (if non-NULL) how much of it is in transparent huge pages.  */
+
+size_t vm_get_mapping_page_size(void * addr, size_t * huge_bytes)
+{
+	size_t page_size = vm_get_page_size();
+	if (huge_bytes)
+		*huge_bytes = 0;
+
+#ifdef __linux__
+	FILE *f = fopen("/proc/self/smaps", "r");
+	if (f == NULL)
+		return page_size;
+	char line[256];
+	bool found = false;
+	while (fgets(line, sizeof(line), f)) {
+		unsigned long start, end, kb;
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			// Start of the next mapping
+			if (found)
+				break;
+			found = (vm_uintptr_t)addr >= start && (vm_uintptr_t)addr < end;
+		} else if (found) {
+			if (sscanf(line, "KernelPageSize: %lu kB", &kb) == 1)
+				page_size = (size_t)kb * 1024;
+			else if (huge_bytes && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+				*huge_bytes = (size_t)kb * 1024;
+		}
+	}
+	fclose(f);
+#endif
+
+	return page_size;
+}
+
+/* Replace memory contents by a copy-on-write mapping of a file named
+   after their hash.  */
+
+int vm_share_contents(void * addr, size_t size, const char * dir, int prot)
+{
+#if defined(HAVE_MMAP_VM) && !defined(HAVE_MACH_VM)
+	// 64-bit FNV-1a hash of the contents
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= ((unsigned char *)addr)[i];
+		hash *= 0x100000001b3ULL;
+	}
+	char name[PATH_MAX];
+	if (snprintf(name, sizeof(name), "%s/%016llx-%lu.img", dir, hash, (unsigned long)size) >= (int)sizeof(name))
+		return -1;
+
+	// Use an existing file only if it really has the same contents
+	int fd = open(name, O_RDONLY);
+	if (fd >= 0) {
+		void *file = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		bool same = file != MAP_FAILED && memcmp(file, addr, size) == 0;
+		if (file != MAP_FAILED)
+			munmap(file, size);
+		if (!same) {
+			close(fd);
+			return -1;
+		}
+	} else {
+
+		// Create it under a temporary name first, so that other processes
+		// never see a partially written file
+		char temp_name[PATH_MAX];
+		if (snprintf(temp_name, sizeof(temp_name), "%s.%d", name, (int)getpid()) >= (int)sizeof(temp_name))
+			return -1;
+		fd = open(temp_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			return -1;
+		size_t done = 0;
+		while (done < size) {
+			ssize_t actual = write(fd, (char *)addr + done, size - done);
+			if (actual < 0 && errno == EINTR)
+				continue;
+			if (actual <= 0)
+				break;
+			done += actual;
+		}
+		if (done < size || rename(temp_name, name) < 0) {
+			close(fd);
+			unlink(temp_name);
+			return -1;
+		}
+	}
+
+	// Private, so that writes neither fail nor reach the file
+	void *ret = mmap((caddr_t)addr, size, prot, MAP_PRIVATE | MAP_FIXED, fd, 0);
+	close(fd);
+	return ret == MAP_FAILED ? -1 : 0;
+#else
+	// Unsupported
+	return -1;
+#endif
+}
+
 #ifdef CONFIGURE_TEST_VM_WRITE_WATCH
 int main(void)
 {
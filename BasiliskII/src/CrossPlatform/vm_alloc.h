@@ -58,6 +58,7 @@ extern "C" {
 #define VM_MAP_FIXED			0x04
 #define VM_MAP_32BIT			0x08
 #define VM_MAP_WRITE_WATCH		0x10
+#define VM_MAP_HUGE				0x20
 
 /* Default mapping options.  */
 #define VM_MAP_DEFAULT			(VM_MAP_PRIVATE)
@@ -99,10 +100,21 @@ extern void vm_exit(void);
 
 extern void * vm_acquire(size_t size, int options = VM_MAP_DEFAULT);
 
+/* Size of the area set aside for the frame buffer, either right behind
+   the first allocation (Mach VM, AArch64) or by vm_init_reserved().  */
+#define VM_RESERVED_SIZE		(80 * 1024 * 1024)	// for 6K Retina
+
 extern void * vm_acquire_reserved(size_t size);
 
 extern int vm_init_reserved(void * host_address);
 
+/* Check whether a reserved area of at least SIZE bytes exists, and whether
+   ADDR is the start of it.  */
+
+extern bool vm_has_reserved(size_t size);
+
+extern bool vm_is_reserved(void * addr);
+
 /* Allocate zero-filled memory at exactly ADDR (which must be page-aligned).
    Returns 0 if successful, -1 on errors.  */
 
@@ -135,4 +147,26 @@ extern int vm_reset_write_watch(void * addr, size_t size);
 
 extern int vm_get_page_size(void);
 
+/* Set up how VM_MAP_HUGE mappings are made. These are backed by explicit
+   huge pages if their size and address are multiples of the huge page
+   size (and protections are only ever changed for the whole region),
+   else transparent huge pages are requested. With PREFAULT, they are
+   bound to the NUMA node of the calling thread and faulted in at once.  */
+
+extern void vm_set_huge_pages(bool enable, bool prefault);
+
+/* Returns the size of the pages backing the mapping at ADDR, and in
+   HUGE_BYTES (if non-NULL) how much of it is in transparent huge pages.  */
+
+extern size_t vm_get_mapping_page_size(void * addr, size_t * huge_bytes = NULL);
+
+/* Replace the SIZE bytes at ADDR (page-aligned) by a copy-on-write
+   mapping of a file in directory DIR. The file is named after a hash of
+   the contents and created if it doesn't exist yet, so that all
+   processes with identical contents share the pages they don't write
+   to. PROT are the protection bits of the mapping. Returns 0 if
+   successful, -1 on errors (the contents are left in place then).  */
+
+extern int vm_share_contents(void * addr, size_t size, const char * dir, int prot);
+
 #endif /* VM_ALLOC_H */
@@ -552,6 +552,28 @@ ssize_t extfs_write(int fd, void *buffer, size_t length)
 	return write(fd, buffer, length);
 }
 
+/*
+ *  Read "length" bytes at file position "offset" to "buffer" (without
+ *  changing the file position), returns number of bytes read (or -1 on error)
+ */
+
+ssize_t extfs_pread(int fd, void *buffer, size_t length, loff_t offset)
+{
+	return pread(fd, buffer, length, offset);
+}
+
+
+/*
+ *  Write "length" bytes from "buffer" to file position "offset" (without
+ *  changing the file position), returns number of bytes written (or -1 on error)
+ */
+
+ssize_t extfs_pwrite(int fd, void *buffer, size_t length, loff_t offset)
+{
+	return pwrite(fd, buffer, length, offset);
+}
+
+
 
 /*
  *  Remove file/directory (and associated helper files),
@@ -29,6 +29,7 @@
 #include "user_strings.h"
 #include "audio.h"
 #include "audio_defs.h"
+#include "audio_dsp.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -40,15 +41,50 @@
 
 #define MAC_MAX_VOLUME 0x0100
 
+// Ring buffer between AudioInterrupt() (emulator thread) and stream_func() (audio thread),
+// holding samples in the DSP format (stereo, 16 bit host byte order) at the device rate
+#define AUDIO_RING_BLOCKS 8				// Ring capacity [blocks]
+#define AUDIO_MIN_LEAD 1				// Blocks buffered ahead of the one being played, lower limit
+#define AUDIO_MAX_LEAD 6				// ... upper limit
+#define AUDIO_SETTLE_BLOCKS 1024		// Blocks played without underrun before the lead is lowered again
+
+// The ring indices are only ever written by one side
+#if SDL_VERSION_ATLEAST(2,0,0)
+typedef SDL_atomic_t audio_atomic_t;
+#define audio_atomic_get(a) ((uint32)SDL_AtomicGet(a))
+#define audio_atomic_set(a, v) SDL_AtomicSet(a, (int)(v))
+#else
+typedef struct { int value; } audio_atomic_t;
+#define audio_atomic_get(a) ((uint32)__atomic_load_n(&(a)->value, __ATOMIC_ACQUIRE))
+#define audio_atomic_set(a, v) __atomic_store_n(&(a)->value, (int)(v), __ATOMIC_RELEASE)
+#endif
+
 // The currently selected audio parameters (indices in audio_sample_rates[] etc. vectors)
 static int audio_sample_rate_index = 0;
 static int audio_sample_size_index = 0;
 static int audio_channel_count_index = 0;
 
 // Global variables
-static SDL_sem *audio_irq_done_sem = NULL;			// Signal from interrupt to streaming thread: data block read
-static uint8 silence_byte;							// Byte value to use to fill sound buffers with silence
-static uint8 *audio_mix_buf = NULL;
+static int audio_freq;								// Device sample rate [Hz]
+static uint8 *audio_ring = NULL;					// Samples waiting to be played
+static uint32 audio_ring_mask;						// Ring size - 1 (size is a power of 2)
+static audio_atomic_t audio_ring_head;				// Read position [bytes], written by stream_func()
+static audio_atomic_t audio_ring_tail;				// Write position [bytes], written by AudioInterrupt()
+static audio_atomic_t audio_ring_target;			// Fill level AudioInterrupt() tops the ring up to [bytes]
+static int audio_block_size;						// Size of one device buffer [bytes]
+static AudioResampler audio_resampler;				// Mixer rate -> device rate
+static int16 *audio_convert_buf = NULL;				// Mixer output in the DSP format
+static int16 *audio_resample_buf = NULL;			// ... at the device rate
+static int audio_dsp_buf_frames = 0;				// Size of these buffers [frames]
+static uint8 *audio_cd_buf = NULL;					// CD audio for one device buffer
+static int audio_lead;								// Current lead [blocks]
+static int audio_settle_count;						// Blocks played since the last underrun
+static bool audio_streaming = false;				// Last device buffer was filled completely
+static uint32 audio_underruns = 0;					// Device buffers that had to be padded with silence
+static uint32 audio_overruns = 0;					// Mixer blocks that didn't fit into the ring
+static bool audio_null_sink = false;				// Play into the null sink instead of an SDL device
+static SDL_Thread *null_sink_thread = NULL;
+static volatile bool null_sink_quit;
 static int main_volume = MAC_MAX_VOLUME;
 static int speaker_volume = MAC_MAX_VOLUME;
 static bool main_mute = false;
@@ -57,6 +93,8 @@ static bool speaker_mute = false;
 // Prototypes
 static void stream_func(void *arg, uint8 *stream, int stream_len);
 static int get_audio_volume();
+static int get_mix_volume();
+static int null_sink_func(void *arg);
 
 
 /*
@@ -71,6 +109,17 @@ static void set_audio_status_format(void)
 	AudioStatus.channels = audio_channel_counts[audio_channel_count_index];
 }
 
+// Sample rate the default device runs at
+static int native_audio_rate(int fallback)
+{
+#if SDL_VERSION_ATLEAST(2,24,0)
+	SDL_AudioSpec spec;
+	if (SDL_GetDefaultAudioInfo(NULL, &spec, 0) == 0 && spec.freq > 0)
+		return spec.freq;
+#endif
+	return fallback;
+}
+
 // Init SDL audio system
 static bool open_sdl_audio(void)
 {
@@ -90,17 +139,23 @@ static bool open_sdl_audio(void)
 		audio_channel_count_index = audio_channel_counts.size() - 1;
 	}
 
+	// The device gets the DSP format at its native rate, where SDL can tell;
+	// the MacOS side may choose any of the formats above
+	int mac_rate = audio_sample_rates[audio_sample_rate_index] >> 16;
 	SDL_AudioSpec audio_spec;
 	memset(&audio_spec, 0, sizeof(audio_spec));
-	audio_spec.freq = audio_sample_rates[audio_sample_rate_index] >> 16;
-	audio_spec.format = (audio_sample_sizes[audio_sample_size_index] == 8) ? AUDIO_U8 : AUDIO_S16MSB;
-	audio_spec.channels = audio_channel_counts[audio_channel_count_index];
+	audio_spec.freq = audio_null_sink ? 48000 : native_audio_rate(mac_rate);
+	audio_spec.format = AUDIO_S16SYS;
+	audio_spec.channels = 2;
 	audio_spec.samples = 4096 >> PrefsFindInt32("sound_buffer");
 	audio_spec.callback = stream_func;
 	audio_spec.userdata = NULL;
 
 	// Open the audio device, forcing the desired format
-	if (SDL_OpenAudio(&audio_spec, NULL) < 0) {
+	if (audio_null_sink) {
+		audio_spec.silence = 0;
+		audio_spec.size = 4 * audio_spec.samples;
+	} else if (SDL_OpenAudio(&audio_spec, NULL) < 0) {
 		fprintf(stderr, "WARNING: Cannot open audio: %s\n", SDL_GetError());
 		return false;
 	}
@@ -118,6 +173,38 @@ static bool open_sdl_audio(void)
 	audio_spec.silence, get_audio_volume());
 #endif
 
+	// Sound buffer size = 4096 frames
+	audio_frames_per_block = audio_spec.samples;
+	audio_freq = audio_spec.freq;
+	Audio_resampler_init(audio_resampler, mac_rate, audio_freq);
+
+	// Allocate ring buffer, with room for the lead plus one resampled mixer block
+	audio_block_size = audio_spec.size;
+	uint32 ring_size = 1;
+	uint32 mac_block_size = (uint32)((uint64)audio_frames_per_block * audio_freq / mac_rate + AUDIO_RESAMPLER_TAPS) * 4;
+	while (ring_size < (uint32)audio_block_size * AUDIO_RING_BLOCKS + mac_block_size)
+		ring_size <<= 1;
+	audio_ring = (uint8 *)malloc(ring_size);
+	audio_cd_buf = (uint8 *)malloc(audio_block_size);
+	audio_ring_mask = ring_size - 1;
+	audio_atomic_set(&audio_ring_head, 0);
+	audio_atomic_set(&audio_ring_tail, 0);
+	audio_lead = AUDIO_MIN_LEAD;
+	audio_atomic_set(&audio_ring_target, (audio_lead + 1) * audio_block_size);
+	audio_settle_count = 0;
+	audio_streaming = false;
+
+	if (audio_null_sink) {
+		printf("Using null audio output\n");
+		null_sink_quit = false;
+#if SDL_VERSION_ATLEAST(2,0,0)
+		null_sink_thread = SDL_CreateThread(null_sink_func, "audio_null_sink", NULL);
+#else
+		null_sink_thread = SDL_CreateThread(null_sink_func, NULL);
+#endif
+		return true;
+	}
+
 #if SDL_VERSION_ATLEAST(2,0,0)
 	const char * driver_name = SDL_GetCurrentAudioDriver();
 #else
@@ -125,12 +212,7 @@ static bool open_sdl_audio(void)
 	SDL_AudioDriverName(driver_name, sizeof(driver_name) - 1);
 #endif
 	printf("Using SDL/%s audio output\n", driver_name ? driver_name : "");
-	silence_byte = audio_spec.silence;
 	SDL_PauseAudio(0);
-
-	// Sound buffer size = 4096 frames
-	audio_frames_per_block = audio_spec.samples;
-	audio_mix_buf = (uint8*)malloc(audio_spec.size);
 	return true;
 }
 
@@ -164,8 +246,8 @@ void AudioInit(void)
 	if (PrefsFindBool("nosound"))
 		return;
 
-	// Init semaphore
-	audio_irq_done_sem = SDL_CreateSemaphore(0);
+	// Discard the output at real-time pace instead of playing it?
+	audio_null_sink = PrefsFindBool("sound_null");
 #ifdef BINCUE
 	InitBinCue();
 #endif
@@ -184,9 +266,23 @@ static void close_audio(void)
 #if defined(BINCUE)
 	CloseAudio_bincue();
 #endif
-	SDL_CloseAudio();
-	free(audio_mix_buf);
-	audio_mix_buf = NULL;
+	if (null_sink_thread) {
+		null_sink_quit = true;
+		SDL_WaitThread(null_sink_thread, NULL);
+		null_sink_thread = NULL;
+	} else
+		SDL_CloseAudio();
+	if (audio_underruns || audio_overruns)
+		D(bug("audio: %u underruns, %u overruns, lead %d blocks\n", audio_underruns, audio_overruns, audio_lead));
+	free(audio_ring);
+	audio_ring = NULL;
+	free(audio_cd_buf);
+	audio_cd_buf = NULL;
+	free(audio_convert_buf);
+	free(audio_resample_buf);
+	audio_convert_buf = audio_resample_buf = NULL;
+	audio_dsp_buf_frames = 0;
+	Audio_resampler_exit(audio_resampler);
 	audio_open = false;
 }
 
@@ -197,9 +293,8 @@ void AudioExit(void)
 #ifdef BINCUE
 	ExitBinCue();
 #endif
-	// Delete semaphore
-	if (audio_irq_done_sem)
-		SDL_DestroySemaphore(audio_irq_done_sem);
+	if (audio_null_sink)
+		printf("Audio: %u underruns, %u overruns\n", audio_underruns, audio_overruns);
 }
 
 
@@ -222,80 +317,183 @@ void audio_exit_stream()
 
 
 /*
- *  Streaming function
+ *  Streaming function, plays what AudioInterrupt() left in the ring and
+ *  asks for more. It never waits for the emulator; if the ring runs dry,
+ *  the rest of the buffer is silence and the lead is increased.
  */
 
 static void stream_func(void *arg, uint8 *stream, int stream_len)
 {
+	int16 *dst = (int16 *)stream;
+	int frames = stream_len / 4;
+
+	// CD audio is mixed in along with the system sound
+	const int16 *cd = NULL;
+	int cd_volume = 0;
+#if defined(BINCUE)
+	if (GetAudio_bincue(audio_cd_buf, stream_len, &cd_volume))
+		cd = (const int16 *)audio_cd_buf;
+#endif
+
 	if (AudioStatus.num_sources) {
-		// Trigger audio interrupt to get new buffer
-		D(bug("stream: triggering irq\n"));
-		SetInterruptFlag(INTFLAG_AUDIO);
-		TriggerInterrupt();
-		D(bug("stream: waiting for ack\n"));
-		SDL_SemWait(audio_irq_done_sem);
-		D(bug("stream: ack received\n"));
+		uint32 head = audio_atomic_get(&audio_ring_head);
+		int avail = audio_atomic_get(&audio_ring_tail) - head;
+		int work_size = avail < stream_len ? avail : stream_len;
+		D(bug("stream: %d bytes available\n", avail));
+
+		// Adapt the lead to how timely the emulator delivers
+		if (work_size < stream_len) {
+			if (audio_streaming) {
+				audio_underruns++;
+				if (audio_lead < AUDIO_MAX_LEAD)
+					audio_lead++;
+				audio_atomic_set(&audio_ring_target, (audio_lead + 1) * audio_block_size);
+			}
+			audio_settle_count = 0;
+			audio_streaming = false;
+		} else {
+			if (++audio_settle_count >= AUDIO_SETTLE_BLOCKS && audio_lead > AUDIO_MIN_LEAD) {
+				audio_lead--;
+				audio_atomic_set(&audio_ring_target, (audio_lead + 1) * audio_block_size);
+				audio_settle_count = 0;
+			}
+			audio_streaming = true;
+		}
 
-		// Get size of audio data
-		uint32 apple_stream_info = ReadMacInt32(audio_data + adatStreamInfo);
-		if (apple_stream_info && !main_mute && !speaker_mute) {
-			int work_size = ReadMacInt32(apple_stream_info + scd_sampleCount) * (AudioStatus.sample_size >> 3) * AudioStatus.channels;
-			D(bug("stream: work_size %d\n", work_size));
-			if (work_size > stream_len)
-				work_size = stream_len;
-			if (work_size == 0)
-				goto silence;
-
-			// Send data to audio device
-			bool dbl = AudioStatus.channels == 2 &&
-				ReadMacInt16(apple_stream_info + scd_numChannels) == 1 &&
-				ReadMacInt16(apple_stream_info + scd_sampleSize) == 8;
-			uint8 *src = Mac2HostAddr(ReadMacInt32(apple_stream_info + scd_buffer));
-			if (dbl)
-				for (int i = 0; i < work_size; i += 2)
-					audio_mix_buf[i] = audio_mix_buf[i + 1] = src[i >> 1];
-			else memcpy(audio_mix_buf, src, work_size);
-			memset((uint8 *)stream, silence_byte, stream_len);
-			SDL_MixAudio(stream, audio_mix_buf, work_size, get_audio_volume());
-
-			D(bug("stream: data written\n"));
-
-		} else
-			goto silence;
+		// Mix the ring (in up to two pieces) and CD audio into the device buffer in one pass
+		int volume = (main_mute || speaker_mute) ? 0 : get_mix_volume();
+		uint32 pos = head & audio_ring_mask;
+		int len = work_size;
+		if (pos + len > audio_ring_mask + 1)
+			len = audio_ring_mask + 1 - pos;
+		Audio_mix(dst, (const int16 *)(audio_ring + pos), volume, cd, cd_volume, len / 4);
+		Audio_mix(dst + len / 2, (const int16 *)audio_ring, volume, cd ? cd + len / 2 : NULL, cd_volume, (work_size - len) / 4);
+		Audio_mix(dst + work_size / 2, NULL, 0, cd ? cd + work_size / 2 : NULL, cd_volume, frames - work_size / 4);
+		audio_atomic_set(&audio_ring_head, head + work_size);
+
+		// Have the next blocks mixed before they are due
+		if (avail - work_size < (int)audio_atomic_get(&audio_ring_target)) {
+			D(bug("stream: triggering irq\n"));
+			SetInterruptFlag(INTFLAG_AUDIO);
+			TriggerInterrupt();
+		}
 
 	} else {
 
-		// Audio not active, play silence
-		silence: memset(stream, silence_byte, stream_len);
+		// Audio not active, drop anything left over
+		audio_atomic_set(&audio_ring_head, audio_atomic_get(&audio_ring_tail));
+		audio_streaming = false;
+		Audio_mix(dst, NULL, 0, cd, cd_volume, frames);
 	}
-	
-#if defined(BINCUE)
-	MixAudio_bincue(stream, stream_len);
-#endif
-	
 }
 
 
 /*
- *  MacOS audio interrupt, read next data block
+ *  Null sink thread, consumes the stream at the rate a device would
  */
 
+static int null_sink_func(void *arg)
+{
+	uint8 *buf = (uint8 *)malloc(audio_block_size);
+	uint64 played = 0;		// Frames
+	Uint32 start = SDL_GetTicks();
+	while (!null_sink_quit) {
+		stream_func(NULL, buf, audio_block_size);
+		played += audio_frames_per_block;
+		Sint32 delay = (Sint32)((Uint32)(played * 1000 / audio_freq) - (SDL_GetTicks() - start));
+		if (delay > 0)
+			SDL_Delay(delay);
+	}
+	free(buf);
+	return 0;
+}
+
+
+/*
+ *  MacOS audio interrupt, read data blocks into the ring until it holds
+ *  the lead stream_func() asked for
+ */
+
+// Make the DSP buffers hold at least frames frames
+static bool reserve_dsp_buffers(int frames)
+{
+	if (frames <= audio_dsp_buf_frames)
+		return true;
+	free(audio_convert_buf);
+	free(audio_resample_buf);
+	audio_convert_buf = (int16 *)malloc(frames * 4);
+	audio_resample_buf = (int16 *)malloc(frames * 4);
+	if (audio_convert_buf == NULL || audio_resample_buf == NULL) {
+		free(audio_convert_buf);
+		free(audio_resample_buf);
+		audio_convert_buf = audio_resample_buf = NULL;
+		audio_dsp_buf_frames = 0;
+		return false;
+	}
+	audio_dsp_buf_frames = frames;
+	return true;
+}
+
 void AudioInterrupt(void)
 {
 	D(bug("AudioInterrupt\n"));
 
-	// Get data from apple mixer
-	if (AudioStatus.mixer) {
+	if (!AudioStatus.mixer) {
+		WriteMacInt32(audio_data + adatStreamInfo, 0);
+		return;
+	}
+
+	for (int i = 0; i < AUDIO_RING_BLOCKS; i++) {
+		uint32 tail = audio_atomic_get(&audio_ring_tail);
+		uint32 fill = tail - audio_atomic_get(&audio_ring_head);
+		if (audio_ring == NULL || fill >= audio_atomic_get(&audio_ring_target))
+			break;
+
+		// Get data from apple mixer
 		M68kRegisters r;
 		r.a[0] = audio_data + adatStreamInfo;
 		r.a[1] = AudioStatus.mixer;
 		Execute68k(audio_data + adatGetSourceData, &r);
 		D(bug(" GetSourceData() returns %08lx\n", r.d[0]));
-	} else
-		WriteMacInt32(audio_data + adatStreamInfo, 0);
 
-	// Signal stream function
-	SDL_SemPost(audio_irq_done_sem);
+		// Get size of audio data
+		uint32 apple_stream_info = ReadMacInt32(audio_data + adatStreamInfo);
+		if (apple_stream_info == 0)
+			break;
+		int frames = ReadMacInt32(apple_stream_info + scd_sampleCount);
+		D(bug(" %d frames\n", frames));
+		if (frames == 0)
+			break;
+
+		// Convert it to the DSP format at the device rate
+		int rate = ReadMacInt32(apple_stream_info + scd_sampleRate) >> 16;
+		if (rate == 0)
+			rate = AudioStatus.sample_rate >> 16;
+		if (rate != audio_resampler.in_rate)
+			Audio_resampler_init(audio_resampler, rate, audio_freq);
+		int out_frames = Audio_resampler_max_output(audio_resampler, frames);
+		if (!reserve_dsp_buffers(frames > out_frames ? frames : out_frames))
+			break;
+		Audio_convert(audio_convert_buf, Mac2HostAddr(ReadMacInt32(apple_stream_info + scd_buffer)), frames,
+			ReadMacInt16(apple_stream_info + scd_sampleSize), ReadMacInt16(apple_stream_info + scd_numChannels), true);
+		out_frames = Audio_resample(audio_resampler, audio_resample_buf, audio_convert_buf, frames);
+		int work_size = out_frames * 4;
+
+		// Copy it to the ring
+		uint32 space = audio_ring_mask + 1 - fill;
+		if ((uint32)work_size > space) {
+			audio_overruns++;
+			work_size = space & ~3;
+		}
+		const uint8 *src = (const uint8 *)audio_resample_buf;
+		uint32 pos = tail & audio_ring_mask;
+		int len = work_size;
+		if (pos + len > audio_ring_mask + 1)
+			len = audio_ring_mask + 1 - pos;
+		memcpy(audio_ring + pos, src, len);
+		memcpy(audio_ring, src + len, work_size - len);
+		audio_atomic_set(&audio_ring_tail, tail + work_size);
+	}
 	D(bug("AudioInterrupt done\n"));
 }
 
@@ -386,6 +584,11 @@ static int get_audio_volume() {
 	return main_volume * speaker_volume * SDL_MIX_MAXVOLUME / (MAC_MAX_VOLUME * MAC_MAX_VOLUME);
 }
 
+// Volume for Audio_mix(), 8.8 fixed point
+static int get_mix_volume() {
+	return main_volume * speaker_volume / MAC_MAX_VOLUME;
+}
+
 #if SDL_VERSION_ATLEAST(2,0,0)
 static int play_startup(void *arg) {
 	SDL_AudioSpec wav_spec;
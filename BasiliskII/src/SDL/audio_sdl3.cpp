@@ -29,6 +29,7 @@
 #include "user_strings.h"
 #include "audio.h"
 #include "audio_defs.h"
+#include "audio_dsp.h"
 
 #include <queue>
 
@@ -36,7 +37,6 @@
 #include "debug.h"
 
 #define MONITOR_MAIN_STREAM 0
-#define MONITOR_INTERRUPT_STREAM 0
 #define DISPLAY_EVERY 4
 
 #if defined(BINCUE)
@@ -48,7 +48,12 @@
 
 #define MAIN_STREAM_EXTRA_DATA_MARGIN_MS 3
 #define INTERRUPT_STREAM_QUEUE_TARGET_MS 5
-#define INTERRUPT_RETRY_MS 5
+
+// Ring buffer between AudioInterrupt() (emulator thread) and stream_func() (audio thread),
+// holding samples in the DSP format (stereo, 16 bit host byte order) at the device rate
+#define AUDIO_RING_BLOCKS 8				// Ring capacity [blocks]
+#define AUDIO_MAX_LEAD 6				// Max. lead the ring grows to after underruns [blocks]
+#define AUDIO_SETTLE_BLOCKS 1024		// Blocks played without underrun before the lead is lowered again
 
 // The currently selected audio parameters (indices in audio_sample_rates[] etc. vectors)
 static int audio_sample_rate_index = 0;
@@ -56,8 +61,24 @@ static int audio_sample_size_index = 0;
 static int audio_channel_count_index = 0;
 
 // Global variables
-static SDL_Semaphore *audio_irq_done_sem = NULL;	// Signal from interrupt to streaming thread: data block read
-static uint8 silence_byte;							// Byte value to use to fill sound buffers with silence
+static uint8 *audio_ring = NULL;					// Samples waiting to be played
+static uint32 audio_ring_mask;						// Ring size - 1 (size is a power of 2)
+static SDL_AtomicInt audio_ring_head;				// Read position [bytes], written by stream_func()
+static SDL_AtomicInt audio_ring_tail;				// Write position [bytes], written by AudioInterrupt()
+static SDL_AtomicInt audio_ring_target;				// Fill level AudioInterrupt() tops the ring up to [bytes]
+static int audio_block_size;						// Size of one block from the Apple mixer at the device rate [bytes]
+static AudioResampler audio_resampler;				// Mixer rate -> device rate, only used by AudioInterrupt()
+static int16 *audio_convert_buf = NULL;				// Mixer output in the DSP format
+static int16 *audio_resample_buf = NULL;			// ... at the device rate
+static int audio_dsp_buf_frames = 0;				// Size of these buffers [frames]
+static int audio_lead;								// Lead added after underruns [blocks]
+static int audio_settle_count;						// Bytes played since the last underrun
+static bool audio_streaming = false;				// Last device buffer was filled completely
+static uint32 audio_underruns = 0;					// Device buffers that had to be padded with silence
+static uint32 audio_overruns = 0;					// Converted samples that didn't fit into the ring
+static bool audio_null_sink = false;				// Play into the null sink instead of an SDL device
+static SDL_Thread *null_sink_thread = NULL;
+static volatile bool null_sink_quit;
 static int main_volume = MAC_MAX_VOLUME;
 static int speaker_volume = MAC_MAX_VOLUME;
 static bool main_mute = false;
@@ -70,13 +91,11 @@ SDL_AudioSpec audio_spec;
 // Prototypes
 static void SDLCALL stream_func(void *arg, SDL_AudioStream *stream, int additional_amount, int total_amount);
 static float get_audio_volume();
+static int get_mix_volume();
 static void start_threads();
 static void stop_threads();
 
-static SDL_Thread * interrupt_thread = NULL;
-static int interrupt_thread_func(void *data);
-static bool interrupt_thread_quit;
-static SDL_AudioStream * interrupt_stream = NULL;
+static int null_sink_func(void *data);
 
 /*
  *  Initialization
@@ -111,10 +130,19 @@ static bool open_sdl_audio(void)
 		audio_channel_count_index = (int)audio_channel_counts.size() - 1;
 	}
 
-	//memset(&audio_spec, 0, sizeof(audio_spec));
-	audio_spec.format = (audio_sample_sizes[audio_sample_size_index] == 8) ? SDL_AUDIO_U8 : SDL_AUDIO_S16BE;
-	audio_spec.channels = audio_channel_counts[audio_channel_count_index];
-	audio_spec.freq = audio_sample_rates[audio_sample_rate_index] >> 16;
+	// The device gets the DSP format at its native rate; the MacOS side may
+	// choose any of the formats above
+	int mac_rate = audio_sample_rates[audio_sample_rate_index] >> 16;
+	SDL_AudioSpec device_spec;
+	int device_frames;
+	audio_spec.format = SDL_AUDIO_S16;
+	audio_spec.channels = 2;
+	if (audio_null_sink)
+		audio_spec.freq = 48000;
+	else if (SDL_GetAudioDeviceFormat(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &device_spec, &device_frames) && device_spec.freq > 0)
+		audio_spec.freq = device_spec.freq;
+	else
+		audio_spec.freq = mac_rate;
 
 	D(bug("Opening SDL audio device stream, freq %d chan %d format %s\n", audio_spec.freq, audio_spec.channels,
 		SDL_GetAudioFormatName(audio_spec.format)));
@@ -122,29 +150,51 @@ static bool open_sdl_audio(void)
 	assert(!main_open_sdl_stream);
 
 	// Open the audio device, forcing the desired format
-	SDL_AudioStream *stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &audio_spec, stream_func, NULL);
-	if (stream == NULL) {
-		fprintf(stderr, "WARNING: Cannot open audio: %s\n", SDL_GetError());
-		return false;
+	SDL_AudioStream *stream = NULL;
+	if (!audio_null_sink) {
+		stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &audio_spec, stream_func, NULL);
+		if (stream == NULL) {
+			fprintf(stderr, "WARNING: Cannot open audio: %s\n", SDL_GetError());
+			return false;
+		}
 	}
 	main_open_sdl_stream = stream;
-	silence_byte = SDL_GetSilenceValueForFormat(audio_spec.format);
 #if defined(BINCUE)
-	OpenAudio_bincue(audio_spec.freq, audio_spec.format, audio_spec.channels, silence_byte, (int)(get_audio_volume()*128));
+	OpenAudio_bincue(audio_spec.freq, audio_spec.format, audio_spec.channels, 0, (int)(get_audio_volume()*128));
 #endif
 
-	printf("Using SDL/%s audio output\n", SDL_GetCurrentAudioDriver());
 	audio_frames_per_block = 4096 >> PrefsFindInt32("sound_buffer");
+	Audio_resampler_init(audio_resampler, mac_rate, audio_spec.freq);
 	start_threads();
+	if (stream == NULL) {
+		printf("Using null audio output\n");
+		return true;
+	}
+	printf("Using SDL/%s audio output\n", SDL_GetCurrentAudioDriver());
 	SDL_ResumeAudioDevice(SDL_GetAudioStreamDevice(stream));
 	return true;
 }
 
 static void start_threads() {
-	interrupt_stream = SDL_CreateAudioStream(&audio_spec, &audio_spec);
-	assert(interrupt_thread == NULL);
-	interrupt_thread_quit = false;
-	interrupt_thread = SDL_CreateThread(interrupt_thread_func, "audio_sdl3_interrupt_thread", NULL);
+	// Allocate ring buffer
+	audio_block_size = (int)((uint64)audio_frames_per_block * audio_spec.freq / audio_resampler.in_rate + AUDIO_RESAMPLER_TAPS) * 4;
+	uint32 ring_size = 1;
+	while (ring_size < (uint32)audio_block_size * AUDIO_RING_BLOCKS)
+		ring_size <<= 1;
+	audio_ring = (uint8 *)malloc(ring_size);
+	audio_ring_mask = ring_size - 1;
+	SDL_SetAtomicInt(&audio_ring_head, 0);
+	SDL_SetAtomicInt(&audio_ring_tail, 0);
+	audio_lead = 0;
+	SDL_SetAtomicInt(&audio_ring_target, 0);	// Set by stream_func()
+	audio_settle_count = 0;
+	audio_streaming = false;
+
+	assert(null_sink_thread == NULL);
+	if (audio_null_sink) {
+		null_sink_quit = false;
+		null_sink_thread = SDL_CreateThread(null_sink_func, "audio_sdl3_null_sink", NULL);
+	}
 }
 
 static void stop_threads() {
@@ -153,21 +203,30 @@ static void stop_threads() {
 		SDL_WaitThread(startup_thread, NULL);
 	startup_thread = NULL;
 	//
-	interrupt_thread_quit = true;
-	if (interrupt_thread != NULL)
-		SDL_WaitThread(interrupt_thread, NULL);
-	interrupt_thread = NULL;
-	SDL_DestroyAudioStream(interrupt_stream);
+	null_sink_quit = true;
+	if (null_sink_thread != NULL)
+		SDL_WaitThread(null_sink_thread, NULL);
+	null_sink_thread = NULL;
 }
 
 static bool close_sdl_audio() {
-	stop_threads();
+	bool was_open = false;
 	if (main_open_sdl_stream) {
 		SDL_DestroyAudioStream(main_open_sdl_stream);
 		main_open_sdl_stream = NULL;
-		return true;
+		was_open = true;
 	}
-	return false;
+	stop_threads();
+	if (audio_underruns || audio_overruns)
+		D(bug("audio: %u underruns, %u overruns\n", audio_underruns, audio_overruns));
+	free(audio_ring);
+	audio_ring = NULL;
+	free(audio_convert_buf);
+	free(audio_resample_buf);
+	audio_convert_buf = audio_resample_buf = NULL;
+	audio_dsp_buf_frames = 0;
+	Audio_resampler_exit(audio_resampler);
+	return was_open;
 }
 
 static bool open_audio(void)
@@ -200,8 +259,8 @@ void AudioInit(void)
 	if (PrefsFindBool("nosound"))
 		return;
 
-	// Init semaphore
-	audio_irq_done_sem = SDL_CreateSemaphore(0);
+	// Discard the output at real-time pace instead of playing it?
+	audio_null_sink = PrefsFindBool("sound_null");
 #ifdef BINCUE
 	InitBinCue();
 #endif
@@ -232,9 +291,8 @@ void AudioExit(void)
 #ifdef BINCUE
 	ExitBinCue();
 #endif
-	// Delete semaphore
-	if (audio_irq_done_sem)
-		SDL_DestroySemaphore(audio_irq_done_sem);
+	if (audio_null_sink)
+		printf("Audio: %u underruns, %u overruns\n", audio_underruns, audio_overruns);
 }
 
 
@@ -265,104 +323,114 @@ static int time_to_stream_bytes(int time_ms) {
 	int time_numerator = time_ms;
 	int time_denominator = 100;
 
-	// sample size across all channels
-	int sample_size = AudioStatus.channels * (AudioStatus.sample_size >> 3); // bytes
-	// Take care with data types
-	// - AudioStatus.sample_rate Hz is in 16.16 fixed point and will overflow if we multiply its uint32 by even 2
-	int time_samples = ((int)(((uint64)AudioStatus.sample_rate * time_numerator) >> 16) / time_denominator);
-	// - We want a number of bytes that is an integer multiple of a sample for each channel
-	return time_samples * sample_size;
+	// The device stream is always in the DSP format, 4 bytes per frame
+	int time_samples = (int)((int64)audio_spec.freq * time_numerator / time_denominator);
+	return time_samples * 4;
+}
+
+// Append converted samples to the ring
+static void ring_put(const int16 *src, int frames)
+{
+	uint32 tail = (uint32)SDL_GetAtomicInt(&audio_ring_tail);
+	uint32 space = audio_ring_mask + 1 - (tail - (uint32)SDL_GetAtomicInt(&audio_ring_head));
+	int work_size = frames * 4;
+	if (work_size > (int)space) {
+		audio_overruns++;
+		work_size = space & ~3;
+	}
+	uint32 pos = tail & audio_ring_mask;
+	int len = work_size;
+	if (pos + len > audio_ring_mask + 1)
+		len = audio_ring_mask + 1 - pos;
+	memcpy(audio_ring + pos, src, len);
+	memcpy(audio_ring, (const uint8 *)src + len, work_size - len);
+	SDL_SetAtomicInt(&audio_ring_tail, (int)(tail + work_size));
 }
 
-static int interrupt_thread_func(void *data)
+// Make the DSP buffers hold at least frames frames
+static bool reserve_dsp_buffers(int frames)
 {
-	while (!interrupt_thread_quit) {
+	if (frames <= audio_dsp_buf_frames)
+		return true;
+	free(audio_convert_buf);
+	free(audio_resample_buf);
+	audio_convert_buf = (int16 *)malloc(frames * 4);
+	audio_resample_buf = (int16 *)malloc(frames * 4);
+	if (audio_convert_buf == NULL || audio_resample_buf == NULL) {
+		free(audio_convert_buf);
+		free(audio_resample_buf);
+		audio_convert_buf = audio_resample_buf = NULL;
+		audio_dsp_buf_frames = 0;
+		return false;
+	}
+	audio_dsp_buf_frames = frames;
+	return true;
+}
 
-	int target_queue_size = time_to_stream_bytes(INTERRUPT_STREAM_QUEUE_TARGET_MS);
+// Play samples from the ring into a device buffer, ask the emulator for more
+static void play_ring(uint8 *stream, int len)
+{
+	int16 *dst = (int16 *)stream;
+	int frames = len / 4;
 
-#if MONITOR_INTERRUPT_STREAM
-		static int monitor_stream_count = 0;
-		if (monitor_stream_count++ % DISPLAY_EVERY == 0)
-			bug("audio mac interrupt thread: target_queue_size %5d q %6d\n",
-				target_queue_size, SDL_GetAudioStreamQueued(interrupt_stream));
+	// CD audio is mixed in along with the system sound
+	const int16 *cd = NULL;
+	int cd_volume = 0;
+#if defined(BINCUE)
+	uint8 cd_buf[len];
+	if (GetAudio_bincue(cd_buf, len, &cd_volume))
+		cd = (const int16 *)cd_buf;
 #endif
 
 	if (AudioStatus.num_sources) {
-		while (SDL_GetAudioStreamQueued(interrupt_stream) < target_queue_size) {
-			// Trigger audio interrupt to get new buffer
+		uint32 head = (uint32)SDL_GetAtomicInt(&audio_ring_head);
+		int avail = (int)((uint32)SDL_GetAtomicInt(&audio_ring_tail) - head);
+		int work_size = std::min(avail, len);
+
+		// Adapt the lead to how timely the emulator delivers
+		if (work_size < len) {
+			if (audio_streaming) {
+				audio_underruns++;
+				if (audio_lead < AUDIO_MAX_LEAD)
+					audio_lead++;
+			}
+			audio_settle_count = 0;
+			audio_streaming = false;
+		} else {
+			audio_settle_count += work_size;
+			if (audio_settle_count >= audio_block_size * AUDIO_SETTLE_BLOCKS && audio_lead > 0) {
+				audio_lead--;
+				audio_settle_count = 0;
+			}
+			audio_streaming = true;
+		}
+		int target = time_to_stream_bytes(INTERRUPT_STREAM_QUEUE_TARGET_MS) + audio_lead * audio_block_size;
+		SDL_SetAtomicInt(&audio_ring_target, target);
+
+		// Mix the ring (in up to two pieces) and CD audio into the device buffer in one pass
+		int volume = (main_mute || speaker_mute) ? 0 : get_mix_volume();
+		uint32 pos = head & audio_ring_mask;
+		int part = work_size;
+		if (pos + part > audio_ring_mask + 1)
+			part = audio_ring_mask + 1 - pos;
+		Audio_mix(dst, (const int16 *)(audio_ring + pos), volume, cd, cd_volume, part / 4);
+		Audio_mix(dst + part / 2, (const int16 *)audio_ring, volume, cd ? cd + part / 2 : NULL, cd_volume, (work_size - part) / 4);
+		Audio_mix(dst + work_size / 2, NULL, 0, cd ? cd + work_size / 2 : NULL, cd_volume, frames - work_size / 4);
+		SDL_SetAtomicInt(&audio_ring_head, (int)(head + work_size));
+
+		// Have the next blocks mixed before they are due
+		if (avail - work_size < target) {
 			D(bug("stream: triggering irq\n"));
 			SetInterruptFlag(INTFLAG_AUDIO);
 			TriggerInterrupt();
-			D(bug("stream: waiting for ack\n"));
-			SDL_WaitSemaphore(audio_irq_done_sem);
-			D(bug("stream: ack received\n"));
-			
-			// Get size of audio data
-			uint32 apple_stream_info = ReadMacInt32(audio_data + adatStreamInfo);
-			if (apple_stream_info) {
-
-				bool known_audio_format;
-				int source_sample_size;
-				SDL_AudioFormat source_format;
-				uint32 fourcc = ReadMacInt32(apple_stream_info + scd_format);
-				switch (fourcc) {
-					case FOURCC('t','w','o','s'):
-						known_audio_format = true;
-						source_sample_size = 16;
-						source_format = SDL_AUDIO_S16BE;
-						break;
-					case FOURCC('r','a','w',' '):
-						known_audio_format = true;
-						source_sample_size = 8;
-						source_format = SDL_AUDIO_U8;
-						break;
-					default:
-						// bug("SoundComponentData in unsupported format fourcc '%c%c%c%c'\n",
-							// (fourcc >> 24)&0xff, (fourcc >> 16)&0xff, (fourcc >> 8)&0xff, fourcc&0xff);
-						known_audio_format = false;
-						// We can't do anything with the source data but we know the duration,
-						// so we generate an appropriate silence
-						// Set a placeholder source format to use for it:
-						source_sample_size = 8;
-						source_format = SDL_AUDIO_U8;
-				}
-
-				uint16 source_channels = ReadMacInt16(apple_stream_info + scd_numChannels);
-
-				int work_size = ReadMacInt32(apple_stream_info + scd_sampleCount) * (source_sample_size >> 3) * source_channels;
-				if (work_size == 0)
-					break; // no more audio available right now
-
-				uint8 buf[work_size];
-
-				uint32 source_sample_rate = ReadMacInt32(apple_stream_info + scd_sampleRate);
-
-				SDL_AudioSpec current_scd_spec = {source_format, source_channels, (uint16)(source_sample_rate >> 16)};
-				//bug("scd channels %d sr %d 0x%x >>16%d\n", source_channels, source_sample_rate, source_sample_rate, source_sample_rate>>16);
-
-				SDL_SetAudioStreamFormat(interrupt_stream, &current_scd_spec, NULL);
-
-				if (known_audio_format && !main_mute && !speaker_mute) {
-					Mac2Host_memcpy(buf, ReadMacInt32(apple_stream_info + scd_buffer), work_size);
-				} else {
-					memset(buf, SDL_GetSilenceValueForFormat(source_format), work_size);
-				}
-
-				SDL_PutAudioStreamData(interrupt_stream, buf, work_size);
-			}
-			else {
-				SDL_ClearAudioStream(interrupt_stream);
-				break;
-			}
 		}
-	}
-
-	// Audio isn't active or the mac doesn't have any right now.
-	// Wait a little while.
-	SDL_Delay(INTERRUPT_RETRY_MS);
+	} else {
 
-	} // while
-	return 0;
+		// Audio not active, drop anything left over
+		SDL_SetAtomicInt(&audio_ring_head, SDL_GetAtomicInt(&audio_ring_tail));
+		audio_streaming = false;
+		Audio_mix(dst, NULL, 0, cd, cd_volume, frames);
+	}
 }
 
 static void SDLCALL stream_func(void *, SDL_AudioStream *stream, int stream_len, int total_amount)
@@ -382,7 +450,7 @@ static void SDLCALL stream_func(void *, SDL_AudioStream *stream, int stream_len,
 		target_queue_size = stream_len + margin;
 	}
 
-	int bytes_available = SDL_GetAudioStreamAvailable(interrupt_stream);
+	int bytes_available = (int)((uint32)SDL_GetAtomicInt(&audio_ring_tail) - (uint32)SDL_GetAtomicInt(&audio_ring_head));
 	if (bytes_available > stream_len) {
 		// push any extra bytes, up to the target number, right away
 		stream_len = std::min(bytes_available, target_queue_size);
@@ -402,41 +470,104 @@ static void SDLCALL stream_func(void *, SDL_AudioStream *stream, int stream_len,
 				stream_len, total_amount, margin, target_queue_size, bytes_available);
 #endif
 
-	uint8 src[stream_len], dst[stream_len];
-	int i = SDL_GetAudioStreamData(interrupt_stream, src, stream_len);
-	if (i < stream_len)
-		memset(src + i, silence_byte, stream_len - i);
-	memset(dst, silence_byte, stream_len);
-	//SDL_AudioSpec audio_spec;
-	//int r = SDL_GetAudioStreamFormat(stream, NULL, &audio_spec);// little endianが帰ってくる
-	SDL_MixAudio(dst, src, audio_spec.format, stream_len, get_audio_volume());
-#if defined(BINCUE)
-	MixAudio_bincue(dst, stream_len);
-#endif
+	uint8 dst[stream_len];
+	play_ring(dst, stream_len);
 	SDL_PutAudioStreamData(stream, dst, stream_len);
 }
 
 
 /*
- *  MacOS audio interrupt, read next data block
+ *  Null sink thread, consumes the stream at the rate a device would
+ */
+
+static int null_sink_func(void *data)
+{
+	uint8 *buf = (uint8 *)malloc(audio_frames_per_block * 4);
+	uint64 played = 0;		// Frames
+	Uint64 start = SDL_GetTicksNS();
+	while (!null_sink_quit) {
+		play_ring(buf, audio_frames_per_block * 4);
+		played += audio_frames_per_block;
+		Sint64 delay = (Sint64)(played * SDL_NS_PER_SECOND / audio_spec.freq) - (Sint64)(SDL_GetTicksNS() - start);
+		if (delay > 0)
+			SDL_DelayNS(delay);
+	}
+	free(buf);
+	return 0;
+}
+
+
+/*
+ *  MacOS audio interrupt, read data blocks into the ring until it holds
+ *  the lead stream_func() asked for
  */
 
 void AudioInterrupt(void)
 {
 	D(bug("AudioInterrupt\n"));
 
-	// Get data from apple mixer
-	if (AudioStatus.mixer) {
+	if (!AudioStatus.mixer) {
+		WriteMacInt32(audio_data + adatStreamInfo, 0);
+		return;
+	}
+
+	for (int n = 0; n < AUDIO_RING_BLOCKS; n++) {
+		uint32 fill = (uint32)SDL_GetAtomicInt(&audio_ring_tail) - (uint32)SDL_GetAtomicInt(&audio_ring_head);
+		if (audio_ring == NULL || (int)fill >= SDL_GetAtomicInt(&audio_ring_target))
+			break;
+
+		// Get data from apple mixer
 		M68kRegisters r;
 		r.a[0] = audio_data + adatStreamInfo;
 		r.a[1] = AudioStatus.mixer;
 		Execute68k(audio_data + adatGetSourceData, &r);
 		D(bug(" GetSourceData() returns %08lx\n", r.d[0]));
-	} else
-		WriteMacInt32(audio_data + adatStreamInfo, 0);
 
-	// Signal stream function
-	SDL_SignalSemaphore(audio_irq_done_sem);
+		// Get size of audio data
+		uint32 apple_stream_info = ReadMacInt32(audio_data + adatStreamInfo);
+		if (apple_stream_info == 0)
+			break;
+
+		int frames = ReadMacInt32(apple_stream_info + scd_sampleCount);
+		if (frames == 0)
+			break; // no more audio available right now
+
+		int rate = ReadMacInt32(apple_stream_info + scd_sampleRate) >> 16;
+		if (rate == 0)
+			rate = AudioStatus.sample_rate >> 16;
+		if (rate != audio_resampler.in_rate)
+			Audio_resampler_init(audio_resampler, rate, audio_spec.freq);
+		int out_frames = Audio_resampler_max_output(audio_resampler, frames);
+		if (!reserve_dsp_buffers(std::max(frames, out_frames)))
+			break;
+
+		// Convert to the DSP format
+		int source_sample_size;
+		uint32 fourcc = ReadMacInt32(apple_stream_info + scd_format);
+		switch (fourcc) {
+			case FOURCC('t','w','o','s'):
+				source_sample_size = 16;
+				break;
+			case FOURCC('r','a','w',' '):
+				source_sample_size = 8;
+				break;
+			default:
+				// bug("SoundComponentData in unsupported format fourcc '%c%c%c%c'\n",
+					// (fourcc >> 24)&0xff, (fourcc >> 16)&0xff, (fourcc >> 8)&0xff, fourcc&0xff);
+				// We can't do anything with the source data but we know the duration,
+				// so we generate an appropriate silence
+				source_sample_size = 0;
+		}
+		if (source_sample_size)
+			Audio_convert(audio_convert_buf, Mac2HostAddr(ReadMacInt32(apple_stream_info + scd_buffer)), frames,
+				source_sample_size, ReadMacInt16(apple_stream_info + scd_numChannels), true);
+		else
+			memset(audio_convert_buf, 0, frames * 4);
+
+		// Resample it to the device rate and queue it
+		out_frames = Audio_resample(audio_resampler, audio_resample_buf, audio_convert_buf, frames);
+		ring_put(audio_resample_buf, out_frames);
+	}
 	D(bug("AudioInterrupt done\n"));
 }
 
@@ -527,6 +658,11 @@ static float get_audio_volume() {
 	return (float) main_volume * speaker_volume / (MAC_MAX_VOLUME * MAC_MAX_VOLUME);
 }
 
+// Volume for Audio_mix(), 8.8 fixed point
+static int get_mix_volume() {
+	return main_volume * speaker_volume / MAC_MAX_VOLUME;
+}
+
 static int play_startup(void *arg) {
 	SDL_AudioSpec wav_spec;
 	Uint8 *wav_buffer;
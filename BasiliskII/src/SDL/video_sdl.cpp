@@ -207,6 +207,12 @@ extern void SysMountFirstFloppy(void);
 
 static void *vm_acquire_framebuffer(uint32 size)
 {
+#ifndef SHEEPSHAVER
+	// Use the area reserved behind Mac RAM and ROM if there is one, so the
+	// frame buffer has a fixed Mac address (needed for snapshots)
+	if (vm_has_reserved(size))
+		return vm_acquire_reserved(size);
+#endif
 	// always try to reallocate framebuffer at the same address
 	static void *fb = VM_MAP_FAILED;
 	if (fb != VM_MAP_FAILED) {
@@ -224,7 +230,8 @@ static void *vm_acquire_framebuffer(uint32 size)
 
 static inline void vm_release_framebuffer(void *fb, uint32 size)
 {
-	vm_release(fb, size);
+	if (!vm_is_reserved(fb))
+		vm_release(fb, size);
 }
 
 static inline int get_customized_color_depth(int default_depth)
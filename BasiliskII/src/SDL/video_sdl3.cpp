@@ -232,6 +232,12 @@ static void *vm_acquire_framebuffer(uint32 size)
 #if defined(HAVE_MACH_VM) || defined(HAVE_MMAP_VM) && defined(__aarch64__)
 	return vm_acquire_reserved(size);
 #else
+#ifndef SHEEPSHAVER
+	// Use the area reserved behind Mac RAM and ROM if there is one, so the
+	// frame buffer has a fixed Mac address (needed for snapshots)
+	if (vm_has_reserved(size))
+		return vm_acquire_reserved(size);
+#endif
 	// always try to reallocate framebuffer at the same address
 	static void *fb = VM_MAP_FAILED;
 	if (fb != VM_MAP_FAILED) {
@@ -251,7 +257,8 @@ static void *vm_acquire_framebuffer(uint32 size)
 static inline void vm_release_framebuffer(void *fb, uint32 size)
 {
 #if !(defined(HAVE_MACH_VM) || defined(HAVE_MMAP_VM) && defined(__aarch64__))
-	vm_release(fb, size);
+	if (!vm_is_reserved(fb))
+		vm_release(fb, size);
 #endif
 }
 
@@ -0,0 +1,289 @@
+/*
+ *  bench_bincue.cpp - Time BIN/CUE data and CD audio reads
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Writes a two-file cue sheet (a MODE1/2352 data track and an audio
+ *  track) and an ISO of the same data into a directory below the current
+ *  one, checks read_bincue() against the ISO and times:
+ *   - cooked data reads through read_bincue(), the previous one
+ *     lseek()/read() per raw sector, and pread() from the ISO,
+ *     with the bin files dropped from the page cache and cached
+ *   - the mean, 99th percentile and maximum latency of the audio
+ *     callback's reads while playing the audio track, with and without
+ *     the read-ahead thread ("cdreadahead" pref), on an idle disk and
+ *     while another thread reads a file the cache dropped
+ *  Build it with "make bench" (if BIN/CUE support is configured), it is
+ *  not part of the emulator. Use a directory on a real disk, on tmpfs the
+ *  uncached runs are the same as the cached ones.
+ */
+
+#include "bincue.cpp"
+
+#include <pthread.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+const int DATA_SECTORS = 16384;			// 32 MB of data
+const int AUDIO_FRAMES = 60 * CD_FRAMES;	// 1 minute of audio
+
+static std::string dir;
+
+// Stub for the prefs, the read-ahead thread is started by main()
+bool PrefsFindBool(const char *name) { return false; }
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fail(const char *what)
+{
+	fprintf(stderr, "bench_bincue: %s: %s\n", what, strerror(errno));
+	exit(1);
+}
+
+static void write_file(const std::string &name, const std::vector<uint8> &data)
+{
+	int fd = open((dir + "/" + name).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || write(fd, &data[0], data.size()) != (ssize_t)data.size() || fsync(fd) < 0)
+		fail(name.c_str());
+	close(fd);
+}
+
+// Drop a file from the page cache
+static void uncache(const char *name)
+{
+	int fd = open((dir + "/" + name).c_str(), O_RDONLY);
+	if (fd >= 0) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+}
+
+// Cooked read as read_bincue() did it before, one raw sector per read()
+static size_t read_per_sector(CueSheet *cs, int fd, uint8 *buf, loff_t offset, size_t len)
+{
+	uint8 secbuf[2352];
+	size_t bytes_read = 0;
+	loff_t sec = (offset / cs->cooked_sector_size) * cs->raw_sector_size;
+	size_t secoff = offset % cs->cooked_sector_size;
+	if (lseek(fd, sec, SEEK_SET) < 0)
+		return 0;
+	while (len) {
+		size_t available = cs->cooked_sector_size - secoff;
+		if (available > len)
+			available = len;
+		if (read(fd, secbuf, cs->raw_sector_size) != cs->raw_sector_size)
+			break;
+		memcpy(buf + bytes_read, secbuf + cs->header_size + secoff, available);
+		secoff = 0;
+		bytes_read += available;
+		len -= available;
+	}
+	return bytes_read;
+}
+
+enum { READ_BINCUE, READ_PER_SECTOR, READ_ISO };
+
+static void bench_data(const char *name, int how, CueSheet *cs, int fd, bool cached)
+{
+	const size_t size = (size_t)DATA_SECTORS * 2048;
+	std::vector<uint8> buf(64 << 10);
+	double seq = 0, rnd = 1e9;
+
+	// Best of three runs, the first one is a warm-up when cached
+	for (int run = 0; run < 3; ++run) {
+		if (!cached) {
+			uncache("data.bin");
+			uncache("data.iso");
+		}
+
+		// Sequential 64K reads
+		double t = now();
+		for (loff_t pos = 0; pos < (loff_t)size; pos += buf.size()) {
+			size_t got = how == READ_BINCUE ? read_bincue(cs, &buf[0], pos, buf.size()) :
+				how == READ_PER_SECTOR ? read_per_sector(cs, fd, &buf[0], pos, buf.size()) :
+				pread(fd, &buf[0], buf.size(), pos);
+			if (got != buf.size())
+				fail("data read");
+		}
+		seq = std::max(seq, size / (1 << 20) / (now() - t));
+
+		// Random 2K reads
+		const int N = 20000;
+		if (!cached) {
+			uncache("data.bin");
+			uncache("data.iso");
+		}
+		srand(1);
+		t = now();
+		for (int n = 0; n < N; ++n) {
+			loff_t pos = (loff_t)(rand() % DATA_SECTORS) * 2048;
+			if (how == READ_BINCUE)
+				read_bincue(cs, &buf[0], pos, 2048);
+			else if (how == READ_PER_SECTOR)
+				read_per_sector(cs, fd, &buf[0], pos, 2048);
+			else
+				pread(fd, &buf[0], 2048, pos);
+		}
+		rnd = std::min(rnd, (now() - t) * 1e6 / N);
+	}
+
+	printf("%-16s %-8s %8.0f MB/s seq read %8.2f us/2K read\n", name,
+		cached ? "cached" : "uncached", seq, rnd);
+}
+
+// Keeps the disk busy with uncached reads while "busy" is set
+static volatile bool busy;
+
+static void *disk_load(void *arg)
+{
+	int fd = open((dir + "/data.iso").c_str(), O_RDONLY);
+	std::vector<uint8> buf(1 << 20);
+	while (busy) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		for (loff_t pos = 0; busy && pread(fd, &buf[0], buf.size(), pos) > 0; pos += buf.size())
+			;
+	}
+	close(fd);
+	return NULL;
+}
+
+// Play the audio track in the chunks an SDL audio callback asks for.
+// The first call is left out, it always has to wait for the disk.
+static void bench_audio(const char *name, CDPlayer *player, const std::vector<uint8> &audio, bool load)
+{
+	const size_t chunk = 4096;
+	loff_t base = (loff_t)DATA_SECTORS * 2352;
+	std::vector<uint8> buf(chunk);
+	uncache("audio.bin");
+
+	pthread_t loader;
+	busy = load;
+	if (load)
+		pthread_create(&loader, NULL, disk_load, NULL);
+
+	std::vector<double> times;
+	for (size_t pos = 0; pos + chunk <= audio.size(); pos += chunk) {
+		double t = now();
+		size_t got = ReadAudio(player, &buf[0], base + pos, chunk);
+		t = now() - t;
+		if (got != chunk || memcmp(&buf[0], &audio[pos], chunk) != 0) {
+			fprintf(stderr, "bench_bincue: wrong audio data at %lu\n", (unsigned long)pos);
+			exit(1);
+		}
+		if (pos)
+			times.push_back(t);
+		usleep(2000);		// 10 times faster than real time
+	}
+
+	if (load) {
+		busy = false;
+		pthread_join(loader, NULL);
+	}
+	double total = 0;
+	for (size_t i = 0; i < times.size(); ++i)
+		total += times[i];
+	std::sort(times.begin(), times.end());
+	printf("%-16s %-8s %8.1f us/callback mean %8.1f us p99 %8.1f us max\n", name,
+		load ? "busy" : "idle", total * 1e6 / times.size(),
+		times[times.size() * 99 / 100] * 1e6, times.back() * 1e6);
+}
+
+int main(void)
+{
+	char tmpl[] = "bench_bincueXXXXXX";
+	if (mkdtemp(tmpl) == NULL)
+		fail("mkdtemp");
+	dir = tmpl;
+
+	// Raw sectors carry a sync pattern, the sector address and the data
+	std::vector<uint8> bin((size_t)DATA_SECTORS * 2352), iso((size_t)DATA_SECTORS * 2048);
+	srand(0);
+	for (int s = 0; s < DATA_SECTORS; ++s) {
+		uint8 *raw = &bin[(size_t)s * 2352];
+		memset(raw + 1, 0xff, 10);
+		raw[12] = s >> 16; raw[13] = s >> 8; raw[14] = s; raw[15] = 1;
+		for (int i = 0; i < 2048; ++i)
+			iso[(size_t)s * 2048 + i] = raw[16 + i] = rand();
+	}
+	std::vector<uint8> audio((size_t)AUDIO_FRAMES * 2352);
+	for (size_t i = 0; i < audio.size(); ++i)
+		audio[i] = rand();
+	write_file("data.bin", bin);
+	write_file("data.iso", iso);
+	write_file("audio.bin", audio);
+
+	std::string cue = dir + "/image.cue";
+	FILE *f = fopen(cue.c_str(), "w");
+	if (f == NULL)
+		fail(cue.c_str());
+	fprintf(f, "FILE \"data.bin\" BINARY\n  TRACK 01 MODE1/2352\n    INDEX 01 00:00:00\n"
+		"FILE \"audio.bin\" BINARY\n  TRACK 02 AUDIO\n    INDEX 01 00:00:00\n");
+	fclose(f);
+
+	InitBinCue();
+	CueSheet *cs = (CueSheet *)open_bincue(cue.c_str());
+	if (cs == NULL)
+		fail("open_bincue");
+	std::vector<uint8> check(iso.size());
+	if (read_bincue(cs, &check[0], 0, check.size()) != check.size() || check != iso) {
+		fprintf(stderr, "bench_bincue: read_bincue() returns wrong data\n");
+		return 1;
+	}
+
+	int bin_fd = open((dir + "/data.bin").c_str(), O_RDONLY);
+	int iso_fd = open((dir + "/data.iso").c_str(), O_RDONLY);
+	if (bin_fd < 0 || iso_fd < 0)
+		fail("open");
+	for (int cached = 0; cached < 2; ++cached) {
+		bench_data("read_bincue", READ_BINCUE, cs, -1, cached);
+		bench_data("per raw sector", READ_PER_SECTOR, cs, bin_fd, cached);
+		bench_data("ISO", READ_ISO, cs, iso_fd, cached);
+	}
+	close(bin_fd);
+	close(iso_fd);
+
+	CDPlayer *player = CSToPlayer(cs);
+	for (int load = 0; load < 2; ++load) {
+#ifdef USE_SDL_AUDIO
+		player->readahead = StartReadAhead(cs);
+		if (player->readahead) {
+			bench_audio("read-ahead", player, audio, load);
+			StopReadAhead(player->readahead);
+			player->readahead = NULL;
+		}
+#endif
+		bench_audio("direct", player, audio, load);
+	}
+	close_bincue(cs);
+	ExitBinCue();
+
+	unlink((dir + "/image.cue").c_str());
+	unlink((dir + "/data.bin").c_str());
+	unlink((dir + "/data.iso").c_str());
+	unlink((dir + "/audio.bin").c_str());
+	rmdir(dir.c_str());
+	return 0;
+}
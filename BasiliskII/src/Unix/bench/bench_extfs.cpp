@@ -0,0 +1,209 @@
+/*
+ *  bench_extfs.cpp - Time ExtFS catalog lookups on a large host tree
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Creates a tree of DIRS folders with FILES files each in a directory
+ *  below the current one, shares it as the ExtFS root and walks it with
+ *  get_dir_entry() as the Finder does when it opens every folder. Then it
+ *  times random find_fsitem_by_id(), find_fsitem() and find_fsitem_guest()
+ *  lookups of the FSItems the walk created, and the same lookups done by
+ *  scanning the list of all FSItems as they were before the hash tables.
+ *  Last it renames a folder the way fs_rename() does and checks that the
+ *  folder keeps its CNID and its files follow it to the new path.
+ *  Build it with "make bench", it is not part of the emulator.
+ */
+
+#include "extfs.cpp"
+
+#include <limits.h>
+#include <string>
+#include <vector>
+
+const int DIRS = 200;
+const int FILES = 250;		// 50000 files in all
+
+static std::string dir;
+
+// Stubs for the parts of the emulator that ExtFS calls
+uintptr MEMBaseDiff;
+extern "C" void Execute68k(uint32 addr, M68kRegisters *r) {}
+extern "C" void Execute68kTrap(uint16 trap, M68kRegisters *r) {}
+int FindFreeDriveNumber(int num) { return num; }
+uint32 TimeToMacTime(time_t t) { return t; }
+time_t MacTimeToTime(uint32 t) { return t; }
+const char *GetString(int num) { return "Unix"; }
+const char *PrefsFindString(const char *name, int index) { return index == 0 ? dir.c_str() : NULL; }
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fail(const char *what)
+{
+	fprintf(stderr, "bench_extfs: %s: %s\n", what, strerror(errno));
+	exit(1);
+}
+
+// Reference: the lookups as they were, one scan of the FSItem list each
+static FSItem *list_find_by_id(uint32 cnid)
+{
+	for (FSItem *p = first_fs_item; p; p = p->next)
+		if (p->id == cnid)
+			return p;
+	return NULL;
+}
+
+static FSItem *list_find(const char *name, FSItem *parent)
+{
+	for (FSItem *p = first_fs_item; p; p = p->next)
+		if (p->parent == parent && !strcmp(p->name, name))
+			return p;
+	return NULL;
+}
+
+static FSItem *list_find_guest(const char *guest_name, FSItem *parent)
+{
+	for (FSItem *p = first_fs_item; p; p = p->next)
+		if (p->parent == parent && !strcmp(p->guest_name, guest_name))
+			return p;
+	return NULL;
+}
+
+// Read all entries of all folders, returns the FSItems in walk order
+static std::vector<FSItem *> walk(FSItem *root)
+{
+	std::vector<FSItem *> items;
+	DirEntry *e;
+	for (int i = 1; ; ++i) {
+		get_path_for_fsitem(root);
+		if (get_dir_entry(root, i, e) != noErr)
+			break;
+		FSItem *d = e->item;
+		items.push_back(d);
+		for (int j = 1; ; ++j) {
+			get_path_for_fsitem(d);
+			if (get_dir_entry(d, j, e) != noErr)
+				break;
+			items.push_back(e->item);
+		}
+	}
+	return items;
+}
+
+enum { BY_ID, BY_NAME, BY_GUEST_NAME };
+
+static double lookup(const std::vector<FSItem *> &items, int how, bool hashed, int n)
+{
+	srand(1);
+	double t = now();
+	for (int i = 0; i < n; ++i) {
+		FSItem *p = items[rand() % items.size()], *q;
+		if (how == BY_ID)
+			q = hashed ? find_fsitem_by_id(p->id) : list_find_by_id(p->id);
+		else if (how == BY_NAME)
+			q = hashed ? find_fsitem(p->name, p->parent) : list_find(p->name, p->parent);
+		else
+			q = hashed ? find_fsitem_guest(p->guest_name, p->parent) : list_find_guest(p->guest_name, p->parent);
+		if (q != p) {
+			fprintf(stderr, "bench_extfs: lookup of %s returns the wrong FSItem\n", p->name);
+			exit(1);
+		}
+	}
+	return (now() - t) * 1e6 / n;
+}
+
+int main(void)
+{
+	char tmpl[] = "bench_extfsXXXXXX", path[PATH_MAX];
+	if (mkdtemp(tmpl) == NULL || realpath(tmpl, path) == NULL)
+		fail("mkdtemp");
+	dir = path;
+
+	char name[PATH_MAX];
+	for (int i = 0; i < DIRS; ++i) {
+		sprintf(name, "%s/folder%03d", path, i);
+		if (mkdir(name, 0755) < 0)
+			fail(name);
+		for (int j = 0; j < FILES; ++j) {
+			sprintf(name, "%s/folder%03d/file%03d.c", path, i, j);
+			int fd = creat(name, 0644);
+			if (fd < 0)
+				fail(name);
+			close(fd);
+		}
+	}
+
+	ExtFSInit();
+	FSItem *root = find_fsitem_by_id(ROOT_ID);
+
+	double t = now();
+	std::vector<FSItem *> items = walk(root);
+	double first = (now() - t) * 1e6 / items.size();
+	if (items.size() != DIRS + DIRS * FILES) {
+		fprintf(stderr, "bench_extfs: walk found %lu items\n", (unsigned long)items.size());
+		return 1;
+	}
+	t = now();
+	walk(root);
+	double again = (now() - t) * 1e6 / items.size();
+	printf("walk of %lu items     %8.2f us/item first %8.2f us/item again\n",
+		(unsigned long)items.size(), first, again);
+
+	static const char *names[] = {"find_fsitem_by_id", "find_fsitem", "find_fsitem_guest"};
+	for (int how = BY_ID; how <= BY_GUEST_NAME; ++how)
+		printf("%-22s %8.3f us hashed %8.1f us list scan\n", names[how],
+			lookup(items, how, true, 1000000), lookup(items, how, false, 2000));
+
+	// Rename folder000, its FSItem and files must move along
+	FSItem *d = items[0], *f = items[1];
+	uint32 id = d->id;
+	get_path_for_fsitem(d);
+	std::string old_path = full_path;
+	FSItem *new_item = find_fsitem("renamed", root);
+	get_path_for_fsitem(new_item);
+	if (rename(old_path.c_str(), full_path) < 0)
+		fail("rename");
+	swap_fsitem_locations(d, new_item);
+	get_path_for_fsitem(f);
+	if (find_fsitem_by_id(id) != d || find_fsitem("renamed", root) != d
+			|| find_fsitem_guest(f->guest_name, d) != f
+			|| strcmp(full_path, (dir + "/renamed/file000.c").c_str())) {
+		fprintf(stderr, "bench_extfs: rename leaves FSItems at the old path\n");
+		return 1;
+	}
+	if (rename((dir + "/renamed").c_str(), old_path.c_str()) < 0)
+		fail("rename");
+
+	ExtFSExit();
+
+	for (int i = 0; i < DIRS; ++i) {
+		for (int j = 0; j < FILES; ++j) {
+			sprintf(name, "%s/folder%03d/file%03d.c", path, i, j);
+			unlink(name);
+		}
+		sprintf(name, "%s/folder%03d", path, i);
+		rmdir(name);
+	}
+	rmdir(path);
+	return 0;
+}
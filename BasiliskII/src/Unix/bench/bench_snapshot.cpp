@@ -0,0 +1,280 @@
+/*
+ *  bench_snapshot.cpp - Time snapshot save and restore
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Fills a 128 MB Mac RAM the way a booted MacOS leaves it (a third of the
+ *  pages used, the rest zero), saves a snapshot into a directory below
+ *  the current one and times:
+ *   - SaveSnapshot()
+ *   - RestoreSnapshot(), then the page faults for touching 1% of the pages
+ *     and all of them, with the snapshot in the page cache and dropped
+ *     from it
+ *   - read() of the whole RAM image, which is what a restore without
+ *     mmap() costs
+ *   - the pause of CheckpointSave() and the time the writer thread needs
+ *     with a number of pages changed between checkpoints, with soft-dirty
+ *     tracking (Linux) and comparing all pages
+ *  Last it restores the snapshot with its checkpoint log and checks it.
+ *  The emulator's other components are stubs that save a few bytes.
+ *  Build it with "make bench", it is not part of the emulator. Use a
+ *  directory on a real disk, on tmpfs the uncached runs are the same as
+ *  the cached ones.
+ */
+
+#include "snapshot_unix.cpp"
+
+#include <sys/time.h>
+
+const uint32 RAM_SIZE = 128 << 20;
+const uint32 ROM_SIZE = 1 << 20;
+
+static std::string dir;
+static std::vector<uint8> expect;		// RAM contents saved
+
+// Stubs for the parts of the emulator that are saved
+uint32 RAMBaseMac, ROMBaseMac, RAMSize, ROMSize;
+uint8 *RAMBaseHost, *ROMBaseHost;
+uintptr MEMBaseDiff;
+int CPUType = 4, FPUType = 1;
+bool CPUIs68060, TwentyFourBitAddressing;
+SERDPort *the_serd_port[2];
+uint8 XPRAM[XPRAM_SIZE];
+
+#define STATE_STUB(name) \
+	void name##SaveState(snapshot_data &s) { s.put32(0x12345678); } \
+	bool name##RestoreState(snapshot_data &s) { return s.get32() == 0x12345678 && s.ok(); }
+STATE_STUB(Timer) STATE_STUB(Sony) STATE_STUB(Disk) STATE_STUB(CDROM)
+STATE_STUB(Ether) STATE_STUB(Audio) STATE_STUB(ADB) STATE_STUB(Video)
+void Save680x0State(snapshot_data &s) { s.put_bytes(XPRAM, 200); }
+bool Restore680x0State(snapshot_data &s) { uint8 regs[200]; return s.get_bytes(regs, 200); }
+bool ExtFSSaveState(snapshot_data &s) { s.put8(0); return true; }
+bool ExtFSRestoreState(snapshot_data &s) { return s.get8() == 0 && s.ok(); }
+void TimerReset(void) {}
+void EtherReset(void) {}
+void AudioReset(void) {}
+void ErrorAlert(const char *text) { fprintf(stderr, "bench_snapshot: %s\n", text); }
+void QuitEmulator(void) { exit(1); }
+
+uint64 GetTicks_usec(void)
+{
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return (uint64)t.tv_sec * 1000000 + t.tv_usec;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fail(const char *what)
+{
+	fprintf(stderr, "bench_snapshot: %s: %s\n", what, strerror(errno));
+	exit(1);
+}
+
+// Drop a file from the page cache, or read all of it into the cache (holes
+// in a file that was just written have no page cache pages yet)
+static void set_cached(const std::string &path, bool cached)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		fail(path.c_str());
+	if (cached) {
+		std::vector<uint8> buf(1 << 20);
+		while (read(fd, &buf[0], buf.size()) > 0)
+			;
+	} else
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static void bench_restore(const std::string &path, bool cached)
+{
+	const uint32 page_size = getpagesize(), num_pages = RAMSize / page_size;
+	set_cached(path, cached);
+
+	// Fresh RAM as after InitAll()
+	if (vm_acquire_fixed(RAMBaseHost, RAMSize) < 0)
+		fail("vm_acquire_fixed");
+
+	double t = now();
+	if (!RestoreSnapshot(path.c_str())) {
+		fprintf(stderr, "bench_snapshot: RestoreSnapshot() failed\n");
+		exit(1);
+	}
+	double restore = now() - t;
+
+	// What a resumed Mac touches first, then everything
+	volatile uint8 sum = 0;
+	srand(1);
+	t = now();
+	for (uint32 i = 0; i < num_pages / 100; ++i)
+		sum += RAMBaseHost[(rand() % num_pages) * page_size];
+	double some = now() - t;
+	t = now();
+	for (uint32 i = 0; i < num_pages; ++i)
+		sum += RAMBaseHost[i * page_size];
+	double all = some + now() - t;
+	if (memcmp(RAMBaseHost, &expect[0], RAMSize) != 0) {
+		fprintf(stderr, "bench_snapshot: restored RAM differs\n");
+		exit(1);
+	}
+
+	// Reading the image instead of mapping it
+	set_cached(path, cached);
+	int fd = open(path.c_str(), O_RDONLY);
+	snapshot_header h;
+	if (fd < 0 || !read_header(fd, path.c_str(), h))
+		fail(path.c_str());
+	std::vector<uint8> image(RAMSize);
+	t = now();
+	if (!read_fully(fd, &image[0], RAMSize, h.ram_offset))
+		fail(path.c_str());
+	double read = now() - t;
+	close(fd);
+
+	printf("restore %-8s %8.2f ms, %8.2f ms with 1%% of RAM touched, %8.1f ms with all (read(): %.1f ms)\n",
+		cached ? "cached" : "uncached", restore * 1e3, (restore + some) * 1e3, (restore + all) * 1e3, read * 1e3);
+}
+
+// Wait until the checkpoint writer thread is done
+static void wait_writer(void)
+{
+	for (;;) {
+		pthread_mutex_lock(&writer_lock);
+		bool busy = writer_busy;
+		pthread_mutex_unlock(&writer_lock);
+		if (!busy)
+			break;
+		usleep(100);
+	}
+}
+
+static void bench_checkpoints(const char *mode)
+{
+	const uint32 page_size = getpagesize(), num_pages = RAMSize / page_size;
+	static const int changed[] = {0, 64, 1024, 4096};
+	const int ROUNDS = 5;
+
+	srand(2);
+	for (int c = 0; c < 4; ++c) {
+		double pause = 0, worst = 0, written = 0;
+		for (int round = 0; round < ROUNDS; ++round) {
+			for (int i = 0; i < changed[c]; ++i) {
+				uint32 offset = (rand() % num_pages) * page_size + round;
+				RAMBaseHost[offset]++;
+				expect[offset]++;
+			}
+			double t = now();
+			CheckpointSave(false);
+			t = now() - t;
+			pause += t;
+			worst = std::max(worst, t);
+			t = now();
+			wait_writer();
+			written += now() - t;
+		}
+		printf("checkpoint %-12s %5d pages changed %8.2f ms pause (%.2f ms max) %8.2f ms writing\n",
+			mode, changed[c], pause * 1e3 / ROUNDS, worst * 1e3, written * 1e3 / ROUNDS);
+	}
+}
+
+int main(void)
+{
+	char tmpl[] = "bench_snapshotXXXXXX";
+	if (mkdtemp(tmpl) == NULL)
+		fail("mkdtemp");
+	dir = tmpl;
+	std::string path = dir + "/mac.snap";
+
+	RAMSize = RAM_SIZE;
+	ROMSize = ROM_SIZE;
+	RAMBaseHost = (uint8 *)vm_acquire(RAMSize);
+	ROMBaseHost = (uint8 *)vm_acquire(ROMSize);
+	if (RAMBaseHost == VM_MAP_FAILED || ROMBaseHost == VM_MAP_FAILED)
+		fail("vm_acquire");
+	MEMBaseDiff = (uintptr)RAMBaseHost;
+	ROMBaseMac = RAMSize;
+	memset(ROMBaseHost, 0x4e, ROMSize);
+
+	// Used pages come in runs, like the system heap, applications and caches
+	const uint32 page_size = getpagesize();
+	uint32 x = 1;
+	for (uint32 pos = 0; pos < RAMSize; pos += page_size)
+		if ((pos / page_size) % 48 < 16)
+			for (uint32 i = 0; i < page_size; i += 4) {
+				x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+				*(uint32 *)(RAMBaseHost + pos + i) = x & 0xff00ff00;
+			}
+	expect.assign(RAMBaseHost, RAMBaseHost + RAMSize);
+
+	double t = now();
+	if (!SaveSnapshot(path.c_str())) {
+		fprintf(stderr, "bench_snapshot: SaveSnapshot() failed\n");
+		return 1;
+	}
+	printf("save             %8.1f ms\n", (now() - t) * 1e3);
+
+	bench_restore(path, true);
+	bench_restore(path, false);
+
+	// Checkpoints, the first one writes a new snapshot
+	if (!CheckpointInit(path.c_str(), false)) {
+		fprintf(stderr, "bench_snapshot: CheckpointInit() failed\n");
+		return 1;
+	}
+	double t_full = now();
+	CheckpointSave(false);
+	double pause = now() - t_full;
+	wait_writer();
+	printf("checkpoint full         %8.2f ms pause %8.2f ms writing\n", pause * 1e3, (now() - t_full - pause) * 1e3);
+#ifdef __linux__
+	if (pagemap_fd >= 0) {
+		bench_checkpoints("soft-dirty");
+		int fd = pagemap_fd;
+		pagemap_fd = -1;
+		bench_checkpoints("compare all");
+		pagemap_fd = fd;
+	} else
+#endif
+	bench_checkpoints("compare all");
+	CheckpointExit();
+
+	// Restore with the log
+	if (vm_acquire_fixed(RAMBaseHost, RAMSize) < 0)
+		fail("vm_acquire_fixed");
+	t = now();
+	if (!RestoreSnapshot(path.c_str()) || memcmp(RAMBaseHost, &expect[0], RAMSize) != 0) {
+		fprintf(stderr, "bench_snapshot: checkpoints are not restored\n");
+		return 1;
+	}
+	printf("restore with log        %8.2f ms\n", (now() - t) * 1e3);
+
+	vm_release(RAMBaseHost, RAMSize);
+	vm_release(ROMBaseHost, ROMSize);
+	unlink(path.c_str());
+	unlink(log_path(path.c_str()).c_str());
+	unlink((path + ".lock").c_str());
+	rmdir(dir.c_str());
+	return 0;
+}
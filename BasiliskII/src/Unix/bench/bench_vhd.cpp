@@ -0,0 +1,302 @@
+/*
+ *  bench_vhd.cpp - Compare the native and libvhd VHD backends
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Builds a dynamic parent and a differencing child image in a temporary
+ *  directory, checks that every backend reads back the same data and
+ *  times sequential and random I/O on the child, with a raw image of the
+ *  same contents for reference, and libvhd if it is configured. Build it
+ *  with "make bench", it is not part of the emulator.
+ */
+
+#include "disk_unix.h"
+
+#include <errno.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+const uint64 DISK_SIZE = 64 << 20;
+const uint32 BLOCK_SIZE = 2 << 20;
+
+static std::string dir;
+static std::vector<uint8> expect;		// Contents of the differencing image
+
+static void put32(uint8 *p, uint32 v)
+{
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static void put64(uint8 *p, uint64 v)
+{
+	put32(p, v >> 32);
+	put32(p + 4, v);
+}
+
+static uint32 vhd_checksum(const uint8 *p, size_t len)
+{
+	uint32 sum = 0;
+	while (len--)
+		sum += *p++;
+	return ~sum;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fail(const char *what)
+{
+	fprintf(stderr, "bench_vhd: %s: %s\n", what, strerror(errno));
+	exit(1);
+}
+
+// Create an empty dynamic image, or a differencing image of "parent"
+static void create_vhd(const char *path, const char *parent, uint8 *uuid)
+{
+	uint32 entries = DISK_SIZE / BLOCK_SIZE;
+	uint32 bat_size = (entries * 4 + 511) & ~511;
+	loff_t bat_pos = parent ? 2048 : 1536;
+	uint8 footer[512], header[1024], locator[512];
+	memset(footer, 0, sizeof(footer));
+	memset(header, 0, sizeof(header));
+	memset(locator, 0, sizeof(locator));
+	uint32 timestamp = time(NULL) - 946684800;
+
+	// Footer, with the CHS geometry as the specification computes it
+	memcpy(footer, "conectix", 8);
+	put32(footer + 8, 2);
+	put32(footer + 12, 0x00010000);
+	put64(footer + 16, 512);
+	put32(footer + 24, timestamp);
+	memcpy(footer + 28, "B2bn", 4);
+	put32(footer + 32, 0x00010000);
+	memcpy(footer + 36, "Wi2k", 4);
+	put64(footer + 40, DISK_SIZE);
+	put64(footer + 48, DISK_SIZE);
+	uint32 sectors = DISK_SIZE / 512, spt = 17, heads = (sectors / 17 + 1023) / 1024;
+	if (heads < 4)
+		heads = 4;
+	if (sectors / spt >= heads * 1024 || heads > 16) {
+		spt = 31; heads = 16;
+	}
+	if (sectors / spt >= heads * 1024) {
+		spt = 63; heads = 16;
+	}
+	footer[56] = (sectors / spt / heads) >> 8;
+	footer[57] = sectors / spt / heads;
+	footer[58] = heads;
+	footer[59] = spt;
+	put32(footer + 60, parent ? 4 : 3);
+	for (int i = 0; i < 16; ++i)
+		uuid[i] = footer[68 + i] = rand();
+	put32(footer + 64, vhd_checksum(footer, sizeof(footer)));
+
+	// Dynamic disk header, parents are found through an absolute MacX
+	// locator and the name next to the child
+	memcpy(header, "cxsparse", 8);
+	put64(header + 8, ~uint64(0));
+	put64(header + 16, bat_pos);
+	put32(header + 24, 0x00010000);
+	put32(header + 28, entries);
+	put32(header + 32, BLOCK_SIZE);
+	if (parent) {
+		int fd = open(parent, O_RDONLY);
+		uint8 pfooter[512];
+		if (fd < 0 || pread(fd, pfooter, 512, 0) != 512)
+			fail(parent);
+		close(fd);
+		memcpy(header + 40, pfooter + 68, 16);
+		memcpy(header + 56, pfooter + 24, 4);
+		const char *name = strrchr(parent, '/') + 1;
+		for (int i = 0; name[i]; ++i)
+			header[64 + i * 2 + 1] = name[i];
+		std::string url = std::string("file://") + parent;
+		memcpy(locator, url.c_str(), url.size());
+		memcpy(header + 576, "MacX", 4);
+		put32(header + 576 + 4, 1);
+		put32(header + 576 + 8, url.size());
+		put64(header + 576 + 16, 1536);
+	}
+	put32(header + 36, vhd_checksum(header, sizeof(header)));
+
+	std::vector<uint8> bat(bat_size, 0xff);
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0
+			|| pwrite(fd, footer, 512, 0) != 512
+			|| pwrite(fd, header, 1024, 512) != 1024
+			|| (parent && pwrite(fd, locator, 512, 1536) != 512)
+			|| pwrite(fd, &bat[0], bat_size, bat_pos) != (ssize_t)bat_size
+			|| pwrite(fd, footer, 512, bat_pos + bat_size) != 512)
+		fail(path);
+	close(fd);
+}
+
+static disk_generic *open_native(const char *path, bool read_only)
+{
+	disk_generic *disk = NULL;
+	if (disk_vhd_native_factory(path, read_only, &disk) != disk_generic::DISK_VALID)
+		fail(path);
+	return disk;
+}
+
+#ifdef HAVE_LIBVHD
+static disk_generic *open_libvhd(const char *path, bool read_only)
+{
+	disk_generic *disk = NULL;
+	if (disk_vhd_factory(path, read_only, &disk) != disk_generic::DISK_VALID)
+		fail(path);
+	return disk;
+}
+#endif
+
+// Plain image file, as the emulator reads it without a disk_generic
+struct disk_raw : disk_generic {
+	disk_raw(const char *path) : fd(open(path, O_RDWR)) { if (fd < 0) fail(path); }
+	virtual ~disk_raw() { close(fd); }
+	virtual bool is_read_only() { return false; }
+	virtual loff_t size() { return DISK_SIZE; }
+	virtual size_t read(void *buf, loff_t offset, size_t length) { return pread(fd, buf, length, offset); }
+	virtual size_t write(void *buf, loff_t offset, size_t length) { return pwrite(fd, buf, length, offset); }
+	int fd;
+};
+
+static disk_generic *open_raw(const char *path, bool read_only)
+{
+	return new disk_raw(path);
+}
+
+// Build the parent and child images and the raw copy of the child
+static void setup(void)
+{
+	uint8 uuid[16];
+	std::string parent = dir + "/parent.vhd", child = dir + "/child.vhd";
+	create_vhd(parent.c_str(), NULL, uuid);
+	create_vhd(child.c_str(), parent.c_str(), uuid);
+	expect.assign(DISK_SIZE, 0);
+
+	// Parent: first half written, child: scattered 4K writes all over
+	srand(1);
+	disk_generic *d = open_native(parent.c_str(), false);
+	std::vector<uint8> buf(1 << 20);
+	for (uint64 pos = 0; pos < DISK_SIZE / 2; pos += buf.size()) {
+		for (size_t i = 0; i < buf.size(); ++i)
+			buf[i] = rand();
+		if (d->write(&buf[0], pos, buf.size()) != buf.size())
+			fail("parent write");
+		memcpy(&expect[pos], &buf[0], buf.size());
+	}
+	delete d;
+	d = open_native(child.c_str(), false);
+	for (int n = 0; n < 4000; ++n) {
+		uint64 pos = (uint64)(rand() % (DISK_SIZE / 512 - 8)) * 512;
+		for (size_t i = 0; i < 4096; ++i)
+			buf[i] = rand();
+		if (d->write(&buf[0], pos, 4096) != 4096)
+			fail("child write");
+		memcpy(&expect[pos], &buf[0], 4096);
+	}
+	delete d;
+
+	std::string raw = dir + "/child.img";
+	int fd = open(raw.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || write(fd, &expect[0], DISK_SIZE) != (ssize_t)DISK_SIZE)
+		fail(raw.c_str());
+	close(fd);
+}
+
+static void bench(const char *name, disk_generic *(*open_disk)(const char *, bool), const char *image)
+{
+	std::string path = dir + "/" + image;
+	disk_generic *d = open_disk(path.c_str(), true);
+	std::vector<uint8> buf(128 << 10);
+
+	// Check contents
+	for (uint64 pos = 0; pos < DISK_SIZE; pos += buf.size())
+		if (d->read(&buf[0], pos, buf.size()) != buf.size()
+				|| memcmp(&buf[0], &expect[pos], buf.size()) != 0) {
+			fprintf(stderr, "bench_vhd: %s returns wrong data at %llu\n", name, (unsigned long long)pos);
+			exit(1);
+		}
+
+	// Sequential 128K reads
+	double t = now();
+	for (int pass = 0; pass < 4; ++pass)
+		for (uint64 pos = 0; pos < DISK_SIZE; pos += buf.size())
+			d->read(&buf[0], pos, buf.size());
+	double seq = 4.0 * DISK_SIZE / (1 << 20) / (now() - t);
+
+	// Random 4K reads
+	const int N = 50000;
+	srand(2);
+	t = now();
+	for (int n = 0; n < N; ++n)
+		d->read(&buf[0], (uint64)(rand() % (DISK_SIZE / 512 - 8)) * 512, 4096);
+	double rnd = (now() - t) * 1e6 / N;
+	delete d;
+
+	// Random 4K writes into a new differencing image (a copy for raw)
+	std::string wpath = dir + "/write." + (strcmp(image, "child.img") ? "vhd" : "img");
+	if (strcmp(image, "child.img")) {
+		uint8 uuid[16];
+		create_vhd(wpath.c_str(), (dir + "/parent.vhd").c_str(), uuid);
+	} else {
+		int fd = open(wpath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || ftruncate(fd, DISK_SIZE) < 0)
+			fail(wpath.c_str());
+		close(fd);
+	}
+	d = open_disk(wpath.c_str(), false);
+	memset(&buf[0], 0x5a, 4096);
+	srand(3);
+	t = now();
+	for (int n = 0; n < N / 5; ++n)
+		if (d->write(&buf[0], (uint64)(rand() % (DISK_SIZE / 512 - 8)) * 512, 4096) != 4096)
+			fail("write");
+	double wr = (now() - t) * 1e6 / (N / 5);
+	delete d;
+	unlink(wpath.c_str());
+
+	printf("%-8s %8.0f MB/s seq read %8.2f us/4K read %8.2f us/4K write\n", name, seq, rnd, wr);
+}
+
+int main(void)
+{
+	char tmpl[] = "/tmp/bench_vhdXXXXXX";
+	if (mkdtemp(tmpl) == NULL)
+		fail("mkdtemp");
+	dir = tmpl;
+	setup();
+
+	bench("raw", open_raw, "child.img");
+	bench("native", open_native, "child.vhd");
+#ifdef HAVE_LIBVHD
+	bench("libvhd", open_libvhd, "child.vhd");
+#endif
+
+	unlink((dir + "/child.img").c_str());
+	unlink((dir + "/child.vhd").c_str());
+	unlink((dir + "/parent.vhd").c_str());
+	rmdir(dir.c_str());
+	return 0;
+}
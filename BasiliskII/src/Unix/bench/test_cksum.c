@@ -0,0 +1,234 @@
+/*
+ * test_cksum.c - check and time the slirp Internet checksum
+ *
+ * Please read the file COPYRIGHT for the
+ * terms and conditions of the copyright.
+ */
+
+/*
+ * Compares cksum() and cksum_adjust() against the BSD in_cksum() loop
+ * on random buffers of varying length, alignment and content, with and
+ * without the AVX2 loop if this CPU has it, then times them on typical
+ * packet sizes (around CKSUM_AVX2_MIN and above).  Build it with
+ * "make bench" in the Unix directory, it is not part of the emulator.
+ */
+
+#include "cksum.c"
+
+#include <time.h>
+
+int slirp_debug;
+FILE *dfd;
+
+/*
+ * Reference: the portable checksum routine, as a copy so it can be
+ * compared with the AVX2 loop
+ */
+
+#define ADDCARRY(x)  (x > 65535 ? x -= 65535 : x)
+#define REDUCE {l_util.l = sum; sum = l_util.s[0] + l_util.s[1]; ADDCARRY(sum);}
+
+static int
+cksum_ref(struct mbuf *m, int len)
+{
+	register u_int16_t *w;
+	register int sum = 0;
+	register int mlen = 0;
+	int byte_swapped = 0;
+
+	union {
+		u_int8_t	c[2];
+		u_int16_t	s;
+	} s_util;
+	union {
+		u_int16_t s[2];
+		u_int32_t l;
+	} l_util;
+	
+	if (m->m_len == 0)
+	   goto cont;
+	w = mtod(m, u_int16_t *);
+	
+	mlen = m->m_len;
+	
+	if (len < mlen)
+	   mlen = len;
+	len -= mlen;
+	/*
+	 * Force to even boundary.
+	 */
+	if ((1 & (long) w) && (mlen > 0)) {
+		REDUCE;
+		sum <<= 8;
+		s_util.c[0] = *(u_int8_t *)w;
+		w = (u_int16_t *)((int8_t *)w + 1);
+		mlen--;
+		byte_swapped = 1;
+	}
+	/*
+	 * Unroll the loop to make overhead from
+	 * branches &c small.
+	 */
+	while ((mlen -= 32) >= 0) {
+		sum += w[0]; sum += w[1]; sum += w[2]; sum += w[3];
+		sum += w[4]; sum += w[5]; sum += w[6]; sum += w[7];
+		sum += w[8]; sum += w[9]; sum += w[10]; sum += w[11];
+		sum += w[12]; sum += w[13]; sum += w[14]; sum += w[15];
+		w += 16;
+	}
+	mlen += 32;
+	while ((mlen -= 8) >= 0) {
+		sum += w[0]; sum += w[1]; sum += w[2]; sum += w[3];
+		w += 4;
+	}
+	mlen += 8;
+	if (mlen == 0 && byte_swapped == 0)
+	   goto cont;
+	REDUCE;
+	while ((mlen -= 2) >= 0) {
+		sum += *w++;
+	}
+	
+	if (byte_swapped) {
+		REDUCE;
+		sum <<= 8;
+		byte_swapped = 0;
+		if (mlen == -1) {
+			s_util.c[1] = *(u_int8_t *)w;
+			sum += s_util.s;
+			mlen = 0;
+		} else
+		   
+		   mlen = -1;
+	} else if (mlen == -1)
+	   s_util.c[0] = *(u_int8_t *)w;
+	
+cont:
+	if (mlen == -1) {
+		/* The last mbuf has odd # of bytes. Follow the
+		 standard (the odd byte may be shifted left by 8 bits
+			   or not as determined by endian-ness of the machine) */
+		s_util.c[1] = 0;
+		sum += s_util.s;
+	}
+	REDUCE;
+	return (~sum & 0xffff);
+}
+
+static double
+now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+#define BUF_SIZE (65536 + 64)
+static u_int8_t buf[BUF_SIZE];
+
+/* Random buffers, returns the number of mismatches */
+static int
+fuzz(const char *name, long iterations)
+{
+	struct mbuf m;
+	long i;
+	int n, errors = 0;
+
+	srand(1);
+	for (i = 0; i < iterations; i++) {
+		int off = rand() % 32;
+		int len = rand() % (i % 100 == 0 ? 65536 : 1600);
+		int kind = rand() % 4;
+
+		/* All zeros and all ones hit the carry corner cases */
+		for (n = 0; n < len + 8; n++)
+			buf[off + n] = kind == 0 ? 0 : kind == 1 ? 0xff : rand();
+		m.m_data = (caddr_t)buf + off;
+		m.m_len = len + (rand() % 2) * 8;
+		if (cksum(&m, len) != cksum_ref(&m, len)) {
+			if (errors++ < 10)
+				printf("%s: mismatch at offset %d, length %d: %04x instead of %04x\n",
+				       name, off, len, cksum(&m, len), cksum_ref(&m, len));
+		}
+	}
+
+	/* Change the first word and update the checksum stored in the second */
+	for (i = 0; i < iterations / 20; i++) {
+		int len = 8 + rand() % 200;
+		u_int16_t o, w, sum;
+
+		for (n = 0; n < len; n++)
+			buf[n] = rand();
+		m.m_data = (caddr_t)buf;
+		m.m_len = len;
+		memset(buf + 2, 0, 2);
+		sum = cksum(&m, len);
+		memcpy(buf + 2, &sum, 2);
+		memcpy(&o, buf, 2);
+		buf[0] = rand();
+		buf[1] = rand();
+		memcpy(&w, buf, 2);
+		sum = cksum_adjust(sum, o, w);
+		memcpy(buf + 2, &sum, 2);
+		if (cksum(&m, len) != 0) {
+			if (errors++ < 10)
+				printf("%s: cksum_adjust() mismatch, length %d\n", name, len);
+		}
+	}
+	return errors;
+}
+
+static void
+bench(const char *name)
+{
+	static const int sizes[] = { 40, 128, 256, 576, 1500, 16384 };
+	struct mbuf m;
+	unsigned int i;
+	long n, k;
+
+	for (n = 0; n < BUF_SIZE; n++)
+		buf[n] = rand();
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		volatile int x = 0;
+		int len = sizes[i];
+		double t0, t1, t2;
+
+		m.m_data = (caddr_t)buf;
+		m.m_len = len;
+		n = 100000000 / len;
+		t0 = now();
+		for (k = 0; k < n; k++)
+			x += cksum_ref(&m, len);
+		t1 = now();
+		for (k = 0; k < n; k++)
+			x += cksum(&m, len);
+		t2 = now();
+		printf("%-8s %5d bytes: %6.2f GB/s (reference %6.2f GB/s)\n", name, len,
+		       n * (double)len / (t2 - t1) / 1e9, n * (double)len / (t1 - t0) / 1e9);
+	}
+}
+
+static int
+check(const char *name)
+{
+	int errors;
+
+	errors = fuzz(name, 2000000);
+	printf("%-8s %s\n", name, errors ? "FAILED" : "ok");
+	bench(name);
+	return errors;
+}
+
+int
+main(int argc, char **argv)
+{
+	int errors = 0;
+
+	errors += check("generic");
+#ifdef CKSUM_X86
+	cksum_init();
+	if (cksum_avx2)
+		errors += check("avx2");
+#endif
+	return errors != 0;
+}
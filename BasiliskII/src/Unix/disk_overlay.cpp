@@ -0,0 +1,424 @@
+/*
+ *  disk_overlay.cpp - Copy-on-write overlay on top of a read-only base image
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Overlay file layout (all numbers big-endian):
+ *
+ *    0  header page: magic, cluster size, virtual size, map and data
+ *       offsets, path of the base image (relative to the overlay file
+ *       unless absolute)
+ *    map_offset   one 32-bit entry per virtual cluster: 0 if the cluster
+ *       still lives in the base image, otherwise 1 + index of the cluster
+ *       in the data area. The map is page aligned and mmap()ed, so it is
+ *       never read or written explicitly.
+ *    data_offset  clusters, appended in allocation order
+ */
+
+#include "disk_unix.h"
+#include "macos_util.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define DEBUG 0
+#include "debug.h"
+
+static const char OVERLAY_MAGIC[8] = {'B', '2', 'O', 'V', 'R', 'L', 'A', 'Y'};
+const uint32 OVERLAY_VERSION = 1;
+const uint32 OVERLAY_HEADER_SIZE = 4096;
+const uint32 OVERLAY_CLUSTER_SIZE = 65536;	// Default for new overlays
+
+// Header field offsets
+enum {
+	OVL_VERSION = 8,
+	OVL_CLUSTER_SIZE = 12,
+	OVL_VIRTUAL_SIZE = 16,
+	OVL_MAP_OFFSET = 24,
+	OVL_MAP_ENTRIES = 32,
+	OVL_DATA_OFFSET = 40,
+	OVL_BASE_NAME_LEN = 48,
+	OVL_BASE_NAME = 52
+};
+
+static inline uint32 ovl_get32(const uint8 *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline uint64 ovl_get64(const uint8 *p)
+{
+	return ((uint64)ovl_get32(p) << 32) | ovl_get32(p + 4);
+}
+
+static inline void ovl_put32(uint8 *p, uint32 v)
+{
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static inline void ovl_put64(uint8 *p, uint64 v)
+{
+	ovl_put32(p, v >> 32);
+	ovl_put32(p + 4, v);
+}
+
+static bool ovl_pread(int fd, void *buf, size_t len, loff_t pos)
+{
+	char *b = (char *)buf;
+	while (len) {
+		ssize_t actual = pread(fd, b, len, pos);
+		if (actual < 0 && errno == EINTR)
+			continue;
+		if (actual <= 0)
+			return false;
+		b += actual;
+		pos += actual;
+		len -= actual;
+	}
+	return true;
+}
+
+static bool ovl_pwrite(int fd, const void *buf, size_t len, loff_t pos)
+{
+	const char *b = (const char *)buf;
+	while (len) {
+		ssize_t actual = pwrite(fd, b, len, pos);
+		if (actual < 0 && errno == EINTR)
+			continue;
+		if (actual <= 0)
+			return false;
+		b += actual;
+		pos += actual;
+		len -= actual;
+	}
+	return true;
+}
+
+static loff_t ovl_page_align(loff_t x)
+{
+	loff_t page = getpagesize();
+	return (x + page - 1) & ~(page - 1);
+}
+
+struct disk_overlay : disk_generic {
+	disk_overlay(int fd, int base_fd, bool read_only)
+	: fd(fd), base_fd(base_fd), read_only(read_only), total_size(0),
+		base_start(0), base_size(0), cluster_size(0), map(NULL), map_bytes(0),
+		map_entries(0), data_offset(0), next_cluster(0) { }
+
+	virtual ~disk_overlay() {
+		if (map) {
+			if (!read_only)
+				msync(map, map_bytes, MS_SYNC);
+			munmap(map, map_bytes);
+		}
+		close(base_fd);
+		close(fd);
+	}
+
+	virtual bool is_read_only() { return read_only; }
+	virtual loff_t size() { return total_size; }
+
+	virtual size_t read(void *buf, loff_t offset, size_t length) {
+		if (offset >= total_size)
+			return 0;
+		length = std::min(length, size_t(total_size - offset));
+		uint8 *b = (uint8 *)buf;
+		size_t done = 0;
+		while (done < length) {
+			uint32 cluster = offset / cluster_size;
+			uint32 first = map_entry(cluster);
+			uint32 off = offset % cluster_size;
+			size_t run = std::min(size_t(cluster_size - off), length - done);
+
+			// Extend over following clusters that are contiguous in the
+			// overlay, or that all still live in the base image
+			for (uint32 c = cluster + 1, e = first; done + run < length; c++) {
+				uint32 next = map_entry(c);
+				if (first ? next != e + 1 : next != 0)
+					break;
+				e = next;
+				run = std::min(run + cluster_size, length - done);
+			}
+			bool ok = first ?
+				ovl_pread(fd, b + done, run, cluster_pos(first) + off) :
+				read_base(b + done, offset, run);
+			if (!ok)
+				break;
+			done += run;
+			offset += run;
+		}
+		return done;
+	}
+
+	virtual size_t write(void *buf, loff_t offset, size_t length) {
+		if (read_only || offset >= total_size)
+			return 0;
+		length = std::min(length, size_t(total_size - offset));
+		const uint8 *b = (const uint8 *)buf;
+		size_t done = 0;
+		while (done < length) {
+			uint32 cluster = offset / cluster_size;
+			uint32 off = offset % cluster_size;
+			size_t len = std::min(size_t(cluster_size - off), length - done);
+			uint32 entry = map_entry(cluster);
+			if (entry == 0) {
+				if (!allocate_cluster(cluster, b + done, off, len))
+					break;
+			} else if (!ovl_pwrite(fd, b + done, len, cluster_pos(entry) + off))
+				break;
+			done += len;
+			offset += len;
+		}
+		return done;
+	}
+
+	// Parse header, open base image and map the allocation table
+	disk_generic::status init(const char *path);
+
+protected:
+	int fd;				// Overlay file
+	int base_fd;		// Base image, always read-only
+	bool read_only;
+	loff_t total_size;
+	loff_t base_start;	// Size of base image file header (if any)
+	loff_t base_size;	// Size of base image data
+	uint32 cluster_size;
+	uint32 *map;		// mmap()ed allocation map
+	size_t map_bytes;
+	uint32 map_entries;
+	loff_t data_offset;
+	uint32 next_cluster;	// Next free cluster in the data area
+
+	uint32 map_entry(uint32 cluster) const {
+		return cluster < map_entries ? ntohl(map[cluster]) : 0;
+	}
+
+	loff_t cluster_pos(uint32 entry) const {
+		return data_offset + (loff_t)(entry - 1) * cluster_size;
+	}
+
+	// Read from the base image, zero-filling past its end
+	bool read_base(uint8 *buf, loff_t offset, size_t length) {
+		size_t avail = offset < base_size ?
+			std::min(length, size_t(base_size - offset)) : 0;
+		if (avail && !ovl_pread(base_fd, buf, avail, base_start + offset))
+			return false;
+		memset(buf + avail, 0, length - avail);
+		return true;
+	}
+
+	// Copy a cluster from the base into the overlay, merged with new data.
+	// The map entry is set only after the cluster data has been written.
+	uint32 allocate_cluster(uint32 cluster, const uint8 *data, uint32 off, size_t len) {
+		std::vector<uint8> buf(cluster_size);
+		if (len < cluster_size && !read_base(&buf[0], (loff_t)cluster * cluster_size, cluster_size))
+			return 0;
+		memcpy(&buf[off], data, len);
+		uint32 entry = next_cluster + 1;
+		if (!ovl_pwrite(fd, &buf[0], cluster_size, cluster_pos(entry)))
+			return 0;
+		next_cluster++;
+		map[cluster] = htonl(entry);
+		D(bug("overlay: cluster %u -> %u\n", cluster, entry));
+		return entry;
+	}
+};
+
+
+// Resolve base image path relative to the overlay file
+static std::string ovl_base_path(const char *overlay, const std::string &base)
+{
+	if (base.empty() || base[0] == '/')
+		return base;
+	const char *slash = strrchr(overlay, '/');
+	return slash ? std::string(overlay, slash - overlay + 1) + base : base;
+}
+
+disk_generic::status disk_overlay::init(const char *path)
+{
+	uint8 header[OVERLAY_HEADER_SIZE];
+	if (!ovl_pread(fd, header, OVERLAY_HEADER_SIZE, 0)
+			|| memcmp(header, OVERLAY_MAGIC, sizeof(OVERLAY_MAGIC)) != 0)
+		return DISK_UNKNOWN;
+	if (ovl_get32(header + OVL_VERSION) != OVERLAY_VERSION) {
+		fprintf(stderr, "overlay: Unsupported version\n");
+		return DISK_INVALID;
+	}
+	cluster_size = ovl_get32(header + OVL_CLUSTER_SIZE);
+	total_size = ovl_get64(header + OVL_VIRTUAL_SIZE);
+	loff_t map_offset = ovl_get64(header + OVL_MAP_OFFSET);
+	map_entries = ovl_get32(header + OVL_MAP_ENTRIES);
+	data_offset = ovl_get64(header + OVL_DATA_OFFSET);
+	uint32 name_len = ovl_get32(header + OVL_BASE_NAME_LEN);
+	if (cluster_size < 512 || (cluster_size & (cluster_size - 1))
+			|| (loff_t)map_entries * cluster_size < total_size
+			|| map_offset % getpagesize()
+			|| data_offset < map_offset + (loff_t)map_entries * 4
+			|| name_len > OVERLAY_HEADER_SIZE - OVL_BASE_NAME) {
+		fprintf(stderr, "overlay: Bad header\n");
+		return DISK_INVALID;
+	}
+
+	// Open base image
+	std::string base = ovl_base_path(path, std::string((const char *)header + OVL_BASE_NAME, name_len));
+	base_fd = open(base.c_str(), O_RDONLY);
+	if (base_fd == -1) {
+		fprintf(stderr, "overlay: Can't open base image %s: %s\n", base.c_str(), strerror(errno));
+		return DISK_INVALID;
+	}
+	loff_t size = lseek(base_fd, 0, SEEK_END);
+	uint8 data[256];
+	memset(data, 0, sizeof(data));
+	pread(base_fd, data, sizeof(data), 0);
+	FileDiskLayout(size, data, base_start, base_size);
+
+	// Map the allocation table
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < data_offset) {
+		fprintf(stderr, "overlay: Truncated overlay file\n");
+		return DISK_INVALID;
+	}
+	next_cluster = (st.st_size - data_offset + cluster_size - 1) / cluster_size;
+	map_bytes = ovl_page_align((size_t)map_entries * 4);
+	void *p = mmap(NULL, map_bytes, read_only ? PROT_READ : PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, map_offset);
+	if (p == MAP_FAILED) {
+		perror("overlay: mmap failed");
+		return DISK_INVALID;
+	}
+	map = (uint32 *)p;
+
+	D(bug("overlay: %s on %s, %lld bytes, %u clusters in use\n", path, base.c_str(),
+		(long long)total_size, next_cluster));
+	return DISK_VALID;
+}
+
+static disk_generic::status ovl_open(const char *path, bool read_only, disk_generic **disk)
+{
+	int fd = open(path, read_only ? O_RDONLY : O_RDWR);
+	if (fd == -1 && !read_only) {
+		read_only = true;
+		fd = open(path, O_RDONLY);
+	}
+	if (fd == -1)
+		return disk_generic::DISK_UNKNOWN;
+
+	disk_overlay *d = new disk_overlay(fd, -1, read_only);
+	disk_generic::status st = d->init(path);
+	if (st != disk_generic::DISK_VALID)
+		delete d;
+	else
+		*disk = d;
+	return st;
+}
+
+disk_generic::status disk_overlay_factory(const char *path,
+		bool read_only, disk_generic **disk) {
+	// Does it look like an overlay?
+	char magic[sizeof(OVERLAY_MAGIC)];
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return disk_generic::DISK_UNKNOWN;
+	bool is_overlay = ovl_pread(fd, magic, sizeof(magic), 0)
+		&& memcmp(magic, OVERLAY_MAGIC, sizeof(magic)) == 0;
+	close(fd);
+	if (!is_overlay)
+		return disk_generic::DISK_UNKNOWN;
+	return ovl_open(path, read_only, disk);
+}
+
+
+/*
+ *  Open a private overlay for the plain image file "base" in directory
+ *  "dir", creating it if it doesn't exist yet
+ */
+
+disk_generic::status disk_overlay_attach(const char *base, const char *dir,
+		disk_generic **disk) {
+	char real_base[PATH_MAX];
+	if (realpath(base, real_base) == NULL)
+		return disk_generic::DISK_UNKNOWN;
+	const char *slash = strrchr(real_base, '/');
+	std::string path = std::string(dir) + "/" + (slash ? slash + 1 : real_base) + ".overlay";
+
+	if (access(path.c_str(), F_OK) != 0) {
+		int base_fd = open(real_base, O_RDONLY);
+		if (base_fd == -1)
+			return disk_generic::DISK_UNKNOWN;
+		loff_t size = lseek(base_fd, 0, SEEK_END);
+		uint8 data[256];
+		memset(data, 0, sizeof(data));
+		pread(base_fd, data, sizeof(data), 0);
+		close(base_fd);
+		loff_t start, real_size;
+		FileDiskLayout(size, data, start, real_size);
+
+		size_t name_len = strlen(real_base);
+		if (name_len > OVERLAY_HEADER_SIZE - OVL_BASE_NAME)
+			return disk_generic::DISK_UNKNOWN;
+		uint32 entries = (real_size + OVERLAY_CLUSTER_SIZE - 1) / OVERLAY_CLUSTER_SIZE;
+		loff_t map_offset = ovl_page_align(OVERLAY_HEADER_SIZE);
+		loff_t data_offset = ovl_page_align(map_offset + (loff_t)entries * 4);
+
+		uint8 header[OVERLAY_HEADER_SIZE];
+		memset(header, 0, sizeof(header));
+		memcpy(header, OVERLAY_MAGIC, sizeof(OVERLAY_MAGIC));
+		ovl_put32(header + OVL_VERSION, OVERLAY_VERSION);
+		ovl_put32(header + OVL_CLUSTER_SIZE, OVERLAY_CLUSTER_SIZE);
+		ovl_put64(header + OVL_VIRTUAL_SIZE, real_size);
+		ovl_put64(header + OVL_MAP_OFFSET, map_offset);
+		ovl_put32(header + OVL_MAP_ENTRIES, entries);
+		ovl_put64(header + OVL_DATA_OFFSET, data_offset);
+		ovl_put32(header + OVL_BASE_NAME_LEN, name_len);
+		memcpy(header + OVL_BASE_NAME, real_base, name_len);
+
+		// Map and data area start out as a hole
+		int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+		if (fd == -1) {
+			fprintf(stderr, "overlay: Can't create %s: %s\n", path.c_str(), strerror(errno));
+			return disk_generic::DISK_INVALID;
+		}
+		bool ok = ovl_pwrite(fd, header, sizeof(header), 0) && ftruncate(fd, data_offset) == 0;
+		close(fd);
+		if (!ok) {
+			unlink(path.c_str());
+			return disk_generic::DISK_INVALID;
+		}
+		printf("Created overlay %s for %s\n", path.c_str(), real_base);
+	} else {
+		// Overlays are named after the base file, catch name clashes
+		uint8 header[OVERLAY_HEADER_SIZE];
+		int fd = open(path.c_str(), O_RDONLY);
+		bool ok = fd != -1 && ovl_pread(fd, header, sizeof(header), 0);
+		if (fd != -1)
+			close(fd);
+		uint32 name_len = ok ? ovl_get32(header + OVL_BASE_NAME_LEN) : 0;
+		if (ok && (name_len != strlen(real_base)
+				|| memcmp(header + OVL_BASE_NAME, real_base, name_len) != 0)) {
+			fprintf(stderr, "overlay: %s belongs to a different base image\n", path.c_str());
+			return disk_generic::DISK_INVALID;
+		}
+	}
+	return ovl_open(path.c_str(), false, disk);
+}
@@ -29,17 +29,27 @@
 #define __MACOSX__ 1
 #endif
 
+// Number of band files kept open at once
+const int BAND_POOL_SIZE = 16;
+
 struct disk_sparsebundle : disk_generic {
 	disk_sparsebundle(const char *bands, int fd, bool read_only,
 		loff_t band_size, loff_t total_size)
 	: token_fd(fd), read_only(read_only), band_size(band_size),
-		total_size(total_size), band_dir(strdup(bands)),
-		band_cur(-1), band_fd(-1), band_alloc(-1) {
+		total_size(total_size), band_dir(strdup(bands)), use_clock(0) {
+		for (int i = 0; i < BAND_POOL_SIZE; ++i) {
+			pool[i].band = -1;
+			pool[i].fd = -1;
+			pool[i].alloc = -1;
+			pool[i].last_use = 0;
+		}
 	}
 	
 	virtual ~disk_sparsebundle() {
-		if (band_fd != -1)
-			close(band_fd);
+		for (int i = 0; i < BAND_POOL_SIZE; ++i) {
+			if (pool[i].fd != -1)
+				close(pool[i].fd);
+		}
 		close(token_fd);
 		free(band_dir);
 	}
@@ -61,10 +71,15 @@ protected:
 	loff_t band_size, total_size;
 	char *band_dir;			// directory containing band files
 	
-	// Currently open band
-	loff_t band_cur;		// index of the band
-	int band_fd;			// -1 if not open
-	loff_t band_alloc;		// how much space is already used?
+	// Pool of open bands, recycled in LRU order
+	struct band_slot {
+		loff_t band;		// index of the band, -1 if slot is free
+		int fd;				// -1 if not open
+		loff_t alloc;		// how much space is already used?
+		uint32 last_use;	// value of use_clock at last access
+	};
+	band_slot pool[BAND_POOL_SIZE];
+	uint32 use_clock;
 	
 	typedef ssize_t (disk_sparsebundle::*band_func)(char *buf, loff_t band,
 		size_t offset, size_t len);
@@ -93,15 +108,44 @@ protected:
 		}
 		return done;
 	}
-		
+	
+	// Find the pool slot to use for a band: either the one that already
+	// holds it, or the least recently used one.
+	band_slot *find_slot(loff_t band, bool *hit) {
+		band_slot *victim = &pool[0];
+		for (int i = 0; i < BAND_POOL_SIZE; ++i) {
+			band_slot *s = &pool[i];
+			if (s->band == band) {
+				*hit = true;
+				return s;
+			}
+			if (s->band == -1) {
+				if (victim->band != -1)
+					victim = s;
+			} else if (victim->band != -1 && s->last_use < victim->last_use)
+				victim = s;
+		}
+		*hit = false;
+		return victim;
+	}
+	
 	// Open a band by index. It's ok if the band is already open.
 	enum open_ret {
 		OPEN_FAILED = 0,
 		OPEN_NOENT,		// Band doesn't exist yet
 		OPEN_OK,
 	};
-	open_ret open_band(loff_t band, bool create) {
-		if (band_cur == band)
+	open_ret open_band(loff_t band, bool create, band_slot **slot) {
+		bool hit;
+		band_slot *s = find_slot(band, &hit);
+		if (++use_clock == 0) {		// wrapped, restart LRU ordering
+			for (int i = 0; i < BAND_POOL_SIZE; ++i)
+				pool[i].last_use = 0;
+			use_clock = 1;
+		}
+		s->last_use = use_clock;
+		*slot = s;
+		if (hit)
 			return OPEN_OK;
 		
 		char path[PATH_MAX + 1];
@@ -110,41 +154,41 @@ protected:
 			return OPEN_FAILED;
 		}
 		
-		if (band_fd != -1)
-			close(band_fd);
-		band_alloc = -1;
-		band_cur = -1;
-		
 		int oflags = read_only ? O_RDONLY : O_RDWR;
 		if (create)
 			oflags |= O_CREAT;
-		band_fd = open(path, oflags, 0644);
-		if (band_fd == -1) {
+		int fd = open(path, oflags, 0644);
+		if (fd == -1) {
 			return (!create && errno == ENOENT) ? OPEN_NOENT : OPEN_FAILED;
 		}
 		
+		// Evict the previous occupant of the slot
+		if (s->fd != -1)
+			close(s->fd);
+		s->fd = fd;
+		s->band = band;
+		s->alloc = -1;
+		
 		// Get the allocated size
 		if (!read_only) {
-			band_alloc = lseek(band_fd, 0, SEEK_END);
-			if (band_alloc == -1)
-				band_alloc = band_size;
+			s->alloc = lseek(fd, 0, SEEK_END);
+			if (s->alloc == -1)
+				s->alloc = band_size;
 		}
-		band_cur = band;
 		return OPEN_OK;
 	}
 	
 	ssize_t band_read(char *buf, loff_t band, size_t off, size_t len) {
-		open_ret st = open_band(band, false);
+		band_slot *s;
+		open_ret st = open_band(band, false, &s);
 		if (st == OPEN_FAILED)
 			return -1;
 		
 		// Unallocated bytes 
-		size_t want = (st == OPEN_NOENT || off >= band_alloc) ? 0
-			: std::min(len, (size_t)band_alloc - off);
+		size_t want = (st == OPEN_NOENT || off >= s->alloc) ? 0
+			: std::min(len, (size_t)s->alloc - off);
 		if (want) {
-			if (lseek(band_fd, off, SEEK_SET) == -1)
-				return -1;
-			ssize_t err = ::read(band_fd, buf, want);
+			ssize_t err = pread(s->fd, buf, want, off);
 			if (err < want)
 				return err;
 		}
@@ -160,18 +204,16 @@ protected:
 		for (; nz > 0 && !buf[nz-1]; --nz)
 			; // pass
 		
-		open_ret st = open_band(band, nz);
+		band_slot *s;
+		open_ret st = open_band(band, nz, &s);
 		if (st != OPEN_OK)
 			return st == OPEN_NOENT ? len : -1;
-
-		if (lseek(band_fd, off, SEEK_SET) == -1)
-			return -1;
 		
-		size_t space = (off >= band_alloc ? 0 : band_alloc - off);
+		size_t space = (off >= s->alloc ? 0 : s->alloc - off);
 		size_t want = std::max(nz, std::min(space, len));
-		ssize_t err = ::write(band_fd, buf, want);
+		ssize_t err = pwrite(s->fd, buf, want, off);
 		if (err >= 0)
-			band_alloc = std::max(band_alloc, loff_t(off + err));
+			s->alloc = std::max(s->alloc, loff_t(off + err));
 		if (err < want)
 			return err;
 		return len;
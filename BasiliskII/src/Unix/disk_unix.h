@@ -43,6 +43,12 @@ typedef disk_generic::status (disk_factory)(const char *path, bool read_only,
 	disk_generic **disk);
 
 extern disk_factory disk_sparsebundle_factory;
+extern disk_factory disk_vhd_native_factory;
+extern disk_factory disk_overlay_factory;
 extern disk_factory disk_vhd_factory;
 
+// Open (and create if needed) a copy-on-write overlay for a plain image file
+extern disk_generic::status disk_overlay_attach(const char *base,
+	const char *dir, disk_generic **disk);
+
 #endif
@@ -0,0 +1,559 @@
+/*
+ *  disk_vhd.cpp - Native dynamic and differencing VHD implementation
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  The block allocation table is kept in memory for the lifetime of the
+ *  disk, and sector bitmaps of differencing images are loaded on first use
+ *  and then cached. Fixed VHDs are left to libvhd or the raw file code,
+ *  except when they are the parent of a differencing image.
+ */
+
+#include "disk_unix.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define DEBUG 0
+#include "debug.h"
+
+const uint32 VHD_SECTOR_SIZE = 512;
+const uint32 VHD_FOOTER_SIZE = 512;
+const uint32 VHD_HEADER_SIZE = 1024;
+const uint32 VHD_BAT_UNUSED = 0xffffffff;
+const int VHD_MAX_CHAIN = 16;		// Max. depth of differencing chains
+
+// Disk types
+enum {
+	VHD_TYPE_FIXED = 2,
+	VHD_TYPE_DYNAMIC = 3,
+	VHD_TYPE_DIFF = 4
+};
+
+// Footer field offsets
+enum {
+	VHD_FTR_DATA_OFFSET = 16,
+	VHD_FTR_CURR_SIZE = 48,
+	VHD_FTR_TYPE = 60,
+	VHD_FTR_UUID = 68
+};
+
+// Dynamic disk header field offsets
+enum {
+	VHD_HDR_TABLE_OFFSET = 16,
+	VHD_HDR_MAX_ENTRIES = 28,
+	VHD_HDR_BLOCK_SIZE = 32,
+	VHD_HDR_PARENT_UUID = 40,
+	VHD_HDR_PARENT_NAME = 64,
+	VHD_HDR_LOCATORS = 576
+};
+
+static inline uint32 vhd_get32(const uint8 *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline uint64 vhd_get64(const uint8 *p)
+{
+	return ((uint64)vhd_get32(p) << 32) | vhd_get32(p + 4);
+}
+
+static inline void vhd_put32(uint8 *p, uint32 v)
+{
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+// Read exactly "len" bytes at "pos", false on error or short read
+static bool vhd_pread(int fd, void *buf, size_t len, loff_t pos)
+{
+	char *b = (char *)buf;
+	while (len) {
+		ssize_t actual = pread(fd, b, len, pos);
+		if (actual < 0 && errno == EINTR)
+			continue;
+		if (actual <= 0)
+			return false;
+		b += actual;
+		pos += actual;
+		len -= actual;
+	}
+	return true;
+}
+
+static bool vhd_pwrite(int fd, const void *buf, size_t len, loff_t pos)
+{
+	const char *b = (const char *)buf;
+	while (len) {
+		ssize_t actual = pwrite(fd, b, len, pos);
+		if (actual < 0 && errno == EINTR)
+			continue;
+		if (actual <= 0)
+			return false;
+		b += actual;
+		pos += actual;
+		len -= actual;
+	}
+	return true;
+}
+
+struct disk_vhd_native : disk_generic {
+	disk_vhd_native(int fd, bool read_only)
+	: fd(fd), read_only(read_only), disk_type(0), total_size(0),
+		block_size(0), bitmap_size(0), bat_offset(0), next_block(0),
+		parent(NULL) { }
+
+	virtual ~disk_vhd_native() {
+		for (size_t i = 0; i < bitmaps.size(); ++i)
+			delete[] bitmaps[i];
+		delete parent;
+		close(fd);
+	}
+
+	virtual bool is_read_only() { return read_only; }
+	virtual loff_t size() { return total_size; }
+
+	virtual size_t read(void *buf, loff_t offset, size_t length) {
+		if (offset >= total_size)
+			return 0;
+		length = std::min(length, size_t(total_size - offset));
+		return read_range((uint8 *)buf, offset, length) ? length : 0;
+	}
+
+	virtual size_t write(void *buf, loff_t offset, size_t length) {
+		if (read_only || offset >= total_size)
+			return 0;
+		length = std::min(length, size_t(total_size - offset));
+
+		// Unaligned head and tail sectors are merged with the current
+		// contents, so the bitmap only ever covers whole sectors
+		uint32 head = offset % VHD_SECTOR_SIZE;
+		uint32 tail = (offset + length) % VHD_SECTOR_SIZE;
+		if (head == 0 && tail == 0)
+			return write_range((uint8 *)buf, offset, length) ? length : 0;
+
+		loff_t start = offset - head;
+		size_t span = head + length + (tail ? VHD_SECTOR_SIZE - tail : 0);
+		std::vector<uint8> bounce(span);
+		if (head && !read_range(&bounce[0], start, VHD_SECTOR_SIZE))
+			return 0;
+		if (tail && !read_range(&bounce[span - VHD_SECTOR_SIZE],
+				start + span - VHD_SECTOR_SIZE, VHD_SECTOR_SIZE))
+			return 0;
+		memcpy(&bounce[head], buf, length);
+		return write_range(&bounce[0], start, span) ? length : 0;
+	}
+
+	// Parse footer and header, load BAT
+	disk_generic::status init(const char *path, int depth);
+
+protected:
+	int fd;
+	bool read_only;
+	uint32 disk_type;
+	loff_t total_size;
+
+	uint8 footer[VHD_FOOTER_SIZE];	// Copy of the footer, rewritten after new blocks
+	uint32 block_size;				// Bytes of data per block
+	uint32 bitmap_size;				// Bytes of bitmap in front of each block, sector aligned
+	loff_t bat_offset;				// File position of the BAT
+	std::vector<uint32> bat;		// Sector offset of each block, or VHD_BAT_UNUSED
+	std::vector<uint8 *> bitmaps;	// Cached sector bitmaps (differencing only), NULL if not loaded
+	loff_t next_block;				// File position of the next allocated block (= footer position)
+	disk_vhd_native *parent;		// Parent image (differencing only)
+
+	loff_t block_data_pos(uint32 block) const {
+		return (loff_t)bat[block] * VHD_SECTOR_SIZE + bitmap_size;
+	}
+
+	static bool sector_present(const uint8 *bitmap, uint32 sector) {
+		return bitmap[sector >> 3] & (0x80 >> (sector & 7));
+	}
+
+	// Get sector bitmap of allocated block, reading it from disk if needed
+	uint8 *get_bitmap(uint32 block) {
+		if (bitmaps[block] == NULL) {
+			uint8 *bm = new uint8[bitmap_size];
+			if (!vhd_pread(fd, bm, bitmap_size,
+					(loff_t)bat[block] * VHD_SECTOR_SIZE)) {
+				delete[] bm;
+				return NULL;
+			}
+			bitmaps[block] = bm;
+		}
+		return bitmaps[block];
+	}
+
+	// Read data that doesn't belong to this image: from the parent for
+	// differencing images, zeros otherwise
+	bool read_parent(uint8 *buf, loff_t offset, size_t length) {
+		if (parent == NULL) {
+			memset(buf, 0, length);
+			return true;
+		}
+		size_t avail = offset < parent->total_size ?
+			std::min(length, size_t(parent->total_size - offset)) : 0;
+		if (avail && !parent->read_range(buf, offset, avail))
+			return false;
+		memset(buf + avail, 0, length - avail);
+		return true;
+	}
+
+	// Read part of one block; runs of sectors with the same bitmap state
+	// are transferred with a single pread()
+	bool read_block(uint8 *buf, uint32 block, uint32 off, uint32 len) {
+		loff_t block_start = (loff_t)block * block_size;
+		if (bat[block] == VHD_BAT_UNUSED)
+			return read_parent(buf, block_start + off, len);
+		if (parent == NULL)
+			return vhd_pread(fd, buf, len, block_data_pos(block) + off);
+
+		const uint8 *bm = get_bitmap(block);
+		if (bm == NULL)
+			return false;
+		uint32 end = off + len;
+		while (off < end) {
+			uint32 sector = off / VHD_SECTOR_SIZE;
+			bool present = sector_present(bm, sector);
+			uint32 run_end = (sector + 1) * VHD_SECTOR_SIZE;
+			while (run_end < end && sector_present(bm, run_end / VHD_SECTOR_SIZE) == present)
+				run_end += VHD_SECTOR_SIZE;
+			run_end = std::min(run_end, end);
+			bool ok = present ?
+				vhd_pread(fd, buf, run_end - off, block_data_pos(block) + off) :
+				read_parent(buf, block_start + off, run_end - off);
+			if (!ok)
+				return false;
+			buf += run_end - off;
+			off = run_end;
+		}
+		return true;
+	}
+
+	bool read_range(uint8 *buf, loff_t offset, size_t length) {
+		if (disk_type == VHD_TYPE_FIXED)
+			return vhd_pread(fd, buf, length, offset);
+		while (length) {
+			uint32 block = offset / block_size;
+			uint32 off = offset % block_size;
+			uint32 len = std::min(size_t(block_size - off), length);
+			if (block >= bat.size())
+				memset(buf, 0, len);
+			else if (!read_block(buf, block, off, len))
+				return false;
+			buf += len;
+			offset += len;
+			length -= len;
+		}
+		return true;
+	}
+
+	// Append a new block in place of the footer, then move the footer
+	// behind it and update the BAT. The data area is left as a hole.
+	bool allocate_block(uint32 block) {
+		loff_t pos = next_block;
+		loff_t new_end = pos + bitmap_size + block_size;
+		if (!vhd_pwrite(fd, footer, VHD_FOOTER_SIZE, new_end))
+			return false;
+
+		// Dynamic images own every sector of an allocated block, in
+		// differencing images sectors start out in the parent
+		uint8 *bm = new uint8[bitmap_size];
+		memset(bm, parent ? 0x00 : 0xff, bitmap_size);
+		if (!vhd_pwrite(fd, bm, bitmap_size, pos)) {
+			delete[] bm;
+			return false;
+		}
+
+		uint8 entry[4];
+		vhd_put32(entry, pos / VHD_SECTOR_SIZE);
+		if (!vhd_pwrite(fd, entry, 4, bat_offset + (loff_t)block * 4)) {
+			delete[] bm;
+			return false;
+		}
+
+		bat[block] = pos / VHD_SECTOR_SIZE;
+		delete[] bitmaps[block];
+		bitmaps[block] = bm;
+		next_block = new_end;
+		D(bug("vhd: allocated block %u at %lld\n", block, (long long)pos));
+		return true;
+	}
+
+	// Write part of one block; the bitmap is updated once per call
+	bool write_block(const uint8 *buf, uint32 block, uint32 off, uint32 len) {
+		if (bat[block] == VHD_BAT_UNUSED) {
+			// All-zero writes to a sparse dynamic image need no block
+			if (parent == NULL) {
+				uint32 i;
+				for (i = 0; i < len && buf[i] == 0; ++i)
+					;
+				if (i == len)
+					return true;
+			}
+			if (!allocate_block(block))
+				return false;
+		}
+		if (!vhd_pwrite(fd, buf, len, block_data_pos(block) + off))
+			return false;
+		if (parent == NULL)
+			return true;
+
+		uint8 *bm = get_bitmap(block);
+		if (bm == NULL)
+			return false;
+		uint32 first = off / VHD_SECTOR_SIZE, last = (off + len - 1) / VHD_SECTOR_SIZE;
+		uint32 dirty_lo = bitmap_size, dirty_hi = 0;
+		for (uint32 s = first; s <= last; ++s) {
+			if (!sector_present(bm, s)) {
+				bm[s >> 3] |= 0x80 >> (s & 7);
+				dirty_lo = std::min(dirty_lo, s >> 3);
+				dirty_hi = std::max(dirty_hi, (s >> 3) + 1);
+			}
+		}
+		if (dirty_lo < dirty_hi)
+			return vhd_pwrite(fd, bm + dirty_lo, dirty_hi - dirty_lo,
+				(loff_t)bat[block] * VHD_SECTOR_SIZE + dirty_lo);
+		return true;
+	}
+
+	bool write_range(const uint8 *buf, loff_t offset, size_t length) {
+		while (length) {
+			uint32 block = offset / block_size;
+			uint32 off = offset % block_size;
+			uint32 len = std::min(size_t(block_size - off), length);
+			if (block >= bat.size() || !write_block(buf, block, off, len))
+				return false;
+			buf += len;
+			offset += len;
+			length -= len;
+		}
+		return true;
+	}
+
+	bool open_parent(const char *path, const uint8 *header, int depth);
+};
+
+
+// Convert UTF-16 string to UTF-8
+static std::string vhd_utf16_to_utf8(const uint8 *p, size_t bytes, bool big_endian)
+{
+	std::string s;
+	for (size_t i = 0; i + 1 < bytes; i += 2) {
+		uint32 c = big_endian ? (p[i] << 8) | p[i + 1] : (p[i + 1] << 8) | p[i];
+		if (c == 0)
+			break;
+		if (c < 0x80)
+			s += char(c);
+		else if (c < 0x800) {
+			s += char(0xc0 | (c >> 6));
+			s += char(0x80 | (c & 0x3f));
+		} else {
+			s += char(0xe0 | (c >> 12));
+			s += char(0x80 | ((c >> 6) & 0x3f));
+			s += char(0x80 | (c & 0x3f));
+		}
+	}
+	return s;
+}
+
+// Make Windows path usable on Unix
+static std::string vhd_unix_path(std::string s)
+{
+	std::replace(s.begin(), s.end(), '\\', '/');
+	if (s.compare(0, 2, "./") == 0)
+		s.erase(0, 2);
+	return s;
+}
+
+static std::string vhd_dirname(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? std::string(path, slash - path + 1) : std::string();
+}
+
+static bool vhd_open_file(const char *path, bool read_only, int depth,
+	disk_vhd_native **disk, disk_generic::status *st)
+{
+	int fd = open(path, read_only ? O_RDONLY : O_RDWR);
+	if (fd == -1)
+		return false;
+	disk_vhd_native *d = new disk_vhd_native(fd, read_only);
+	*st = d->init(path, depth);
+	if (*st != disk_generic::DISK_VALID) {
+		delete d;
+		return false;
+	}
+	*disk = d;
+	return true;
+}
+
+// Locate and open the parent of a differencing image
+bool disk_vhd_native::open_parent(const char *path, const uint8 *header, int depth)
+{
+	if (depth >= VHD_MAX_CHAIN) {
+		fprintf(stderr, "vhd: Differencing chain too deep\n");
+		return false;
+	}
+	std::string dir = vhd_dirname(path);
+
+	// Collect candidate paths, best guesses first
+	std::vector<std::string> candidates;
+	for (int i = 0; i < 8; ++i) {
+		const uint8 *loc = header + VHD_HDR_LOCATORS + i * 24;
+		uint32 code = vhd_get32(loc);
+		uint32 len = vhd_get32(loc + 8);
+		loff_t pos = vhd_get64(loc + 16);
+		if (code == 0 || len == 0 || len > PATH_MAX * 4)
+			continue;
+		std::vector<uint8> data(len);
+		if (!vhd_pread(fd, &data[0], len, pos))
+			continue;
+		std::string name;
+		if (code == 0x4d616358) {			// 'MacX', file URL
+			name.assign((const char *)&data[0], len);
+			name = name.c_str();
+			if (name.compare(0, 16, "file://localhost") == 0)
+				name.erase(0, 16);
+			else if (name.compare(0, 7, "file://") == 0)
+				name.erase(0, 7);
+		} else if (code == 0x57327275) {	// 'W2ru', relative path
+			name = vhd_unix_path(vhd_utf16_to_utf8(&data[0], len, false));
+			if (!name.empty() && name[0] != '/')
+				name = dir + name;
+		} else if (code == 0x57326b75) {	// 'W2ku', absolute path
+			name = vhd_unix_path(vhd_utf16_to_utf8(&data[0], len, false));
+		} else
+			continue;
+		if (!name.empty())
+			candidates.push_back(name);
+	}
+	std::string pname = vhd_utf16_to_utf8(header + VHD_HDR_PARENT_NAME, 512, true);
+	if (!pname.empty())
+		candidates.push_back(dir + vhd_unix_path(pname));
+
+	for (size_t i = 0; i < candidates.size(); ++i) {
+		disk_generic::status st;
+		D(bug("vhd: trying parent %s\n", candidates[i].c_str()));
+		if (vhd_open_file(candidates[i].c_str(), true, depth + 1, &parent, &st)) {
+			if (memcmp(parent->footer + VHD_FTR_UUID, header + VHD_HDR_PARENT_UUID, 16) != 0)
+				fprintf(stderr, "vhd: WARNING: Parent %s has different UUID\n", candidates[i].c_str());
+			return true;
+		}
+	}
+	fprintf(stderr, "vhd: Can't find parent image \"%s\"\n", pname.c_str());
+	return false;
+}
+
+disk_generic::status disk_vhd_native::init(const char *path, int depth)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < VHD_FOOTER_SIZE)
+		return DISK_UNKNOWN;
+
+	// The footer lives at the end of the file, dynamic images keep a copy
+	// at the start
+	loff_t footer_pos = (st.st_size & ~loff_t(VHD_SECTOR_SIZE - 1)) - VHD_FOOTER_SIZE;
+	if (!vhd_pread(fd, footer, VHD_FOOTER_SIZE, footer_pos)
+			|| memcmp(footer, "conectix", 8) != 0) {
+		if (!vhd_pread(fd, footer, VHD_FOOTER_SIZE, 0)
+				|| memcmp(footer, "conectix", 8) != 0)
+			return DISK_UNKNOWN;
+		footer_pos = (st.st_size + VHD_SECTOR_SIZE - 1) & ~loff_t(VHD_SECTOR_SIZE - 1);
+	}
+	disk_type = vhd_get32(footer + VHD_FTR_TYPE);
+	total_size = vhd_get64(footer + VHD_FTR_CURR_SIZE);
+	next_block = footer_pos;
+
+	if (disk_type == VHD_TYPE_FIXED) {
+		// Only supported as parent of differencing images
+		if (depth == 0)
+			return DISK_UNKNOWN;
+		total_size = std::min(total_size, footer_pos);
+		return DISK_VALID;
+	}
+	if (disk_type != VHD_TYPE_DYNAMIC && disk_type != VHD_TYPE_DIFF) {
+		fprintf(stderr, "vhd: Unsupported disk type %u\n", disk_type);
+		return DISK_INVALID;
+	}
+
+	uint8 header[VHD_HEADER_SIZE];
+	if (!vhd_pread(fd, header, VHD_HEADER_SIZE, vhd_get64(footer + VHD_FTR_DATA_OFFSET))
+			|| memcmp(header, "cxsparse", 8) != 0) {
+		fprintf(stderr, "vhd: Bad dynamic disk header\n");
+		return DISK_INVALID;
+	}
+	bat_offset = vhd_get64(header + VHD_HDR_TABLE_OFFSET);
+	block_size = vhd_get32(header + VHD_HDR_BLOCK_SIZE);
+	uint32 entries = vhd_get32(header + VHD_HDR_MAX_ENTRIES);
+	if (block_size < VHD_SECTOR_SIZE || block_size % VHD_SECTOR_SIZE
+			|| (loff_t)entries * block_size < total_size) {
+		fprintf(stderr, "vhd: Bad block size %u\n", block_size);
+		return DISK_INVALID;
+	}
+	uint32 block_sectors = block_size / VHD_SECTOR_SIZE;
+	bitmap_size = ((block_sectors + 7) / 8 + VHD_SECTOR_SIZE - 1) & ~(VHD_SECTOR_SIZE - 1);
+
+	// Keep the whole BAT in memory
+	std::vector<uint8> raw_bat((size_t)entries * 4);
+	if (entries && !vhd_pread(fd, &raw_bat[0], raw_bat.size(), bat_offset)) {
+		fprintf(stderr, "vhd: Can't read block allocation table\n");
+		return DISK_INVALID;
+	}
+	bat.resize(entries);
+	bitmaps.resize(entries, NULL);
+	for (uint32 i = 0; i < entries; ++i)
+		bat[i] = vhd_get32(&raw_bat[i * 4]);
+
+	if (disk_type == VHD_TYPE_DIFF && !open_parent(path, header, depth))
+		return DISK_INVALID;
+
+	D(bug("vhd: %s type %u, %lld bytes, %u blocks of %u bytes\n", path, disk_type,
+		(long long)total_size, entries, block_size));
+	return DISK_VALID;
+}
+
+disk_generic::status disk_vhd_native_factory(const char *path,
+		bool read_only, disk_generic **disk) {
+	// Check for the footer copy in front of dynamic images
+	char magic[8];
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return disk_generic::DISK_UNKNOWN;
+	bool is_vhd = vhd_pread(fd, magic, sizeof(magic), 0)
+		&& memcmp(magic, "conectix", 8) == 0;
+	close(fd);
+	if (!is_vhd)
+		return disk_generic::DISK_UNKNOWN;
+
+	disk_vhd_native *d;
+	disk_generic::status st = disk_generic::DISK_UNKNOWN;
+	if (!vhd_open_file(path, read_only, 0, &d, &st)) {
+		if (!read_only && st == disk_generic::DISK_UNKNOWN
+				&& (errno == EACCES || errno == EROFS || errno == EPERM)
+				&& vhd_open_file(path, true, 0, &d, &st))
+			fprintf(stderr, "vhd: Can only mount read-only\n");
+		else
+			return st;
+	}
+	*disk = d;
+	return disk_generic::DISK_VALID;
+}
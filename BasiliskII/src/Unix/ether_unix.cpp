@@ -62,6 +62,7 @@
 #endif
 
 #include <sys/wait.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <pthread.h>
 #include <semaphore.h>
@@ -90,6 +91,14 @@
 #include "ctl.h"
 #endif
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#if defined(HAVE_SLIRP) && defined(HAVE_SYS_EPOLL_H)
+#include <sys/epoll.h>
+#endif
+
 #ifdef HAVE_LIBVDEPLUG
 extern "C" {
 #include <libvdeplug.h>
@@ -103,6 +112,7 @@ extern "C" {
 #include "user_strings.h"
 #include "ether.h"
 #include "ether_defs.h"
+#include "timer.h"
 
 #ifndef NO_STD_NAMESPACE
 using std::map;
@@ -149,8 +159,9 @@ static char *net_if_name = NULL;			// TUN/TAP device name
 static const char *net_if_script = NULL;	// Network config script
 static pthread_t slirp_thread;				// Slirp reception thread
 static bool slirp_thread_active = false;	// Flag: Slirp reception threadinstalled
-static int slirp_output_fd = -1;			// fd of slirp output pipe
-static int slirp_input_fds[2] = { -1, -1 };	// fds of slirp input pipe
+#if defined(HAVE_SLIRP) && defined(HAVE_SYS_EPOLL_H)
+static int slirp_epoll_fd = -1;				// epoll instance of slirp reception thread
+#endif
 #ifdef HAVE_LIBVDEPLUG
 static VDECONN *vde_conn;
 #endif
@@ -169,6 +180,128 @@ static uint8 packet_buffer[2048];
 // Attached network protocols, maps protocol type to MacOS handler address
 static map<uint16, uint32> net_protocols;
 
+// Single-producer single-consumer packet ring in shared memory. The
+// producer fills slots in place. Rings that have a doorbell (an eventfd,
+// or a pipe where that is not available) ring it only when the ring was
+// empty, so the consumer can take all queued packets per wakeup.
+const uint32 PACKET_RING_SIZE = 256;		// Number of slots (power of 2)
+const int PACKET_SLOT_SIZE = 1516;			// Maximum packet size
+
+struct PacketRing {
+	uint32 head;							// Next slot to read (written by consumer)
+	uint32 tail;							// Next slot to write (written by producer)
+	int doorbell[2];						// Doorbell read/write fds (same fd for eventfd, -1 = none)
+	uint16 length[PACKET_RING_SIZE];		// Packet lengths
+	uint8 data[PACKET_RING_SIZE][PACKET_SLOT_SIZE];	// Packet data
+};
+
+static PacketRing *rx_ring = NULL;			// Received packets waiting for MacOS
+static bool rx_irq_pending = false;			// Flag: Ethernet interrupt triggered but not yet serviced
+static bool rx_thread_waiting = false;		// Flag: reception thread waits for interrupt to be serviced
+static int32 rx_coalesce_usecs = 0;			// Max. time to hold back Ethernet interrupt to collect more packets
+const uint32 RX_COALESCE_PACKETS = 32;		// Trigger Ethernet interrupt as soon as this many packets are queued
+#ifndef SHEEPSHAVER
+static struct sockaddr_in rx_from[PACKET_RING_SIZE];	// Senders of packets in rx_ring (UDP tunnel)
+#endif
+
+#ifdef HAVE_SLIRP
+static PacketRing *slirp_input_ring = NULL;	// Packets from MacOS to slirp
+static PacketRing *slirp_output_ring = NULL;	// Packets from slirp to MacOS (rx_ring in slirp mode)
+static bool slirp_output_blocked = false;	// Flag: slirp held back packets because output ring was full
+#endif
+
+static PacketRing *packet_ring_create(bool with_doorbell)
+{
+	PacketRing *r = new PacketRing;
+	r->head = r->tail = 0;
+	r->doorbell[0] = r->doorbell[1] = -1;
+	if (!with_doorbell)
+		return r;
+#ifdef __linux__
+	r->doorbell[0] = r->doorbell[1] = eventfd(0, EFD_NONBLOCK);
+	if (r->doorbell[0] < 0) {
+		delete r;
+		return NULL;
+	}
+#else
+	if (pipe(r->doorbell) < 0) {
+		delete r;
+		return NULL;
+	}
+	fcntl(r->doorbell[0], F_SETFL, O_NONBLOCK);
+	fcntl(r->doorbell[1], F_SETFL, O_NONBLOCK);
+#endif
+	return r;
+}
+
+static void packet_ring_destroy(PacketRing *r)
+{
+	if (r == NULL)
+		return;
+	if (r->doorbell[0] >= 0)
+		close(r->doorbell[0]);
+	if (r->doorbell[1] != r->doorbell[0])
+		close(r->doorbell[1]);
+	delete r;
+}
+
+static inline uint32 packet_ring_count(PacketRing *r)
+{
+	return __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+}
+
+static inline bool packet_ring_full(PacketRing *r)
+{
+	return r->tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) >= PACKET_RING_SIZE;
+}
+
+// Get slot for next packet (producer side), returns NULL if ring is full
+static inline uint8 *packet_ring_put_slot(PacketRing *r)
+{
+	if (packet_ring_full(r))
+		return NULL;
+	return r->data[r->tail & (PACKET_RING_SIZE - 1)];
+}
+
+// Publish packet of given length in slot obtained from packet_ring_put_slot()
+static void packet_ring_put(PacketRing *r, int len)
+{
+	uint32 t = r->tail;
+	r->length[t & (PACKET_RING_SIZE - 1)] = len;
+	__atomic_store_n(&r->tail, t + 1, __ATOMIC_RELEASE);
+	if (r->doorbell[1] < 0)
+		return;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == t) {
+		uint64 one = 1;
+		write(r->doorbell[1], &one, sizeof(one));
+	}
+}
+
+// Get oldest packet (consumer side), returns NULL if ring is empty;
+// the doorbell is cleared before reporting an empty ring
+static uint8 *packet_ring_get_slot(PacketRing *r, int &len)
+{
+	uint32 h = r->head;
+	if (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == h) {
+		if (r->doorbell[0] < 0)
+			return NULL;
+		uint64 buf[8];
+		while (read(r->doorbell[0], buf, sizeof(buf)) > 0) ;
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == h)
+			return NULL;
+	}
+	len = r->length[h & (PACKET_RING_SIZE - 1)];
+	return r->data[h & (PACKET_RING_SIZE - 1)];
+}
+
+// Release slot obtained from packet_ring_get_slot()
+static inline void packet_ring_get(PacketRing *r)
+{
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
 // Prototypes
 static void *receive_func(void *arg);
 static void *slirp_receive_func(void *arg);
@@ -191,6 +324,16 @@ static int read_packet(void);
 
 static bool start_thread(void)
 {
+	// Set up receive ring (slirp puts packets into its output ring directly)
+#ifdef HAVE_SLIRP
+	if (net_if_type == NET_IF_SLIRP)
+		rx_ring = slirp_output_ring;
+	else
+#endif
+	rx_ring = packet_ring_create(false);
+	rx_irq_pending = rx_thread_waiting = false;
+	rx_coalesce_usecs = PrefsFindInt32("ethercoalesce");
+
 	if (sem_init(&int_ack, 0, 0) < 0) {
 		printf("WARNING: Cannot init semaphore");
 		return false;
@@ -231,6 +374,12 @@ static void stop_thread(void)
 		pthread_join(slirp_thread, NULL);
 		slirp_thread_active = false;
 	}
+#ifdef HAVE_SYS_EPOLL_H
+	if (slirp_epoll_fd >= 0) {
+		close(slirp_epoll_fd);
+		slirp_epoll_fd = -1;
+	}
+#endif
 #endif
 
 	if (thread_active) {
@@ -241,6 +390,13 @@ static void stop_thread(void)
 		sem_destroy(&int_ack);
 		thread_active = false;
 	}
+
+	// Free receive ring
+#ifdef HAVE_SLIRP
+	if (rx_ring != slirp_output_ring)
+#endif
+	packet_ring_destroy(rx_ring);
+	rx_ring = NULL;
 }
 
 
@@ -345,16 +501,17 @@ bool ether_init(void)
 			return false;
 		}
 
-		// Open slirp output pipe
-		int fds[2];
-		if (pipe(fds) < 0)
-			return false;
-		fd = fds[0];
-		slirp_output_fd = fds[1];
-
-		// Open slirp input pipe
-		if (pipe(slirp_input_fds) < 0)
+		// Create packet rings between emulator and slirp thread, the
+		// reception thread waits on the doorbell of the output ring
+		slirp_input_ring = packet_ring_create(true);
+		slirp_output_ring = packet_ring_create(true);
+		if (slirp_input_ring == NULL || slirp_output_ring == NULL) {
+			packet_ring_destroy(slirp_input_ring);
+			packet_ring_destroy(slirp_output_ring);
+			slirp_input_ring = slirp_output_ring = NULL;
 			return false;
+		}
+		fd = slirp_output_ring->doorbell[0];
 
 		// Set up port redirects
 		slirp_add_redirs();
@@ -531,22 +688,18 @@ bool ether_init(void)
 open_error:
 	stop_thread();
 
+#ifdef HAVE_SLIRP
+	if (slirp_output_ring) {
+		packet_ring_destroy(slirp_input_ring);
+		packet_ring_destroy(slirp_output_ring);
+		slirp_input_ring = slirp_output_ring = NULL;
+		fd = -1;
+	}
+#endif
 	if (fd > 0) {
 		close(fd);
 		fd = -1;
 	}
-	if (slirp_input_fds[0] >= 0) {
-		close(slirp_input_fds[0]);
-		slirp_input_fds[0] = -1;
-	}
-	if (slirp_input_fds[1] >= 0) {
-		close(slirp_input_fds[1]);
-		slirp_input_fds[1] = -1;
-	}
-	if (slirp_output_fd >= 0) {
-		close(slirp_output_fd);
-		slirp_output_fd = -1;
-	}
 	return false;
 }
 
@@ -568,20 +721,20 @@ void ether_exit(void)
 	if (net_if_name)
 		free(net_if_name);
 
+#ifdef HAVE_SLIRP
+	// Free slirp packet rings (fd is the output ring's doorbell)
+	if (slirp_output_ring) {
+		packet_ring_destroy(slirp_input_ring);
+		packet_ring_destroy(slirp_output_ring);
+		slirp_input_ring = slirp_output_ring = NULL;
+		fd = -1;
+	}
+#endif
+
 	// Close sheep_net device
 	if (fd > 0)
 		close(fd);
 
-	// Close slirp input buffer
-	if (slirp_input_fds[0] >= 0)
-		close(slirp_input_fds[0]);
-	if (slirp_input_fds[1] >= 0)
-		close(slirp_input_fds[1]);
-
-	// Close slirp output buffer
-	if (slirp_output_fd > 0)
-		close(slirp_output_fd);
-
 #ifdef HAVE_LIBVDEPLUG
 	// Close vde_connection
 	if (net_if_type == NET_IF_VDE)
@@ -697,10 +850,7 @@ void EtherIRQ(void)
 	OTEnterInterrupt();
 	ether_do_interrupt();
 	OTLeaveInterrupt();
-
-	// Acknowledge interrupt to reception thread
 	D(bug(" EtherIRQ done\n"));
-	sem_post(&int_ack);
 }
 #else
 // Add multicast address
@@ -763,10 +913,7 @@ void EtherInterrupt(void)
 {
 	D(bug("EtherIRQ\n"));
 	ether_do_interrupt();
-
-	// Acknowledge interrupt to reception thread
 	D(bug(" EtherIRQ done\n"));
-	sem_post(&int_ack);
 }
 #endif
 
@@ -856,6 +1003,17 @@ int16 ether_detach_ph(uint16 type)
 
 static int16 ether_do_write(uint32 arg)
 {
+#ifdef HAVE_SLIRP
+	// Copy packet straight into slirp input ring
+	if (net_if_type == NET_IF_SLIRP) {
+		uint8 *slot = packet_ring_put_slot(slirp_input_ring);
+		if (slot == NULL)
+			return excessCollsns;
+		packet_ring_put(slirp_input_ring, ether_arg_to_buffer(arg, slot));
+		return noErr;
+	}
+#endif
+
 	// Copy packet to buffer
 	uint8 packet[1516], *p = packet;
 	int len = 0;
@@ -877,14 +1035,6 @@ static int16 ether_do_write(uint32 arg)
 #endif
 
 	// Transmit packet
-#ifdef HAVE_SLIRP
-	if (net_if_type == NET_IF_SLIRP) {
-		const int slirp_input_fd = slirp_input_fds[1];
-		write(slirp_input_fd, &len, sizeof(len));
-		write(slirp_input_fd, packet, len);
-		return noErr;
-	} else
-#endif
 #ifdef HAVE_LIBVDEPLUG
 	if (net_if_type == NET_IF_VDE) {
 		if (fd == -1) {	// which means vde service is not running
@@ -957,40 +1107,91 @@ void ether_stop_udp_thread(void)
 #ifdef HAVE_SLIRP
 int slirp_can_output(void)
 {
+	if (packet_ring_full(slirp_output_ring)) {
+		__atomic_store_n(&slirp_output_blocked, true, __ATOMIC_SEQ_CST);
+		return 0;
+	}
 	return 1;
 }
 
 void slirp_output(const uint8 *packet, int len)
 {
-	write(slirp_output_fd, packet, len);
+	uint8 *slot = packet_ring_put_slot(slirp_output_ring);
+	if (slot == NULL || len > PACKET_SLOT_SIZE)
+		return;
+	memcpy(slot, packet, len);
+	packet_ring_put(slirp_output_ring, len);
 }
 
-void *slirp_receive_func(void *arg)
+// Wake up slirp thread if it is waiting for room in the output ring
+static inline void slirp_output_released(void)
 {
-	const int slirp_input_fd = slirp_input_fds[0];
+	if (__atomic_load_n(&slirp_output_blocked, __ATOMIC_SEQ_CST)) {
+		__atomic_store_n(&slirp_output_blocked, false, __ATOMIC_SEQ_CST);
+		uint64 one = 1;
+		write(slirp_input_ring->doorbell[1], &one, sizeof(one));
+	}
+}
 
+#ifdef HAVE_SYS_EPOLL_H
+void *slirp_receive_func(void *arg)
+{
+	// Sockets stay registered with the epoll instance, the input ring's
+	// doorbell is registered with fd -1 so slirp ignores it
+	int epfd = slirp_epoll_fd = epoll_create(64);
+	if (epfd < 0) {
+		printf("WARNING: Cannot create epoll instance for slirp\n");
+		return NULL;
+	}
+	struct epoll_event doorbell_ev;
+	memset(&doorbell_ev, 0, sizeof(doorbell_ev));
+	doorbell_ev.events = EPOLLIN;
+	doorbell_ev.data.fd = -1;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, slirp_input_ring->doorbell[0], &doorbell_ev);
+
+	const int MAX_EVENTS = 64;
+	struct epoll_event events[MAX_EVENTS];
 	for (;;) {
-		// Wait for packets to arrive
-		fd_set rfds, wfds, xfds;
-		int nfds;
-		struct timeval tv;
+		// Process all packets in the input queue
+		int len;
+		uint8 *packet;
+		while ((packet = packet_ring_get_slot(slirp_input_ring, len)) != NULL) {
+			slirp_input(packet, len);
+			packet_ring_get(slirp_input_ring);
+		}
 
-		// ... in the input queue
-		FD_ZERO(&rfds);
-		FD_SET(slirp_input_fd, &rfds);
-		tv.tv_sec = 0;
-		tv.tv_usec = 0;
-		if (select(slirp_input_fd + 1, &rfds, NULL, NULL, &tv) > 0) {
-			int len;
-			read(slirp_input_fd, &len, sizeof(len));
-			uint8 packet[1516];
-			assert(len <= sizeof(packet));
-			read(slirp_input_fd, packet, len);
+		// Wait for socket activity, more packets, or the next TCP/IP timer
+		int timeout = slirp_epoll_fill(epfd);
+#if ! USE_SLIRP_TIMEOUT
+		timeout = 10000;
+#endif
+		int n = epoll_wait(epfd, events, MAX_EVENTS, timeout < 0 ? -1 : (timeout + 999) / 1000);
+		slirp_epoll_poll(events, n > 0 ? n : 0);
+
+#ifdef HAVE_PTHREAD_TESTCANCEL
+		pthread_testcancel();
+#endif
+	}
+	return NULL;
+}
+#else
+void *slirp_receive_func(void *arg)
+{
+	const int doorbell_fd = slirp_input_ring->doorbell[0];
+
+	for (;;) {
+		// Process all packets in the input queue
+		int len;
+		uint8 *packet;
+		while ((packet = packet_ring_get_slot(slirp_input_ring, len)) != NULL) {
 			slirp_input(packet, len);
+			packet_ring_get(slirp_input_ring);
 		}
 
-		// ... in the output queue
-		nfds = -1;
+		// Wait for socket activity or more packets
+		fd_set rfds, wfds, xfds;
+		int nfds = -1;
+		struct timeval tv;
 		FD_ZERO(&rfds);
 		FD_ZERO(&wfds);
 		FD_ZERO(&xfds);
@@ -998,6 +1199,9 @@ void *slirp_receive_func(void *arg)
 #if ! USE_SLIRP_TIMEOUT
 		timeout = 10000;
 #endif
+		FD_SET(doorbell_fd, &rfds);
+		if (doorbell_fd > nfds)
+			nfds = doorbell_fd;
 		tv.tv_sec = 0;
 		tv.tv_usec = timeout;
 		if (select(nfds + 1, &rfds, &wfds, &xfds, &tv) >= 0)
@@ -1011,6 +1215,7 @@ void *slirp_receive_func(void *arg)
 	}
 	return NULL;
 }
+#endif
 #else
 int slirp_can_output(void)
 {
@@ -1027,48 +1232,184 @@ void slirp_output(const uint8 *packet, int len)
  *  Packet reception thread
  */
 
-static void *receive_func(void *arg)
+// Wait until packets can be read from the network device (timeout in usecs,
+// < 0 = infinite), returns > 0 if packets are ready, 0 on timeout or
+// interruption, < 0 on error
+static int wait_for_packets(int timeout)
 {
-	for (;;) {
-
-		// Wait for packets to arrive
 #if USE_POLL
-		struct pollfd pf = {fd, POLLIN, 0};
-		int res = poll(&pf, 1, -1);
+	struct pollfd pf = {fd, POLLIN, 0};
+	int res = poll(&pf, 1, timeout < 0 ? -1 : (timeout + 999) / 1000);
 #else
-		fd_set rfds;
-		FD_ZERO(&rfds);
-		FD_SET(fd, &rfds);
-		// A NULL timeout could cause select() to block indefinitely,
-		// even if it is supposed to be a cancellation point [MacOS X]
-		struct timeval tv = { 0, 20000 };
-		int res = select(fd + 1, &rfds, NULL, NULL, &tv);
+	fd_set rfds;
+	FD_ZERO(&rfds);
+	FD_SET(fd, &rfds);
+	// A NULL timeout could cause select() to block indefinitely,
+	// even if it is supposed to be a cancellation point [MacOS X]
+	struct timeval tv = { 0, 20000 };
+	if (timeout >= 0 && timeout < 20000)
+		tv.tv_usec = timeout;
+	int res = select(fd + 1, &rfds, NULL, NULL, &tv);
 #ifdef HAVE_PTHREAD_TESTCANCEL
-		pthread_testcancel();
+	pthread_testcancel();
 #endif
-		if (res == 0 || (res == -1 && errno == EINTR))
-			continue;
 #endif
-		if (res <= 0)
-			break;
+	if (res == -1 && errno == EINTR)
+		return 0;
+	return res;
+}
+
+// Move packets that are ready on the network device to the receive ring,
+// returns false on a fatal read error
+static bool rx_ring_fill(void)
+{
+#ifdef HAVE_SLIRP
+	if (net_if_type == NET_IF_SLIRP)
+		return true;	// slirp fills the ring itself
+#endif
 
+#if !defined(SHEEPSHAVER) && defined(HAVE_RECVMMSG)
+	if (udp_tunnel) {
+		// Receive as many datagrams as there are free slots in one call
+		struct mmsghdr msgs[RX_COALESCE_PACKETS];
+		struct iovec iov[RX_COALESCE_PACKETS];
+		for (;;) {
+			uint32 tail = rx_ring->tail;
+			int count = PACKET_RING_SIZE - packet_ring_count(rx_ring);
+			if (count > (int)RX_COALESCE_PACKETS)
+				count = RX_COALESCE_PACKETS;
+			if (count == 0)
+				break;
+			for (int i = 0; i < count; i++) {
+				uint32 slot = (tail + i) & (PACKET_RING_SIZE - 1);
+				iov[i].iov_base = rx_ring->data[slot];
+				iov[i].iov_len = 1514;
+				memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+				msgs[i].msg_hdr.msg_name = &rx_from[slot];
+				msgs[i].msg_hdr.msg_namelen = sizeof(rx_from[slot]);
+				msgs[i].msg_hdr.msg_iov = &iov[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+			}
+			int res = recvmmsg(fd, msgs, count, MSG_DONTWAIT, NULL);
+			if (res <= 0)
+				break;
+			for (int i = 0; i < res; i++)
+				packet_ring_put(rx_ring, msgs[i].msg_len);	// Runts are dropped by ether_do_interrupt()
+		}
+		return true;
+	}
+#endif
+
+	uint8 *slot;
+	while ((slot = packet_ring_put_slot(rx_ring)) != NULL) {
+		ssize_t length;
+#ifndef SHEEPSHAVER
+		if (udp_tunnel) {
+			socklen_t from_len = sizeof(struct sockaddr_in);
+			length = recvfrom(fd, slot, 1514, 0, (struct sockaddr *)&rx_from[rx_ring->tail & (PACKET_RING_SIZE - 1)], &from_len);
+		} else
+#endif
 #ifdef ENABLE_MACOSX_ETHERHELPER
 		if (net_if_type == NET_IF_ETHERHELPER) {
-			if (read_packet() < 1) {
+			// Helper pipe is blocking, only read what has arrived
+			if (packet_ring_count(rx_ring) > 0 && wait_for_packets(0) <= 0)
 				break;
-			}
+			length = read_packet();
+			if (length < 1)
+				return false;
+			memcpy(slot, packet_buffer + 2, length);
+		} else
+#endif
+#ifdef HAVE_LIBVDEPLUG
+		if (net_if_type == NET_IF_VDE) {
+			length = vde_recv(vde_conn, slot, 1514, MSG_DONTWAIT);
+		} else
+#endif
+#if defined(__linux__)
+		if (net_if_type == NET_IF_ETHERTAP) {
+			// Linux ethertap has two random bytes before the packet
+			uint8 pad[2];
+			struct iovec iov[2] = {{pad, 2}, {slot, 1514}};
+			length = readv(fd, iov, 2) - 2;
+		} else
+#endif
+		{
+			// Read packet from sheep_net device
+			length = read(fd, slot, 1514);
 		}
+
+		if (length <= 0)
+			break;
+		packet_ring_put(rx_ring, length);
+	}
+	return true;
+}
+
+// Wait until the pending Ethernet interrupt has been serviced
+static void wait_for_interrupt_ack(void)
+{
+	__atomic_store_n(&rx_thread_waiting, true, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&rx_irq_pending, __ATOMIC_SEQ_CST)
+	 || !__atomic_exchange_n(&rx_thread_waiting, false, __ATOMIC_SEQ_CST))
+		sem_wait(&int_ack);
+}
+
+static void *receive_func(void *arg)
+{
+	for (;;) {
+
+		// Wait for packets to arrive
+		int res = wait_for_packets(-1);
+		if (res == 0)
+			continue;
+		if (res < 0)
+			break;
+
+		if (!ether_driver_opened) {
+			Delay_usec(20000);
+			continue;
+		}
+
+		// Queue packets in receive ring. Unless an interrupt is pending
+		// anyway, hold it back for up to rx_coalesce_usecs to collect a
+		// larger batch.
+		if (!rx_ring_fill())
+			break;
+		if (rx_coalesce_usecs > 0 && !__atomic_load_n(&rx_irq_pending, __ATOMIC_SEQ_CST)) {
+			uint64 deadline = GetTicks_usec() + rx_coalesce_usecs;
+			while (packet_ring_count(rx_ring) < RX_COALESCE_PACKETS) {
+				int64 left = deadline - GetTicks_usec();
+				if (left <= 0)
+					break;
+#ifdef HAVE_SLIRP
+				if (net_if_type == NET_IF_SLIRP) {
+					Delay_usec(left);
+					continue;
+				}
 #endif
-		if (ether_driver_opened) {
-			// Trigger Ethernet interrupt
-			D(bug(" packet received, triggering Ethernet interrupt\n"));
+				res = wait_for_packets(left);
+				if (res < 0 || (res > 0 && !rx_ring_fill()))
+					return NULL;
+			}
+		}
+
+		// Trigger Ethernet interrupt unless one is already pending
+		if (!__atomic_exchange_n(&rx_irq_pending, true, __ATOMIC_SEQ_CST)) {
+			D(bug(" packets received, triggering Ethernet interrupt\n"));
 			SetInterruptFlag(INTFLAG_ETHER);
 			TriggerInterrupt();
+		}
 
-			// Wait for interrupt acknowledge by EtherInterrupt()
-			sem_wait(&int_ack);
-		} else
-			Delay_usec(20000);
+		// Wait for interrupt acknowledge by EtherInterrupt() when no more
+		// packets can be queued (with slirp, the doorbell stays set until
+		// the ring has been drained)
+#ifdef HAVE_SLIRP
+		if (net_if_type == NET_IF_SLIRP)
+			wait_for_interrupt_ack();
+		else
+#endif
+		if (packet_ring_full(rx_ring))
+			wait_for_interrupt_ack();
 	}
 	return NULL;
 }
@@ -1080,76 +1421,50 @@ static void *receive_func(void *arg)
 
 void ether_do_interrupt(void)
 {
-	// Call protocol handler for received packets
+	// Packets arriving from now on need another interrupt
+	__atomic_store_n(&rx_irq_pending, false, __ATOMIC_SEQ_CST);
+
+	// Call protocol handler for all queued packets
 	EthernetPacket ether_packet;
 	uint32 packet = ether_packet.addr();
-	ssize_t length;
-	for (;;) {
+	uint8 *slot;
+	int length;
+	while ((slot = packet_ring_get_slot(rx_ring, length)) != NULL) {
 
+		// Copy packet to Mac memory and release slot
+		Host2Mac_memcpy(packet, slot, length);
 #ifndef SHEEPSHAVER
-		if (udp_tunnel) {
-
-			// Read packet from socket
-			struct sockaddr_in from;
-			socklen_t from_len = sizeof(from);
-			length = recvfrom(fd, Mac2HostAddr(packet), 1514, 0, (struct sockaddr *)&from, &from_len);
-			if (length < 14)
-				break;
-			ether_udp_read(packet, length, &from);
-
-		} else
-#endif
-#ifdef ENABLE_MACOSX_ETHERHELPER
-		if (net_if_type == NET_IF_ETHERHELPER) {
-			unsigned short *pkt_len;
-			uint32 p = packet;
-
-			pkt_len = (unsigned short *)packet_buffer;
-			length = *pkt_len;
-			memcpy(Mac2HostAddr(packet), pkt_len + 1, length);
-			ether_dispatch_packet(p, length);
-			break;
-		} else
-#endif
-		{
-#ifdef HAVE_LIBVDEPLUG
-			if (net_if_type == NET_IF_VDE) {
-				length = vde_recv(vde_conn, Mac2HostAddr(packet), 1514, 0);
-			} else
+		struct sockaddr_in from = rx_from[rx_ring->head & (PACKET_RING_SIZE - 1)];
 #endif
-			{
-				// Read packet from sheep_net device
-#if defined(__linux__)
-				length = read(fd, Mac2HostAddr(packet), net_if_type == NET_IF_ETHERTAP ? 1516 : 1514);
-#else
-				length = read(fd, Mac2HostAddr(packet), 1514);
+		packet_ring_get(rx_ring);
+#ifdef HAVE_SLIRP
+		if (net_if_type == NET_IF_SLIRP)
+			slirp_output_released();
 #endif
-			}
 
-			if (length < 14)
-				break;
+		if (length < 14)
+			continue;
 
 #if MONITOR
-			bug("Receiving Ethernet packet:\n");
-			for (int i=0; i<length; i++) {
-				bug("%02x ", ReadMacInt8(packet + i));
-			}
-			bug("\n");
+		bug("Receiving Ethernet packet:\n");
+		for (int i=0; i<length; i++) {
+			bug("%02x ", ReadMacInt8(packet + i));
+		}
+		bug("\n");
 #endif
 
-			// Pointer to packet data (Ethernet header)
-			uint32 p = packet;
-#if defined(__linux__)
-			if (net_if_type == NET_IF_ETHERTAP) {
-				p += 2;			// Linux ethertap has two random bytes before the packet
-				length -= 2;
-			}
+		// Dispatch packet
+#ifndef SHEEPSHAVER
+		if (udp_tunnel)
+			ether_udp_read(packet, length, &from);
+		else
 #endif
-
-			// Dispatch packet
-			ether_dispatch_packet(p, length);
-		}
+			ether_dispatch_packet(packet, length);
 	}
+
+	// Acknowledge interrupt to reception thread if it is waiting for it
+	if (__atomic_exchange_n(&rx_thread_waiting, false, __ATOMIC_SEQ_CST))
+		sem_post(&int_ack);
 }
 
 // Helper function for port forwarding
@@ -0,0 +1,91 @@
+/*
+ *  intflag_unix.cpp - Interrupt flags, Unix specific stuff
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "sysdeps.h"
+#include "main.h"
+
+#include <stdio.h>
+
+
+/*
+ *  Interrupt flags (must be handled atomically!)
+ *
+ *  InterruptFlags itself is defined by main_unix.cpp. For each source, the
+ *  time from raising the interrupt to the handler taking it is recorded
+ *  in a latency histogram.
+ */
+
+#if EMULATED_68K || defined(SHEEPSHAVER)
+const int INTFLAG_SOURCES = 8;
+const int INTFLAG_LATENCY_BUCKETS = 6;
+static const int intflag_latency_limit[INTFLAG_LATENCY_BUCKETS - 1] = { 10, 100, 1000, 10000, 100000 };	// [usec]
+static uint64 intflag_raise_time[INTFLAG_SOURCES];		// Time the pending interrupt was raised, 0 = unknown
+static uint64 intflag_latency[INTFLAG_SOURCES][INTFLAG_LATENCY_BUCKETS];
+
+void SetInterruptFlag(uint32 flag)
+{
+	// The time stamp is only taken by the first of several raises
+	uint64 now = GetTicks_usec();
+	for (int i = 0; i < INTFLAG_SOURCES; i++) {
+		uint64 unknown = 0;
+		if (flag & (1 << i))
+			__atomic_compare_exchange_n(&intflag_raise_time[i], &unknown, now, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	}
+	__atomic_fetch_or(&InterruptFlags, flag, __ATOMIC_SEQ_CST);
+}
+
+void ClearInterruptFlag(uint32 flag)
+{
+	uint32 taken = __atomic_fetch_and(&InterruptFlags, ~flag, __ATOMIC_SEQ_CST) & flag;
+	if (taken == 0)
+		return;
+	uint64 now = GetTicks_usec();
+	for (int i = 0; i < INTFLAG_SOURCES; i++) {
+		if (!(taken & (1 << i)))
+			continue;
+		uint64 raised = __atomic_exchange_n(&intflag_raise_time[i], 0, __ATOMIC_SEQ_CST);
+		if (raised == 0 || raised > now)
+			continue;
+		int bucket = 0;
+		while (bucket < INTFLAG_LATENCY_BUCKETS - 1 && now - raised >= (uint64)intflag_latency_limit[bucket])
+			bucket++;
+		intflag_latency[i][bucket]++;
+	}
+}
+
+
+/*
+ *  Print latency histograms of the sources that raised interrupts
+ */
+
+void intflag_report(void)
+{
+	for (int i = 0; i < INTFLAG_SOURCES; i++) {
+		uint64 taken = 0;
+		for (int j = 0; j < INTFLAG_LATENCY_BUCKETS; j++)
+			taken += intflag_latency[i][j];
+		if (taken == 0)
+			continue;
+		char name[32];
+		sprintf(name, "Interrupt %02x latency", 1 << i);
+		print_latency_histogram(name, intflag_latency_limit, INTFLAG_LATENCY_BUCKETS - 1, intflag_latency[i]);
+	}
+}
+#endif
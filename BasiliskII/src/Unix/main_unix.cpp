@@ -99,6 +99,7 @@ using std::string;
 #include "vm_alloc.h"
 #include "sigsegv.h"
 #include "rpc.h"
+#include "snapshot.h"
 
 #if USE_JIT
 #ifdef UPDATE_UAE
@@ -160,24 +161,9 @@ static pthread_t emul_thread;						// Handle of MacOS emulation thread (main thr
 #endif
 static int use_gui = -1;   							// Override prefs and show gui
 
-static bool xpram_thread_active = false;			// Flag: XPRAM watchdog installed
-static volatile bool xpram_thread_cancel = false;	// Flag: Cancel XPRAM thread
-static pthread_t xpram_thread;						// XPRAM watchdog
-
 static bool tick_thread_active = false;				// Flag: 60Hz thread installed
-static volatile bool tick_thread_cancel = false;	// Flag: Cancel 60Hz thread
-static pthread_t tick_thread;						// 60Hz thread
 static pthread_attr_t tick_thread_attr;				// 60Hz thread attributes
-
-static pthread_mutex_t intflag_lock = PTHREAD_MUTEX_INITIALIZER;	// Mutex to protect InterruptFlags
-#define LOCK_INTFLAGS pthread_mutex_lock(&intflag_lock)
-#define UNLOCK_INTFLAGS pthread_mutex_unlock(&intflag_lock)
-
-#else
-
-#define LOCK_INTFLAGS
-#define UNLOCK_INTFLAGS
-
+bool tick_inhibit;									// Flag: Hold back 60Hz interrupts (MacOS reset)
 #endif
 
 #if !EMULATED_68K
@@ -206,17 +192,28 @@ static struct sigaction sigint_sa;	// sigaction for SIGINT handler
 static void sigint_handler(...);
 #endif
 
+#if HAVE_680X0_SNAPSHOTS
+static const char *snapshot_path = NULL;			// Snapshot file (NULL = snapshots disabled)
+static volatile sig_atomic_t snapshot_requested = 0;	// Flag: save snapshot or take checkpoint
+static volatile sig_atomic_t snapshot_signaled = 0;	// Flag: SIGUSR2 received
+static int32 checkpoint_interval = 0;				// Seconds between checkpoints (0 = checkpoints disabled)
+static struct sigaction snapshot_sa;				// sigaction for SIGUSR2 handler
+static void snapshot_handler(int sig);
+static void save_snapshot(void);
+#endif
+
 #if REAL_ADDRESSING
 static bool lm_area_mapped = false;	// Flag: Low Memory area mmap()ped
 #endif
 
+static uint32 frame_buffer_reserved = 0;	// Size of frame buffer area allocated behind ROM
+
 static rpc_connection_t *gui_connection = NULL;	// RPC connection to the GUI
 static const char *gui_connection_path = NULL;	// GUI connection identifier
 
 
 // Prototypes
-static void *xpram_func(void *arg);
-static void *tick_func(void *arg);
+static void ticks_elapsed(int elapsed);
 static void one_tick(...);
 #if !EMULATED_68K
 static void sigirq_handler(int sig, int code, struct sigcontext *scp);
@@ -250,15 +247,15 @@ char *strdup(const char *s)
  */
 
 // NOTE: VM_MAP_32BIT is only used when compiling a 64-bit JIT on specific platforms
-void *vm_acquire_mac(size_t size)
+void *vm_acquire_mac(size_t size, int options = 0)
 {
-	return vm_acquire(size, VM_MAP_DEFAULT | VM_MAP_32BIT);
+	return vm_acquire(size, VM_MAP_DEFAULT | VM_MAP_32BIT | options);
 }
 
 #if REAL_ADDRESSING
-static int vm_acquire_mac_fixed(void *addr, size_t size)
+static int vm_acquire_mac_fixed(void *addr, size_t size, int options = 0)
 {
-	return vm_acquire_fixed(addr, size, VM_MAP_DEFAULT | VM_MAP_32BIT);
+	return vm_acquire_fixed(addr, size, VM_MAP_DEFAULT | VM_MAP_32BIT | options);
 }
 #endif
 
@@ -412,6 +409,9 @@ static void usage(const char *prg_name)
 		"  --rominfo\n    dump ROM information\n"
 		"  --switch SWITCH_PATH\n    vde_switch address\n", prg_name
 	);
+#if HAVE_680X0_SNAPSHOTS
+	printf("  --compact-snapshot FILE\n    merge checkpoints into snapshot FILE and exit\n");
+#endif
 	LoadPrefs(NULL); // read the prefs file so PrefsPrintUsage() will print the correct default values
 	PrefsPrintUsage();
 	printf("\nBuild Date: %s\n", __DATE__);
@@ -529,6 +529,12 @@ int main(int argc, char **argv)
 			} else {
 				use_gui = false;
 			}
+#if HAVE_680X0_SNAPSHOTS
+		} else if (strcmp(argv[i], "--compact-snapshot") == 0) {
+			if (++i >= argc)
+				usage(argv[0]);
+			exit(CompactSnapshot(argv[i]) ? 0 : 1);
+#endif
 		} else if (strcmp(argv[i], "--gui") == 0 || strcmp(argv[i], "--settings") == 0) {
 			// Alternative commands to enter the GUI
 			use_gui = true;
@@ -682,6 +688,7 @@ int main(int argc, char **argv)
 	
 	// Initialize VM system
 	vm_init();
+	vm_set_huge_pages(PrefsFindBool("hugepages"), PrefsFindBool("prefault"));
 
 #if REAL_ADDRESSING
 	// Flag: RAM and ROM are contigously allocated from address 0
@@ -697,7 +704,7 @@ int main(int argc, char **argv)
 #endif
 
 	// Try to allocate all memory from 0x0000, if it is not known to crash
-	if (can_map_all_memory && (vm_acquire_mac_fixed(0, RAMSize + 0x100000) == 0)) {
+	if (can_map_all_memory && (vm_acquire_mac_fixed(0, RAMSize + 0x100000, VM_MAP_HUGE) == 0)) {
 		D(bug("Could allocate RAM and ROM from 0x0000\n"));
 		memory_mapped_from_zero = true;
 	}
@@ -727,13 +734,24 @@ int main(int argc, char **argv)
 	else
 #endif
 	{
-		uint8 *ram_rom_area = (uint8 *)vm_acquire_mac(RAMSize + 0x100000);
+#if HAVE_680X0_SNAPSHOTS
+		// With snapshots, the frame buffer goes into an area right behind
+		// ROM, so it has the same Mac address on every start
+		snapshot_path = PrefsFindString("snapshot");
+		if (snapshot_path && !vm_has_reserved(VM_RESERVED_SIZE))
+			frame_buffer_reserved = VM_RESERVED_SIZE;
+#endif
+		uint8 *ram_rom_area = (uint8 *)vm_acquire_mac(RAMSize + 0x100000 + frame_buffer_reserved, VM_MAP_HUGE);
 		if (ram_rom_area == VM_MAP_FAILED) {	
 			ErrorAlert(STR_NO_MEM_ERR);
 			QuitEmulator();
 		}
 		RAMBaseHost = ram_rom_area;
 		ROMBaseHost = RAMBaseHost + RAMSize;
+#if HAVE_680X0_SNAPSHOTS
+		if (frame_buffer_reserved && vm_init_reserved(ROMBaseHost + 0x100000) < 0)
+			printf("WARNING: Cannot reserve frame buffer area, snapshots may not be restorable\n");
+#endif
 	}
 
 #if USE_SCRATCHMEM_SUBTERFUGE
@@ -819,6 +837,24 @@ int main(int argc, char **argv)
 		QuitEmulator();
 	D(bug("Initialization complete\n"));
 
+#if HAVE_680X0_SNAPSHOTS
+	// Continue from snapshot, if there is one
+	bool snapshot_restored = snapshot_path && RestoreSnapshot(snapshot_path);
+
+	// Write checkpoints to the log of the snapshot file periodically
+	if (snapshot_path)
+		checkpoint_interval = PrefsFindInt32("checkpoint");
+	if (checkpoint_interval > 0 && !CheckpointInit(snapshot_path, snapshot_restored))
+		checkpoint_interval = 0;
+#endif
+
+	// Share the patched ROM with other instances using the same one (the
+	// video driver and the MacOS still write to it, that only unshares
+	// the pages written to)
+	const char *rom_cache_dir = PrefsFindString("romcachedir");
+	if (rom_cache_dir && vm_share_contents(ROMBaseHost, ROMSize, rom_cache_dir, VM_PAGE_READ | VM_PAGE_WRITE) < 0)
+		printf("WARNING: Cannot share ROM through %s\n", rom_cache_dir);
+
 	D(bug("Mac RAM starts at %p (%08x)\n", RAMBaseHost, RAMBaseMac));
 	D(bug("Mac ROM starts at %p (%08x)\n", ROMBaseHost, ROMBaseMac));
 
@@ -881,12 +917,23 @@ int main(int argc, char **argv)
 	sigaction(SIGINT, &sigint_sa, NULL);
 #endif
 
+#if HAVE_680X0_SNAPSHOTS
+	// Setup SIGUSR2 handler to save snapshots
+	if (snapshot_path) {
+		sigemptyset(&snapshot_sa.sa_mask);
+		snapshot_sa.sa_handler = snapshot_handler;
+		snapshot_sa.sa_flags = SA_RESTART;
+		sigaction(SIGUSR2, &snapshot_sa, NULL);
+	}
+#endif
+
 #ifndef USE_CPU_EMUL_SERVICES
 #if defined(HAVE_PTHREADS)
 
-	// POSIX threads available, start 60Hz thread
+	// POSIX threads available, start 60Hz thread (it also takes care of the XPRAM watchdog)
+	memcpy(last_xpram, XPRAM, XPRAM_SIZE);
 	Set_pthread_attr(&tick_thread_attr, 0);
-	tick_thread_active = (pthread_create(&tick_thread, &tick_thread_attr, tick_func, NULL) == 0);
+	tick_thread_active = tick_source_start(ticks_elapsed, &tick_inhibit, &tick_thread_attr);
 	if (!tick_thread_active) {
 		sprintf(str, GetString(STR_TICK_THREAD_ERR), strerror(errno));
 		ErrorAlert(str);
@@ -947,11 +994,13 @@ int main(int argc, char **argv)
 #endif
 #endif
 
-#ifdef USE_PTHREADS_SERVICES
-	// Start XPRAM watchdog thread
-	memcpy(last_xpram, XPRAM, XPRAM_SIZE);
-	xpram_thread_active = (pthread_create(&xpram_thread, NULL, xpram_func, NULL) == 0);
-	D(bug("XPRAM thread started\n"));
+#if HAVE_680X0_SNAPSHOTS
+	// Resume 68k at the point the snapshot was taken
+	if (snapshot_restored) {
+		D(bug("Resuming emulation...\n"));
+		Resume680x0();
+		QuitEmulator();
+	}
 #endif
 
 	// Start 68k and jump to ROM boot routine
@@ -985,11 +1034,9 @@ void QuitEmulator(void)
 #elif defined(USE_PTHREADS_SERVICES)
 	// Stop 60Hz thread
 	if (tick_thread_active) {
-		tick_thread_cancel = true;
-#ifdef HAVE_PTHREAD_CANCEL
-		pthread_cancel(tick_thread);
-#endif
-		pthread_join(tick_thread, NULL);
+		tick_source_stop();
+		if (PrefsFindBool("timingstats"))
+			tick_report();
 	}
 #elif defined(HAVE_TIMER_CREATE) && defined(_POSIX_REALTIME_SIGNALS)
 	// Stop 60Hz timer
@@ -1000,16 +1047,17 @@ void QuitEmulator(void)
 	req.it_interval.tv_usec = req.it_value.tv_usec = 0;
 	setitimer(ITIMER_REAL, &req, NULL);
 #endif
-
-#ifdef USE_PTHREADS_SERVICES
-	// Stop XPRAM watchdog thread
-	if (xpram_thread_active) {
-		xpram_thread_cancel = true;
-#ifdef HAVE_PTHREAD_CANCEL
-		pthread_cancel(xpram_thread);
+	if (PrefsFindBool("timingstats")) {
+		idle_report();
+#if EMULATED_68K
+		intflag_report();
 #endif
-		pthread_join(xpram_thread, NULL);
 	}
+
+#if HAVE_680X0_SNAPSHOTS
+	// Wait for the last checkpoint to be written
+	if (checkpoint_interval > 0)
+		CheckpointExit();
 #endif
 
 	// Deinitialize everything
@@ -1017,7 +1065,11 @@ void QuitEmulator(void)
 
 	// Free ROM/RAM areas
 	if (RAMBaseHost != VM_MAP_FAILED) {
-		vm_release(RAMBaseHost, RAMSize + 0x100000);
+#if DEBUG
+		size_t huge_bytes, page_size = vm_get_mapping_page_size(RAMBaseHost, &huge_bytes);
+		bug("RAM area used %d KB pages, %d KB in transparent huge pages\n", (int)(page_size / 1024), (int)(huge_bytes / 1024));
+#endif
+		vm_release(RAMBaseHost, RAMSize + 0x100000 + frame_buffer_reserved);
 		RAMBaseHost = NULL;
 		ROMBaseHost = NULL;
 	}
@@ -1107,6 +1159,30 @@ static void sigint_handler(...)
 #endif
 
 
+/*
+ *  SIGUSR2 handler, requests a snapshot (saved from the 68k emulation on
+ *  the next tick)
+ */
+
+#if HAVE_680X0_SNAPSHOTS
+static void snapshot_handler(int sig)
+{
+	snapshot_signaled = 1;
+	snapshot_requested = 1;
+}
+
+static void save_snapshot(void)
+{
+	bool signaled = snapshot_signaled;
+	snapshot_signaled = 0;
+	if (checkpoint_interval > 0)
+		CheckpointSave(signaled);
+	else
+		SaveSnapshot(snapshot_path);
+}
+#endif
+
+
 #ifdef HAVE_PTHREADS
 /*
  *  Pthread configuration
@@ -1220,27 +1296,11 @@ void B2_delete_mutex(B2_mutex *mutex)
 
 
 /*
- *  Interrupt flags (must be handled atomically!)
+ *  Interrupt flags (must be handled atomically!), see intflag_unix.cpp
  */
 
 uint32 InterruptFlags = 0;
 
-#if EMULATED_68K
-void SetInterruptFlag(uint32 flag)
-{
-	LOCK_INTFLAGS;
-	InterruptFlags |= flag;
-	UNLOCK_INTFLAGS;
-}
-
-void ClearInterruptFlag(uint32 flag)
-{
-	LOCK_INTFLAGS;
-	InterruptFlags &= ~flag;
-	UNLOCK_INTFLAGS;
-}
-#endif
-
 #if !EMULATED_68K
 void TriggerInterrupt(void)
 {
@@ -1270,18 +1330,6 @@ static void xpram_watchdog(void)
 	}
 }
 
-#ifdef USE_PTHREADS_SERVICES
-static void *xpram_func(void *arg)
-{
-	while (!xpram_thread_cancel) {
-		for (int i=0; i<60 && !xpram_thread_cancel; i++)
-			Delay_usec(999999);		// Only wait 1 second so we quit promptly when xpram_thread_cancel becomes true
-		xpram_watchdog();
-	}
-	return NULL;
-}
-#endif
-
 
 /*
  *  60Hz thread (really 60.15Hz)
@@ -1295,21 +1343,31 @@ static void one_second(void)
 	SetInterruptFlag(INTFLAG_1HZ);
 	TriggerInterrupt();
 
-#ifndef USE_PTHREADS_SERVICES
 	static int second_counter = 0;
 	if (++second_counter > 60) {
 		second_counter = 0;
 		xpram_watchdog();
 	}
-#endif
 }
 
-static void one_tick(...)
+// All periodic work is done from one wakeup; elapsed > 1 after the tick
+// source skipped, held back or batched ticks (while the emulator is idle).
+// MacOS gets one interrupt for them, the others are added to Ticks.
+static void ticks_elapsed(int elapsed)
 {
 	static int tick_counter = 0;
-	if (++tick_counter > 60) {
-		tick_counter = 0;
+	tick_counter += elapsed;
+	while (tick_counter >= 60) {
+		tick_counter -= 60;
 		one_second();
+
+#if HAVE_680X0_SNAPSHOTS
+		static int32 checkpoint_counter = 0;
+		if (checkpoint_interval > 0 && ++checkpoint_counter >= checkpoint_interval) {
+			checkpoint_counter = 0;
+			snapshot_requested = 1;
+		}
+#endif
 	}
 
 #ifndef USE_PTHREADS_SERVICES
@@ -1322,38 +1380,26 @@ static void one_tick(...)
 	SetInterruptFlag(INTFLAG_ETHER);
 #endif
 
+#if HAVE_680X0_SNAPSHOTS
+	// Save snapshot when the 68k emulation reaches the next instruction boundary
+	if (snapshot_requested) {
+		snapshot_requested = 0;
+		Checkpoint680x0(save_snapshot);
+	}
+#endif
+
 	// Trigger 60Hz interrupt
 	if (ROMVersion != ROM_VERSION_CLASSIC || HasMacStarted()) {
+		ExtraTicks += elapsed - 1;
 		SetInterruptFlag(INTFLAG_60HZ);
 		TriggerInterrupt();
 	}
 }
 
-#ifdef USE_PTHREADS_SERVICES
-bool tick_inhibit;
-static void *tick_func(void *arg)
+static void one_tick(...)
 {
-	uint64 start = GetTicks_usec();
-	int64 ticks = 0;
-	uint64 next = start;
-	while (!tick_thread_cancel) {
-		if (!tick_inhibit)
-			one_tick();
-		next += 16625;
-		int64 delay = next - GetTicks_usec();
-		if (delay > 0)
-			Delay_usec(delay);
-		else if (delay < -16625)
-			next = GetTicks_usec();
-		ticks++;
-	}
-#if DEBUG
-	uint64 end = GetTicks_usec();
-	D(bug("%lld ticks in %lld usec = %f ticks/sec\n", ticks, end - start, ticks * 1000000.0 / (end - start)));
-#endif
-	return NULL;
+	ticks_elapsed(1);
 }
-#endif
 
 
 #if !EMULATED_68K
@@ -37,10 +37,20 @@ prefs_desc platform_prefs_items[] = {
 	{"mousewheellines", TYPE_INT32, false, "number of lines to scroll in mouse wheel mode 1"},
 #else
 	{"fbdevicefile", TYPE_STRING, false,   "path of frame buffer device specification file"},
+	{"snapshot", TYPE_STRING, false,       "file to save the emulator state to on SIGUSR2 and restore it from"},
+	{"checkpoint", TYPE_INT32, false,      "seconds between incremental checkpoints to the snapshot file (0 = off)"},
 #endif
+	{"ethercoalesce", TYPE_INT32, false,   "max. microseconds to delay Ethernet receive interrupts"},
 	{"dsp", TYPE_STRING, false,            "audio output (dsp) device name"},
 	{"mixer", TYPE_STRING, false,          "audio mixer device name"},
 	{"idlewait", TYPE_BOOLEAN, false,      "sleep when idle"},
+	{"diskoverlaydir", TYPE_STRING, false, "directory for copy-on-write overlays of disk image files"},
+	{"diskmmap", TYPE_BOOLEAN, false,      "read disk and CD-ROM image files through memory mappings"},
+	{"cdreadahead", TYPE_BOOLEAN, false,   "read CD audio of BIN/CUE images ahead in a separate thread"},
+	{"hugepages", TYPE_BOOLEAN, false,     "back Mac RAM and JIT translation cache with large pages"},
+	{"prefault", TYPE_BOOLEAN, false,      "fault in Mac RAM on the local NUMA node at startup"},
+	{"romcachedir", TYPE_STRING, false,    "directory for patched ROM images shared between instances"},
+	{"timingstats", TYPE_BOOLEAN, false,   "print timing statistics on quit"},
 #ifdef USE_SDL_VIDEO
 	{"sdlrender", TYPE_STRING, false,      "SDL_Renderer driver (\"auto\", \"software\" (may be faster), etc.)"},
 #endif
@@ -338,6 +348,7 @@ void SavePrefs(void)
 void AddPlatformPrefsDefaults(void)
 {
 	PrefsAddBool("keycodes", false);
+	PrefsAddBool("hugepages", true);
 	PrefsReplaceString("extfs", "/");
 	PrefsReplaceInt32("mousewheelmode", 1);
 	PrefsReplaceInt32("mousewheellines", 3);
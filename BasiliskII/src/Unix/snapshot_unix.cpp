@@ -0,0 +1,1282 @@
+/*
+ *  snapshot_unix.cpp - Emulator state snapshots, Unix implementation
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Snapshot file layout (all numbers big-endian):
+ *
+ *    0  header: magic, version, machine fingerprint (RAM and ROM size,
+ *       ROM checksum, CPU and FPU type), size of the state area, offset
+ *       of the RAM image, random ID of the snapshot
+ *    SNAP_HEADER_SIZE  state area: one section per component, each a
+ *       tag, a length and the data written by the component
+ *    ram_offset  RAM image, aligned to SNAP_RAM_ALIGN. Pages that are all
+ *       zeroes are not written, so they are holes in a sparse file.
+ *
+ *  The RAM image is mapped copy-on-write on restore, so restoring only
+ *  costs as many page faults as the Mac touches pages. It is not
+ *  compressed for that reason. New snapshots are written to a temporary
+ *  file which is then renamed, so a running instance that has mapped the
+ *  previous snapshot keeps seeing its contents.
+ *
+ *  Checkpoint log layout (name of the snapshot file with ".log" appended):
+ *
+ *    0  header: magic, version, page size, ID of the snapshot the log
+ *       belongs to
+ *    LOG_HEADER_SIZE  one record per checkpoint: tag, sequence number,
+ *       size of the state area, number of pages, state area, page numbers,
+ *       page contents, end tag and Adler-32 checksum of the record.
+ *       Sections of the state area that didn't change since the previous
+ *       checkpoint have the length SECTION_UNCHANGED and no data.
+ *
+ *  On restore, the records are applied to the snapshot in order, up to the
+ *  first one that is incomplete, damaged or out of sequence.
+ *
+ *  Only one instance at a time may write checkpoints of a snapshot. As the
+ *  snapshot and the log are replaced with rename(), it holds an flock() on
+ *  a lock file next to them instead (the name of the snapshot file with
+ *  ".lock" appended).
+ */
+
+#include "sysdeps.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "cpu_emulation.h"
+#include "main.h"
+#include "macos_util.h"
+#include "xpram.h"
+#include "timer.h"
+#include "sony.h"
+#include "disk.h"
+#include "cdrom.h"
+#include "extfs.h"
+#include "serial.h"
+#include "ether.h"
+#include "audio.h"
+#include "adb.h"
+#include "video.h"
+#include "vm_alloc.h"
+#include "snapshot.h"
+
+#define DEBUG 0
+#include "debug.h"
+
+#if HAVE_680X0_SNAPSHOTS
+
+static const char SNAP_MAGIC[8] = {'B', '2', 'S', 'N', 'A', 'P', 'S', 'H'};
+const uint32 SNAP_VERSION = 3;
+const uint32 SNAP_HEADER_SIZE = 256;
+const uint32 SNAP_RAM_ALIGN = 65536;	// Allows mmap() with up to 64K pages
+const uint32 SNAP_FINGERPRINT_SIZE = 22;
+
+static const char LOG_MAGIC[8] = {'B', '2', 'C', 'K', 'P', 'L', 'O', 'G'};
+const uint32 LOG_VERSION = 1;
+const uint32 LOG_HEADER_SIZE = 32;
+const uint32 LOG_RECORD = FOURCC('C','K','P','T');
+const uint32 LOG_RECORD_END = FOURCC('E','N','D',' ');
+const uint32 LOG_RECORD_HEADER_SIZE = 16;
+const uint32 LOG_RECORD_TRAILER_SIZE = 8;
+
+const uint32 SECTION_UNCHANGED = 0xffffffff;
+
+// Section tags, in file order
+enum {
+	SNAP_CPU = FOURCC('C','P','U',' '),
+	SNAP_ROM = FOURCC('R','O','M',' '),
+	SNAP_XPRAM = FOURCC('X','P','R','M'),
+	SNAP_TIMER = FOURCC('T','I','M','E'),
+	SNAP_SONY = FOURCC('S','O','N','Y'),
+	SNAP_DISK = FOURCC('D','I','S','K'),
+	SNAP_CDROM = FOURCC('C','D','R','M'),
+	SNAP_EXTFS = FOURCC('E','X','F','S'),
+	SNAP_ETHER = FOURCC('E','T','H','R'),
+	SNAP_AUDIO = FOURCC('A','U','D','I'),
+	SNAP_ADB = FOURCC('A','D','B',' '),
+	SNAP_VIDEO = FOURCC('V','I','D','E')
+};
+
+// Snapshot file header
+struct snapshot_header {
+	uint8 fingerprint[SNAP_FINGERPRINT_SIZE];
+	uint32 state_size;
+	uint64 ram_offset;
+	uint64 id;			// Identifies the checkpoint log belonging to the snapshot
+
+	// RAM size is the first value of the fingerprint
+	uint32 ram_size(void) const {return (fingerprint[0] << 24) | (fingerprint[1] << 16) | (fingerprint[2] << 8) | fingerprint[3];}
+};
+
+// Log position after restoring a snapshot, so checkpoints can be appended
+static uint64 restored_id;
+static loff_t restored_log_end = 0;		// 0 = no valid log
+static uint32 restored_log_seq;
+static snapshot_data restored_state;
+static std::vector<uint32> restored_log_pages;	// RAM pages changed by the log
+static uint32 restored_log_page_size;
+
+
+/*
+ *  Machine fingerprint, the snapshot can only be restored on an identically
+ *  configured emulator
+ */
+
+static void put_fingerprint(snapshot_data &s)
+{
+	s.put32(RAMSize);
+	s.put32(ROMSize);
+	s.put32(ReadMacInt32(ROMBaseMac));	// ROM checksum
+	s.put32(CPUType);
+	s.put8(CPUIs68060);
+	s.put32(FPUType);
+	s.put8(TwentyFourBitAddressing);
+}
+
+static void get_fingerprint(uint8 *p)
+{
+	snapshot_data s;
+	put_fingerprint(s);
+	assert(s.size() == SNAP_FINGERPRINT_SIZE);
+	memcpy(p, s.bytes(), SNAP_FINGERPRINT_SIZE);
+}
+
+static uint64 new_snapshot_id(void)
+{
+	return ((uint64)time(NULL) << 32) ^ ((uint64)getpid() << 16) ^ GetTicks_usec();
+}
+
+
+/*
+ *  Sections of the state area
+ */
+
+static void put_section(snapshot_data &state, uint32 tag, const snapshot_data &s)
+{
+	state.put32(tag);
+	state.put32(s.size());
+	state.put_bytes(s.bytes(), s.size());
+}
+
+static snapshot_data get_section(snapshot_data &state, uint32 tag)
+{
+	uint32 saved_tag = state.get32();
+	uint32 size = state.get32();
+	if (saved_tag != tag || size > state.remaining()) {
+		D(bug("Section %c%c%c%c missing\n", tag >> 24, tag >> 16, tag >> 8, tag));
+		snapshot_data s;
+		s.fail();
+		return s;
+	}
+	std::vector<uint8> data(size);
+	state.get_bytes(size ? &data[0] : NULL, size);
+	return snapshot_data(size ? &data[0] : NULL, size);
+}
+
+// State area split into its sections, for comparing checkpoints
+struct state_section {
+	uint32 tag;
+	bool unchanged;
+	std::vector<uint8> data;
+};
+typedef std::vector<state_section> state_sections;
+
+static bool split_state(snapshot_data state, state_sections &sections)
+{
+	sections.clear();
+	while (state.ok() && !state.at_end()) {
+		state_section section;
+		section.tag = state.get32();
+		uint32 size = state.get32();
+		section.unchanged = (size == SECTION_UNCHANGED);
+		if (section.unchanged)
+			size = 0;
+		if (size > state.remaining())
+			return false;
+		section.data.resize(size);
+		state.get_bytes(size ? &section.data[0] : NULL, size);
+		sections.push_back(section);
+	}
+	return state.ok();
+}
+
+static snapshot_data join_state(const state_sections &sections)
+{
+	snapshot_data state;
+	for (state_sections::const_iterator i = sections.begin(); i != sections.end(); ++i) {
+		state.put32(i->tag);
+		state.put32(i->unchanged ? SECTION_UNCHANGED : i->data.size());
+		if (!i->unchanged && !i->data.empty())
+			state.put_bytes(&i->data[0], i->data.size());
+	}
+	return state;
+}
+
+// Mark sections that are the same as in the previous state as unchanged
+static snapshot_data diff_state(const snapshot_data &state, const snapshot_data &prev)
+{
+	state_sections sections, prev_sections;
+	split_state(state, sections);
+	if (split_state(prev, prev_sections) && prev_sections.size() == sections.size()) {
+		for (size_t i = 0; i < sections.size(); i++)
+			if (sections[i].tag == prev_sections[i].tag && sections[i].data == prev_sections[i].data) {
+				sections[i].unchanged = true;
+				sections[i].data.clear();
+			}
+	}
+	return join_state(sections);
+}
+
+// Fill in unchanged sections from the previous state
+static bool merge_state(state_sections &sections, const state_sections &prev)
+{
+	if (sections.size() != prev.size())
+		return false;
+	for (size_t i = 0; i < sections.size(); i++) {
+		if (sections[i].tag != prev[i].tag)
+			return false;
+		if (sections[i].unchanged) {
+			sections[i].unchanged = false;
+			sections[i].data = prev[i].data;
+		}
+	}
+	return true;
+}
+
+
+/*
+ *  Save state of all components, returns NULL or the reason why the state
+ *  can't be saved
+ */
+
+static const char *save_state(snapshot_data &state)
+{
+	// Host resources the Mac is using can't be saved
+	for (int i = 0; i < 2; i++)
+		if (the_serd_port[i] && the_serd_port[i]->is_open)
+			return "a serial port is open";
+
+	snapshot_data s;
+	Save680x0State(s);
+	put_section(state, SNAP_CPU, s);
+	s = snapshot_data();
+	s.put_bytes(ROMBaseHost, ROMSize);
+	put_section(state, SNAP_ROM, s);
+	s = snapshot_data();
+	s.put_bytes(XPRAM, XPRAM_SIZE);
+	put_section(state, SNAP_XPRAM, s);
+	s = snapshot_data();
+	TimerSaveState(s);
+	put_section(state, SNAP_TIMER, s);
+	s = snapshot_data();
+	SonySaveState(s);
+	put_section(state, SNAP_SONY, s);
+	s = snapshot_data();
+	DiskSaveState(s);
+	put_section(state, SNAP_DISK, s);
+	s = snapshot_data();
+	CDROMSaveState(s);
+	put_section(state, SNAP_CDROM, s);
+	s = snapshot_data();
+	if (!ExtFSSaveState(s))
+		return "files on the host file system are open";
+	put_section(state, SNAP_EXTFS, s);
+	s = snapshot_data();
+	EtherSaveState(s);
+	put_section(state, SNAP_ETHER, s);
+	s = snapshot_data();
+	AudioSaveState(s);
+	put_section(state, SNAP_AUDIO, s);
+	s = snapshot_data();
+	ADBSaveState(s);
+	put_section(state, SNAP_ADB, s);
+	s = snapshot_data();
+	VideoSaveState(s);
+	put_section(state, SNAP_VIDEO, s);
+	return NULL;
+}
+
+
+/*
+ *  Restore state of all components
+ */
+
+static bool restore_state(snapshot_data &state)
+{
+	snapshot_data s = get_section(state, SNAP_CPU);
+	if (!Restore680x0State(s))
+		return false;
+	s = get_section(state, SNAP_ROM);
+	if (!s.get_bytes(ROMBaseHost, ROMSize))
+		return false;
+	s = get_section(state, SNAP_XPRAM);
+	if (!s.get_bytes(XPRAM, XPRAM_SIZE))
+		return false;
+	s = get_section(state, SNAP_TIMER);
+	if (!TimerRestoreState(s))
+		return false;
+	s = get_section(state, SNAP_SONY);
+	if (!SonyRestoreState(s))
+		return false;
+	s = get_section(state, SNAP_DISK);
+	if (!DiskRestoreState(s))
+		return false;
+	s = get_section(state, SNAP_CDROM);
+	if (!CDROMRestoreState(s))
+		return false;
+	s = get_section(state, SNAP_EXTFS);
+	if (!ExtFSRestoreState(s))
+		return false;
+	s = get_section(state, SNAP_ETHER);
+	if (!EtherRestoreState(s))
+		return false;
+	s = get_section(state, SNAP_AUDIO);
+	if (!AudioRestoreState(s))
+		return false;
+	s = get_section(state, SNAP_ADB);
+	if (!ADBRestoreState(s))
+		return false;
+	s = get_section(state, SNAP_VIDEO);
+	return VideoRestoreState(s);
+}
+
+
+/*
+ *  File I/O helpers
+ */
+
+static bool write_fully(int fd, const uint8 *p, size_t size, loff_t offset)
+{
+	while (size) {
+		ssize_t actual = pwrite(fd, p, size, offset);
+		if (actual < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p += actual;
+		size -= actual;
+		offset += actual;
+	}
+	return true;
+}
+
+static bool read_fully(int fd, void *p, size_t size, loff_t offset)
+{
+	uint8 *q = (uint8 *)p;
+	while (size) {
+		ssize_t actual = pread(fd, q, size, offset);
+		if (actual < 0 && errno == EINTR)
+			continue;
+		if (actual <= 0)
+			return false;
+		q += actual;
+		size -= actual;
+		offset += actual;
+	}
+	return true;
+}
+
+static inline bool is_zero_page(const uint8 *p, size_t size)
+{
+	return p[0] == 0 && memcmp(p, p + 1, size - 1) == 0;
+}
+
+static uint32 adler32(uint32 adler, const uint8 *p, size_t size)
+{
+	uint32 a = adler & 0xffff, b = adler >> 16;
+	while (size) {
+		size_t n = size < 5552 ? size : 5552;	// Largest n for which b can't overflow
+		size -= n;
+		while (n--) {
+			a += *p++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+
+/*
+ *  Write snapshot file, skipping RAM pages that are all zeroes
+ */
+
+static bool write_ram(int fd, loff_t offset, const uint8 *ram, uint32 ram_size, uint32 &written)
+{
+	const uint32 page_size = getpagesize();
+	written = 0;
+	uint32 run_start = 0, run_size = 0;
+	for (uint32 page = 0; page < ram_size; page += page_size) {
+		if (!is_zero_page(ram + page, page_size)) {
+			if (run_size == 0)
+				run_start = page;
+			run_size += page_size;
+			continue;
+		}
+		if (run_size && !write_fully(fd, ram + run_start, run_size, offset + run_start))
+			return false;
+		written += run_size;
+		run_size = 0;
+	}
+	if (run_size && !write_fully(fd, ram + run_start, run_size, offset + run_start))
+		return false;
+	written += run_size;
+
+	// Zero pages at the end must still be part of the file
+	return ftruncate(fd, offset + ram_size) == 0;
+}
+
+static bool write_snapshot(const char *path, snapshot_header &h, const snapshot_data &state, const uint8 *ram, uint32 &ram_written)
+{
+	h.state_size = state.size();
+	h.ram_offset = (SNAP_HEADER_SIZE + state.size() + SNAP_RAM_ALIGN - 1) & ~(uint64)(SNAP_RAM_ALIGN - 1);
+	snapshot_data header;
+	header.put_bytes(SNAP_MAGIC, sizeof(SNAP_MAGIC));
+	header.put32(SNAP_VERSION);
+	header.put_bytes(h.fingerprint, SNAP_FINGERPRINT_SIZE);
+	header.put32(h.state_size);
+	header.put64(h.ram_offset);
+	header.put64(h.id);
+	std::vector<uint8> header_page(SNAP_HEADER_SIZE);
+	memcpy(&header_page[0], header.bytes(), header.size());
+
+	// Write to temporary file and replace the old snapshot with it
+	std::string tmp_path = std::string(path) + ".tmp";
+	int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		printf("WARNING: Cannot create snapshot file %s (%s)\n", tmp_path.c_str(), strerror(errno));
+		return false;
+	}
+	bool ok = write_fully(fd, &header_page[0], SNAP_HEADER_SIZE, 0)
+	       && write_fully(fd, state.bytes(), state.size(), SNAP_HEADER_SIZE)
+	       && write_ram(fd, h.ram_offset, ram, h.ram_size(), ram_written);
+	if (close(fd) < 0)
+		ok = false;
+	if (ok && rename(tmp_path.c_str(), path) < 0)
+		ok = false;
+	if (!ok) {
+		printf("WARNING: Cannot write snapshot file %s (%s)\n", path, strerror(errno));
+		unlink(tmp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+
+/*
+ *  Read and check snapshot file header
+ */
+
+static bool read_header(int fd, const char *path, snapshot_header &h)
+{
+	uint8 header_page[SNAP_HEADER_SIZE];
+	char magic[sizeof(SNAP_MAGIC)];
+	snapshot_data header;
+	if (read_fully(fd, header_page, SNAP_HEADER_SIZE, 0)) {
+		header = snapshot_data(header_page, SNAP_HEADER_SIZE);
+		header.get_bytes(magic, sizeof(magic));
+	}
+	if (header.size() == 0 || memcmp(magic, SNAP_MAGIC, sizeof(SNAP_MAGIC)) != 0 || header.get32() != SNAP_VERSION) {
+		printf("WARNING: %s is not a snapshot file, ignored\n", path);
+		return false;
+	}
+	header.get_bytes(h.fingerprint, SNAP_FINGERPRINT_SIZE);
+	h.state_size = header.get32();
+	h.ram_offset = header.get64();
+	h.id = header.get64();
+	struct stat st;
+	if (!header.ok() || h.ram_offset % SNAP_RAM_ALIGN || h.ram_offset < SNAP_HEADER_SIZE + (uint64)h.state_size
+	 || fstat(fd, &st) < 0 || (uint64)st.st_size < h.ram_offset + h.ram_size()) {
+		printf("WARNING: Snapshot %s is damaged, ignored\n", path);
+		return false;
+	}
+	return true;
+}
+
+
+/*
+ *  Checkpoint log
+ */
+
+static std::string log_path(const char *path)
+{
+	return std::string(path) + ".log";
+}
+
+// Lock the snapshot against writes by other instances, returns the file
+// descriptor of the lock file or -1 (errno is EWOULDBLOCK if another
+// instance holds the lock)
+static int lock_snapshot(const char *path)
+{
+	std::string path_str = std::string(path) + ".lock";
+	int fd = open(path_str.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return -1;
+	if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+		int saved_errno = errno;
+		close(fd);
+		errno = saved_errno;
+		return -1;
+	}
+	return fd;
+}
+
+static void print_lock_warning(const char *path, const char *what)
+{
+	if (errno == EWOULDBLOCK)
+		printf("WARNING: Snapshot %s is used by another instance, %s\n", path, what);
+	else
+		printf("WARNING: Cannot lock snapshot %s (%s), %s\n", path, strerror(errno), what);
+}
+
+// Create empty log for the snapshot with the given ID, returns file descriptor
+static int create_log(const char *path, uint64 id)
+{
+	snapshot_data header;
+	header.put_bytes(LOG_MAGIC, sizeof(LOG_MAGIC));
+	header.put32(LOG_VERSION);
+	header.put32(getpagesize());
+	header.put64(id);
+	std::vector<uint8> header_page(LOG_HEADER_SIZE);
+	memcpy(&header_page[0], header.bytes(), header.size());
+
+	std::string path_str = log_path(path), tmp_path = path_str + ".tmp";
+	int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		return -1;
+	if (!write_fully(fd, &header_page[0], LOG_HEADER_SIZE, 0) || rename(tmp_path.c_str(), path_str.c_str()) < 0) {
+		close(fd);
+		unlink(tmp_path.c_str());
+		return -1;
+	}
+	return fd;
+}
+
+// Apply the records of the log of the snapshot with the given ID to the RAM
+// image and state area, returns the number of records. end is set to the
+// offset behind the last valid record, or 0 if there is no valid log. If
+// changed is given, it receives the numbers of the pages the log changed.
+static int replay_log(const char *path, uint64 id, uint8 *ram, uint32 ram_size, snapshot_data &state, loff_t &end, uint32 &seq,
+                      std::vector<uint32> *changed = NULL, uint32 *changed_page_size = NULL)
+{
+	end = 0;
+	seq = 0;
+	if (changed)
+		changed->clear();
+	std::string path_str = log_path(path);
+	int fd = open(path_str.c_str(), O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	// Check header
+	uint8 header_page[LOG_HEADER_SIZE];
+	char magic[sizeof(LOG_MAGIC)];
+	snapshot_data header;
+	if (read_fully(fd, header_page, LOG_HEADER_SIZE, 0)) {
+		header = snapshot_data(header_page, LOG_HEADER_SIZE);
+		header.get_bytes(magic, sizeof(magic));
+	}
+	uint32 version = header.get32();
+	uint32 page_size = header.get32();
+	uint64 log_id = header.get64();
+	struct stat st;
+	if (header.size() == 0 || memcmp(magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0 || version != LOG_VERSION
+	 || page_size == 0 || ram_size % page_size || fstat(fd, &st) < 0) {
+		printf("WARNING: %s is not a checkpoint log, ignored\n", path_str.c_str());
+		close(fd);
+		return 0;
+	}
+	if (log_id != id) {
+		D(bug("Checkpoint log %s belongs to an older snapshot, ignored\n", path_str.c_str()));
+		close(fd);
+		return 0;
+	}
+	end = LOG_HEADER_SIZE;
+
+	state_sections current;
+	if (!split_state(state, current)) {
+		close(fd);
+		return 0;
+	}
+	const uint32 num_pages = ram_size / page_size;
+	int records = 0;
+	for (;;) {
+
+		// Read record
+		uint8 record_header[LOG_RECORD_HEADER_SIZE];
+		if (!read_fully(fd, record_header, LOG_RECORD_HEADER_SIZE, end))
+			break;
+		snapshot_data h(record_header, LOG_RECORD_HEADER_SIZE);
+		uint32 tag = h.get32();
+		uint32 record_seq = h.get32();
+		uint32 state_size = h.get32();
+		uint32 record_pages = h.get32();
+		uint64 record_size = LOG_RECORD_HEADER_SIZE + (uint64)state_size + (uint64)record_pages * (4 + page_size) + LOG_RECORD_TRAILER_SIZE;
+		if (tag != LOG_RECORD || record_seq != seq + 1 || record_pages > num_pages || end + record_size > (uint64)st.st_size)
+			break;
+		std::vector<uint8> record(record_size);
+		if (!read_fully(fd, &record[0], record_size, end))
+			break;
+		snapshot_data trailer(&record[record_size - LOG_RECORD_TRAILER_SIZE], LOG_RECORD_TRAILER_SIZE);
+		if (trailer.get32() != LOG_RECORD_END || trailer.get32() != adler32(1, &record[0], record_size - LOG_RECORD_TRAILER_SIZE))
+			break;
+
+		// Check record contents before applying anything
+		state_sections sections;
+		if (!split_state(snapshot_data(&record[LOG_RECORD_HEADER_SIZE], state_size), sections) || !merge_state(sections, current))
+			break;
+		snapshot_data page_numbers(&record[LOG_RECORD_HEADER_SIZE + state_size], record_pages * 4);
+		std::vector<uint32> pages(record_pages);
+		bool pages_ok = true;
+		for (uint32 i = 0; i < record_pages; i++)
+			if ((pages[i] = page_numbers.get32()) >= num_pages)
+				pages_ok = false;
+		if (!pages_ok)
+			break;
+
+		// Apply record
+		const uint8 *p = &record[LOG_RECORD_HEADER_SIZE + state_size + record_pages * 4];
+		for (uint32 i = 0; i < record_pages; i++, p += page_size)
+			memcpy(ram + pages[i] * page_size, p, page_size);
+		if (changed)
+			changed->insert(changed->end(), pages.begin(), pages.end());
+		current = sections;
+		seq = record_seq;
+		end += record_size;
+		records++;
+	}
+	close(fd);
+	D(bug("%d checkpoints in %s, valid up to offset %lld\n", records, path_str.c_str(), (long long)end));
+
+	if (changed) {
+		std::sort(changed->begin(), changed->end());
+		changed->erase(std::unique(changed->begin(), changed->end()), changed->end());
+		*changed_page_size = page_size;
+	}
+
+	state = join_state(current);
+	return records;
+}
+
+
+/*
+ *  Save complete emulator state to file (must be called from the 680x0
+ *  checkpoint callback)
+ */
+
+bool SaveSnapshot(const char *path)
+{
+	uint64 start = GetTicks_usec();
+
+	snapshot_data state;
+	const char *reason = save_state(state);
+	if (reason) {
+		printf("WARNING: Cannot save snapshot while %s\n", reason);
+		return false;
+	}
+
+	snapshot_header h;
+	get_fingerprint(h.fingerprint);
+	h.id = new_snapshot_id();
+	uint32 ram_written = 0;
+	if (!write_snapshot(path, h, state, RAMBaseHost, ram_written))
+		return false;
+
+	// Checkpoints of the previous snapshot don't apply any more
+	unlink(log_path(path).c_str());
+
+	printf("Snapshot saved to %s (%u KB state, %u of %u KB RAM) in %d ms\n", path,
+		(uint32)(state.size() / 1024), ram_written / 1024, RAMSize / 1024, (int)((GetTicks_usec() - start) / 1000));
+	return true;
+}
+
+
+/*
+ *  Restore complete emulator state from file (must be called after
+ *  InitAll() and before the 680x0 emulation is started), returns false if
+ *  the emulator has to boot normally
+ */
+
+bool RestoreSnapshot(const char *path)
+{
+	uint64 start = GetTicks_usec();
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	// Check header
+	snapshot_header h;
+	if (!read_header(fd, path, h)) {
+		close(fd);
+		return false;
+	}
+	uint8 fingerprint[SNAP_FINGERPRINT_SIZE];
+	get_fingerprint(fingerprint);
+	if (memcmp(h.fingerprint, fingerprint, SNAP_FINGERPRINT_SIZE) != 0) {
+		printf("WARNING: Snapshot %s was saved with a different RAM, ROM or CPU setting, ignored\n", path);
+		close(fd);
+		return false;
+	}
+
+	// Read state area
+	std::vector<uint8> state_data(h.state_size);
+	if (!read_fully(fd, h.state_size ? &state_data[0] : NULL, h.state_size, SNAP_HEADER_SIZE)) {
+		printf("WARNING: Cannot read snapshot %s (%s)\n", path, strerror(errno));
+		close(fd);
+		return false;
+	}
+	snapshot_data state(h.state_size ? &state_data[0] : NULL, h.state_size);
+
+	// Remember the state after InitAll(), to go back to it if a component
+	// can't be restored
+	snapshot_data initial_state;
+	const char *reason = save_state(initial_state);
+	if (reason) {
+		printf("WARNING: Cannot restore snapshot %s while %s\n", path, reason);
+		close(fd);
+		return false;
+	}
+
+	// Map RAM image copy-on-write, or read it if that's not possible
+	bool ram_mapped = mmap(RAMBaseHost, RAMSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, h.ram_offset) != MAP_FAILED;
+	if (!ram_mapped && !read_fully(fd, RAMBaseHost, RAMSize, h.ram_offset)) {
+		printf("WARNING: Cannot read snapshot %s (%s)\n", path, strerror(errno));
+		memset(RAMBaseHost, 0, RAMSize);
+		close(fd);
+		return false;
+	}
+	close(fd);
+
+	// Apply checkpoints taken after the snapshot
+	loff_t log_end;
+	uint32 log_seq;
+	std::vector<uint32> log_pages;
+	uint32 log_page_size = 0;
+	int checkpoints = replay_log(path, h.id, RAMBaseHost, RAMSize, state, log_end, log_seq, &log_pages, &log_page_size);
+	snapshot_data full_state = state;
+
+	// Restore components. If that fails, undo everything: put all
+	// components back into their initial state and replace the RAM image
+	// by empty memory again.
+	if (!restore_state(state)) {
+		printf("WARNING: Cannot restore snapshot %s, booting normally\n", path);
+		if (!restore_state(initial_state)) {
+			ErrorAlert("Cannot reset emulator after a failed snapshot restore");
+			QuitEmulator();
+		}
+		TimerReset();
+		EtherReset();
+		AudioReset();
+		if (!ram_mapped)
+			memset(RAMBaseHost, 0, RAMSize);
+		else if (vm_acquire_fixed(RAMBaseHost, RAMSize, VM_MAP_DEFAULT | VM_MAP_HUGE) < 0) {
+			ErrorAlert("Cannot reset emulator after a failed snapshot restore");
+			QuitEmulator();
+		}
+		return false;
+	}
+	restored_id = h.id;
+	restored_log_end = log_end;
+	restored_log_seq = log_seq;
+	restored_state = full_state;
+	restored_log_pages.swap(log_pages);
+	restored_log_page_size = log_page_size;
+
+	printf("Snapshot restored from %s with %d checkpoints (RAM %s) in %d ms\n", path, checkpoints,
+		ram_mapped ? "mapped" : "read", (int)((GetTicks_usec() - start) / 1000));
+	return true;
+}
+
+
+/*
+ *  Merge the checkpoint log into the snapshot file, so it can be restored
+ *  without replaying the log
+ */
+
+bool CompactSnapshot(const char *path)
+{
+	int lock_fd = lock_snapshot(path);
+	if (lock_fd < 0) {
+		print_lock_warning(path, "not compacted");
+		return false;
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("WARNING: Cannot open snapshot %s (%s)\n", path, strerror(errno));
+		close(lock_fd);
+		return false;
+	}
+	snapshot_header h;
+	if (!read_header(fd, path, h)) {
+		close(fd);
+		close(lock_fd);
+		return false;
+	}
+	std::vector<uint8> state_data(h.state_size);
+	const uint32 ram_size = h.ram_size();
+	uint8 *ram = NULL;
+	if (read_fully(fd, h.state_size ? &state_data[0] : NULL, h.state_size, SNAP_HEADER_SIZE)) {
+		ram = (uint8 *)mmap(NULL, ram_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, h.ram_offset);
+		if (ram == (uint8 *)MAP_FAILED)
+			ram = NULL;
+	}
+	close(fd);
+	if (ram == NULL) {
+		printf("WARNING: Cannot read snapshot %s (%s)\n", path, strerror(errno));
+		close(lock_fd);
+		return false;
+	}
+	snapshot_data state(h.state_size ? &state_data[0] : NULL, h.state_size);
+
+	loff_t log_end;
+	uint32 log_seq;
+	int checkpoints = replay_log(path, h.id, ram, ram_size, state, log_end, log_seq);
+	bool ok = true;
+	if (checkpoints) {
+		h.id = new_snapshot_id();
+		uint32 ram_written = 0;
+		ok = write_snapshot(path, h, state, ram, ram_written);
+	}
+	munmap(ram, ram_size);
+	if (ok)
+		unlink(log_path(path).c_str());
+	close(lock_fd);
+	if (!ok)
+		return false;
+	printf("%d checkpoints merged into snapshot %s\n", checkpoints, path);
+	return true;
+}
+
+
+/*
+ *  Incremental checkpoints
+ *
+ *  A checkpoint only writes the RAM pages that changed since the previous
+ *  one, appending them to the log of the snapshot file together with the
+ *  state area. The emulation is only stopped while the changed pages are
+ *  copied into a second RAM image that holds the contents of the last
+ *  checkpoint, never for file I/O: a separate thread writes the log, and a
+ *  checkpoint that comes up while it is still busy is skipped.
+ *
+ *  Under Linux, the pages to compare are found with the soft-dirty bits of
+ *  the page tables. Unlike write protection, these also catch writes of
+ *  the kernel to Mac RAM (e.g. read() into a Mac buffer). Elsewhere all
+ *  pages are compared. When the log has grown bigger than the RAM, the
+ *  image is written as a new snapshot and the log starts over.
+ */
+
+#ifdef HAVE_PTHREADS
+
+static const char *ckpt_path = NULL;		// Snapshot file
+static int ckpt_lock_fd = -1;				// Lock file of the snapshot
+static uint8 *ckpt_ram = NULL;				// RAM contents of the last checkpoint
+static uint32 ckpt_page_size;
+static snapshot_header ckpt_header;			// Header of new snapshot files
+static bool ckpt_suspended = false;			// Flag: checkpoints not possible at the moment (warning printed)
+static int ckpt_count = 0;					// Statistics
+static uint64 ckpt_max_pause = 0;
+
+static int pagemap_fd = -1;					// Soft-dirty page tracking
+static int clear_refs_fd = -1;
+
+static pthread_t writer_thread;				// Log writer thread
+static bool writer_thread_active = false;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static bool writer_busy = false;			// Flag: job pending or being written (protected by writer_lock)
+static bool writer_quit = false;			// Flag: writer thread shall exit (protected by writer_lock)
+static bool have_base = false;				// Flag: snapshot and log are valid (protected by writer_lock)
+
+static bool job_full;						// Job: write snapshot instead of log record
+static snapshot_data job_state;				// Job: state area
+static std::vector<uint32> job_pages;		// Job: changed pages
+
+static int log_fd = -1;						// Log file (only used by writer thread)
+static loff_t log_end;
+static uint32 log_seq;
+static snapshot_data log_state;				// State area of the last checkpoint in the log
+
+#ifdef __linux__
+const uint64 PM_SOFT_DIRTY = 1ULL << 55;	// Bit in /proc/self/pagemap entries
+
+static bool clear_soft_dirty(void)
+{
+	return write(clear_refs_fd, "4", 1) == 1;
+}
+
+static bool init_soft_dirty(void)
+{
+	pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+	clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY);
+	if (pagemap_fd >= 0 && clear_refs_fd >= 0 && clear_soft_dirty()) {
+
+		// Check that a write is actually tracked
+		volatile uint8 *p = RAMBaseHost;
+		*p = *p;
+		uint64 entry;
+		if (read_fully(pagemap_fd, &entry, sizeof(entry), (loff_t)((uintptr)RAMBaseHost / ckpt_page_size) * sizeof(entry)) && (entry & PM_SOFT_DIRTY))
+			return true;
+	}
+	if (pagemap_fd >= 0)
+		close(pagemap_fd);
+	if (clear_refs_fd >= 0)
+		close(clear_refs_fd);
+	pagemap_fd = clear_refs_fd = -1;
+	return false;
+}
+#endif
+
+// Copy page to the checkpoint image if it changed
+static inline void update_page(uint32 page)
+{
+	const uint32 offset = page * ckpt_page_size;
+	if (memcmp(ckpt_ram + offset, RAMBaseHost + offset, ckpt_page_size) != 0) {
+		memcpy(ckpt_ram + offset, RAMBaseHost + offset, ckpt_page_size);
+		job_pages.push_back(page);
+	}
+}
+
+static void update_pages(bool all)
+{
+	job_pages.clear();
+	const uint32 num_pages = RAMSize / ckpt_page_size;
+	uint32 page = 0;
+#ifdef __linux__
+	if (pagemap_fd >= 0) {
+		if (!all) {
+			static uint64 entries[4096];
+			const loff_t first = (uintptr)RAMBaseHost / ckpt_page_size;
+			while (page < num_pages) {
+				uint32 n = num_pages - page < 4096 ? num_pages - page : 4096;
+				if (!read_fully(pagemap_fd, entries, n * sizeof(uint64), (first + page) * sizeof(uint64)))
+					break;	// Compare the remaining pages
+				for (uint32 i = 0; i < n; i++)
+					if (entries[i] & PM_SOFT_DIRTY)
+						update_page(page + i);
+				page += n;
+			}
+		}
+		clear_soft_dirty();
+	}
+#endif
+	for (; page < num_pages; page++)
+		update_page(page);
+}
+
+// Map the RAM image of the restored snapshot copy-on-write, returns NULL
+// if it's no longer there
+static uint8 *map_restored_ram(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	uint8 *ram = NULL;
+	snapshot_header h;
+	if (read_header(fd, path, h) && h.id == restored_id && h.ram_size() == RAMSize) {
+		ram = (uint8 *)mmap(NULL, RAMSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, h.ram_offset);
+		if (ram == (uint8 *)MAP_FAILED)
+			ram = NULL;
+	}
+	close(fd);
+	return ram;
+}
+
+// Write checkpoint image as new snapshot and start a new log
+static bool write_base(void)
+{
+	uint64 start = GetTicks_usec();
+	ckpt_header.id = new_snapshot_id();
+	uint32 ram_written = 0;
+	if (!write_snapshot(ckpt_path, ckpt_header, job_state, ckpt_ram, ram_written))
+		return false;
+	if (log_fd >= 0)
+		close(log_fd);
+	log_fd = create_log(ckpt_path, ckpt_header.id);
+	if (log_fd < 0) {
+		printf("WARNING: Cannot create checkpoint log %s (%s)\n", log_path(ckpt_path).c_str(), strerror(errno));
+		return false;
+	}
+	log_end = LOG_HEADER_SIZE;
+	log_seq = 0;
+	log_state = job_state;
+	D(bug("Snapshot written (%u KB RAM) in %d ms\n", ram_written / 1024, (int)((GetTicks_usec() - start) / 1000)));
+	return true;
+}
+
+// Append checkpoint to the log
+static bool write_record(void)
+{
+	snapshot_data state = diff_state(job_state, log_state);
+	snapshot_data record;
+	record.put32(LOG_RECORD);
+	record.put32(log_seq + 1);
+	record.put32(state.size());
+	record.put32(job_pages.size());
+	record.put_bytes(state.bytes(), state.size());
+	for (size_t i = 0; i < job_pages.size(); i++)
+		record.put32(job_pages[i]);
+	uint32 checksum = adler32(1, record.bytes(), record.size());
+	loff_t offset = log_end;
+	bool ok = write_fully(log_fd, record.bytes(), record.size(), offset);
+	offset += record.size();
+
+	// Page contents, consecutive pages with one write
+	for (size_t i = 0; ok && i < job_pages.size(); ) {
+		size_t n = 1;
+		while (i + n < job_pages.size() && job_pages[i + n] == job_pages[i] + n)
+			n++;
+		const uint8 *p = ckpt_ram + job_pages[i] * ckpt_page_size;
+		const size_t size = n * ckpt_page_size;
+		checksum = adler32(checksum, p, size);
+		ok = write_fully(log_fd, p, size, offset);
+		offset += size;
+		i += n;
+	}
+
+	snapshot_data trailer;
+	trailer.put32(LOG_RECORD_END);
+	trailer.put32(checksum);
+	if (!ok || !write_fully(log_fd, trailer.bytes(), trailer.size(), offset)) {
+		printf("WARNING: Cannot write checkpoint log %s (%s)\n", log_path(ckpt_path).c_str(), strerror(errno));
+		return false;
+	}
+	log_end = offset + trailer.size();
+	log_seq++;
+	log_state = job_state;
+	D(bug("Checkpoint %u written, log is %lld KB\n", log_seq, (long long)(log_end / 1024)));
+	return true;
+}
+
+static void *writer_func(void *arg)
+{
+	pthread_mutex_lock(&writer_lock);
+	for (;;) {
+		while (!writer_busy && !writer_quit)
+			pthread_cond_wait(&writer_cond, &writer_lock);
+		if (!writer_busy)
+			break;
+		pthread_mutex_unlock(&writer_lock);
+
+		// Once the log is bigger than the RAM, merging it is cheaper than replaying it
+		bool ok;
+		if (job_full)
+			ok = write_base();
+		else {
+			ok = write_record();
+			if (ok && log_end - LOG_HEADER_SIZE > (loff_t)RAMSize)
+				ok = write_base();
+		}
+
+		// A failed write leaves an incomplete log, the next checkpoint is a full one
+		pthread_mutex_lock(&writer_lock);
+		have_base = ok;
+		writer_busy = false;
+	}
+	pthread_mutex_unlock(&writer_lock);
+	return NULL;
+}
+
+
+/*
+ *  Initialize checkpoints to the log of the given snapshot file (must be
+ *  called after RestoreSnapshot())
+ */
+
+bool CheckpointInit(const char *path, bool restored)
+{
+	// Two instances appending to the same log would mix their RAM images
+	ckpt_lock_fd = lock_snapshot(path);
+	if (ckpt_lock_fd < 0) {
+		print_lock_warning(path, "no checkpoints");
+		return false;
+	}
+
+	ckpt_path = path;
+	ckpt_page_size = getpagesize();
+	writer_busy = writer_quit = have_base = false;
+	get_fingerprint(ckpt_header.fingerprint);
+
+	// After a restore, the checkpoint image is a second copy-on-write
+	// mapping of the snapshot's RAM image with the pages changed by its log
+	// copied in. Copying all of the RAM would fault in all of it.
+	ckpt_ram = restored ? map_restored_ram(path) : NULL;
+	if (ckpt_ram) {
+		for (size_t i = 0; i < restored_log_pages.size(); i++) {
+			const uint32 offset = restored_log_pages[i] * restored_log_page_size;
+			memcpy(ckpt_ram + offset, RAMBaseHost + offset, restored_log_page_size);
+		}
+	} else {
+		ckpt_ram = (uint8 *)vm_acquire(RAMSize);
+		if (ckpt_ram == VM_MAP_FAILED) {
+			ckpt_ram = NULL;
+			printf("WARNING: Not enough memory for checkpoints\n");
+			close(ckpt_lock_fd);
+			ckpt_lock_fd = -1;
+			return false;
+		}
+		if (restored)
+			for (uint32 offset = 0; offset < RAMSize; offset += ckpt_page_size)
+				if (!is_zero_page(RAMBaseHost + offset, ckpt_page_size))
+					memcpy(ckpt_ram + offset, RAMBaseHost + offset, ckpt_page_size);
+	}
+	std::vector<uint32>().swap(restored_log_pages);
+
+	// Continue the log of a restored snapshot, otherwise the first
+	// checkpoint writes a new snapshot
+	if (restored) {
+		if (restored_log_end) {
+			log_fd = open(log_path(path).c_str(), O_WRONLY);
+			if (log_fd >= 0 && ftruncate(log_fd, restored_log_end) < 0) {
+				close(log_fd);
+				log_fd = -1;
+			}
+		} else
+			log_fd = create_log(path, restored_id);
+		if (log_fd >= 0) {
+			ckpt_header.id = restored_id;
+			log_end = restored_log_end ? restored_log_end : LOG_HEADER_SIZE;
+			log_seq = restored_log_seq;
+			log_state = restored_state;
+			have_base = true;
+		}
+	}
+
+	bool soft_dirty = false;
+#ifdef __linux__
+	soft_dirty = init_soft_dirty();
+#endif
+
+	writer_thread_active = (pthread_create(&writer_thread, NULL, writer_func, NULL) == 0);
+	if (!writer_thread_active) {
+		printf("WARNING: Cannot start checkpoint thread\n");
+		CheckpointExit();
+		return false;
+	}
+	D(bug("Checkpoints to %s, %s\n", log_path(path).c_str(), soft_dirty ? "soft-dirty page tracking" : "comparing all pages"));
+	return true;
+}
+
+
+/*
+ *  Deinitialization, waits until the last checkpoint is written
+ */
+
+void CheckpointExit(void)
+{
+	if (writer_thread_active) {
+		pthread_mutex_lock(&writer_lock);
+		writer_quit = true;
+		pthread_cond_signal(&writer_cond);
+		pthread_mutex_unlock(&writer_lock);
+		pthread_join(writer_thread, NULL);
+		writer_thread_active = false;
+		D(bug("%d checkpoints, longest pause %d usec\n", ckpt_count, (int)ckpt_max_pause));
+	}
+	if (log_fd >= 0) {
+		close(log_fd);
+		log_fd = -1;
+	}
+	if (pagemap_fd >= 0) {
+		close(pagemap_fd);
+		close(clear_refs_fd);
+		pagemap_fd = clear_refs_fd = -1;
+	}
+	if (ckpt_ram) {
+		vm_release(ckpt_ram, RAMSize);
+		ckpt_ram = NULL;
+	}
+	if (ckpt_lock_fd >= 0) {
+		close(ckpt_lock_fd);
+		ckpt_lock_fd = -1;
+	}
+}
+
+
+/*
+ *  Take checkpoint (must be called from the 680x0 checkpoint callback)
+ */
+
+void CheckpointSave(bool requested)
+{
+	if (!writer_thread_active)
+		return;
+	pthread_mutex_lock(&writer_lock);
+	bool busy = writer_busy, full = !have_base;
+	pthread_mutex_unlock(&writer_lock);
+	if (busy) {
+		if (requested)
+			printf("WARNING: Snapshot not saved, the previous checkpoint is still being written\n");
+		D(bug("Checkpoint skipped, the previous one is still being written\n"));
+		return;
+	}
+
+	uint64 start = GetTicks_usec();
+	job_state = snapshot_data();
+	const char *reason = save_state(job_state);
+	if (reason) {
+		if (!ckpt_suspended || requested)
+			printf("WARNING: No checkpoints while %s\n", reason);
+		ckpt_suspended = true;
+		return;
+	}
+	ckpt_suspended = false;
+	update_pages(full);
+	job_full = full;
+
+	uint64 pause = GetTicks_usec() - start;
+	if (pause > ckpt_max_pause)
+		ckpt_max_pause = pause;
+	ckpt_count++;
+	D(bug("Checkpoint: %d pages changed, emulation stopped for %d usec\n", (int)job_pages.size(), (int)pause));
+
+	pthread_mutex_lock(&writer_lock);
+	writer_busy = true;
+	pthread_cond_signal(&writer_cond);
+	pthread_mutex_unlock(&writer_lock);
+}
+
+#else
+
+bool CheckpointInit(const char *path, bool restored)
+{
+	printf("WARNING: Checkpoints are not available without pthreads\n");
+	return false;
+}
+
+void CheckpointExit(void)
+{
+}
+
+void CheckpointSave(bool requested)
+{
+}
+
+#endif
+
+#endif
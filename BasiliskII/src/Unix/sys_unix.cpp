@@ -23,6 +23,11 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <algorithm>
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 
 #ifdef HAVE_AVAILABILITYMACROS_H
 #include <AvailabilityMacros.h>
@@ -70,6 +75,8 @@
 static disk_factory *disk_factories[] = {
 #ifndef STANDALONE_GUI
 	disk_sparsebundle_factory,
+	disk_vhd_native_factory,
+	disk_overlay_factory,
 #if defined(HAVE_LIBVHD)
 	disk_vhd_factory,
 #endif
@@ -93,6 +100,15 @@ struct mac_file_handle {
 	bool is_media_present;		// Flag: media is inserted and available
 	disk_generic *generic_disk;
 
+#ifdef HAVE_MMAP
+	uint8 *map_base;		// Image file mapping for reads (only if is_file is true), or NULL
+	loff_t map_size;
+	loff_t map_next;		// Offset following the last read
+	loff_t map_prefetched;	// End of range already passed to MADV_WILLNEED
+	int map_seq_count;		// Consecutive reads that didn't match the current access pattern
+	bool map_sequential;	// Current access pattern
+#endif
+
 #if defined(__linux__)
 	int cdrom_cap;		// CD-ROM capability flags (only valid if is_cdrom is true)
 #elif defined(__FreeBSD__)
@@ -123,6 +139,15 @@ static void cdrom_close(mac_file_handle *fh);
 static bool cdrom_open(mac_file_handle *fh, const char *path = NULL);
 
 
+#ifdef HAVE_MMAP
+// Read-ahead window for sequential access to mapped image files
+const loff_t MAP_PREFETCH_SIZE = 1024 * 1024;
+
+// Number of reads after which the access pattern is considered changed
+const int MAP_PATTERN_THRESHOLD = 4;
+#endif
+
+
 /*
  *  Initialization
  */
@@ -540,6 +565,80 @@ static mac_file_handle *open_filehandle(const char *name)
 		return fh;
 }
 
+#ifdef HAVE_MMAP
+/*
+ *  Map image file for reading. Writes still go through write(), the
+ *  mapping sees them as it shares the page cache with the file.
+ */
+
+static void map_image_file(mac_file_handle *fh, loff_t size)
+{
+	if (size <= 0 || size != (loff_t)(size_t)size)
+		return;
+	void *p = mmap(NULL, size, PROT_READ, MAP_SHARED, fh->fd, 0);
+	if (p == MAP_FAILED) {
+		D(bug(" mmap of %s failed: %s\n", fh->name, strerror(errno)));
+		return;
+	}
+	madvise(p, size, MADV_RANDOM);
+	fh->map_base = (uint8 *)p;
+	fh->map_size = size;
+	fh->map_next = -1;
+	fh->map_prefetched = 0;
+	fh->map_seq_count = 0;
+	fh->map_sequential = false;
+	D(bug(" mapped %s, %lld bytes\n", fh->name, (long long)size));
+}
+
+static void unmap_image_file(mac_file_handle *fh)
+{
+	if (fh->map_base) {
+		munmap(fh->map_base, fh->map_size);
+		fh->map_base = NULL;
+	}
+}
+
+/*
+ *  Switch read-ahead strategy of mapped image file when the access pattern
+ *  changes, and prefetch ahead of sequential reads
+ */
+
+static void map_access_hint(mac_file_handle *fh, loff_t pos, size_t length)
+{
+	bool sequential = (pos == fh->map_next);
+	fh->map_next = pos + length;
+	if (sequential != fh->map_sequential) {
+		if (++fh->map_seq_count >= MAP_PATTERN_THRESHOLD) {
+			fh->map_sequential = sequential;
+			fh->map_seq_count = 0;
+			fh->map_prefetched = 0;
+			madvise(fh->map_base, fh->map_size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+		}
+	} else
+		fh->map_seq_count = 0;
+
+	if (fh->map_sequential && pos + (loff_t)length + MAP_PREFETCH_SIZE / 2 > fh->map_prefetched) {
+		loff_t page_mask = getpagesize() - 1;
+		loff_t start = std::max(fh->map_prefetched, pos + (loff_t)length) & ~page_mask;
+		loff_t end = std::min(start + MAP_PREFETCH_SIZE, fh->map_size);
+		if (start < end)
+			madvise(fh->map_base + start, end - start, MADV_WILLNEED);
+		fh->map_prefetched = end;
+	}
+}
+#endif
+
+static mac_file_handle *open_generic(const char *name, disk_generic *generic)
+{
+	mac_file_handle *fh = open_filehandle(name);
+	fh->generic_disk = generic;
+	fh->file_size = generic->size();
+	fh->read_only = generic->is_read_only();
+	fh->is_media_present = true;
+	sys_add_mac_file_handle(fh);
+	return fh;
+}
+
 void *Sys_open(const char *name, bool read_only, bool is_cdrom)
 {
 	bool is_file = strncmp(name, "/dev/", 5) != 0;
@@ -573,6 +672,11 @@ void *Sys_open(const char *name, bool read_only, bool is_cdrom)
 
 	D(bug("Sys_open(%s, %s)\n", name, read_only ? "read-only" : "read/write"));
 
+	// Plain image files opened read/write get a private copy-on-write
+	// overlay if requested, so the image itself is never written to
+	const char *overlay_dir = PrefsFindString("diskoverlaydir");
+	bool use_overlay = overlay_dir && is_file && !is_cdrom && !read_only;
+
 	// Check if write access is allowed, set read-only flag if not
 	if (!read_only && access(name, W_OK))
 		read_only = true;
@@ -614,17 +718,22 @@ void *Sys_open(const char *name, bool read_only, bool is_cdrom)
 		disk_generic::status st = f(name, read_only, &generic);
 		if (st == disk_generic::DISK_INVALID)
 			return NULL;
-		if (st == disk_generic::DISK_VALID) {
-			mac_file_handle *fh = open_filehandle(name);
-			fh->generic_disk = generic;
-			fh->file_size = generic->size();
-			fh->read_only = generic->is_read_only();
-			fh->is_media_present = true;
-			sys_add_mac_file_handle(fh);
-			return fh;
-		}
+		if (st == disk_generic::DISK_VALID)
+			return open_generic(name, generic);
 	}
 
+#ifndef STANDALONE_GUI
+	struct stat st;
+	if (use_overlay && stat(name, &st) == 0 && S_ISREG(st.st_mode)) {
+		disk_generic *generic;
+		disk_generic::status status = disk_overlay_attach(name, overlay_dir, &generic);
+		if (status == disk_generic::DISK_INVALID)
+			return NULL;
+		if (status == disk_generic::DISK_VALID)
+			return open_generic(name, generic);
+	}
+#endif
+
 	int open_flags = (read_only ? O_RDONLY : O_RDWR);
 #if defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__MACOSX__)
 	open_flags |= (is_cdrom ? O_NONBLOCK : 0);
@@ -667,6 +776,10 @@ void *Sys_open(const char *name, bool read_only, bool is_cdrom)
 			lseek(fd, 0, SEEK_SET);
 			read(fd, data, 256);
 			FileDiskLayout(size, data, fh->start_byte, fh->file_size);
+#ifdef HAVE_MMAP
+			if (PrefsFindBool("diskmmap"))
+				map_image_file(fh, size);
+#endif
 		} else {
 			struct stat st;
 			if (fstat(fd, &st) == 0) {
@@ -733,6 +846,9 @@ void Sys_close(void *arg)
 #endif
 	if (fh->generic_disk)
 		delete fh->generic_disk;
+#ifdef HAVE_MMAP
+	unmap_image_file(fh);
+#endif
 
 	if (fh->is_cdrom)
 		cdrom_close(fh);
@@ -762,7 +878,20 @@ size_t Sys_read(void *arg, void *buffer, loff_t offset, size_t length)
 
 	if (fh->generic_disk)
 		return fh->generic_disk->read(buffer, offset, length);
-	
+
+#ifdef HAVE_MMAP
+	// Copy straight from mapped image file
+	if (fh->map_base) {
+		loff_t pos = offset + fh->start_byte;
+		if (offset < 0 || pos >= fh->map_size)
+			return 0;
+		length = std::min(length, size_t(fh->map_size - pos));
+		map_access_hint(fh, pos, length);
+		memcpy(buffer, fh->map_base + pos, length);
+		return length;
+	}
+#endif
+
 	// Seek to position
 	if (lseek(fh->fd, offset + fh->start_byte, SEEK_SET) < 0)
 		return 0;
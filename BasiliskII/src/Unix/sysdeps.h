@@ -220,6 +220,19 @@ typedef uae_u32 uaecptr;
 /* Timing functions */
 extern uint64 GetTicks_usec(void);
 extern void Delay_usec(uint64 usec);
+#if defined(HAVE_PTHREADS) && defined(__cplusplus)
+/* 60Hz tick source, calls func with the number of ticks elapsed since the last call */
+extern bool tick_source_start(void (*func)(int elapsed), const bool *inhibit, pthread_attr_t *attr);
+extern void tick_source_stop(void);
+/* Print tick and wakeup latency statistics of the tick source */
+extern void tick_report(void);
+#endif
+/* Print latency histogram, limits in usec */
+extern void print_latency_histogram(const char *name, const int *limit, int num_limits, const uint64 *count);
+/* Print idle time statistics of the emulator thread */
+extern void idle_report(void);
+/* Print interrupt latency histograms */
+extern void intflag_report(void);
 
 /* Spinlocks */
 #ifdef __GNUC__
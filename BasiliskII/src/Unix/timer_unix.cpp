@@ -339,15 +339,236 @@ void Delay_usec(uint64 usec)
 }
 
 
+/*
+ *  Print a latency histogram with num_limits + 1 buckets, the labels are
+ *  made from the bucket limits [usec]
+ */
+
+void print_latency_histogram(const char *name, const int *limit, int num_limits, const uint64 *count)
+{
+	printf("%s [", name);
+	for (int i = 0; i <= num_limits; i++) {
+		int l = i < num_limits ? limit[i] : limit[num_limits - 1];
+		printf("%s%s%d%s", i ? " " : "", i < num_limits ? "<" : ">=", l % 1000 ? l : l / 1000, l % 1000 ? "us" : "ms");
+	}
+	printf("]:");
+	for (int i = 0; i <= num_limits; i++)
+		printf(" %llu", (unsigned long long)count[i]);
+	printf("\n");
+}
+
+
+/*
+ *  60Hz tick source (really 60.15Hz)
+ *
+ *  Ticks follow absolute deadlines on the monotonic clock, so they don't
+ *  drift. Ticks that were missed because the thread ran late by more than
+ *  a period, or that fell into a time the emulator had ticks inhibited,
+ *  are not delivered one by one. The next call of the tick function gets
+ *  their count instead.
+ *
+ *  While the emulator thread is idle, the tick thread is parked. The
+ *  emulator thread wakes up every few ticks by itself (see idle_timeout())
+ *  and unparks the tick thread when it leaves idle_wait(), which then
+ *  delivers the ticks that came due in the meantime.
+ */
+
+#ifdef HAVE_PTHREADS
+const int64 TICK_PERIOD_NS = 16625000;
+const int TICK_JITTER_BUCKETS = 8;
+static const int tick_jitter_limit[TICK_JITTER_BUCKETS - 1] = { 50, 100, 250, 500, 1000, 2000, 5000 };	// [usec]
+
+static pthread_t tick_thread;
+static bool tick_thread_active = false;
+static volatile bool tick_thread_cancel;
+static void (*tick_function)(int elapsed);
+static const bool *tick_inhibit_flag;
+static uint64 tick_start;								// Time of tick 0 [nsec]
+
+#ifdef HAVE_PTHREAD_COND_INIT
+static pthread_mutex_t tick_park_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tick_park_cond = PTHREAD_COND_INITIALIZER;
+static bool tick_park_requested = false;				// Emulator thread is in idle_wait()
+static uint32 tick_unpark_count = 0;					// Times the emulator thread left idle_wait()
+#endif
+
+// Statistics
+static uint64 tick_count;								// Ticks delivered
+static uint64 tick_missed;								// Ticks skipped because the thread was late
+static uint64 tick_suppressed;							// Ticks that fell into inhibited time
+static uint64 tick_parked;								// Ticks that fell into parked time
+static uint64 tick_jitter_sum;							// Sum of wakeup latencies [nsec]
+static uint64 tick_jitter_max;							// Max. wakeup latency [nsec]
+static uint64 tick_jitter_hist[TICK_JITTER_BUCKETS];	// Wakeup latency histogram
+
+static uint64 tick_clock_ns(void)
+{
+#if defined(HAVE_CLOCK_NANOSLEEP) && defined(CLOCK_MONOTONIC)
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64)t.tv_sec * 1000000000 + t.tv_nsec;
+#else
+	return GetTicks_usec() * 1000;
+#endif
+}
+
+static void tick_sleep_until(uint64 deadline)
+{
+#if defined(HAVE_CLOCK_NANOSLEEP) && defined(CLOCK_MONOTONIC)
+	struct timespec t;
+	t.tv_sec = deadline / 1000000000;
+	t.tv_nsec = deadline % 1000000000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR && !tick_thread_cancel) ;
+#else
+	uint64 now = tick_clock_ns();
+	if (deadline > now)
+		Delay_usec((deadline - now) / 1000);
+#endif
+}
+
+// Wait while the emulator thread is idle, returns true if the thread was parked
+static bool tick_park(void)
+{
+	bool parked = false;
+#ifdef HAVE_PTHREAD_COND_INIT
+	pthread_mutex_lock(&tick_park_lock);
+	uint32 unparks = tick_unpark_count;
+	while (tick_park_requested && unparks == tick_unpark_count && !tick_thread_cancel) {
+		parked = true;
+		pthread_cond_wait(&tick_park_cond, &tick_park_lock);
+	}
+	pthread_mutex_unlock(&tick_park_lock);
+#endif
+	return parked;
+}
+
+#ifdef HAVE_PTHREAD_COND_INIT
+// Called by the emulator thread when it enters and leaves idle_wait()
+static void tick_request_park(bool park)
+{
+	if (!tick_thread_active)
+		return;
+	pthread_mutex_lock(&tick_park_lock);
+	tick_park_requested = park;
+	if (!park) {
+		tick_unpark_count++;
+		pthread_cond_signal(&tick_park_cond);
+	}
+	pthread_mutex_unlock(&tick_park_lock);
+}
+#endif
+
+static void *tick_func(void *arg)
+{
+	uint64 next = tick_start;
+	int elapsed = 0;
+	while (!tick_thread_cancel) {
+		next += TICK_PERIOD_NS;
+		bool parked = tick_park();
+		tick_sleep_until(next);
+		if (tick_thread_cancel)
+			break;
+		elapsed++;
+
+		// More than a period behind? Then skip the missed ticks
+		int64 late = tick_clock_ns() - next;
+		if (late >= TICK_PERIOD_NS) {
+			int64 missed = late / TICK_PERIOD_NS;
+			next += missed * TICK_PERIOD_NS;
+			late -= missed * TICK_PERIOD_NS;
+			elapsed += (int)missed;
+			if (parked)
+				tick_parked += missed;
+			else
+				tick_missed += missed;
+		}
+
+		// The wakeup latency of a parked thread depends on the emulator thread
+		if (!parked) {
+			if (late < 0)
+				late = 0;
+			tick_jitter_sum += late;
+			if ((uint64)late > tick_jitter_max)
+				tick_jitter_max = late;
+			int bucket = 0;
+			while (bucket < TICK_JITTER_BUCKETS - 1 && late >= tick_jitter_limit[bucket] * 1000)
+				bucket++;
+			tick_jitter_hist[bucket]++;
+		}
+
+		// Hold back ticks while inhibited, they are accounted for on resume
+		if (tick_inhibit_flag && *tick_inhibit_flag) {
+			tick_suppressed++;
+			continue;
+		}
+		tick_function(elapsed);
+		tick_count++;
+		elapsed = 0;
+	}
+	return NULL;
+}
+
+bool tick_source_start(void (*func)(int elapsed), const bool *inhibit, pthread_attr_t *attr)
+{
+	tick_function = func;
+	tick_inhibit_flag = inhibit;
+	tick_count = tick_missed = tick_suppressed = tick_parked = 0;
+	tick_jitter_sum = tick_jitter_max = 0;
+	memset(tick_jitter_hist, 0, sizeof(tick_jitter_hist));
+	tick_start = tick_clock_ns();
+	tick_thread_cancel = false;
+	tick_thread_active = (pthread_create(&tick_thread, attr, tick_func, NULL) == 0);
+	return tick_thread_active;
+}
+
+void tick_source_stop(void)
+{
+	if (!tick_thread_active)
+		return;
+	tick_thread_cancel = true;
+#ifdef HAVE_PTHREAD_COND_INIT
+	pthread_mutex_lock(&tick_park_lock);
+	pthread_cond_signal(&tick_park_cond);
+	pthread_mutex_unlock(&tick_park_lock);
+#endif
+	pthread_join(tick_thread, NULL);
+	tick_thread_active = false;
+}
+
+void tick_report(void)
+{
+	uint64 wakeups = 0;
+	for (int i = 0; i < TICK_JITTER_BUCKETS; i++)
+		wakeups += tick_jitter_hist[i];
+	printf("Ticks: %llu delivered, %llu missed, %llu suppressed, %llu parked, wakeup latency avg %llu usec, max %llu usec\n",
+		(unsigned long long)tick_count, (unsigned long long)tick_missed, (unsigned long long)tick_suppressed, (unsigned long long)tick_parked,
+		(unsigned long long)(wakeups ? tick_jitter_sum / wakeups / 1000 : 0), (unsigned long long)(tick_jitter_max / 1000));
+	print_latency_histogram("Tick wakeup latency", tick_jitter_limit, TICK_JITTER_BUCKETS - 1, tick_jitter_hist);
+}
+#endif
+
+
 /*
  *  Suspend emulator thread, virtual CPU in idle mode
+ *
+ *  The emulator thread sleeps until an event source calls idle_resume()
+ *  (interrupts from the tick, timer and I/O threads all go through
+ *  TriggerInterrupt()), but never longer than until the next tick or
+ *  Time Manager task is due. A wakeup that arrives while the emulator
+ *  thread is not sleeping is remembered, so it can't get lost.
  */
 
+// The Time Manager deadline only backs up the notification of the timer
+// thread, so leave it some time to deliver it first. The tick deadline
+// is exact, the parked tick thread relies on it.
+const int64 IDLE_DEADLINE_SLACK = 1000;	// [usec]
+
 #ifdef HAVE_PTHREADS
 #if defined(HAVE_PTHREAD_COND_INIT)
 #define IDLE_USES_COND_WAIT 1
 static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static bool idle_pending = false;		// idle_resume() was called since the last idle_wait()
 #elif defined(HAVE_SEM_INIT)
 #define IDLE_USES_SEMAPHORE 1
 #include <semaphore.h>
@@ -365,12 +586,98 @@ static int idle_sem_ok = -1;
 #endif
 #endif
 
+// Ticks delivered at once while the emulator thread is idle (the tick
+// thread is parked then, see above)
+#ifdef IDLE_USES_COND_WAIT
+const int IDLE_TICK_BATCH = 4;
+#else
+const int IDLE_TICK_BATCH = 1;
+#endif
+
+// Statistics
+static uint64 idle_since;				// Time of first idle_wait() [usec]
+static uint64 idle_time;				// Time spent in idle_wait() [usec]
+static uint64 idle_waits;				// Calls of idle_wait()
+static uint64 idle_event_wakeups;		// Woken up by idle_resume()
+static uint64 idle_deadline_wakeups;	// Woken up by a deadline
+
+// Time until the earliest deadline [usec], or -1 if there is none
+static int64 idle_timeout(void)
+{
+	int64 timeout = -1;
+
+	// Next Time Manager task; when it's overdue, the timer thread is
+	// about to trigger its interrupt anyway
+	tm_time_t next, now, delta;
+	if (timer_next_wakeup(next)) {
+		timer_current_time(now);
+		if (timer_cmp_time(next, now) > 0) {
+			timer_sub_time(delta, next, now);
+#if defined(__MACH__) || defined(HAVE_CLOCK_GETTIME)
+			timeout = (int64)delta.tv_sec * 1000000 + delta.tv_nsec / 1000;
+#else
+			timeout = (int64)delta.tv_sec * 1000000 + delta.tv_usec;
+#endif
+			timeout += IDLE_DEADLINE_SLACK;
+		}
+	}
+
+#ifdef HAVE_PTHREADS
+	// Next tick to be delivered
+	if (tick_thread_active) {
+		uint64 phase = (tick_clock_ns() - tick_start) % TICK_PERIOD_NS;
+		int64 tick = (TICK_PERIOD_NS * IDLE_TICK_BATCH - phase) / 1000;
+		if (timeout < 0 || tick < timeout)
+			timeout = tick;
+	}
+#endif
+
+	return timeout;
+}
+
 void idle_wait(void)
 {
+	uint64 start = GetTicks_usec();
+	if (idle_since == 0)
+		idle_since = start;
+	idle_waits++;
+	int64 timeout = idle_timeout();
+
 #ifdef IDLE_USES_COND_WAIT
+	tick_request_park(true);
 	pthread_mutex_lock(&idle_lock);
-	pthread_cond_wait(&idle_cond, &idle_lock);
+	if (!idle_pending) {
+		if (timeout < 0) {
+			while (!idle_pending)
+				pthread_cond_wait(&idle_cond, &idle_lock);
+		} else {
+			struct timespec until;
+#ifdef HAVE_CLOCK_GETTIME
+			clock_gettime(CLOCK_REALTIME, &until);
+#else
+			struct timeval tv;
+			gettimeofday(&tv, NULL);
+			until.tv_sec = tv.tv_sec;
+			until.tv_nsec = tv.tv_usec * 1000;
+#endif
+			until.tv_sec += timeout / 1000000;
+			until.tv_nsec += (timeout % 1000000) * 1000;
+			if (until.tv_nsec >= 1000000000) {
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000;
+			}
+			while (!idle_pending)
+				if (pthread_cond_timedwait(&idle_cond, &idle_lock, &until) == ETIMEDOUT)
+					break;
+		}
+	}
+	if (idle_pending)
+		idle_event_wakeups++;
+	else
+		idle_deadline_wakeups++;
+	idle_pending = false;
 	pthread_mutex_unlock(&idle_lock);
+	tick_request_park(false);
 #else
 #ifdef IDLE_USES_SEMAPHORE
 	LOCK_IDLE;
@@ -380,14 +687,19 @@ void idle_wait(void)
 		idle_sem_ok++;
 		UNLOCK_IDLE;
 		sem_wait(&idle_sem);
+		idle_event_wakeups++;
+		idle_time += GetTicks_usec() - start;
 		return;
 	}
 	UNLOCK_IDLE;
 #endif
 
-	// Fallback: sleep 10 ms
-	Delay_usec(10000);
+	// Fallback: sleep until the next deadline, but no longer than 10 ms
+	Delay_usec(timeout >= 0 && timeout < 10000 ? timeout : 10000);
+	idle_deadline_wakeups++;
 #endif
+
+	idle_time += GetTicks_usec() - start;
 }
 
 
@@ -398,7 +710,10 @@ void idle_wait(void)
 void idle_resume(void)
 {
 #ifdef IDLE_USES_COND_WAIT
+	pthread_mutex_lock(&idle_lock);
+	idle_pending = true;
 	pthread_cond_signal(&idle_cond);
+	pthread_mutex_unlock(&idle_lock);
 #else
 #ifdef IDLE_USES_SEMAPHORE
 	LOCK_IDLE;
@@ -412,3 +727,19 @@ void idle_resume(void)
 #endif
 #endif
 }
+
+
+/*
+ *  Report how much of the time the emulator thread was idle
+ */
+
+void idle_report(void)
+{
+	if (idle_since == 0)
+		return;
+	uint64 total = GetTicks_usec() - idle_since;
+	printf("Idle: %llu of %llu msec (%d%%), %llu waits, %llu woken by events, %llu by deadlines\n",
+		(unsigned long long)(idle_time / 1000), (unsigned long long)(total / 1000),
+		total ? (int)(idle_time * 100 / total) : 0, (unsigned long long)idle_waits,
+		(unsigned long long)idle_event_wakeups, (unsigned long long)idle_deadline_wakeups);
+}
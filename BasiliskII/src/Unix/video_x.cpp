@@ -562,6 +562,11 @@ static int error_handler(Display *d, XErrorEvent *e)
 
 static void *vm_acquire_framebuffer(uint32 size)
 {
+	// Use the area reserved behind Mac RAM and ROM if there is one, so the
+	// frame buffer has a fixed Mac address (needed for snapshots)
+	if (vm_has_reserved(size))
+		return vm_acquire_reserved(size);
+
 	// always try to allocate framebuffer at the same address
 	static void *fb = VM_MAP_FAILED;
 	if (fb != VM_MAP_FAILED) {
@@ -575,7 +580,8 @@ static void *vm_acquire_framebuffer(uint32 size)
 
 static inline void vm_release_framebuffer(void *fb, uint32 size)
 {
-	vm_release(fb, size);
+	if (!vm_is_reserved(fb))
+		vm_release(fb, size);
 }
 #endif
 
@@ -33,6 +33,7 @@
 #include "prefs.h"
 #include "video.h"
 #include "adb.h"
+#include "snapshot.h"
 
 #ifdef POWERPC_ROM
 #include "thunks.h"
@@ -98,6 +99,40 @@ void ADBExit(void)
 }
 
 
+/*
+ *  Save/restore ADB device registers and mouse position (pressed keys and
+ *  buttons are not saved, they are released on restore)
+ */
+
+void ADBSaveState(snapshot_data &s)
+{
+	B2_lock_mutex(mouse_lock);
+	s.put_bytes(mouse_reg_3, sizeof(mouse_reg_3));
+	s.put_bytes(key_reg_2, sizeof(key_reg_2));
+	s.put_bytes(key_reg_3, sizeof(key_reg_3));
+	s.put32(old_mouse_x);
+	s.put32(old_mouse_y);
+	B2_unlock_mutex(mouse_lock);
+}
+
+bool ADBRestoreState(snapshot_data &s)
+{
+	B2_lock_mutex(mouse_lock);
+	s.get_bytes(mouse_reg_3, sizeof(mouse_reg_3));
+	s.get_bytes(key_reg_2, sizeof(key_reg_2));
+	s.get_bytes(key_reg_3, sizeof(key_reg_3));
+	mouse_x = old_mouse_x = (int32)s.get32();
+	mouse_y = old_mouse_y = (int32)s.get32();
+	memset(key_states, 0, sizeof(key_states));
+	key_read_ptr = key_write_ptr = 0;
+	for (int i = 0; i < 3; i++)
+		mouse_button[i] = old_mouse_button[i] = false;
+	button_read_ptr = button_write_ptr = 0;
+	B2_unlock_mutex(mouse_lock);
+	return s.ok();
+}
+
+
 /*
  *  ADBOp() replacement
  */
@@ -33,6 +33,7 @@
 #include "audio_defs.h"
 #include "user_strings.h"
 #include "cdrom.h"
+#include "snapshot.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -67,6 +68,59 @@ void AudioReset(void)
 }
 
 
+/*
+ *  Save/restore sound component state (the stream is restarted if the
+ *  component was open)
+ */
+
+void AudioSaveState(snapshot_data &s)
+{
+	s.put32(audio_data);
+	s.put32(open_count);
+	s.put8(AudioAvailable);
+	s.put32(AudioStatus.sample_rate);
+	s.put32(AudioStatus.sample_size);
+	s.put32(AudioStatus.channels);
+	s.put32(AudioStatus.mixer);
+	s.put32(AudioStatus.num_sources);
+	s.put32(SoundInSource);
+	s.put32(SoundInPlaythrough);
+	s.put32(SoundInGain);
+}
+
+bool AudioRestoreState(snapshot_data &s)
+{
+	audio_data = s.get32();
+	open_count = s.get32();
+	AudioAvailable = s.get8();
+	uint32 sample_rate = s.get32();
+	uint32 sample_size = s.get32();
+	uint32 channels = s.get32();
+	AudioStatus.mixer = s.get32();
+	AudioStatus.num_sources = s.get32();
+	SoundInSource = s.get32();
+	SoundInPlaythrough = s.get32();
+	SoundInGain = s.get32();
+	if (!s.ok())
+		return false;
+
+	// Switch to the saved format, if the host supports it
+	for (unsigned i=0; i<audio_sample_sizes.size(); i++)
+		if (audio_sample_sizes[i] == sample_size && sample_size != AudioStatus.sample_size)
+			audio_set_sample_size(i);
+	for (unsigned i=0; i<audio_sample_rates.size(); i++)
+		if (audio_sample_rates[i] == sample_rate && sample_rate != AudioStatus.sample_rate)
+			audio_set_sample_rate(i);
+	for (unsigned i=0; i<audio_channel_counts.size(); i++)
+		if (audio_channel_counts[i] == channels && channels != AudioStatus.channels)
+			audio_set_channels(i);
+
+	if (open_count > 0)
+		audio_enter_stream();
+	return true;
+}
+
+
 /*
  *  Get audio info
  */
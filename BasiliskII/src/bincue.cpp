@@ -19,7 +19,7 @@
 /* Geoffrey Brown 2010
  * Includes ideas from dosbox src/dos/cdrom_image.cpp 
  *
- * Limitations:	1) cue files must reference single bin file
+ * Limitations:	1) all bin files of a cue sheet must use the same sector size
  *              2) only supports raw mode1 data and audio
  *              3) no support for audio flags
  *              4) requires SDL audio or OS X core audio
@@ -59,10 +59,12 @@ static int bincue_core_audio_callback(void);
 #endif
 
 #include "bincue.h"
+#include "prefs.h"
 #define DEBUG 0
 #include "debug.h"
 
 #define MAXTRACK 100
+#define MAXFILE 100
 #define MAXLINE 512
 #define CD_FRAMES 75
 //#define RAW_SECTOR_SIZE		2352
@@ -102,10 +104,26 @@ typedef struct {
 	unsigned char tcf;		// Track control field
 } Track;
 
+// Number of raw sectors fetched per read when extracting cooked data
+#define READ_SECTORS 32
+
+// Bin files of a cue sheet are treated as one image, concatenated in
+// the order of their FILE statements. Each file covers a whole number
+// of frames.
+
+typedef struct {
+	char *name;				// Binary file name
+	loff_t start;			// Byte position of file within image
+	loff_t size;			// file length in bytes
+	unsigned int frames;	// file length in frames
+} BinFile;
+
 typedef struct {
-	char *binfile;			// Binary file name
-	unsigned int length;	// file length in frames
-	int binfh;				// binary file handle
+	int fcnt;				// number of bin files
+	BinFile files[MAXFILE];	// Bin files, sorted by start
+	int binfh[MAXFILE];		// bin file handles for data reads
+	uint8 *secbuf;			// raw sectors for data reads
+	unsigned int length;	// image length in frames
 	int tcnt;				// number of tracks
 	Track tracks[MAXTRACK]; // Track management
 	int raw_sector_size;	// Raw bytes to read per sector
@@ -114,9 +132,15 @@ typedef struct {
 	int big_endian_audio;   // Expect raw audio samples in big-endian format
 } CueSheet;
 
+#ifdef USE_SDL_AUDIO
+struct ReadAhead;
+#endif
+
 typedef struct CDPlayer {
 	CueSheet *cs;				// cue sheet to play from
-	int audiofh;				// file handle for audio data
+	int audiofh[MAXFILE];		// file handles for audio data
+	uint8 *buf;					// audio data for one callback
+	int bufsize;
 	unsigned int audioposition; // current position from audiostart (bytes)
 	unsigned int audiostart;	// start position if playing (frame)
 	unsigned int audioend;		// end position if playing (frames)
@@ -134,6 +158,7 @@ typedef struct CDPlayer {
 #endif
 #ifdef USE_SDL_AUDIO
 	SDL_AudioStream *stream;
+	ReadAhead *readahead;		// background reader for audio data
 #endif
 } CDPlayer;
 
@@ -147,6 +172,7 @@ typedef struct {
 
 static unsigned int totalPregap;
 static unsigned int prestart;
+static unsigned int fileStart;	// first frame of current bin file
 
 // Current audio output settings
 
@@ -207,6 +233,94 @@ static int MSFToFrames(MSF msf)
 }
 
 
+static ssize_t bin_pread(int fd, void *buf, size_t len, loff_t pos)
+{
+#ifdef WIN32
+	if (lseek(fd, pos, SEEK_SET) < 0)
+		return -1;
+	return read(fd, buf, len);
+#else
+	return pread(fd, buf, len, pos);
+#endif
+}
+
+static int OpenBinFile(const char *name)
+{
+#ifdef WIN32
+	return open(name, O_RDONLY|O_BINARY);
+#else
+	return open(name, O_RDONLY);
+#endif
+}
+
+// Open a set of handles for all bin files of a cue sheet
+static bool OpenBinFiles(CueSheet *cs, int *fds)
+{
+	for (int i = 0; i < cs->fcnt; i++) {
+		if ((fds[i] = OpenBinFile(cs->files[i].name)) < 0) {
+			D(bug("Can't read bin file %s\n", cs->files[i].name));
+			while (i-- > 0) {
+				close(fds[i]);
+				fds[i] = -1;
+			}
+			return false;
+		}
+	}
+	return true;
+}
+
+static void CloseBinFiles(CueSheet *cs, int *fds)
+{
+	for (int i = 0; i < cs->fcnt; i++)
+		if (fds[i] >= 0)
+			close(fds[i]);
+}
+
+/*
+ * Read from the image, which may span several bin files, using the
+ * given set of file handles. Returns number of bytes read.
+ */
+
+static size_t ReadImage(CueSheet *cs, int *fds, uint8 *buf, loff_t pos, size_t len)
+{
+	// Find file containing pos
+	int lo = 0, hi = cs->fcnt - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (cs->files[mid].start <= pos)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	size_t done = 0;
+	for (int i = lo; len && i < cs->fcnt; i++) {
+		BinFile *f = &cs->files[i];
+		loff_t end = f->start + (loff_t)f->frames * cs->raw_sector_size;
+		if (pos < f->start || pos >= end)
+			break;
+		size_t want = (end - pos < (loff_t)len) ? (size_t)(end - pos) : len;
+		ssize_t ret = bin_pread(fds[i], buf + done, want, pos - f->start);
+		if (ret <= 0)
+			break;
+		done += ret;
+		pos += ret;
+		len -= ret;
+		if ((size_t)ret < want)
+			break;
+	}
+	return done;
+}
+
+static void FreeCueSheet(CueSheet *cs)
+{
+	CloseBinFiles(cs, cs->binfh);
+	for (int i = 0; i < cs->fcnt; i++)
+		free(cs->files[i].name);
+	free(cs->secbuf);
+	free(cs);
+}
+
 static int PositionToTrack(CueSheet *cs, unsigned int position)
 {
 	int i;
@@ -292,6 +406,7 @@ static bool ParseCueSheet(FILE *fh, CueSheet *cs, const char *cuefile)
 	
 	totalPregap = 0;
 	prestart = 0;
+	fileStart = 0;
 	
 	// Use Audio CD settings by default, otherwise data mode will be specified
 	cs->raw_sector_size = 2352;
@@ -316,12 +431,16 @@ static bool ParseCueSheet(FILE *fh, CueSheet *cs, const char *cuefile)
 				char *filename;
 				char *filetype;
 
-				if (i_line > 1) {
-					D(bug("More than one FILE token\n"));
-					goto fail;	
-				}	
+				if (cs->fcnt == MAXFILE) {
+					D(bug("Too many FILE tokens\n"));
+					goto fail;
+				}
 				filename = strtok(NULL, "\"\t\n\r");
 				filetype = strtok(NULL, " \"\t\n\r");
+				if (!filename || !filetype) {
+					D(bug("Bad FILE token\n"));
+					goto fail;
+				}
 				if (strcmp("BINARY", filetype) && strcmp("MOTOROLA", filetype)) {
 					D(bug("Not binary file %s\n", filetype));
 					goto fail;
@@ -329,11 +448,29 @@ static bool ParseCueSheet(FILE *fh, CueSheet *cs, const char *cuefile)
 				else {
 					if (!strcmp("MOTOROLA", filetype))
 						cs->big_endian_audio = true;
+
+					// Frame positions in the cue sheet are relative to
+					// the current file, which follows the previous one
+					BinFile *f = &cs->files[cs->fcnt];
+					if (cs->fcnt > 0) {
+						BinFile *prev = f - 1;
+						prev->frames = prev->size / cs->raw_sector_size;
+						fileStart += prev->frames;
+						f->start = prev->start + (loff_t)prev->frames * cs->raw_sector_size;
+					}
 					char *tmp = strdup(cuefile);
 					char *b = dirname(tmp);
-					cs->binfile = (char *) malloc(strlen(b) + strlen(filename) + 2);
-					sprintf(cs->binfile, "%s/%s", b, filename);
+					f->name = (char *) malloc(strlen(b) + strlen(filename) + 2);
+					sprintf(f->name, "%s/%s", b, filename);
 					free(tmp);
+					cs->fcnt++;
+
+					struct stat buf;
+					if (stat(f->name, &buf)) {
+						D(bug("Can't stat bin file %s\n", f->name));
+						goto fail;
+					}
+					f->size = buf.st_size;
 				}
 			} else if (!strcmp("TRACK", keyword)) {
 				char *field;
@@ -406,9 +543,9 @@ static bool ParseCueSheet(FILE *fh, CueSheet *cs, const char *cuefile)
 				}
 
 				if (i_index == 1)
-					curr->start = MSFToFrames(msf);
+					curr->start = fileStart + MSFToFrames(msf);
 				else if (i_index == 0)
-					prestart = MSFToFrames(msf);
+					prestart = fileStart + MSFToFrames(msf);
 			} else if (!strcmp("PREGAP", keyword)) {
 				MSF msf;
 				char *field = strtok(NULL, " \t\n\r");
@@ -452,58 +589,45 @@ static bool ParseCueSheet(FILE *fh, CueSheet *cs, const char *cuefile)
 static bool LoadCueSheet(const char *cuefile, CueSheet *cs)
 {
 	FILE *fh = NULL;
-	int binfh = -1;
-	struct stat buf;
 	Track *tlast = NULL;
+	BinFile *flast = NULL;
 
 	if (cs) {
 		bzero(cs, sizeof(*cs));
+		for (int i = 0; i < MAXFILE; i++)
+			cs->binfh[i] = -1;
 		if (!(fh = fopen(cuefile, "r")))
 			return false;
 
-		if (!ParseCueSheet(fh, cs, cuefile)) goto fail;
-
-		// Open bin file and find length
-		#ifdef WIN32
-			binfh = open(cs->binfile,O_RDONLY|O_BINARY);
-		#else
-			binfh = open(cs->binfile,O_RDONLY);
-		#endif
-		if (binfh < 0) {
-			D(bug("Can't read bin file %s\n", cs->binfile));
+		if (!ParseCueSheet(fh, cs, cuefile) || cs->fcnt == 0 || cs->tcnt == 0)
 			goto fail;
-		}
 
-		if (fstat(binfh, &buf)) {
-			D(bug("fstat returned error\n"));
+		// Open bin files
+		if (!OpenBinFiles(cs, cs->binfh))
 			goto fail;
-		}
 
-		// compute length of final track
+		// compute length of image and final track
 
+		flast = &cs->files[cs->fcnt - 1];
+		flast->frames = flast->size / cs->raw_sector_size;
+		cs->length = flast->start / cs->raw_sector_size + flast->frames;
 
 		tlast = &cs->tracks[cs->tcnt - 1];
-		tlast->length = buf.st_size/cs->raw_sector_size
-						- tlast->start + totalPregap;
+		tlast->length = cs->length - tlast->start + totalPregap;
 
 		if (tlast->length < 0) {
 			D(bug("Binary file too short \n"));
  		  	goto fail;	
    	    }
 
-		// save bin file length and pointer
-
-		cs->length = buf.st_size/cs->raw_sector_size;
-		cs->binfh = binfh;
-
 		fclose(fh);
 		return true;
 
 	  fail:
-		if (binfh >= 0)
-			close(binfh);	
+		CloseBinFiles(cs, cs->binfh);
+		for (int i = 0; i < cs->fcnt; i++)
+			free(cs->files[i].name);
 		fclose(fh);
-		free(cs->binfile);
 		return false;
 
     }
@@ -513,8 +637,185 @@ static bool LoadCueSheet(const char *cuefile, CueSheet *cs)
 #ifdef USE_SDL_AUDIO
 	static void OpenPlayerStream(CDPlayer * player);
 	static void ClosePlayerStream(CDPlayer * player);
+
+/*
+ * Background read-ahead of CD audio data
+ *
+ * The audio callback must not wait for the disk, so a reader thread per
+ * player keeps a ring buffer filled with the image data following the
+ * last position played. A read that is not in the ring (after a seek or
+ * when the reader fell behind) is done synchronously, and the reader
+ * restarts behind it.
+ */
+
+#define READAHEAD_CHUNK (25 * 2352)				// 1/3 second of audio
+#define READAHEAD_SIZE (6 * READAHEAD_CHUNK)	// 2 seconds of audio
+
+#if SDL_VERSION_ATLEAST(3, 0, 0)
+typedef SDL_Condition ReadAheadCond;
+#define CreateReadAheadCond		SDL_CreateCondition
+#define DestroyReadAheadCond	SDL_DestroyCondition
+#define WaitReadAheadCond		SDL_WaitCondition
+#define SignalReadAheadCond		SDL_SignalCondition
+#else
+typedef SDL_cond ReadAheadCond;
+#define CreateReadAheadCond		SDL_CreateCond
+#define DestroyReadAheadCond	SDL_DestroyCond
+#define WaitReadAheadCond		SDL_CondWait
+#define SignalReadAheadCond		SDL_CondSignal
+#endif
+
+struct ReadAhead {
+	CueSheet *cs;
+	int fds[MAXFILE];			// private file handles of reader thread
+	uint8 *ring;				// READAHEAD_SIZE bytes
+	size_t head;				// ring index of data at "start"
+	size_t fill;				// valid bytes in ring
+	loff_t start;				// image position of first valid byte, -1 = idle
+	unsigned int generation;	// changes when the ring is restarted
+	bool eof;					// end of image reached
+	bool waiting;				// reader thread waits for room or a restart
+	bool quit;
+#if SDL_VERSION_ATLEAST(3, 0, 0)
+	SDL_Mutex *lock;
+#else
+	SDL_mutex *lock;
+#endif
+	ReadAheadCond *cond;
+	SDL_Thread *thread;
+};
+
+static int ReadAheadThread(void *arg)
+{
+	ReadAhead *ra = (ReadAhead *)arg;
+	uint8 *chunk = (uint8 *) malloc(READAHEAD_CHUNK);
+	if (!chunk)
+		return 0;
+
+	SDL_LockMutex(ra->lock);
+	while (!ra->quit) {
+		if (ra->start < 0 || ra->eof || READAHEAD_SIZE - ra->fill < READAHEAD_CHUNK) {
+			ra->waiting = true;
+			WaitReadAheadCond(ra->cond, ra->lock);
+			ra->waiting = false;
+			continue;
+		}
+		loff_t pos = ra->start + ra->fill;
+		unsigned int generation = ra->generation;
+		SDL_UnlockMutex(ra->lock);
+
+		size_t got = ReadImage(ra->cs, ra->fds, chunk, pos, READAHEAD_CHUNK);
+
+		SDL_LockMutex(ra->lock);
+		if (generation != ra->generation)	// restarted meanwhile, discard
+			continue;
+		size_t tail = (ra->head + ra->fill) % READAHEAD_SIZE;
+		size_t first = READAHEAD_SIZE - tail;
+		if (first > got)
+			first = got;
+		memcpy(ra->ring + tail, chunk, first);
+		memcpy(ra->ring, chunk + first, got - first);
+		ra->fill += got;
+		if (got < READAHEAD_CHUNK)
+			ra->eof = true;
+	}
+	SDL_UnlockMutex(ra->lock);
+	free(chunk);
+	return 0;
+}
+
+static ReadAhead *StartReadAhead(CueSheet *cs)
+{
+	ReadAhead *ra = (ReadAhead *) calloc(1, sizeof(ReadAhead));
+	if (!ra)
+		return NULL;
+	ra->cs = cs;
+	ra->start = -1;
+	ra->ring = (uint8 *) malloc(READAHEAD_SIZE);
+	ra->lock = SDL_CreateMutex();
+	ra->cond = CreateReadAheadCond();
+	if (ra->ring && ra->lock && ra->cond && OpenBinFiles(cs, ra->fds)) {
+		ra->thread = SDL_CreateThread(ReadAheadThread, "CD audio read-ahead", ra);
+		if (ra->thread)
+			return ra;
+		CloseBinFiles(cs, ra->fds);
+	}
+	D(bug("Failed to start CD audio read-ahead\n"));
+	if (ra->cond)
+		DestroyReadAheadCond(ra->cond);
+	if (ra->lock)
+		SDL_DestroyMutex(ra->lock);
+	free(ra->ring);
+	free(ra);
+	return NULL;
+}
+
+static void StopReadAhead(ReadAhead *ra)
+{
+	SDL_LockMutex(ra->lock);
+	ra->quit = true;
+	SignalReadAheadCond(ra->cond);
+	SDL_UnlockMutex(ra->lock);
+	SDL_WaitThread(ra->thread, NULL);
+	CloseBinFiles(ra->cs, ra->fds);
+	DestroyReadAheadCond(ra->cond);
+	SDL_DestroyMutex(ra->lock);
+	free(ra->ring);
+	free(ra);
+}
+
+// Get audio data, from the ring if possible
+static size_t ReadAheadGet(ReadAhead *ra, uint8 *buf, loff_t pos, size_t len)
+{
+	size_t got = 0;
+	SDL_LockMutex(ra->lock);
+	if (ra->start >= 0 && pos >= ra->start && pos < ra->start + (loff_t)ra->fill) {
+		size_t skip = pos - ra->start;
+		got = ra->fill - skip;
+		if (got > len)
+			got = len;
+		size_t index = (ra->head + skip) % READAHEAD_SIZE;
+		size_t first = READAHEAD_SIZE - index;
+		if (first > got)
+			first = got;
+		memcpy(buf, ra->ring + index, first);
+		memcpy(buf + first, ra->ring, got - first);
+		ra->head = (index + got) % READAHEAD_SIZE;
+		ra->fill -= skip + got;
+		ra->start = pos + got;
+	}
+	if (got < len) {
+		// Miss, restart behind the data read synchronously
+		D(bug("CD audio read-ahead miss at %lld\n", (long long)(pos + got)));
+		ra->head = 0;
+		ra->fill = 0;
+		ra->start = pos + len;
+		ra->eof = false;
+		ra->generation++;
+	}
+
+	// Only wake up the reader when it has a whole chunk to read, every
+	// wakeup may cost the audio thread its time slice
+	if (ra->waiting && !ra->eof && READAHEAD_SIZE - ra->fill >= READAHEAD_CHUNK)
+		SignalReadAheadCond(ra->cond);
+	SDL_UnlockMutex(ra->lock);
+	return got;
+}
 #endif
 
+// Read audio data for a player
+static size_t ReadAudio(CDPlayer *player, uint8 *buf, loff_t pos, size_t len)
+{
+	size_t got = 0;
+#ifdef USE_SDL_AUDIO
+	if (player->readahead)
+		got = ReadAheadGet(player->readahead, buf, pos, len);
+#endif
+	if (got < len)
+		got += ReadImage(player->cs, player->audiofh, buf + got, pos + got, len - got);
+	return got;
+}
+
 
 void *open_bincue(const char *name)
 {
@@ -538,9 +839,14 @@ void *open_bincue(const char *name)
 			player->audiostatus = CDROM_AUDIO_NO_STATUS;
 		else
 			player->audiostatus = CDROM_AUDIO_INVALID;
-		player->audiofh = dup(cs->binfh);
+		player->buf = NULL;
+		player->bufsize = 0;
+		for (int i = 0; i < MAXFILE; i++)
+			player->audiofh[i] = -1;
+		OpenBinFiles(cs, player->audiofh);
 
 #ifdef USE_SDL_AUDIO
+		player->readahead = PrefsFindBool("cdreadahead") ? StartReadAhead(cs) : NULL;
 		OpenPlayerStream(player);
 #endif
 
@@ -568,10 +874,14 @@ void close_bincue(void *fh)
 
 		players.remove(player);
 
-		free(cs);
 #ifdef USE_SDL_AUDIO
 		ClosePlayerStream(player);
+		if (player->readahead)
+			StopReadAhead(player->readahead);
 #endif
+		CloseBinFiles(cs, player->audiofh);
+		FreeCueSheet(cs);
+		free(player->buf);
 		free(player);
 	}
 }
@@ -590,56 +900,72 @@ void close_bincue(void *fh)
  * sector.  We compute the byte address of that sector (sec)
  * and the offset of the first byte we want within that sector (secoff)
  *
- * Reading is performed one raw sector at a time, extracting as many
- * valid bytes as possible from that raw sector (available)
+ * Raw sectors are read READ_SECTORS at a time, then as many valid
+ * bytes as possible are extracted from each of them. Images without
+ * header or error bytes are read directly into the target buffer.
  */
 
 size_t read_bincue(void *fh, void *b, loff_t offset, size_t len)
 {
 	CueSheet *cs = (CueSheet *) fh;
-	
+	if (cs == NULL)
+		return 0;
+
+	if (cs->raw_sector_size == cs->cooked_sector_size)
+		return ReadImage(cs, cs->binfh, (uint8 *) b, offset, len);
+
+	if (cs->secbuf == NULL) {
+		cs->secbuf = (uint8 *) malloc(READ_SECTORS * cs->raw_sector_size);
+		if (cs->secbuf == NULL)
+			return 0;
+	}
+
 	size_t bytes_read = 0;						// bytes read so far
 	unsigned char *buf = (unsigned char *) b;	// target buffer
-	unsigned char secbuf[cs->raw_sector_size];		// temporary buffer
 
-	off_t sec = ((offset/cs->cooked_sector_size) * cs->raw_sector_size);
-	off_t secoff = offset % cs->cooked_sector_size;
+	loff_t sec = ((offset/cs->cooked_sector_size) * cs->raw_sector_size);
+	size_t secoff = offset % cs->cooked_sector_size;
 
 	// sec contains location (in bytes) of next raw sector to read
 	// secoff contains offset within that sector at which to start
 	// reading since we can request a read that starts in the middle
 	// of a sector
 
-	if (cs == NULL || lseek(cs->binfh, sec, SEEK_SET) < 0) {
-		return -1;
-	}
 	while (len) {
 
-		// bytes available in next raw sector or len (bytes)
-		// we want whichever is less
+		// read as many raw sectors as needed, up to READ_SECTORS
 
-		size_t available = cs->cooked_sector_size - secoff;
-		available = (available > len) ? len : available;
+		size_t nsec = (secoff + len + cs->cooked_sector_size - 1) / cs->cooked_sector_size;
+		if (nsec > READ_SECTORS)
+			nsec = READ_SECTORS;
+		size_t got = ReadImage(cs, cs->binfh, cs->secbuf, sec, nsec * cs->raw_sector_size);
+		nsec = got / cs->raw_sector_size;
+		if (nsec == 0)
+			return bytes_read;
 
-		// read the next raw sector
+		for (size_t i = 0; i < nsec && len; i++) {
 
-		if (read(cs->binfh, secbuf, cs->raw_sector_size) != cs->raw_sector_size) {
-			return bytes_read;
-		}
+			// bytes available in this raw sector or len (bytes)
+			// we want whichever is less
 
-		// copy cooked sector bytes (skip header if needed, typically 16 bytes)
-		// we want out of those available
+			size_t available = cs->cooked_sector_size - secoff;
+			available = (available > len) ? len : available;
 
-		bcopy(&secbuf[cs->header_size+secoff], &buf[bytes_read], available);
+			// copy cooked sector bytes (skip header if needed, typically 16 bytes)
+			// we want out of those available
 
-		// next sector we start at the beginning
+			memcpy(&buf[bytes_read], &cs->secbuf[i * cs->raw_sector_size + cs->header_size + secoff], available);
 
-		secoff = 0;
+			// next sector we start at the beginning
 
-		// increment running count decrement request
+			secoff = 0;
 
-		bytes_read += available;
-		len -= available;
+			// increment running count decrement request
+
+			bytes_read += available;
+			len -= available;
+		}
+		sec += nsec * cs->raw_sector_size;
 	}
 	return bytes_read;
 }
@@ -961,21 +1287,21 @@ void CDGetVol_bincue(void* fh, uint8* left, uint8* right) {
 
 static uint8 *fill_buffer(int stream_len, CDPlayer* player)
 {
-	static uint8 *buf = 0;
-	static int bufsize = 0;
 	int offset = 0;
 
-	if (bufsize < stream_len) {
-		free(buf);
-		buf = (uint8 *) malloc(stream_len);
-		if (buf) {
-			bufsize = stream_len;
+	if (player->bufsize < stream_len) {
+		free(player->buf);
+		player->buf = (uint8 *) malloc(stream_len);
+		if (player->buf) {
+			player->bufsize = stream_len;
 		}
 		else {
+			player->bufsize = 0;
 			D(bug("malloc failed \n"));
 			return NULL;
 		}
 	}
+	uint8 *buf = player->buf;
 
 	memset(buf, silence_byte, stream_len);
 		
@@ -1056,22 +1382,16 @@ static uint8 *fill_buffer(int stream_len, CDPlayer* player)
 			}
 			current_read_bytes_limit = full_read_bytes_limit;
 
-			if (lseek(player->audiofh,
-					  player->fileoffset + player->audioposition - player->silence,
-						  SEEK_SET) < 0)
-				return NULL;
-
 			if (available < 0) {
 				player->audioposition += available; // correct end !;
 				available = 0;
 			}
 
-			ssize_t ret = 0;
-			if ((ret = read(player->audiofh, &buf[offset], available)) >= 0) {
-				player->audioposition += ret;
-				offset += ret;
-				available -= ret;
-			}
+			size_t ret = ReadAudio(player, &buf[offset],
+				player->fileoffset + player->audioposition - player->silence, available);
+			player->audioposition += ret;
+			offset += ret;
+			available -= ret;
 
 			if ((int)player->audioposition + jump_bytes_after < 0) {
 				player->audiostatus = CDROM_AUDIO_COMPLETED;
@@ -1098,9 +1418,12 @@ bool HaveAudioToMix_bincue() {
 	return currently_playing != NULL;
 }
 
-void MixAudio_bincue(uint8 *stream, int dest_stream_len)
+// Get CD audio in the output format, volume is returned as 8.8 fixed point
+bool GetAudio_bincue(uint8 *stream, int dest_stream_len, int *volume)
 {
-	if (!dest_stream_len) return;
+	bool have_audio = false;
+
+	if (!dest_stream_len) return false;
 
 	if (currently_playing) {
 		LOCK_PLAYER;
@@ -1119,39 +1442,30 @@ void MixAudio_bincue(uint8 *stream, int dest_stream_len)
 		int dest_channels_sample = o.freq * o.channels * dest_format_bytes;
 		int src_stream_len = (int)((uint64) dest_stream_len * source_channels_sample / dest_channels_sample);
 
-		if (player->audiostatus == CDROM_AUDIO_PLAY) {
-			//D(bug("MixAudio cd playing, player=0x%p\n", player));
+		if (player->audiostatus == CDROM_AUDIO_PLAY && player->stream) {
+			//D(bug("GetAudio cd playing, player=0x%p\n", player));
 			uint8 *buf = fill_buffer(src_stream_len, player);
 #if SDL_VERSION_ATLEAST(3, 0, 0)
 			if (buf)
 				SDL_PutAudioStreamData(player->stream, buf, src_stream_len);
 			int avail = SDL_GetAudioStreamAvailable(player->stream);
-			if (avail >= dest_stream_len) {
-				//D(bug("have bytes avail %d stream len %d\n", avail, dest_stream_len));
-				uint8 converted[dest_stream_len];
-				SDL_GetAudioStreamData(player->stream, converted, dest_stream_len);
-				float volume = (float)player->volume_mono/128;
-				// Apply 60% volume while scanning (ff/reverse)
-				if (player->scanning) volume *= 0.6;
-				SDL_MixAudio(stream, converted, (SDL_AudioFormat) o.format, dest_stream_len, volume);
-			}
+			if (avail >= dest_stream_len)
+				have_audio = SDL_GetAudioStreamData(player->stream, stream, dest_stream_len) == dest_stream_len;
 #else
 			if (buf)
 				SDL_AudioStreamPut(player->stream, buf, src_stream_len);
 			int avail = SDL_AudioStreamAvailable(player->stream);
-			if (avail >= dest_stream_len) {
-				//D(bug("have bytes avail %d stream len %d\n", avail, dest_stream_len));
-				uint8 converted[dest_stream_len];
-				SDL_AudioStreamGet(player->stream, converted, dest_stream_len);
-				int volume = player->volume_mono;
-				// Apply 60% volume while scanning (ff/reverse)
-				if (player->scanning) volume = volume * 3 / 5;
-				SDL_MixAudio(stream, converted, dest_stream_len, volume);
-			}
+			if (avail >= dest_stream_len)
+				have_audio = SDL_AudioStreamGet(player->stream, stream, dest_stream_len) == dest_stream_len;
 #endif
+			// Convert from 0-128, apply 60% volume while scanning (ff/reverse)
+			*volume = player->volume_mono * 0x100 / 128;
+			if (player->scanning)
+				*volume = *volume * 3 / 5;
 		}
 		UNLOCK_PLAYER;
 	}
+	return have_audio;
 }
 
 static void OpenPlayerStream(CDPlayer * player) {
@@ -31,6 +31,7 @@
 #include "sysdeps.h"
 
 #include <string.h>
+#include <string>
 #include <vector>
 #include <map>
 
@@ -44,6 +45,7 @@ using std::vector;
 #include "sys.h"
 #include "prefs.h"
 #include "cdrom.h"
+#include "snapshot.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -151,6 +153,7 @@ struct cdrom_drive_info {
 	bool drop;  		// Disc image mounted by drag-and-drop
 	bool init_null;		// Init even if null
 	uint16 driver_reference_number;  // The driver reference number to use for this drive's entry in the unit table
+	std::string name;	// File/device name from the prefs or of the dropped image
 };
 
 // List of drives handled by this driver
@@ -322,8 +325,10 @@ void CDROMInit(void)
 	const char *str;
 	while ((str = PrefsFindString("cdrom", index++)) != NULL) {
 		void *fh = Sys_open(str, true, true);
-		if (fh)
+		if (fh) {
 			drives.push_back(cdrom_drive_info(fh));
+			drives.back().name = str;
+		}
 	}
 
 	if (drives.empty()) {
@@ -339,8 +344,10 @@ void CDROMDrop(const char *path) {
 		cdrom_drive_info &info = drives.back();
 		if (!info.drop) {
 			info.fh = Sys_open(path, true, true);
-			if (info.fh)
+			if (info.fh) {
 				info.drop = true;
+				info.name = path;
+			}
 		}
 	}
 }
@@ -360,6 +367,65 @@ void CDROMExit(void)
 }
 
 
+/*
+ *  Save/restore driver state (the drives and their disc images must be the
+ *  same on restore, audio playback is not resumed)
+ */
+
+void CDROMSaveState(snapshot_data &s)
+{
+	s.put8(acc_run_called);
+	s.put32(drives.size());
+	for (drive_vec::const_iterator info = drives.begin(); info != drives.end(); ++info) {
+		s.put_file(info->name.c_str(), info->fh ? SysGetFileSize(info->fh) : 0);
+		s.put32(info->num);
+		s.put32(info->status);
+		s.put32(info->block_size);
+		s.put32(info->twok_offset);
+		s.put64(info->start_byte);
+		s.put8(info->to_be_mounted);
+		s.put8(info->mount_non_hfs);
+		s.put_bytes(info->toc, sizeof(info->toc));
+		s.put_bytes(info->lead_out, sizeof(info->lead_out));
+		s.put_bytes(info->stop_at, sizeof(info->stop_at));
+		s.put_bytes(info->start_at, sizeof(info->start_at));
+		s.put8(info->play_mode);
+		s.put8(info->play_order);
+		s.put8(info->repeat);
+		s.put8(info->power_mode);
+		s.put16(info->driver_reference_number);
+	}
+}
+
+bool CDROMRestoreState(snapshot_data &s)
+{
+	acc_run_called = s.get8();
+	if (s.get32() != drives.size())
+		return false;
+	for (drive_vec::iterator info = drives.begin(); info != drives.end(); ++info) {
+		if (!s.check_file(info->name.c_str(), info->fh ? SysGetFileSize(info->fh) : 0))
+			return false;
+		info->num = s.get32();
+		info->status = s.get32();
+		info->block_size = s.get32();
+		info->twok_offset = s.get32();
+		info->start_byte = s.get64();
+		info->to_be_mounted = s.get8();
+		info->mount_non_hfs = s.get8();
+		s.get_bytes(info->toc, sizeof(info->toc));
+		s.get_bytes(info->lead_out, sizeof(info->lead_out));
+		s.get_bytes(info->stop_at, sizeof(info->stop_at));
+		s.get_bytes(info->start_at, sizeof(info->start_at));
+		info->play_mode = s.get8();
+		info->play_order = s.get8();
+		info->repeat = s.get8();
+		info->power_mode = s.get8();
+		info->driver_reference_number = s.get16();
+	}
+	return s.ok();
+}
+
+
 /*
  *  Disk was inserted, flag for mounting
  */
@@ -682,6 +748,7 @@ int16 CDROMControl(uint32 pb, uint32 dce)
 						info->close_fh();
 						info->drop = false;
 						info->fh = NULL;
+						info->name.clear();
 					}
 				}
 				else {
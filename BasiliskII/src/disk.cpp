@@ -29,6 +29,7 @@
 #include "sysdeps.h"
 
 #include <string.h>
+#include <string>
 #include <vector>
 
 #ifndef NO_STD_NAMESPACE
@@ -41,6 +42,7 @@ using std::vector;
 #include "sys.h"
 #include "prefs.h"
 #include "disk.h"
+#include "snapshot.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -73,7 +75,7 @@ const uint8 DiskIcon[258] = {
 // Struct for each drive
 struct disk_drive_info {
 	disk_drive_info() : num(0), fh(NULL), start_byte(0), read_only(false), status(0) {}
-	disk_drive_info(void *fh_, bool ro) : num(0), fh(fh_), read_only(ro), status(0) {}
+	disk_drive_info(void *fh_, bool ro, const char *name_) : num(0), fh(fh_), read_only(ro), status(0), name(name_) {}
 
 	void close_fh(void) { Sys_close(fh); }
 
@@ -84,6 +86,7 @@ struct disk_drive_info {
 	bool to_be_mounted;	// Flag: drive must be mounted in accRun
 	bool read_only;		// Flag: force write protection
 	uint32 status;		// Mac address of drive status record
+	std::string name;	// File/device name from the prefs
 };
 
 // List of drives handled by this driver
@@ -166,7 +169,7 @@ void DiskInit(void)
 		}
 		void *fh = Sys_open(str, read_only);
 		if (fh)
-			drives.push_back(disk_drive_info(fh, SysIsReadOnly(fh)));
+			drives.push_back(disk_drive_info(fh, SysIsReadOnly(fh), str));
 	}
 }
 
@@ -184,6 +187,43 @@ void DiskExit(void)
 }
 
 
+/*
+ *  Save/restore driver state (the drives and their image files must be the
+ *  same on restore)
+ */
+
+void DiskSaveState(snapshot_data &s)
+{
+	s.put8(acc_run_called);
+	s.put32(drives.size());
+	for (drive_vec::const_iterator info = drives.begin(); info != drives.end(); ++info) {
+		s.put_file(info->name.c_str(), SysGetFileSize(info->fh));
+		s.put32(info->num);
+		s.put32(info->status);
+		s.put64(info->start_byte);
+		s.put32(info->num_blocks);
+		s.put8(info->to_be_mounted);
+	}
+}
+
+bool DiskRestoreState(snapshot_data &s)
+{
+	acc_run_called = s.get8();
+	if (s.get32() != drives.size())
+		return false;
+	for (drive_vec::iterator info = drives.begin(); info != drives.end(); ++info) {
+		if (!s.check_file(info->name.c_str(), SysGetFileSize(info->fh)))
+			return false;
+		info->num = s.get32();
+		info->status = s.get32();
+		info->start_byte = s.get64();
+		info->num_blocks = s.get32();
+		info->to_be_mounted = s.get8();
+	}
+	return s.ok();
+}
+
+
 /*
  *  Disk was inserted, flag for mounting
  */
@@ -53,6 +53,10 @@ extern bool tick_inhibit;
 
 void PlayStartupSound();
 
+// Written by the tick source only; the 60Hz interrupt adds the ticks that
+// came on top since it last ran to Ticks
+volatile uint32 ExtraTicks = 0;
+
 /*
  *  Execute EMUL_OP opcode (called by 68k emulator or Illegal Instruction trap handler)
  */
@@ -449,14 +453,20 @@ void EmulOp(uint16 opcode, M68kRegisters *r)
 			break;
 		}
 
-		case M68K_EMUL_OP_IRQ:			// Level 1 interrupt
+		case M68K_EMUL_OP_IRQ: {		// Level 1 interrupt
 			r->d[0] = 0;
 
-			if (InterruptFlags & INTFLAG_60HZ) {
-				ClearInterruptFlag(INTFLAG_60HZ);
+			// Take all pending interrupts at once, anything raised while
+			// they are handled is left for the next interrupt
+			uint32 pending = InterruptFlags;
+			ClearInterruptFlag(pending);
 
-				// Increment Ticks variable
-				WriteMacInt32(0x16a, ReadMacInt32(0x16a) + 1);
+			if (pending & INTFLAG_60HZ) {
+				// Increment Ticks variable, also by the ticks that didn't get an interrupt
+				static uint32 extra_ticks_seen = 0;
+				uint32 extra = ExtraTicks - extra_ticks_seen;
+				extra_ticks_seen += extra;
+				WriteMacInt32(0x16a, ReadMacInt32(0x16a) + 1 + extra);
 
 				if (HasMacStarted()) {
 
@@ -477,8 +487,7 @@ void EmulOp(uint16 opcode, M68kRegisters *r)
 				}
 			}
 
-			if (InterruptFlags & INTFLAG_1HZ) {
-				ClearInterruptFlag(INTFLAG_1HZ);
+			if (pending & INTFLAG_1HZ) {
 				if (HasMacStarted()) {
 					SonyInterrupt();
 					DiskInterrupt();
@@ -486,38 +495,33 @@ void EmulOp(uint16 opcode, M68kRegisters *r)
 				}
 			}
 
-			if (InterruptFlags & INTFLAG_SERIAL) {
-				ClearInterruptFlag(INTFLAG_SERIAL);
+			if (pending & INTFLAG_SERIAL) {
 				SerialInterrupt();
 			}
 
-			if (InterruptFlags & INTFLAG_ETHER) {
-				ClearInterruptFlag(INTFLAG_ETHER);
+			if (pending & INTFLAG_ETHER) {
 				EtherInterrupt();
 			}
 #if PRECISE_TIMING
-			if (InterruptFlags & INTFLAG_TIMER) {
-				ClearInterruptFlag(INTFLAG_TIMER);
+			if (pending & INTFLAG_TIMER) {
 				TimerInterrupt();
 			}
 #endif
-			if (InterruptFlags & INTFLAG_AUDIO) {
-				ClearInterruptFlag(INTFLAG_AUDIO);
+			if (pending & INTFLAG_AUDIO) {
 				AudioInterrupt();
 			}
 
-			if (InterruptFlags & INTFLAG_ADB) {
-				ClearInterruptFlag(INTFLAG_ADB);
+			if (pending & INTFLAG_ADB) {
 				if (HasMacStarted())
 					ADBInterrupt();
 			}
 
-			if (InterruptFlags & INTFLAG_NMI) {
-				ClearInterruptFlag(INTFLAG_NMI);
+			if (pending & INTFLAG_NMI) {
 				if (HasMacStarted())
 					TriggerNMI();
 			}
 			break;
+		}
 
 		case M68K_EMUL_OP_PUT_SCRAP: {		// PutScrap() patch
 			void *scrap = Mac2HostAddr(ReadMacInt32(r->a[7] + 4));
@@ -46,6 +46,7 @@
 #include "prefs.h"
 #include "ether.h"
 #include "ether_defs.h"
+#include "snapshot.h"
 
 #ifndef NO_STD_NAMESPACE
 using std::map;
@@ -78,6 +79,9 @@ uint32 ether_data = 0;
 // Attached network protocols for UDP tunneling, maps protocol type to MacOS handler address
 static map<uint16, uint32> udp_protocols;
 
+// Protocols attached to the host network device (only tracked for snapshots)
+static map<uint16, uint32> net_protocols;
+
 
 /*
  *  Initialization
@@ -192,6 +196,7 @@ void EtherResetCachedAllocation();
 void EtherReset(void)
 {
 	udp_protocols.clear();
+	net_protocols.clear();
     EtherResetCachedAllocation();
 	ether_reset();
 }
@@ -291,8 +296,12 @@ int16 EtherControl(uint32 pb, uint32 dce)
 					if (udp_protocols.find(type) != udp_protocols.end())
 						return lapProtErr;
 					udp_protocols[type] = handler;
-				} else
-					return ether_attach_ph(type, handler);
+				} else {
+					int16 res = ether_attach_ph(type, handler);
+					if (res == noErr)
+						net_protocols[type] = handler;
+					return res;
+				}
 			}
 			return noErr;
 		}
@@ -304,8 +313,10 @@ int16 EtherControl(uint32 pb, uint32 dce)
 				if (udp_tunnel) {
 					if (udp_protocols.erase(type) == 0)
 						return lapProtErr;
-				} else
+				} else {
+					net_protocols.erase(type);
 					return ether_detach_ph(type);
+				}
 			}
 			return noErr;
 		}
@@ -496,3 +507,61 @@ EthernetPacket::~EthernetPacket()
 #else
 void EtherResetCachedAllocation() { }
 #endif
+
+
+/*
+ *  Save/restore driver state (attached protocol handlers are reattached,
+ *  multicast addresses are not restored)
+ */
+
+static void save_protocols(snapshot_data &s, const map<uint16, uint32> &protocols)
+{
+	s.put32(protocols.size());
+	for (map<uint16, uint32>::const_iterator i = protocols.begin(); i != protocols.end(); ++i) {
+		s.put16(i->first);
+		s.put32(i->second);
+	}
+}
+
+static void restore_protocols(snapshot_data &s, map<uint16, uint32> &protocols)
+{
+	protocols.clear();
+	uint32 num = s.get32();
+	for (uint32 i = 0; i < num && s.ok(); i++) {
+		uint16 type = s.get16();
+		protocols[type] = s.get32();
+	}
+}
+
+void EtherSaveState(snapshot_data &s)
+{
+	s.put32(ether_data);
+#if SIZEOF_VOID_P != 4 || REAL_ADDRESSING == 0
+	s.put32(ether_packet);
+#else
+	s.put32(0);
+#endif
+	save_protocols(s, udp_protocols);
+	save_protocols(s, net_protocols);
+}
+
+bool EtherRestoreState(snapshot_data &s)
+{
+	EtherReset();
+	ether_data = s.get32();
+#if SIZEOF_VOID_P != 4 || REAL_ADDRESSING == 0
+	ether_packet = s.get32();
+#else
+	s.get32();
+#endif
+	restore_protocols(s, udp_protocols);
+	map<uint16, uint32> protocols;
+	restore_protocols(s, protocols);
+	if (!s.ok())
+		return false;
+	if (net_open && !udp_tunnel)
+		for (map<uint16, uint32>::const_iterator i = protocols.begin(); i != protocols.end(); ++i)
+			if (ether_attach_ph(i->first, i->second) == noErr)
+				net_protocols[i->first] = i->second;
+	return true;
+}
@@ -42,6 +42,8 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
+#include <map>
 
 #ifndef WIN32
 #include <unistd.h>
@@ -60,6 +62,7 @@
 #include "user_strings.h"
 #include "extfs.h"
 #include "extfs_defs.h"
+#include "snapshot.h"
 
 #ifdef WIN32
 # include "posix_emu.h"
@@ -129,6 +132,9 @@ const int CLUMP_SIZE = 0x4000;
 // Drive number of our pseudo-drive
 static int drive_number;
 
+// Number of files opened by fs_open() (open files prevent snapshots)
+static int num_open_files = 0;
+
 
 // Disk/drive icon
 const uint8 ExtFSIcon[256] = {
@@ -152,9 +158,14 @@ const uint8 ExtFSIcon[256] = {
 };
 
 
+struct DirSnapshot;
+
 // These objects are used to map CNIDs to path names
 struct FSItem {
 	FSItem *next;			// Pointer to next FSItem in list
+	FSItem *next_id;		// Next FSItem in CNID hash chain
+	FSItem *next_name;		// Next FSItem in host name hash chain
+	FSItem *next_guest;		// Next FSItem in guest name hash chain
 	uint32 id;				// CNID of this file/dir
 	uint32 parent_id;		// CNID of parent file/dir
 	FSItem *parent;			// Pointer to parent
@@ -162,12 +173,52 @@ struct FSItem {
 	char guest_name[32];	// Object name (C string) - Guest OS
 	time_t mtime;			// Modification time for get_cat_info caching
 	int cache_dircount;		// Cached number of files in directory
+	DirSnapshot *snapshot;	// Cached directory listing for indexed access (or NULL)
 };
 
 static FSItem *first_fs_item, *last_fs_item;
 
 static uint32 next_cnid = fsUsrCNID;	// Next available CNID
 
+// Hash tables for looking up FSItems by CNID, by (parent, host name) and
+// by (parent, guest name); the chains are linked through the FSItems
+const uint32 FSITEM_HASH_MIN_SIZE = 1024;
+
+static FSItem **id_hash, **name_hash, **guest_hash;
+static uint32 fs_hash_size;		// Number of buckets (power of 2)
+static uint32 num_fs_items;		// Number of FSItems in hash tables
+
+// Snapshot of a directory's contents, used for indexed GetCatInfo/GetFileInfo
+// enumeration. Entries are sorted by host name; the stat() and Finder info
+// results of each entry are filled in on first use.
+enum {
+	DE_STAT = 1,			// st and attrib are valid
+	DE_FINFO = 2,			// finfo and fxinfo are valid
+	DE_RFORK = 4			// rf_size is valid
+};
+
+struct DirEntry {
+	char *name;				// Host name of entry
+	FSItem *item;			// FSItem of entry (or NULL if not looked up yet)
+	uint32 valid;			// Mask of valid cached fields (DE_*)
+	struct stat st;			// Cached stat() result
+	uint8 attrib;			// Cached ioFlAttrib lock bit
+	uint32 rf_size;			// Cached resource fork size
+	uint8 finfo[SIZEOF_FInfo];		// Cached Finder info
+	uint8 fxinfo[SIZEOF_FXInfo];	// Cached extended Finder info
+};
+
+struct DirSnapshot {
+	time_t dir_mtime;		// Modification time of directory when snapshot was taken
+	time_t taken;			// Time the snapshot was taken
+	int count;				// Number of entries
+	DirEntry *entries;		// Array of entries
+};
+
+// Snapshots are discarded after this many seconds even if the directory
+// mtime is unchanged, to pick up host-side changes to the entries themselves
+const time_t DIR_SNAPSHOT_TTL = 2;
+
 
 /*
  *  Get object creation time
@@ -207,17 +258,97 @@ static uint32 get_creation_time(const char *path)
 #endif
 
 
+/*
+ *  FSItem hash tables
+ */
+
+static inline uint32 hash_cnid(uint32 cnid)
+{
+	return cnid * 0x9e3779b1;
+}
+
+static uint32 hash_name(const FSItem *parent, const char *name)
+{
+	uint32 h = 2166136261u ^ (uint32)(uintptr)parent;
+	while (*name)
+		h = (h ^ (uint8)*name++) * 16777619;
+	return h ^ (h >> 15);
+}
+
+static void hash_fsitem(FSItem *p)
+{
+	uint32 mask = fs_hash_size - 1;
+	FSItem **b = &id_hash[hash_cnid(p->id) & mask];
+	p->next_id = *b;
+	*b = p;
+	b = &name_hash[hash_name(p->parent, p->name) & mask];
+	p->next_name = *b;
+	*b = p;
+	b = &guest_hash[hash_name(p->parent, p->guest_name) & mask];
+	p->next_guest = *b;
+	*b = p;
+}
+
+static void unhash_fsitem(FSItem *p)
+{
+	uint32 mask = fs_hash_size - 1;
+	FSItem **b = &id_hash[hash_cnid(p->id) & mask];
+	while (*b != p)
+		b = &(*b)->next_id;
+	*b = p->next_id;
+	b = &name_hash[hash_name(p->parent, p->name) & mask];
+	while (*b != p)
+		b = &(*b)->next_name;
+	*b = p->next_name;
+	b = &guest_hash[hash_name(p->parent, p->guest_name) & mask];
+	while (*b != p)
+		b = &(*b)->next_guest;
+	*b = p->next_guest;
+}
+
+static void resize_fsitem_hash(uint32 size)
+{
+	delete[] id_hash;
+	delete[] name_hash;
+	delete[] guest_hash;
+	fs_hash_size = size;
+	id_hash = new FSItem *[size];
+	name_hash = new FSItem *[size];
+	guest_hash = new FSItem *[size];
+	memset(id_hash, 0, size * sizeof(FSItem *));
+	memset(name_hash, 0, size * sizeof(FSItem *));
+	memset(guest_hash, 0, size * sizeof(FSItem *));
+	for (FSItem *p = first_fs_item; p; p = p->next)
+		hash_fsitem(p);
+}
+
+// Link new FSItem into list and hash tables
+static void add_fsitem(FSItem *p)
+{
+	p->next = NULL;
+	if (last_fs_item)
+		last_fs_item->next = p;
+	else
+		first_fs_item = p;
+	last_fs_item = p;
+	if (++num_fs_items > fs_hash_size)
+		resize_fsitem_hash(fs_hash_size * 2);	// also hashes p
+	else
+		hash_fsitem(p);
+}
+
+
 /*
  *  Find FSItem for given CNID
  */
 
 static FSItem *find_fsitem_by_id(uint32 cnid)
 {
-	FSItem *p = first_fs_item;
+	FSItem *p = id_hash[hash_cnid(cnid) & (fs_hash_size - 1)];
 	while (p) {
 		if (p->id == cnid)
 			return p;
-		p = p->next;
+		p = p->next_id;
 	}
 	return NULL;
 }
@@ -229,9 +360,6 @@ static FSItem *find_fsitem_by_id(uint32 cnid)
 static FSItem *create_fsitem(const char *name, const char *guest_name, FSItem *parent)
 {
 	FSItem *p = new FSItem;
-	last_fs_item->next = p;
-	p->next = NULL;
-	last_fs_item = p;
 	p->id = next_cnid++;
 	p->parent_id = parent->id;
 	p->parent = parent;
@@ -240,6 +368,8 @@ static FSItem *create_fsitem(const char *name, const char *guest_name, FSItem *p
 	strncpy(p->guest_name, guest_name, 31);
 	p->guest_name[31] = 0;
 	p->mtime = 0;
+	p->snapshot = NULL;
+	add_fsitem(p);
 	return p;
 }
 
@@ -249,11 +379,11 @@ static FSItem *create_fsitem(const char *name, const char *guest_name, FSItem *p
 
 static FSItem *find_fsitem(const char *name, FSItem *parent)
 {
-	FSItem *p = first_fs_item;
+	FSItem *p = name_hash[hash_name(parent, name) & (fs_hash_size - 1)];
 	while (p) {
 		if (p->parent == parent && !strcmp(p->name, name))
 			return p;
-		p = p->next;
+		p = p->next_name;
 	}
 
 	// Not found, construct new FSItem
@@ -266,11 +396,11 @@ static FSItem *find_fsitem(const char *name, FSItem *parent)
 
 static FSItem *find_fsitem_guest(const char *guest_name, FSItem *parent)
 {
-	FSItem *p = first_fs_item;
+	FSItem *p = guest_hash[hash_name(parent, guest_name) & (fs_hash_size - 1)];
 	while (p) {
 		if (p->parent == parent && !strcmp(p->guest_name, guest_name))
 			return p;
-		p = p->next;
+		p = p->next_guest;
 	}
 
 	// Not found, construct new FSItem
@@ -303,21 +433,164 @@ static void get_path_for_fsitem(FSItem *p)
 
 
 /*
- *  Exchange parent CNIDs in all FSItems
+ *  Exchange the locations (parent and names) of two FSItems after a
+ *  rename/move, so that the CNID of the moved object stays the same and
+ *  the FSItems below it follow it to its new path
  */
 
-static void swap_parent_ids(uint32 parent1, uint32 parent2)
+static void swap_fsitem_locations(FSItem *p1, FSItem *p2)
 {
-	FSItem *p = first_fs_item;
-	while (p) {
-		if (p->parent_id == parent1)
-			p->parent_id = parent2;
-		else if (p->parent_id == parent2)
-			p->parent_id = parent1;
-		p = p->next;
+	unhash_fsitem(p1);
+	unhash_fsitem(p2);
+
+	FSItem *parent = p1->parent;
+	p1->parent = p2->parent;
+	p2->parent = parent;
+	uint32 parent_id = p1->parent_id;
+	p1->parent_id = p2->parent_id;
+	p2->parent_id = parent_id;
+	char *name = p1->name;
+	p1->name = p2->name;
+	p2->name = name;
+	char guest_name[32];
+	memcpy(guest_name, p1->guest_name, 32);
+	memcpy(p1->guest_name, p2->guest_name, 32);
+	memcpy(p2->guest_name, guest_name, 32);
+
+	hash_fsitem(p1);
+	hash_fsitem(p2);
+}
+
+
+/*
+ *  Directory snapshots
+ */
+
+static void free_dir_snapshot(DirSnapshot *s)
+{
+	for (int i=0; i<s->count; i++)
+		delete[] s->entries[i].name;
+	delete[] s->entries;
+	delete s;
+}
+
+// Discard cached listing of directory (after it or one of its entries changed)
+static void invalidate_dir_snapshot(FSItem *dir)
+{
+	if (dir && dir->snapshot) {
+		free_dir_snapshot(dir->snapshot);
+		dir->snapshot = NULL;
 	}
 }
 
+static int compare_dir_entries(const void *a, const void *b)
+{
+	return strcmp(((const DirEntry *)a)->name, ((const DirEntry *)b)->name);
+}
+
+// Read directory (path in full_path) into a new snapshot
+static DirSnapshot *read_dir_snapshot(const struct stat &dir_st)
+{
+	DIR *d = opendir(full_path);
+	if (d == NULL)
+		return NULL;
+
+	DirSnapshot *s = new DirSnapshot;
+	s->dir_mtime = dir_st.st_mtime;
+	s->taken = time(NULL);
+	s->count = 0;
+	int max_count = 64;
+	s->entries = new DirEntry[max_count];
+
+	struct dirent *de;
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;	// Suppress names beginning with '.' (MacOS could interpret these as driver names)
+		if (s->count == max_count) {
+			DirEntry *e = new DirEntry[max_count * 2];
+			memcpy(e, s->entries, max_count * sizeof(DirEntry));
+			delete[] s->entries;
+			s->entries = e;
+			max_count *= 2;
+		}
+		DirEntry *e = &s->entries[s->count++];
+		e->name = new char[strlen(de->d_name) + 1];
+		strcpy(e->name, de->d_name);
+		e->item = NULL;
+		e->valid = 0;
+	}
+	closedir(d);
+
+	qsort(s->entries, s->count, sizeof(DirEntry), compare_dir_entries);
+	return s;
+}
+
+/*
+ *  Get nth (1-based) entry of directory, using (and refreshing if necessary)
+ *  the directory's snapshot; the path of the directory must be in full_path,
+ *  on success the entry's name is appended to it
+ */
+
+static int16 get_dir_entry(FSItem *dir, int index, DirEntry *&entry)
+{
+	struct stat st;
+	if (stat(full_path, &st) < 0 || !S_ISDIR(st.st_mode))
+		return dirNFErr;
+
+	DirSnapshot *s = dir->snapshot;
+	if (s && (s->dir_mtime != st.st_mtime || time(NULL) - s->taken >= DIR_SNAPSHOT_TTL)) {
+		invalidate_dir_snapshot(dir);
+		s = NULL;
+	}
+	if (s == NULL) {
+		D(bug("  reading snapshot of %s\n", full_path));
+		s = dir->snapshot = read_dir_snapshot(st);
+		if (s == NULL)
+			return dirNFErr;
+	}
+
+	if (index > s->count)
+		return fnfErr;
+	entry = &s->entries[index - 1];
+	if (entry->item == NULL)
+		entry->item = find_fsitem(entry->name, dir);
+	add_path_comp(entry->name);
+	return noErr;
+}
+
+// get_finfo() for full_path, going through the cache of the directory entry (if any)
+static void get_cached_finfo(DirEntry *entry, uint32 finfo, uint32 fxinfo, bool is_dir)
+{
+	if (entry == NULL || fxinfo == 0) {
+		if (entry && (entry->valid & DE_FINFO))
+			Host2Mac_memcpy(finfo, entry->finfo, SIZEOF_FInfo);
+		else
+			get_finfo(full_path, finfo, fxinfo, is_dir);
+		return;
+	}
+	if (!(entry->valid & DE_FINFO)) {
+		get_finfo(full_path, finfo, fxinfo, is_dir);
+		Mac2Host_memcpy(entry->finfo, finfo, SIZEOF_FInfo);
+		Mac2Host_memcpy(entry->fxinfo, fxinfo, SIZEOF_FXInfo);
+		entry->valid |= DE_FINFO;
+	} else {
+		Host2Mac_memcpy(finfo, entry->finfo, SIZEOF_FInfo);
+		Host2Mac_memcpy(fxinfo, entry->fxinfo, SIZEOF_FXInfo);
+	}
+}
+
+// get_rfork_size() for full_path, going through the cache of the directory entry (if any)
+static uint32 get_cached_rfork_size(DirEntry *entry)
+{
+	if (entry == NULL)
+		return get_rfork_size(full_path);
+	if (!(entry->valid & DE_RFORK)) {
+		entry->rf_size = get_rfork_size(full_path);
+		entry->valid |= DE_RFORK;
+	}
+	return entry->rf_size;
+}
+
 
 /*
  *  String handling functions
@@ -409,22 +682,25 @@ void ExtFSInit(void)
 	cstr2pstr(FS_NAME, GetString(STR_EXTFS_NAME));
 	cstr2pstr(VOLUME_NAME, GetString(STR_EXTFS_VOLUME_NAME));
 
+	// Set up FSItem hash tables
+	first_fs_item = last_fs_item = NULL;
+	num_fs_items = 0;
+	resize_fsitem_hash(FSITEM_HASH_MIN_SIZE);
+
 	// Create root's parent FSItem
 	FSItem *p = new FSItem;
-	first_fs_item = last_fs_item = p;
-	p->next = NULL;
 	p->id = ROOT_PARENT_ID;
 	p->parent_id = 0;
 	p->parent = NULL;
 	p->name = new char[1];
 	p->name[0] = 0;
 	p->guest_name[0] = 0;
+	p->mtime = 0;
+	p->snapshot = NULL;
+	add_fsitem(p);
 
 	// Create root FSItem
 	p = new FSItem;
-	last_fs_item->next = p;
-	p->next = NULL;
-	last_fs_item = p;
 	p->id = ROOT_ID;
 	p->parent_id = ROOT_PARENT_ID;
 	p->parent = first_fs_item;
@@ -433,6 +709,9 @@ void ExtFSInit(void)
 	strcpy(p->name, volume_name);
 	strncpy(p->guest_name, host_encoding_to_macroman(p->name), 32);
 	p->guest_name[31] = 0;
+	p->mtime = 0;
+	p->snapshot = NULL;
+	add_fsitem(p);
 
 	// Find path for root
 	*RootPath = 0;
@@ -459,17 +738,110 @@ void ExtFSExit(void)
 	FSItem *p = first_fs_item, *next;
 	while (p) {
 		next = p->next;
+		if (p->snapshot)
+			free_dir_snapshot(p->snapshot);
 		delete[] p->name;
 		delete p;
 		p = next;
 	}
 	first_fs_item = last_fs_item = NULL;
+	delete[] id_hash;
+	delete[] name_hash;
+	delete[] guest_hash;
+	id_hash = name_hash = guest_hash = NULL;
+	fs_hash_size = num_fs_items = 0;
 
 	// System specific deinitialization
 	extfs_exit();
 }
 
 
+/*
+ *  Save/restore file system state (the CNID mapping must survive, host file
+ *  descriptors can't, so saving fails while files are open)
+ */
+
+bool ExtFSSaveState(snapshot_data &s)
+{
+	if (num_open_files > 0)
+		return false;
+	s.put32(fs_data);
+	s.put32(drive_number);
+	s.put32(next_cnid);
+	s.put32(num_fs_items);
+	for (FSItem *p = first_fs_item; p; p = p->next) {
+		s.put32(p->id);
+		s.put32(p->parent_id);
+		s.put_string(p->name);
+		s.put_string(p->guest_name);
+	}
+	return true;
+}
+
+bool ExtFSRestoreState(snapshot_data &s)
+{
+	fs_data = s.get32();
+	drive_number = s.get32();
+	next_cnid = s.get32();
+	uint32 num = s.get32();
+
+	// Read all items first, the list is not ordered by parent
+	std::map<uint32, FSItem *> items;
+	std::vector<FSItem *> order;
+	char name[MAX_PATH_LENGTH];
+	for (uint32 i = 0; i < num && s.ok(); i++) {
+		FSItem *p = new FSItem;
+		p->id = s.get32();
+		p->parent_id = s.get32();
+		s.get_string(name, sizeof(name));
+		s.get_string(p->guest_name, sizeof(p->guest_name));
+		p->name = new char[strlen(name) + 1];
+		strcpy(p->name, name);
+		p->parent = NULL;
+		p->mtime = 0;
+		p->snapshot = NULL;
+		items[p->id] = p;
+		order.push_back(p);
+	}
+	bool ok = s.ok() && items.size() == order.size();
+	for (size_t i = 0; ok && i < order.size(); i++) {
+		FSItem *p = order[i];
+		if (p->parent_id) {
+			std::map<uint32, FSItem *>::const_iterator parent = items.find(p->parent_id);
+			if (parent == items.end())
+				ok = false;
+			else
+				p->parent = parent->second;
+		}
+	}
+	if (!ok) {
+		for (size_t i = 0; i < order.size(); i++) {
+			delete[] order[i]->name;
+			delete order[i];
+		}
+		return false;
+	}
+
+	// Replace current items
+	FSItem *p = first_fs_item, *next;
+	while (p) {
+		next = p->next;
+		if (p->snapshot)
+			free_dir_snapshot(p->snapshot);
+		delete[] p->name;
+		delete p;
+		p = next;
+	}
+	first_fs_item = last_fs_item = NULL;
+	num_fs_items = 0;
+	resize_fsitem_hash(FSITEM_HASH_MIN_SIZE);
+	for (size_t i = 0; i < order.size(); i++)
+		add_fsitem(order[i]);
+	num_open_files = 0;
+	return true;
+}
+
+
 /*
  *  Install file system
  */
@@ -1017,6 +1389,107 @@ static uint32 find_fcb(int16 refNum)
 		return fcb;
 }
 
+// Discard cached listing of the directory containing the file of an FCB
+static void invalidate_parent_snapshot(uint32 fcb)
+{
+	FSItem *item = find_fsitem_by_id(ReadMacInt32(fcb + fcbFlNm));
+	if (item)
+		invalidate_dir_snapshot(item->parent);
+}
+
+/*
+ *  File positions are kept in the FCB (fcbCrPs) and all file I/O is done
+ *  with positional reads/writes, so no seeks are needed
+ */
+
+// Get position for read/write/set_fpos from ioPosMode/ioPosOffset
+static int16 get_file_pos(uint32 pb, uint32 fcb, int fd, loff_t &pos)
+{
+	int64 p;
+	switch (ReadMacInt16(pb + ioPosMode) & 3) {
+		case fsFromStart:
+			p = ReadMacInt32(pb + ioPosOffset);
+			break;
+		case fsFromLEOF: {
+			off_t eof = lseek(fd, 0, SEEK_END);
+			if (eof < 0)
+				return posErr;
+			p = (int64)eof + (int32)ReadMacInt32(pb + ioPosOffset);
+			break;
+		}
+		case fsFromMark:
+			p = (int64)ReadMacInt32(fcb + fcbCrPs) + (int32)ReadMacInt32(pb + ioPosOffset);
+			break;
+		default:
+			p = ReadMacInt32(fcb + fcbCrPs);
+			break;
+	}
+	if (p < 0)
+		return posErr;
+	pos = p;
+	return noErr;
+}
+
+// Sequential read detection for read-ahead, per file descriptor
+struct ReadStream {
+	int fd;					// File descriptor this slot belongs to
+	loff_t next_pos;		// Position following the last read
+	loff_t ahead_end;		// End of range the host was asked to read ahead
+	uint32 window;			// Current read-ahead window size
+};
+
+const int NUM_READ_STREAMS = 32;
+const uint32 READAHEAD_MIN = 128 * 1024;
+const uint32 READAHEAD_MAX = 4 * 1024 * 1024;
+
+static ReadStream read_streams[NUM_READ_STREAMS];
+
+static void reset_read_stream(int fd)
+{
+	ReadStream *s = &read_streams[fd % NUM_READ_STREAMS];
+	s->fd = fd;
+	s->next_pos = (loff_t)-1;
+	s->ahead_end = 0;
+	s->window = 0;
+}
+
+// Ask the host to prefetch a file range
+static void readahead_hint(int fd, loff_t pos, loff_t length)
+{
+#if defined(POSIX_FADV_WILLNEED)
+	posix_fadvise(fd, pos, length, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+	struct radvisory ra;
+	ra.ra_offset = pos;
+	ra.ra_count = length;
+	fcntl(fd, F_RDADVISE, &ra);
+#endif
+}
+
+// Account for a read of "length" bytes at "pos", issuing read-ahead for sequential access
+static void note_read(int fd, loff_t pos, uint32 length)
+{
+	ReadStream *s = &read_streams[fd % NUM_READ_STREAMS];
+	if (s->fd != fd)
+		reset_read_stream(fd);
+
+	loff_t end = pos + length;
+	if (pos == s->next_pos) {
+		s->window = s->window ? s->window * 2 : READAHEAD_MIN;
+		if (s->window > READAHEAD_MAX)
+			s->window = READAHEAD_MAX;
+		if (s->ahead_end < end + s->window / 2) {
+			loff_t start = s->ahead_end > end ? s->ahead_end : end;
+			readahead_hint(fd, start, end + s->window - start);
+			s->ahead_end = end + s->window;
+		}
+	} else {
+		s->window = 0;
+		s->ahead_end = 0;
+	}
+	s->next_pos = end;
+}
+
 
 /*
  *  HFS interface functions
@@ -1255,6 +1728,7 @@ static int16 fs_get_file_info(uint32 pb, bool hfs, uint32 dirID)
 	D(bug(" fs_get_file_info(%08lx), vRefNum %d, name %.31s, idx %d, dirID %d\n", pb, ReadMacInt16(pb + ioVRefNum), Mac2HostAddr(ReadMacInt32(pb + ioNamePtr) + 1), ReadMacInt16(pb + ioFDirIndex), dirID));
 
 	FSItem *fs_item;
+	DirEntry *entry = NULL;
 	int16 dir_index = ReadMacInt16(pb + ioFDirIndex);
 	if (dir_index <= 0) {		// Query item specified by ioDirID and ioNamePtr
 
@@ -1276,32 +1750,28 @@ static int16 fs_get_file_info(uint32 pb, bool hfs, uint32 dirID)
 		get_path_for_fsitem(p);
 
 		// Look for nth item in directory and add name to path
-		DIR *d = opendir(full_path);
-		if (d == NULL)
-			return dirNFErr;
-		struct dirent *de = NULL;
-		for (int i=0; i<dir_index; i++) {
-read_next_de:
-			de = readdir(d);
-			if (de == NULL) {
-				closedir(d);
-				return fnfErr;
-			}
-			if (de->d_name[0] == '.')
-				goto read_next_de;	// Suppress names beginning with '.' (MacOS could interpret these as driver names)
-			//!! suppress directories
-		}
-		add_path_comp(de->d_name);
-
-		// Get FSItem for queried item
-		fs_item = find_fsitem(de->d_name, p);
-		closedir(d);
+		//!! suppress directories
+		if ((result = get_dir_entry(p, dir_index, entry)) != noErr)
+			return result;
+		fs_item = entry->item;
 	}
 
 	// Get stats
 	struct stat st;
-	if (stat(full_path, &st))
-		return fnfErr;
+	uint8 attrib;
+	if (entry && (entry->valid & DE_STAT)) {
+		st = entry->st;
+		attrib = entry->attrib;
+	} else {
+		if (stat(full_path, &st))
+			return fnfErr;
+		attrib = access(full_path, W_OK) == 0 ? 0 : faLocked;
+		if (entry) {
+			entry->st = st;
+			entry->attrib = attrib;
+			entry->valid |= DE_STAT;
+		}
+	}
 	if (S_ISDIR(st.st_mode))
 		return fnfErr;
 
@@ -1309,7 +1779,7 @@ read_next_de:
 	if (ReadMacInt32(pb + ioNamePtr))
 		cstr2pstr((char *)Mac2HostAddr(ReadMacInt32(pb + ioNamePtr)), fs_item->guest_name);
 	WriteMacInt16(pb + ioFRefNum, 0);
-	WriteMacInt8(pb + ioFlAttrib, access(full_path, W_OK) == 0 ? 0 : faLocked);
+	WriteMacInt8(pb + ioFlAttrib, attrib);
 	WriteMacInt32(pb + ioDirID, fs_item->id);
 
 #if defined(__BEOS__) || defined(WIN32)
@@ -1321,14 +1791,14 @@ read_next_de:
 #endif
 	WriteMacInt32(pb + ioFlMdDat, TimeToMacTime(st.st_mtime));
 
-	get_finfo(full_path, pb + ioFlFndrInfo, hfs ? pb + ioFlXFndrInfo : 0, false);
+	get_cached_finfo(entry, pb + ioFlFndrInfo, hfs ? pb + ioFlXFndrInfo : 0, false);
 
 	WriteMacInt16(pb + ioFlStBlk, 0);
 	uint32 file_size = (uint32) st.st_size;
 	WriteMacInt32(pb + ioFlLgLen, file_size);
 	WriteMacInt32(pb + ioFlPyLen, (file_size | (AL_BLK_SIZE - 1)) + 1);
 	WriteMacInt16(pb + ioFlRStBlk, 0);
-	uint32 rf_size = get_rfork_size(full_path);
+	uint32 rf_size = get_cached_rfork_size(entry);
 	WriteMacInt32(pb + ioFlRLgLen, rf_size);
 	WriteMacInt32(pb + ioFlRPyLen, (rf_size | (AL_BLK_SIZE - 1)) + 1);
 
@@ -1360,6 +1830,7 @@ static int16 fs_set_file_info(uint32 pb, bool hfs, uint32 dirID)
 
 	// Set Finder info
 	set_finfo(full_path, pb + ioFlFndrInfo, hfs ? pb + ioFlXFndrInfo : 0, false);
+	invalidate_dir_snapshot(fs_item->parent);
 
 	//!! times
 	return noErr;
@@ -1371,6 +1842,7 @@ static int16 fs_get_cat_info(uint32 pb)
 	D(bug(" fs_get_cat_info(%08lx), vRefNum %d, name %.31s, idx %d, dirID %d\n", pb, ReadMacInt16(pb + ioVRefNum), Mac2HostAddr(ReadMacInt32(pb + ioNamePtr) + 1), ReadMacInt16(pb + ioFDirIndex), ReadMacInt32(pb + ioDirID)));
 
 	FSItem *fs_item;
+	DirEntry *entry = NULL;
 	int16 dir_index = ReadMacInt16(pb + ioFDirIndex);
 	if (dir_index < 0) {			// Query directory specified by ioDirID
 
@@ -1400,32 +1872,28 @@ static int16 fs_get_cat_info(uint32 pb)
 		get_path_for_fsitem(p);
 
 		// Look for nth item in directory and add name to path
-		DIR *d = opendir(full_path);
-		if (d == NULL)
-			return dirNFErr;
-		struct dirent *de = NULL;
-		for (int i=0; i<dir_index; i++) {
-read_next_de:
-			de = readdir(d);
-			if (de == NULL) {
-				closedir(d);
-				return fnfErr;
-			}
-			if (de->d_name[0] == '.')
-				goto read_next_de;	// Suppress names beginning with '.' (MacOS could interpret these as driver names)
-		}
-		add_path_comp(de->d_name);
-
-		// Get FSItem for queried item
-		fs_item = find_fsitem(de->d_name, p);
-		closedir(d);
+		if ((result = get_dir_entry(p, dir_index, entry)) != noErr)
+			return result;
+		fs_item = entry->item;
 	}
 	D(bug("  path %s\n", full_path));
 
 	// Get stats
 	struct stat st;
-	if (stat(full_path, &st) < 0)
-		return errno2oserr();
+	uint8 attrib;
+	if (entry && (entry->valid & DE_STAT)) {
+		st = entry->st;
+		attrib = entry->attrib;
+	} else {
+		if (stat(full_path, &st) < 0)
+			return errno2oserr();
+		attrib = access(full_path, W_OK) == 0 ? 0 : faLocked;
+		if (entry) {
+			entry->st = st;
+			entry->attrib = attrib;
+			entry->valid |= DE_STAT;
+		}
+	}
 	if (dir_index == -1 && !S_ISDIR(st.st_mode))
 		return dirNFErr;
 
@@ -1433,7 +1901,7 @@ read_next_de:
 	if (ReadMacInt32(pb + ioNamePtr))
 		cstr2pstr((char *)Mac2HostAddr(ReadMacInt32(pb + ioNamePtr)), fs_item->guest_name);
 	WriteMacInt16(pb + ioFRefNum, 0);
-	WriteMacInt8(pb + ioFlAttrib, (S_ISDIR(st.st_mode) ? faIsDir : 0) | (access(full_path, W_OK) == 0 ? 0 : faLocked));
+	WriteMacInt8(pb + ioFlAttrib, (S_ISDIR(st.st_mode) ? faIsDir : 0) | attrib);
 	WriteMacInt8(pb + ioACUser, 0);
 	WriteMacInt32(pb + ioDirID, fs_item->id);
 	WriteMacInt32(pb + ioFlParID, fs_item->parent_id);
@@ -1453,7 +1921,7 @@ read_next_de:
 	WriteMacInt32(pb + ioFlMdDat, TimeToMacTime(mtime));
 	WriteMacInt32(pb + ioFlBkDat, 0);
 
-	get_finfo(full_path, pb + ioFlFndrInfo, pb + ioFlXFndrInfo, S_ISDIR(st.st_mode));
+	get_cached_finfo(entry, pb + ioFlFndrInfo, pb + ioFlXFndrInfo, S_ISDIR(st.st_mode));
 
 	if (S_ISDIR(st.st_mode)) {
 
@@ -1485,7 +1953,7 @@ read_next_de:
 		WriteMacInt32(pb + ioFlLgLen, file_size);
 		WriteMacInt32(pb + ioFlPyLen, (file_size | (AL_BLK_SIZE - 1)) + 1);
 		WriteMacInt16(pb + ioFlRStBlk, 0);
-		uint32 rf_size = get_rfork_size(full_path);
+		uint32 rf_size = get_cached_rfork_size(entry);
 		WriteMacInt32(pb + ioFlRLgLen, rf_size);
 		WriteMacInt32(pb + ioFlRPyLen, (rf_size | (AL_BLK_SIZE - 1)) + 1);
 		WriteMacInt32(pb + ioFlClpSiz, 0);
@@ -1511,6 +1979,7 @@ static int16 fs_set_cat_info(uint32 pb)
 
 	// Set Finder info
 	set_finfo(full_path, pb + ioFlFndrInfo, pb + ioFlXFndrInfo, S_ISDIR(st.st_mode));
+	invalidate_dir_snapshot(fs_item->parent);
 
 	//!! times
 	return noErr;
@@ -1597,6 +2066,8 @@ static int16 fs_open(uint32 pb, uint32 dirID, uint32 vcb, bool resource_fork)
 	WriteMacInt32(fcb + fcbPLen, (file_size | (AL_BLK_SIZE - 1)) + 1);
 	WriteMacInt32(fcb + fcbCrPs, 0);
 	WriteMacInt32(fcb + fcbVPtr, vcb);
+	if (fd >= 0)
+		reset_read_stream(fd);
 	WriteMacInt32(fcb + fcbClmpSize, CLUMP_SIZE);
 
 	get_finfo(full_path, fs_data + fsPB, 0, false);
@@ -1605,6 +2076,7 @@ static int16 fs_open(uint32 pb, uint32 dirID, uint32 vcb, bool resource_fork)
 	WriteMacInt32(fcb + fcbCatPos, fd);
 	WriteMacInt32(fcb + fcbDirID, fs_item->parent_id);
 	cstr2pstr((char *)Mac2HostAddr(fcb + fcbCName), fs_item->guest_name);
+	num_open_files++;
 	return noErr;
 }
 
@@ -1632,6 +2104,7 @@ static int16 fs_close(uint32 pb)
 	} else
 		close(fd);
 	WriteMacInt32(fcb + fcbCatPos, (uint32)-1);
+	num_open_files--;
 
 	// Release FCB
 	D(bug("  releasing FCB\n"));
@@ -1749,6 +2222,7 @@ static int16 fs_set_eof(uint32 pb)
 	uint32 size = ReadMacInt32(pb + ioMisc);
 	if (ftruncate(fd, size) < 0)
 		return errno2oserr();
+	invalidate_parent_snapshot(fcb);
 
 	// Adjust FCBs
 	WriteMacInt32(fcb + fcbEOF, size);
@@ -1785,9 +2259,7 @@ static int16 fs_get_fpos(uint32 pb)
 	}
 
 	// Get file position
-	uint32 pos = (uint32) lseek(fd, 0, SEEK_CUR);
-	WriteMacInt32(fcb + fcbCrPs, pos);
-	WriteMacInt32(pb + ioPosOffset, pos);
+	WriteMacInt32(pb + ioPosOffset, ReadMacInt32(fcb + fcbCrPs));
 	return noErr;
 }
 
@@ -1812,23 +2284,10 @@ static int16 fs_set_fpos(uint32 pb)
 	}
 
 	// Set file position
-	switch (ReadMacInt16(pb + ioPosMode) & 3) {
-		case fsFromStart:
-			if (lseek(fd, ReadMacInt32(pb + ioPosOffset), SEEK_SET) < 0)
-				return posErr;
-			break;
-		case fsFromLEOF:
-			if (lseek(fd, (int32)ReadMacInt32(pb + ioPosOffset), SEEK_END) < 0)
-				return posErr;
-			break;
-		case fsFromMark:
-			if (lseek(fd, (int32)ReadMacInt32(pb + ioPosOffset), SEEK_CUR) < 0)
-				return posErr;
-			break;
-		default:
-			break;
-	}
-	uint32 pos = (uint32) lseek(fd, 0, SEEK_CUR);
+	loff_t new_pos;
+	if (get_file_pos(pb, fcb, fd, new_pos) != noErr)
+		return posErr;
+	uint32 pos = (uint32) new_pos;
 	WriteMacInt32(fcb + fcbCrPs, pos);
 	WriteMacInt32(pb + ioPosOffset, pos);
 	return noErr;
@@ -1858,28 +2317,19 @@ static int16 fs_read(uint32 pb)
 			return fnOpnErr;
 	}
 
-	// Seek
-	switch (ReadMacInt16(pb + ioPosMode) & 3) {
-		case fsFromStart:
-			if (lseek(fd, ReadMacInt32(pb + ioPosOffset), SEEK_SET) < 0)
-				return posErr;
-			break;
-		case fsFromLEOF:
-			if (lseek(fd, (int32)ReadMacInt32(pb + ioPosOffset), SEEK_END) < 0)
-				return posErr;
-			break;
-		case fsFromMark:
-			if (lseek(fd, (int32)ReadMacInt32(pb + ioPosOffset), SEEK_CUR) < 0)
-				return posErr;
-			break;
-	}
+	// Get position
+	loff_t start;
+	if (get_file_pos(pb, fcb, fd, start) != noErr)
+		return posErr;
 
 	// Read
-	ssize_t actual = extfs_read(fd, Mac2HostAddr(ReadMacInt32(pb + ioBuffer)), ReadMacInt32(pb + ioReqCount));
+	uint32 length = ReadMacInt32(pb + ioReqCount);
+	note_read(fd, start, length);
+	ssize_t actual = extfs_pread(fd, Mac2HostAddr(ReadMacInt32(pb + ioBuffer)), length, start);
 	int16 read_err = errno2oserr();
 	D(bug("  actual %d\n", actual));
 	WriteMacInt32(pb + ioActCount, actual >= 0 ? actual : 0);
-	uint32 pos = (uint32) lseek(fd, 0, SEEK_CUR);
+	uint32 pos = (uint32) (start + (actual > 0 ? actual : 0));
 	WriteMacInt32(fcb + fcbCrPs, pos);
 	WriteMacInt32(pb + ioPosOffset, pos);
 	if (actual != (ssize_t)ReadMacInt32(pb + ioReqCount))
@@ -1912,28 +2362,18 @@ static int16 fs_write(uint32 pb)
 			return fnOpnErr;
 	}
 
-	// Seek
-	switch (ReadMacInt16(pb + ioPosMode) & 3) {
-		case fsFromStart:
-			if (lseek(fd, ReadMacInt32(pb + ioPosOffset), SEEK_SET) < 0)
-				return posErr;
-			break;
-		case fsFromLEOF:
-			if (lseek(fd, (int32)ReadMacInt32(pb + ioPosOffset), SEEK_END) < 0)
-				return posErr;
-			break;
-		case fsFromMark:
-			if (lseek(fd, (int32)ReadMacInt32(pb + ioPosOffset), SEEK_CUR) < 0)
-				return posErr;
-			break;
-	}
+	// Get position
+	loff_t start;
+	if (get_file_pos(pb, fcb, fd, start) != noErr)
+		return posErr;
 
 	// Write
-	ssize_t actual = extfs_write(fd, Mac2HostAddr(ReadMacInt32(pb + ioBuffer)), ReadMacInt32(pb + ioReqCount));
+	ssize_t actual = extfs_pwrite(fd, Mac2HostAddr(ReadMacInt32(pb + ioBuffer)), ReadMacInt32(pb + ioReqCount), start);
 	int16 write_err = errno2oserr();
+	invalidate_parent_snapshot(fcb);
 	D(bug("  actual %d\n", actual));
 	WriteMacInt32(pb + ioActCount, actual >= 0 ? actual : 0);
-	uint32 pos = (uint32) lseek(fd, 0, SEEK_CUR);
+	uint32 pos = (uint32) (start + (actual > 0 ? actual : 0));
 	WriteMacInt32(fcb + fcbCrPs, pos);
 	WriteMacInt32(pb + ioPosOffset, pos);
 	if (actual != (ssize_t)ReadMacInt32(pb + ioReqCount))
@@ -1958,6 +2398,7 @@ static int16 fs_create(uint32 pb, uint32 dirID)
 		return dupFNErr;
 
 	// Create file
+	invalidate_dir_snapshot(fs_item->parent);
 	int fd = creat(full_path, 0666);
 	if (fd < 0)
 		return errno2oserr();
@@ -1983,6 +2424,7 @@ static int16 fs_dir_create(uint32 pb)
 		return dupFNErr;
 
 	// Create directory
+	invalidate_dir_snapshot(fs_item->parent);
 	if (mkdir(full_path, 0777) < 0)
 		return errno2oserr();
 	else {
@@ -2003,6 +2445,8 @@ static int16 fs_delete(uint32 pb, uint32 dirID)
 		return result;
 
 	// Delete file
+	invalidate_dir_snapshot(fs_item);
+	invalidate_dir_snapshot(fs_item->parent);
 	if (!extfs_remove(full_path))
 		return errno2oserr();
 	else
@@ -2038,14 +2482,12 @@ static int16 fs_rename(uint32 pb, uint32 dirID)
 
 	// Rename item
 	D(bug("  renaming %s -> %s\n", old_path, full_path));
+	invalidate_dir_snapshot(fs_item->parent);
 	if (!extfs_rename(old_path, full_path))
 		return errno2oserr();
 	else {
-		// The ID of the old file/dir has to stay the same, so we swap the IDs of the FSItems
-		swap_parent_ids(fs_item->id, new_item->id);
-		uint32 t = fs_item->id;
-		fs_item->id = new_item->id;
-		new_item->id = t;
+		// The ID of the old file/dir has to stay the same, so we swap the locations of the FSItems
+		swap_fsitem_locations(fs_item, new_item);
 		return noErr;
 	}
 }
@@ -2082,17 +2524,15 @@ static int16 fs_cat_move(uint32 pb)
 
 	// Move item
 	D(bug("  moving %s -> %s\n", old_path, full_path));
+	invalidate_dir_snapshot(fs_item->parent);
+	invalidate_dir_snapshot(new_dir_item);
 	if (!extfs_rename(old_path, full_path))
 		return errno2oserr();
 	else {
-		// The ID of the old file/dir has to stay the same, so we swap the IDs of the FSItems
+		// The ID of the old file/dir has to stay the same, so we swap the locations of the FSItems
 		FSItem *new_item = find_fsitem(fs_item->name, new_dir_item);
-		if (new_item) {
-			swap_parent_ids(fs_item->id, new_item->id);
-			uint32 t = fs_item->id;
-			fs_item->id = new_item->id;
-			new_item->id = t;
-		}
+		if (new_item)
+			swap_fsitem_locations(fs_item, new_item);
 		return noErr;
 	}
 }
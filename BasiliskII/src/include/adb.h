@@ -24,6 +24,10 @@
 extern void ADBInit(void);
 extern void ADBExit(void);
 
+class snapshot_data;
+extern void ADBSaveState(snapshot_data &s);
+extern bool ADBRestoreState(snapshot_data &s);
+
 extern void ADBOp(uint8 op, uint8 *data);
 
 extern void ADBMouseMoved(int x, int y);
@@ -42,6 +42,10 @@ extern void AudioInit(void);
 extern void AudioExit(void);
 extern void AudioReset(void);
 
+class snapshot_data;
+extern void AudioSaveState(snapshot_data &s);
+extern bool AudioRestoreState(snapshot_data &s);
+
 extern void AudioInterrupt(void);
 
 extern void audio_enter_stream(void);
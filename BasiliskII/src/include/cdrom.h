@@ -35,6 +35,10 @@ extern void CDROMInterrupt(void);
 
 extern bool CDROMMountVolume(void *fh);
 
+class snapshot_data;
+extern void CDROMSaveState(snapshot_data &s);
+extern bool CDROMRestoreState(snapshot_data &s);
+
 extern int16 CDROMOpen(uint32 pb, uint32 dce);
 extern int16 CDROMPrime(uint32 pb, uint32 dce);
 extern int16 CDROMControl(uint32 pb, uint32 dce);
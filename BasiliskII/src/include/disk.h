@@ -35,6 +35,10 @@ extern void DiskInterrupt(void);
 
 extern bool DiskMountVolume(void *fh);
 
+class snapshot_data;
+extern void DiskSaveState(snapshot_data &s);
+extern bool DiskRestoreState(snapshot_data &s);
+
 extern int16 DiskOpen(uint32 pb, uint32 dce);
 extern int16 DiskPrime(uint32 pb, uint32 dce);
 extern int16 DiskControl(uint32 pb, uint32 dce);
@@ -30,6 +30,10 @@ extern int16 EtherOpen(uint32 pb, uint32 dce);
 extern int16 EtherControl(uint32 pb, uint32 dce);
 extern void EtherReadPacket(uint32 &src, uint32 &dest, uint32 &len, uint32 &remaining);
 
+class snapshot_data;
+extern void EtherSaveState(snapshot_data &s);
+extern bool EtherRestoreState(snapshot_data &s);
+
 // System specific and internal functions/data
 extern void EtherReset(void);
 extern void EtherInterrupt(void);
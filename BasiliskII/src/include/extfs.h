@@ -26,6 +26,10 @@ extern void ExtFSExit(void);
 
 extern void InstallExtFS(void);
 
+class snapshot_data;
+extern bool ExtFSSaveState(snapshot_data &s);
+extern bool ExtFSRestoreState(snapshot_data &s);
+
 extern int16 ExtFSComm(uint16 message, uint32 paramBlock, uint32 globalsPtr);
 extern int16 ExtFSHFS(uint32 vcb, uint16 selectCode, uint32 paramBlock, uint32 globalsPtr, int16 fsid);
 
@@ -40,6 +44,8 @@ extern int open_rfork(const char *path, int flag);
 extern void close_rfork(const char *path, int fd);
 extern ssize_t extfs_read(int fd, void *buffer, size_t length);
 extern ssize_t extfs_write(int fd, void *buffer, size_t length);
+extern ssize_t extfs_pread(int fd, void *buffer, size_t length, loff_t offset);
+extern ssize_t extfs_pwrite(int fd, void *buffer, size_t length, loff_t offset);
 extern bool extfs_remove(const char *path);
 extern bool extfs_rename(const char *old_path, const char *new_path);
 extern const char *host_encoding_to_macroman(const char *filename); // What if the guest OS is using MacJapanese or MacArabic? Oh well...
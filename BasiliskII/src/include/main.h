@@ -78,6 +78,7 @@ enum {
 };
 
 extern uint32 InterruptFlags;									// Currently pending interrupts
+extern volatile uint32 ExtraTicks;								// 60Hz ticks without an interrupt of their own (only grows)
 extern void SetInterruptFlag(uint32 flag);						// Set/clear interrupt flags
 extern void ClearInterruptFlag(uint32 flag);
 
@@ -0,0 +1,145 @@
+/*
+ *  snapshot.h - Emulator state snapshots
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <vector>
+
+/*
+ *  Serialized state of one emulator component. Values are stored in big-endian
+ *  byte order. Reading past the end sets a sticky error flag and returns zeroes,
+ *  so a component can read all its fields and check ok() once at the end.
+ */
+
+class snapshot_data {
+public:
+	snapshot_data() : read_pos(0), error(false) {}
+	snapshot_data(const uint8 *p, size_t size) : data(p, p + size), read_pos(0), error(false) {}
+
+	void put8(uint8 v) {data.push_back(v);}
+	void put16(uint16 v) {put8(v >> 8); put8(v);}
+	void put32(uint32 v) {put16(v >> 16); put16(v);}
+	void put64(uint64 v) {put32(v >> 32); put32(v);}
+	void put_bytes(const void *p, size_t size) {data.insert(data.end(), (const uint8 *)p, (const uint8 *)p + size);}
+	void put_string(const char *s) {size_t size = strlen(s); put32(size); put_bytes(s, size);}
+
+	uint8 get8(void) {uint8 v = 0; get_bytes(&v, 1); return v;}
+	uint16 get16(void) {uint16 v = get8() << 8; return v | get8();}
+	uint32 get32(void) {uint32 v = get16() << 16; return v | get16();}
+	uint64 get64(void) {uint64 v = (uint64)get32() << 32; return v | get32();}
+	bool get_bytes(void *p, size_t size)
+	{
+		if (error || size > data.size() - read_pos) {
+			error = true;
+			memset(p, 0, size);
+			return false;
+		}
+		if (size)
+			memcpy(p, &data[read_pos], size);
+		read_pos += size;
+		return true;
+	}
+
+	// Returns false if the string didn't fit into the buffer
+	bool get_string(char *s, size_t max_size)
+	{
+		uint32 size = get32();
+		if (error || size >= max_size || size > data.size() - read_pos) {
+			error = true;
+			s[0] = 0;
+			return false;
+		}
+		get_bytes(s, size);
+		s[size] = 0;
+		return true;
+	}
+
+	// Identity of a disk image file (name, size and modification time), so a
+	// restore can refuse to continue with a Mac whose RAM holds caches of a
+	// volume that was replaced or written since. An empty name is "no disk".
+	void put_file(const char *name, loff_t size) {put_string(name); put64(size); put64(file_time(name));}
+	bool check_file(const char *name, loff_t size)
+	{
+		char saved_name[1024];
+		get_string(saved_name, sizeof(saved_name));
+		loff_t saved_size = get64();
+		uint64 saved_time = get64();
+		if (!ok())
+			return false;
+		if (strcmp(saved_name, name) != 0 || saved_size != size || saved_time != file_time(name)) {
+			printf("WARNING: %s has changed since the snapshot was saved\n", saved_name[0] ? saved_name : name);
+			return false;
+		}
+		return true;
+	}
+
+	// Mark data as unusable (e.g. a value is out of range)
+	void fail(void) {error = true;}
+
+	// All reads so far were successful
+	bool ok(void) const {return !error;}
+
+	// All data has been read
+	bool at_end(void) const {return read_pos == data.size();}
+
+	// Number of bytes not read yet
+	size_t remaining(void) const {return data.size() - read_pos;}
+
+	const uint8 *bytes(void) const {return data.empty() ? NULL : &data[0];}
+	size_t size(void) const {return data.size();}
+
+private:
+	static uint64 file_time(const char *name)
+	{
+		struct stat st;
+		if (name[0] == 0 || stat(name, &st) < 0)
+			return 0;
+#if defined(__linux__)
+		return (uint64)st.st_mtime * 1000000000 + st.st_mtim.tv_nsec;
+#else
+		return st.st_mtime;
+#endif
+	}
+
+	std::vector<uint8> data;
+	size_t read_pos;
+	bool error;
+};
+
+// Save/restore complete emulator state (implemented by the platform code,
+// must be called on the emulator thread)
+extern bool SaveSnapshot(const char *path);
+extern bool RestoreSnapshot(const char *path);
+
+// Incremental checkpoints, appended to a log next to the snapshot file
+// (CheckpointSave() must be called on the emulator thread, with "requested"
+// set it warns when no checkpoint could be taken)
+extern bool CheckpointInit(const char *path, bool restored);
+extern void CheckpointExit(void);
+extern void CheckpointSave(bool requested);
+
+// Merge the checkpoint log into the snapshot file (while no emulator uses it)
+extern bool CompactSnapshot(const char *path);
+
+#endif
@@ -37,6 +37,10 @@ extern void SonyInterrupt(void);
 
 extern bool SonyMountVolume(void *fh);
 
+class snapshot_data;
+extern void SonySaveState(snapshot_data &s);
+extern bool SonyRestoreState(snapshot_data &s);
+
 extern int16 SonyOpen(uint32 pb, uint32 dce);
 extern int16 SonyPrime(uint32 pb, uint32 dce);
 extern int16 SonyControl(uint32 pb, uint32 dce);
@@ -27,6 +27,10 @@ extern void TimerReset(void);
 
 extern void TimerInterrupt(void);
 
+class snapshot_data;
+extern void TimerSaveState(snapshot_data &s);
+extern bool TimerRestoreState(snapshot_data &s);
+
 extern int16 InsTime(uint32 tm, uint16 trap);
 extern int16 RmvTime(uint32 tm);
 extern int16 PrimeTime(uint32 tm, int32 time);
@@ -41,6 +45,7 @@ extern void timer_sub_time(tm_time_t &res, tm_time_t a, tm_time_t b);
 extern int timer_cmp_time(tm_time_t a, tm_time_t b);
 extern void timer_mac2host_time(tm_time_t &res, int32 mactime);
 extern int32 timer_host2mac_time(tm_time_t hosttime);
+extern bool timer_next_wakeup(tm_time_t &t);
 
 // Suspend execution of emulator thread and resume it on events
 extern void idle_wait(void);
@@ -141,6 +141,8 @@ inline bool IsDirectMode(const video_mode &mode)
 // Mac video driver per-display private variables (opaque)
 struct video_locals;
 
+class snapshot_data;
+
 
 // Abstract base class representing one (possibly virtual) monitor
 // ("monitor" = rectangular display with a contiguous frame buffer)
@@ -179,6 +181,10 @@ public:
 	int16 driver_control(uint16 code, uint32 param, uint32 dce);
 	int16 driver_status(uint16 code, uint32 param);
 
+	// Save/restore driver state and frame buffer contents
+	void save_state(snapshot_data &s) const;
+	bool restore_state(snapshot_data &s);
+
 protected:
 	vector<video_mode> modes;                         // List of supported video modes
 	vector<video_mode>::const_iterator current_mode;  // Currently selected video mode
@@ -271,6 +277,9 @@ extern void VideoExit(void);
 
 extern void VideoQuitFullScreen(void);
 
+extern void VideoSaveState(snapshot_data &s);
+extern bool VideoRestoreState(snapshot_data &s);
+
 extern void VideoInterrupt(void);
 extern void VideoRefresh(void);
 
@@ -82,8 +82,10 @@ prefs_desc common_prefs_items[] = {
 	{"swap_opt_cmd", TYPE_BOOLEAN, false,	"swap option and command key"},
 	{"ignoresegv", TYPE_BOOLEAN, false,    "ignore illegal memory accesses"},
 	{"host_domain", TYPE_STRING, true,	"handle DNS requests for this domain on the host (slirp only)"},
+	{"dnsstatic", TYPE_STRING, true,	"address and names answered by the slirp DNS proxy itself"},
 	{"title", TYPE_STRING, false,	"window title"},
 	{"sound_buffer", TYPE_INT32, false,	"sound buffer length"},
+	{"sound_null", TYPE_BOOLEAN, false,	"discard sound output at real-time pace (no audio device needed)"},
 	{"name_encoding", TYPE_INT32, false,	"file name encoding"},
 	{"delay", TYPE_INT32, false,	"additional delay [uS] every 64k instructions"},
 	{"init_grab", TYPE_BOOLEAN, false,	"initially grabbing mouse"},
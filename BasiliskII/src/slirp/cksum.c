@@ -32,6 +32,100 @@
 
 #include <slirp.h>
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define CKSUM_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Packets from the guest reach slirp through memory, so nothing can
+ * corrupt them on the way and verifying their checksums on input is
+ * wasted work.  Set this to verify them anyway.
+ */
+int cksum_verify = 0;
+
+#ifdef CKSUM_X86
+/*
+ * AVX2 version for long packets: the data is summed up as 32-bit words
+ * into 64-bit lanes, which folds to the same 16-bit ones' complement sum
+ * as adding up 16-bit words (RFC 1071) but needs no carry handling in
+ * the loop.  Below CKSUM_AVX2_MIN bytes (headers, small segments) the
+ * setup costs more than it saves and the portable loop is faster.
+ */
+#define CKSUM_AVX2_MIN 256
+
+static int cksum_avx2;
+
+/* Sum of len bytes at p, a trailing partial word is padded with zeros */
+static u_int64_t
+cksum_add_words(const u_int8_t *p, int len)
+{
+	u_int64_t sum = 0;
+	u_int32_t w;
+
+	while (len >= 4) {
+		memcpy(&w, p, 4);
+		sum += w;
+		p += 4;
+		len -= 4;
+	}
+	if (len > 0) {
+		w = 0;
+		memcpy(&w, p, len);
+		sum += w;
+	}
+	return sum;
+}
+
+__attribute__((target("avx2")))
+static u_int64_t
+cksum_add_avx2(const u_int8_t *p, int len)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i acc0 = zero, acc1 = zero;
+	u_int64_t lanes[4];
+
+	/* Zero-extend 32-bit words to 64-bit lanes and add those up */
+	while (len >= 64) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+		__m256i v1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+		p += 64;
+		len -= 64;
+	}
+	_mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + cksum_add_words(p, len);
+}
+
+static int
+cksum_long(const u_int8_t *p, int len)
+{
+	u_int64_t sum = cksum_add_avx2(p, len);
+
+	/* Fold to 16 bits with end-around carry */
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return (~sum & 0xffff);
+}
+#endif
+
+/*
+ * Use the AVX2 loop for long packets if this CPU has it
+ */
+void
+cksum_init()
+{
+#ifdef CKSUM_X86
+	__builtin_cpu_init();
+	cksum_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
 /*
  * Checksum routine for Internet Protocol family headers (Portable Version).
  *
@@ -60,6 +154,11 @@ int cksum(struct mbuf *m, int len)
 		u_int32_t l;
 	} l_util;
 	
+#ifdef CKSUM_X86
+	if (cksum_avx2 && len >= CKSUM_AVX2_MIN && m->m_len >= len)
+		return cksum_long(mtod(m, u_int8_t *), len);
+#endif
+
 	if (m->m_len == 0)
 	   goto cont;
 	w = mtod(m, u_int16_t *);
@@ -135,3 +234,17 @@ cont:
 	REDUCE;
 	return (~sum & 0xffff);
 }
+
+/*
+ * Update checksum sum after one 16-bit word of the checksummed data
+ * changed from o to n (RFC 1624), all values as stored in the packet
+ */
+u_int16_t cksum_adjust(u_int16_t sum, u_int16_t o, u_int16_t n)
+{
+	u_int32_t s;
+
+	s = (u_int16_t)~sum + (u_int16_t)~o + n;
+	s = (s & 0xffff) + (s >> 16);
+	s = (s & 0xffff) + (s >> 16);
+	return ~s & 0xffff;
+}
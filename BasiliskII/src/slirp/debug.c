@@ -254,6 +254,20 @@ udpstats()
 	lprint("  %6d datagrams sent\r\n", udpstat.udps_opackets);
 }
 
+void
+dnsstats()
+{
+	lprint(" \r\n");
+
+	lprint("DNS proxy stats:\r\n");
+	lprint("  %6lu queries\r\n", dns_stats.dns_queries);
+	lprint("          %6lu answered from the cache\r\n", dns_stats.dns_hits);
+	lprint("          %6lu answered from the dnsstatic table\r\n", dns_stats.dns_static);
+	lprint("          %6lu joined an identical forwarded query\r\n", dns_stats.dns_coalesced);
+	lprint("          %6lu forwarded\r\n", dns_stats.dns_forwarded);
+	lprint("  %6lu replies cached (%lu evicted)\r\n", dns_stats.dns_stored, dns_stats.dns_evicted);
+}
+
 void
 icmpstats()
 {
@@ -270,7 +284,11 @@ icmpstats()
 void
 mbufstats()
 {
+	static u_long last_allocs[SLAB_NCLASSES];
+	static u_int last_time;
+	struct slab_class *sc;
 	struct mbuf *m;
+	u_int elapsed;
 	int i;
 	
         lprint(" \r\n");
@@ -279,16 +297,29 @@ mbufstats()
 
 	lprint("  %6d mbufs allocated (%d max)\r\n", mbuf_alloced, mbuf_max);
 	
-	i = 0;
-	for (m = m_freelist.m_next; m != &m_freelist; m = m->m_next)
-		i++;
-	lprint("  %6d mbufs on free list\r\n",  i);
-	
 	i = 0;
 	for (m = m_usedlist.m_next; m != &m_usedlist; m = m->m_next)
 		i++;
 	lprint("  %6d mbufs on used list\r\n",  i);
         lprint("  %6d mbufs queued as packets\r\n\r\n", if_queued);
+
+	/*
+	 * Slab allocator: alloc rate since the last call, objects
+	 * in use, peak, and the share of the objects in use that
+	 * was not actually requested (internal fragmentation)
+	 */
+	elapsed = curtime - last_time;
+	last_time = curtime;
+	lprint("   Size   Allocs/s  In use  Peak  Total  Unused%%\r\n");
+	for (i = 0; i < SLAB_NCLASSES; i++) {
+		sc = &slab_classes[i];
+		lprint("  %6d %9lu  %6d %5d  %5d  %6d\r\n", sc->sc_size,
+		       elapsed ? (sc->sc_allocs - last_allocs[i]) * 1000 / elapsed : 0,
+		       sc->sc_inuse, sc->sc_peak, sc->sc_total,
+		       sc->sc_inuse ? (int)(100 - sc->sc_requested * 100 / ((u_long)sc->sc_inuse * sc->sc_size)) : 0);
+		last_allocs[i] = sc->sc_allocs;
+	}
+	lprint("  %6d larger data segments in use (%lu allocated)\r\n", slab_large_inuse, slab_large_allocs);
 }
 
 void
@@ -351,6 +382,7 @@ slirp_exit(exit_status)
 		ipstats();
 		tcpstats();
 		udpstats();
+		dnsstats();
 		icmpstats();
 		mbufstats();
 		sockstats();
@@ -43,6 +43,7 @@ void ipstats _P((void));
 void vjstats _P((void));
 void tcpstats _P((void));
 void udpstats _P((void));
+void dnsstats _P((void));
 void icmpstats _P((void));
 void mbufstats _P((void));
 void sockstats _P((void));
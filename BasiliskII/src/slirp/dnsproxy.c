@@ -0,0 +1,540 @@
+/*
+ * dnsproxy.c - caching DNS proxy for the virtual name server
+ *
+ * Please read the file COPYRIGHT for the
+ * terms and conditions of the copyright.
+ */
+
+/*
+ * Queries to the virtual name server (CTL_DNS) are still forwarded to
+ * the host's name server through the UDP NAT, but the replies are kept
+ * for as long as their TTLs allow and answer later queries for the same
+ * question directly.  While a question is being forwarded, identical
+ * queries (other IDs or other guest ports) wait for its reply instead
+ * of being forwarded as well.  Names listed in "dnsstatic" prefs items
+ * are answered locally, without asking any name server.
+ */
+
+#include <slirp.h>
+#include <ctype.h>
+
+const char *PrefsFindStringC(const char *name, int index);
+
+struct dns_stats dns_stats;
+
+#define DNS_HLEN	12		/* Size of DNS header */
+#define DNS_KEY_MAX	(255 + 4)	/* Name in wire format, QTYPE, QCLASS */
+
+#define DNS_TYPE_A	1
+#define DNS_TYPE_OPT	41
+#define DNS_TYPE_ANY	255
+#define DNS_CLASS_IN	1
+
+#define DNS_RCODE_NOERROR	0
+#define DNS_RCODE_NXDOMAIN	3
+
+/* Guest query, identified by the guest's address, port and query ID */
+struct dns_client {
+	struct in_addr	addr;
+	u_int16_t	port;
+	u_int16_t	id;
+};
+
+struct dns_entry {
+	struct dns_entry *lru_next;	/* LRU list, first for insque/remque */
+	struct dns_entry *lru_prev;
+	struct dns_entry *hash_next;
+	u_int32_t	hash;
+	int		keylen;
+	u_char		key[DNS_KEY_MAX];	/* Question, name in lower case */
+	int		pending;		/* Forwarded, no reply yet */
+	u_int		expire;			/* End of TTL or of pending state */
+	u_int		stored;			/* When the reply was cached */
+	struct dns_client origin;		/* Query that was forwarded */
+	int		nwaiters;
+	struct dns_client waiters[DNS_MAX_WAITERS];	/* Queries that joined it */
+	u_char		*reply;			/* Cached reply */
+	int		reply_len;
+	int		nttls;
+	u_int16_t	ttl_off[DNS_MAX_RRS];	/* Offsets of TTLs in reply */
+};
+
+struct dns_static_entry {
+	char		*name;			/* Lower case, no trailing dot */
+	struct in_addr	addr;
+};
+
+static struct dns_entry *dns_hash[DNS_CACHE_BUCKETS];
+static struct dns_entry dns_lru;		/* Most recently used first */
+static int dns_count;
+
+static struct dns_static_entry *dns_static_table;
+static int dns_nstatic;
+
+/* a is earlier than b, for curtime values */
+#define DNS_BEFORE(a, b) ((int)((a) - (b)) < 0)
+
+static u_int16_t get16(const u_char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static u_int32_t get32(const u_char *p)
+{
+	return ((u_int32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void put16(u_char *p, u_int16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void put32(u_char *p, u_int32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/*
+ * Extract the question of a message with exactly one, returns the
+ * offset of the first byte after it or -1
+ */
+static int dns_question(const u_char *msg, int len, u_char *key, int *keylen)
+{
+	int pos = DNS_HLEN, n = 0, l;
+
+	if (len < DNS_HLEN || get16(msg + 4) != 1)
+		return -1;
+	for (;;) {
+		if (pos >= len)
+			return -1;
+		l = msg[pos++];
+		if ((l & 0xc0) || n + l + 1 > 255 || pos + l > len)
+			return -1;
+		key[n++] = l;
+		if (l == 0)
+			break;
+		while (l--)
+			key[n++] = tolower(msg[pos++]);
+	}
+	if (pos + 4 > len)
+		return -1;
+	memcpy(key + n, msg + pos, 4);
+	*keylen = n + 4;
+	return pos + 4;
+}
+
+/* Convert the name in key to dotted form */
+static void dns_key_name(const u_char *key, char *name)
+{
+	int pos = 0, n = 0, l;
+
+	while ((l = key[pos++]) != 0) {
+		if (n)
+			name[n++] = '.';
+		memcpy(name + n, key + pos, l);
+		n += l;
+		pos += l;
+	}
+	name[n] = '\0';
+}
+
+/* Skip a (possibly compressed) name in a resource record, returns -1 if malformed */
+static int dns_skip_name(const u_char *msg, int len, int pos)
+{
+	int l;
+
+	while (pos < len) {
+		l = msg[pos];
+		if ((l & 0xc0) == 0xc0)
+			return pos + 2 <= len ? pos + 2 : -1;
+		if (l & 0xc0)
+			return -1;
+		pos += l + 1;
+		if (l == 0)
+			return pos;
+	}
+	return -1;
+}
+
+/*
+ * Record where the TTLs of a reply's resource records are and find the
+ * time it may be cached for, returns -1 if it can't be cached
+ */
+static int dns_scan_ttls(struct dns_entry *e, const u_char *msg, int len, int pos, u_int32_t *ttl)
+{
+	int an = get16(msg + 6), ns = get16(msg + 8), ar = get16(msg + 10);
+	int rcode = msg[3] & 0x0f;
+	int i, type, rdlen;
+	u_int32_t t, lowest = DNS_CACHE_MAX_TTL;
+
+	e->nttls = 0;
+	for (i = 0; i < an + ns + ar; i++) {
+		pos = dns_skip_name(msg, len, pos);
+		if (pos < 0 || pos + 10 > len)
+			return -1;
+		type = get16(msg + pos);
+		rdlen = get16(msg + pos + 8);
+		if (pos + 10 + rdlen > len)
+			return -1;
+		/* The TTL field of an EDNS OPT record holds flags */
+		if (type != DNS_TYPE_OPT) {
+			if (e->nttls == DNS_MAX_RRS)
+				return -1;
+			e->ttl_off[e->nttls++] = pos + 4;
+			t = get32(msg + pos + 4);
+			if (t & 0x80000000)	/* RFC 2181: treat as zero */
+				t = 0;
+			if (i < an + ns && t < lowest)
+				lowest = t;
+		}
+		pos += 10 + rdlen;
+	}
+
+	/* Negative replies are cached per the SOA in the authority section (RFC 2308) */
+	if (rcode == DNS_RCODE_NXDOMAIN || an == 0) {
+		if (ns == 0)
+			return -1;
+		if (lowest > DNS_NEG_MAX_TTL)
+			lowest = DNS_NEG_MAX_TTL;
+	}
+	*ttl = lowest;
+	return 0;
+}
+
+static u_int32_t dns_hash_key(const u_char *key, int keylen)
+{
+	u_int32_t h = 2166136261U;	/* FNV-1a */
+
+	while (keylen--) {
+		h ^= *key++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static struct dns_entry *dns_lookup(const u_char *key, int keylen, u_int32_t hash)
+{
+	struct dns_entry *e;
+
+	for (e = dns_hash[hash & (DNS_CACHE_BUCKETS - 1)]; e; e = e->hash_next)
+		if (e->hash == hash && e->keylen == keylen && memcmp(e->key, key, keylen) == 0)
+			return e;
+	return NULL;
+}
+
+static void dns_remove(struct dns_entry *e)
+{
+	struct dns_entry **pp = &dns_hash[e->hash & (DNS_CACHE_BUCKETS - 1)];
+
+	while (*pp != e)
+		pp = &(*pp)->hash_next;
+	*pp = e->hash_next;
+	remque(e);
+	if (e->reply)
+		free(e->reply);
+	free(e);
+	dns_count--;
+}
+
+static struct dns_entry *dns_create(const u_char *key, int keylen, u_int32_t hash)
+{
+	struct dns_entry *e;
+
+	if (dns_count >= DNS_CACHE_MAX) {
+		dns_remove(dns_lru.lru_prev);
+		dns_stats.dns_evicted++;
+	}
+	e = (struct dns_entry *)malloc(sizeof(*e));
+	if (e == NULL)
+		return NULL;
+	memset(e, 0, sizeof(*e));
+	memcpy(e->key, key, keylen);
+	e->keylen = keylen;
+	e->hash = hash;
+	e->hash_next = dns_hash[hash & (DNS_CACHE_BUCKETS - 1)];
+	dns_hash[hash & (DNS_CACHE_BUCKETS - 1)] = e;
+	insque(e, &dns_lru);
+	dns_count++;
+	return e;
+}
+
+static void dns_touch(struct dns_entry *e)
+{
+	remque(e);
+	insque(e, &dns_lru);
+}
+
+/* Get an mbuf with room for a len byte message to the guest */
+static struct mbuf *dns_mbuf(int len)
+{
+	struct mbuf *m;
+
+	if ((m = m_get()) == NULL)
+		return NULL;
+	m->m_data += if_maxlinkhdr;
+	if (len > M_FREEROOM(m))
+		m_inc(m, (m->m_data - m->m_dat) + len + 1);
+	m->m_len = len;
+	return m;
+}
+
+/* Send a message to the guest, from the virtual name server */
+static void dns_output(struct mbuf *m, const struct dns_client *c)
+{
+	struct sockaddr_in saddr, daddr;
+
+	put16((u_char *)m->m_data, c->id);
+	saddr.sin_addr.s_addr = special_addr.s_addr | htonl(CTL_DNS);
+	saddr.sin_port = htons(DNS_PORT);
+	daddr.sin_addr = c->addr;
+	daddr.sin_port = c->port;
+	udp_output2(NULL, m, &saddr, &daddr, IPTOS_LOWDELAY);
+}
+
+/* Answer a query for a "dnsstatic" name, returns 0 if it isn't one */
+static int dns_static_answer(const struct dns_client *c, const u_char *msg, int qend, const u_char *key, int keylen)
+{
+	char name[256];
+	struct dns_static_entry *s = NULL;
+	struct mbuf *m;
+	u_char *p;
+	int i, answer;
+
+	if (get16(key + keylen - 2) != DNS_CLASS_IN)
+		return 0;
+	dns_key_name(key, name);
+	for (i = 0; i < dns_nstatic; i++) {
+		if (strcmp(dns_static_table[i].name, name) == 0) {
+			s = &dns_static_table[i];
+			break;
+		}
+	}
+	if (s == NULL)
+		return 0;
+
+	/* Other types than A get an empty (NODATA) reply */
+	answer = (get16(key + keylen - 4) == DNS_TYPE_A || get16(key + keylen - 4) == DNS_TYPE_ANY);
+	if ((m = dns_mbuf(qend + (answer ? 16 : 0))) == NULL)
+		return 1;
+	p = (u_char *)m->m_data;
+	memcpy(p, msg, qend);
+	p[2] = 0x84 | (msg[2] & 0x01);		/* QR, AA, RD from query */
+	p[3] = 0x80;				/* RA, NOERROR */
+	put16(p + 6, answer);
+	put16(p + 8, 0);
+	put16(p + 10, 0);
+	if (answer) {
+		p += qend;
+		put16(p, 0xc000 | DNS_HLEN);	/* Name of question */
+		put16(p + 2, DNS_TYPE_A);
+		put16(p + 4, DNS_CLASS_IN);
+		put32(p + 6, DNS_STATIC_TTL);
+		put16(p + 10, 4);
+		memcpy(p + 12, &s->addr, 4);
+	}
+	dns_output(m, c);
+	return 1;
+}
+
+/*
+ * Look at a query the guest sends to the virtual name server, returns
+ * 1 if it has been answered (or will be, together with an identical
+ * query that was already forwarded), 0 if it has to be forwarded
+ */
+int dns_proxy_query(struct socket *so, struct mbuf *m)
+{
+	const u_char *msg = (const u_char *)m->m_data;
+	u_char key[DNS_KEY_MAX];
+	int keylen, qend, i;
+	u_int32_t hash, elapsed, t;
+	struct dns_client c;
+	struct dns_entry *e;
+	struct mbuf *r;
+	u_char *p;
+
+	/* Standard queries only */
+	if (m->m_len < DNS_HLEN || (msg[2] & 0xf8) != 0)
+		return 0;
+	if ((qend = dns_question(msg, m->m_len, key, &keylen)) < 0)
+		return 0;
+	dns_stats.dns_queries++;
+	c.addr = so->so_laddr;
+	c.port = so->so_lport;
+	c.id = get16(msg);
+
+	if (dns_nstatic && dns_static_answer(&c, msg, qend, key, keylen)) {
+		dns_stats.dns_static++;
+		return 1;
+	}
+
+	hash = dns_hash_key(key, keylen);
+	e = dns_lookup(key, keylen, hash);
+	if (e && DNS_BEFORE(curtime, e->expire)) {
+		dns_touch(e);
+		if (!e->pending) {
+			/* Cached, count down the TTLs */
+			if ((r = dns_mbuf(e->reply_len)) != NULL) {
+				p = (u_char *)r->m_data;
+				memcpy(p, e->reply, e->reply_len);
+				/* Echo the question as the guest spelled it */
+				memcpy(p + DNS_HLEN, msg + DNS_HLEN, qend - DNS_HLEN);
+				elapsed = (curtime - e->stored) / 1000;
+				for (i = 0; i < e->nttls; i++) {
+					t = get32(p + e->ttl_off[i]);
+					put32(p + e->ttl_off[i], t > elapsed ? t - elapsed : 0);
+				}
+				dns_output(r, &c);
+			}
+			dns_stats.dns_hits++;
+			return 1;
+		}
+
+		/* Retransmission of the forwarded query, let it through */
+		if (e->origin.addr.s_addr == c.addr.s_addr && e->origin.port == c.port) {
+			e->origin.id = c.id;
+			dns_stats.dns_forwarded++;
+			return 0;
+		}
+
+		/* Wait for the forwarded query's reply */
+		for (i = 0; i < e->nwaiters; i++) {
+			if (e->waiters[i].addr.s_addr == c.addr.s_addr && e->waiters[i].port == c.port) {
+				e->waiters[i].id = c.id;
+				return 1;
+			}
+		}
+		if (e->nwaiters < DNS_MAX_WAITERS) {
+			e->waiters[e->nwaiters++] = c;
+			dns_stats.dns_coalesced++;
+			return 1;
+		}
+		dns_stats.dns_forwarded++;
+		return 0;
+	}
+
+	/* Not cached (or expired), forward it */
+	if (e) {
+		if (e->reply)
+			free(e->reply);
+		e->reply = NULL;
+		dns_touch(e);
+	} else if ((e = dns_create(key, keylen, hash)) == NULL)
+		return 0;
+	e->pending = 1;
+	e->expire = curtime + DNS_PENDING_TIMEOUT;
+	e->origin = c;
+	e->nwaiters = 0;
+	dns_stats.dns_forwarded++;
+	return 0;
+}
+
+/*
+ * Look at a reply from the host's name server, before it is passed on
+ * to the guest
+ */
+void dns_proxy_reply(struct socket *so, struct mbuf *m)
+{
+	const u_char *msg = (const u_char *)m->m_data;
+	int len = m->m_len, keylen, qend, i, rcode;
+	u_char key[DNS_KEY_MAX];
+	struct dns_entry *e;
+	struct mbuf *r;
+	u_int32_t ttl;
+
+	/* Response to a standard query */
+	if (len < DNS_HLEN || (msg[2] & 0xf8) != 0x80)
+		return;
+	if ((qend = dns_question(msg, len, key, &keylen)) < 0)
+		return;
+	e = dns_lookup(key, keylen, dns_hash_key(key, keylen));
+	if (e == NULL || !e->pending ||
+	    e->origin.addr.s_addr != so->so_laddr.s_addr ||
+	    e->origin.port != so->so_lport || e->origin.id != get16(msg))
+		return;
+
+	/* Answer the queries that joined the forwarded one */
+	for (i = 0; i < e->nwaiters; i++) {
+		if ((r = dns_mbuf(len)) != NULL) {
+			memcpy(r->m_data, msg, len);
+			dns_output(r, &e->waiters[i]);
+		}
+	}
+	e->nwaiters = 0;
+	e->pending = 0;
+
+	/* Keep complete answers and negative replies */
+	rcode = msg[3] & 0x0f;
+	if ((msg[2] & 0x02) != 0 ||		/* TC */
+	    (rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN) ||
+	    dns_scan_ttls(e, msg, len, qend, &ttl) < 0 || ttl == 0 ||
+	    (e->reply = (u_char *)malloc(len)) == NULL) {
+		dns_remove(e);
+		return;
+	}
+	memcpy(e->reply, msg, len);
+	e->reply_len = len;
+	e->stored = curtime;
+	e->expire = curtime + ttl * 1000;
+	dns_stats.dns_stored++;
+}
+
+/*
+ * Set up the cache and read the "dnsstatic" items, which look like
+ * hosts file lines: an address followed by one or more names.
+ * Returns the number of static names.
+ */
+int dns_proxy_init(void)
+{
+	const char *str;
+	char *line, *tok, *p;
+	struct in_addr addr;
+	struct dns_static_entry *t;
+	int i;
+
+	dns_lru.lru_next = dns_lru.lru_prev = &dns_lru;
+
+	for (i = 0; (str = PrefsFindStringC("dnsstatic", i)) != NULL; i++) {
+		if ((line = strdup(str)) == NULL)
+			continue;
+		tok = strtok(line, " \t");
+		if (tok == NULL || !inet_aton(tok, &addr)) {
+			lprint("Bad dnsstatic item \"%s\"\n", str);
+			free(line);
+			continue;
+		}
+		while ((tok = strtok(NULL, " \t")) != NULL) {
+			t = (struct dns_static_entry *)realloc(dns_static_table, (dns_nstatic + 1) * sizeof(*t));
+			if (t == NULL)
+				break;
+			dns_static_table = t;
+			t = &dns_static_table[dns_nstatic];
+			if ((t->name = strdup(tok)) == NULL)
+				break;
+			for (p = t->name; *p; p++)
+				*p = tolower(*p);
+			if (p > t->name && p[-1] == '.')
+				p[-1] = '\0';
+			t->addr = addr;
+			dns_nstatic++;
+		}
+		free(line);
+	}
+	return dns_nstatic;
+}
+
+void dns_proxy_cleanup(void)
+{
+	int i;
+
+	while (dns_lru.lru_next != &dns_lru)
+		dns_remove(dns_lru.lru_next);
+	for (i = 0; i < dns_nstatic; i++)
+		free(dns_static_table[i].name);
+	free(dns_static_table);
+	dns_static_table = NULL;
+	dns_nstatic = 0;
+}
@@ -0,0 +1,34 @@
+/* dnsproxy defines */
+
+#ifndef _DNSPROXY_H_
+#define _DNSPROXY_H_
+
+#define DNS_PORT		53
+
+#define DNS_CACHE_BUCKETS	256	/* Hash buckets (power of 2) */
+#define DNS_CACHE_MAX		512	/* Max. number of cached questions */
+#define DNS_CACHE_MAX_TTL	3600	/* Cap on cached TTLs [s] */
+#define DNS_NEG_MAX_TTL		300	/* Cap on cached NXDOMAIN/NODATA TTLs [s] */
+#define DNS_PENDING_TIMEOUT	5000	/* Time duplicates join a forwarded query [ms] */
+#define DNS_MAX_WAITERS		8	/* Max. duplicates joining one forwarded query */
+#define DNS_MAX_RRS		32	/* Max. resource records in a cached reply */
+#define DNS_STATIC_TTL		60	/* TTL of answers from the "dnsstatic" table [s] */
+
+struct dns_stats {
+	u_long	dns_queries;		/* Queries to the virtual name server */
+	u_long	dns_hits;		/* ... answered from the cache */
+	u_long	dns_coalesced;		/* ... that joined a forwarded query */
+	u_long	dns_static;		/* ... answered from the "dnsstatic" table */
+	u_long	dns_forwarded;		/* ... forwarded to the host's name server */
+	u_long	dns_stored;		/* Replies entered into the cache */
+	u_long	dns_evicted;		/* Entries dropped because the cache was full */
+};
+
+extern struct dns_stats dns_stats;
+
+int dns_proxy_init _P((void));
+void dns_proxy_cleanup _P((void));
+int dns_proxy_query _P((struct socket *, struct mbuf *));
+void dns_proxy_reply _P((struct socket *, struct mbuf *));
+
+#endif
@@ -13,6 +13,8 @@ int if_maxlinkhdr;
 int     if_queued = 0;                  /* Number of packets queued so far */
 int     if_thresh = 10;                 /* Number of packets queued before we start sending
 					 * (to prevent allocing too many mbufs) */
+int	if_hold = 0;			/* If nonzero, if_output only queues packets, so a
+					 * burst of segments goes out in one if_start */
 
 struct  mbuf if_fastq;                  /* fast queue (for interactive data) */
 struct  mbuf if_batchq;                 /* queue for non-interactive data */
@@ -222,6 +224,7 @@ diddit:
 		/* Update *_queued */
 		so->so_queued++;
 		so->so_nqueued++;
+		sochanged(so);
 		/*
 		 * Check if the interactive session should be downgraded to
 		 * the batchq.  A session is downgraded if it has queued 6
@@ -244,7 +247,7 @@ diddit:
 	/*
 	 * This prevents us from malloc()ing too many mbufs
 	 */
-	if (link_up) {
+	if (link_up && !if_hold) {
 		/* if_start will check towrite */
 		if_start();
 	}
@@ -307,6 +310,7 @@ if_start(void)
 	
 	/* Update so_queued */
 	if (ifm->ifq_so) {
+		sochanged(ifm->ifq_so);
 		if (--ifm->ifq_so->so_queued == 0)
 		   /* If there's no more queued, reset nqueued */
 		   ifm->ifq_so->so_nqueued = 0;
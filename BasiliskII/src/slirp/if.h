@@ -22,6 +22,7 @@ extern int	if_maxlinkhdr;
 extern int	if_queued;	/* Number of packets queued so far */
 extern int	if_thresh;	/* Number of packets queued before we start sending
 				 * (to prevent allocing too many mbufs) */
+extern int	if_hold;	/* Defer if_start while nonzero */
 
 extern	struct mbuf if_fastq;                  /* fast queue (for interactive data) */
 extern	struct mbuf if_batchq;                 /* queue for non-interactive data */
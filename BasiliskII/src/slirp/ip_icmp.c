@@ -95,7 +95,7 @@ icmp_input(m, hlen)
   m->m_len -= hlen;
   m->m_data += hlen;
   icp = mtod(m, struct icmp *);
-  if (cksum(m, icmplen)) {
+  if (cksum_verify && cksum(m, icmplen)) {
     icmpstat.icps_checksum++;
     goto freeit;
   }
@@ -108,7 +108,14 @@ icmp_input(m, hlen)
   DEBUG_ARG("icmp_type = %d", icp->icmp_type);
   switch (icp->icmp_type) {
   case ICMP_ECHO:
-    icp->icmp_type = ICMP_ECHOREPLY;
+    {
+      /* Only the type changes, so update the checksum incrementally */
+      u_int16_t o, n;
+      memcpy(&o, icp, 2);		/* icmp_type and icmp_code */
+      icp->icmp_type = ICMP_ECHOREPLY;
+      memcpy(&n, icp, 2);
+      icp->icmp_cksum = cksum_adjust(icp->icmp_cksum, o, n);
+    }
     ip->ip_len += hlen;	             /* since ip_input subtracts this */
     if (ip->ip_dst.s_addr == alias_addr.s_addr) {
       icmp_reflect(m);
@@ -327,21 +334,11 @@ icmp_reflect(m)
   register struct ip *ip = mtod(m, struct ip *);
   int hlen = ip->ip_hl << 2;
   int optlen = hlen - sizeof(struct ip );
-  register struct icmp *icp;
 
   /*
-   * Send an icmp packet back to the ip level,
-   * after supplying a checksum.
+   * Send an icmp packet back to the ip level
+   * (the caller has already updated the icmp checksum)
    */
-  m->m_data += hlen;
-  m->m_len -= hlen;
-  icp = mtod(m, struct icmp *);
-
-  icp->icmp_cksum = 0;
-  icp->icmp_cksum = cksum(m, ip->ip_len - hlen);
-
-  m->m_data -= hlen;
-  m->m_len += hlen;
 
   /* fill in ip */
   if (optlen > 0) {
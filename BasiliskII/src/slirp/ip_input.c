@@ -110,7 +110,7 @@ ip_input(m)
 	 * ip->ip_sum = cksum(m, hlen); 
 	 * if (ip->ip_sum) { 
 	 */
-	if(cksum(m,hlen)) {
+	if(cksum_verify && cksum(m,hlen)) {
 	  ipstat.ips_badsum++;
 	  goto bad;
 	}
@@ -29,6 +29,15 @@ int slirp_select_fill(int *pnfds,
 
 void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds);
 
+#ifdef HAVE_SYS_EPOLL_H
+/* epoll() alternative to slirp_select_fill()/slirp_select_poll(): the
+   fill function keeps the sockets registered with the given epoll
+   instance and returns the timeout in usecs (-1 = none) */
+struct epoll_event;
+int slirp_epoll_fill(int epfd);
+void slirp_epoll_poll(const struct epoll_event *events, int nevents);
+#endif
+
 void slirp_input(const uint8 *pkt, int pkt_len);
 
 /* you must provide the following functions: */
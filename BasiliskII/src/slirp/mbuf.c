@@ -13,6 +13,14 @@
  * could hold, an external malloced buffer is pointed to
  * by m_ext (and the data pointers) and M_EXT is set in
  * the flags
+ *
+ * Both mbufs and external data segments (as well as socket
+ * buffers, see sbuf.c) come from a simple slab allocator:
+ * objects are carved from large chunks and recycled through
+ * a free list per size class, so that steady traffic doesn't
+ * malloc() and free() at all.  Slirp only ever runs on one
+ * thread, so the free lists serve as a per-thread cache and
+ * need no locking.
  */
 
 #include <stdlib.h>
@@ -21,17 +29,23 @@
 struct	mbuf *mbutl;
 char	*mclrefcnt;
 int mbuf_alloced = 0;
-struct mbuf m_freelist, m_usedlist;
-int mbuf_thresh = 30;
+struct mbuf m_usedlist;
 int mbuf_max = 0;
 int msize;
 
+struct slab_class slab_classes[SLAB_NCLASSES];
+int slab_large_inuse;		/* Data segments too large for any class */
+u_long slab_large_allocs;
+
 void
 m_init()
 {
-	m_freelist.m_next = m_freelist.m_prev = &m_freelist;
+	int i;
+
 	m_usedlist.m_next = m_usedlist.m_prev = &m_usedlist;
 	msize_init();
+	for (i = 1; i < SLAB_NCLASSES; i++)
+		slab_classes[i].sc_size = SLAB_MIN_DATA << (i - 1);
 }
 
 void
@@ -43,40 +57,160 @@ msize_init()
 	 */
 	msize = (if_mtu>if_mru?if_mtu:if_mru) + 
 			if_maxlinkhdr + sizeof(struct m_hdr ) + 6;
+
+	/* Keep the mbufs in a chunk aligned */
+	msize = (msize + 15) & ~15;
+	slab_classes[SLAB_MBUF].sc_size = msize;
+}
+
+/*
+ * Get an object from the free list of a size class, if there
+ * are none carve a new chunk into objects
+ */
+static void *
+slab_get(sc)
+	struct slab_class *sc;
+{
+	char *p;
+	int n;
+
+	if (sc->sc_free == NULL) {
+		n = SLAB_CHUNK / sc->sc_size;
+		if (n < 1)
+		   n = 1;
+		p = (char *)malloc(n * sc->sc_size);
+		if (p == NULL)
+		   return NULL;
+		sc->sc_total += n;
+		while (n--) {
+			*(void **)p = sc->sc_free;
+			sc->sc_free = p;
+			p += sc->sc_size;
+		}
+	}
+
+	p = (char *)sc->sc_free;
+	sc->sc_free = *(void **)p;
+	sc->sc_allocs++;
+	if (++sc->sc_inuse > sc->sc_peak)
+	   sc->sc_peak = sc->sc_inuse;
+	return p;
+}
+
+static void
+slab_put(sc, p)
+	struct slab_class *sc;
+	void *p;
+{
+	*(void **)p = sc->sc_free;
+	sc->sc_free = p;
+	sc->sc_inuse--;
+}
+
+/*
+ * Find the size class for a data segment, returns SLAB_NCLASSES
+ * if it is too large for any of them
+ */
+static int
+slab_class_of(size)
+	int size;
+{
+	int i = 1;
+
+	while (i < SLAB_NCLASSES && slab_classes[i].sc_size < size)
+		i++;
+	return i;
+}
+
+/*
+ * Allocate a data segment of size bytes
+ */
+void *
+slab_alloc(size)
+	int size;
+{
+	struct slab_class *sc;
+	int i = slab_class_of(size);
+	void *p;
+
+	if (i == SLAB_NCLASSES) {
+		p = malloc(size);
+		if (p) {
+			slab_large_inuse++;
+			slab_large_allocs++;
+		}
+		return p;
+	}
+
+	sc = &slab_classes[i];
+	p = slab_get(sc);
+	if (p)
+	   sc->sc_requested += size;
+	return p;
 }
 
 /*
- * Get an mbuf from the free list, if there are none
- * malloc one
- * 
- * Because fragmentation can occur if we alloc new mbufs and
- * free old mbufs, we mark all mbufs above mbuf_thresh as M_DOFREE,
- * which tells m_free to actually free() it
+ * Free a data segment, size must be the same as in slab_alloc()
+ */
+void
+slab_free(p, size)
+	void *p;
+	int size;
+{
+	struct slab_class *sc;
+	int i;
+
+	if (p == NULL)
+	   return;
+
+	i = slab_class_of(size);
+	if (i == SLAB_NCLASSES) {
+		free(p);
+		slab_large_inuse--;
+		return;
+	}
+
+	sc = &slab_classes[i];
+	sc->sc_requested -= size;
+	slab_put(sc, p);
+}
+
+/*
+ * Try to resize a data segment of size bytes to new_size bytes in
+ * place (which works within its size class), returns 0 if it has
+ * to be reallocated
+ */
+int
+slab_resize(size, new_size)
+	int size, new_size;
+{
+	int i = slab_class_of(size);
+
+	if (i == SLAB_NCLASSES || slab_class_of(new_size) != i)
+	   return 0;
+	slab_classes[i].sc_requested += new_size - size;
+	return 1;
+}
+
+/*
+ * Get an mbuf from the slab
  */
 struct mbuf *
 m_get()
 {
 	register struct mbuf *m;
-	int flags = 0;
 	
 	DEBUG_CALL("m_get");
 	
-	if (m_freelist.m_next == &m_freelist) {
-		m = (struct mbuf *)malloc(msize);
-		if (m == NULL) goto end_error;
-		mbuf_alloced++;
-		if (mbuf_alloced > mbuf_thresh)
-			flags = M_DOFREE;
-		if (mbuf_alloced > mbuf_max)
-			mbuf_max = mbuf_alloced;
-	} else {
-		m = m_freelist.m_next;
-		remque(m);
-	}
+	m = (struct mbuf *)slab_get(&slab_classes[SLAB_MBUF]);
+	if (m == NULL) goto end_error;
+	slab_classes[SLAB_MBUF].sc_requested += msize;
+	if (++mbuf_alloced > mbuf_max)
+		mbuf_max = mbuf_alloced;
 	
 	/* Insert it in the used list */
 	insque(m,&m_usedlist);
-	m->m_flags = (flags | M_USEDLIST);
+	m->m_flags = M_USEDLIST;
 	
 	/* Initialise it */
 	m->m_size = msize - sizeof(struct m_hdr);
@@ -102,26 +236,21 @@ m_free(m)
 	if (m->m_flags & M_USEDLIST)
 	   remque(m);
 	
-	/* If it's M_EXT, free() it */
-	if (m->m_flags & M_EXT)
-	   free(m->m_ext);
-
-	/*
-	 * Either free() it or put it on the free list
-	 */
-	if (m->m_flags & M_DOFREE) {
-		free(m);
-		mbuf_alloced--;
-	} else if ((m->m_flags & M_FREELIST) == 0) {
-		insque(m,&m_freelist);
+	/* Give back the mbuf (once) and its M_EXT data */
+	if ((m->m_flags & M_FREELIST) == 0) {
+		if (m->m_flags & M_EXT)
+		   slab_free(m->m_ext, m->m_size);
 		m->m_flags = M_FREELIST; /* Clobber other flags */
+		slab_classes[SLAB_MBUF].sc_requested -= msize;
+		slab_put(&slab_classes[SLAB_MBUF], m);
+		mbuf_alloced--;
 	}
   } /* if(m) */
 }
 
 /*
  * Copy data from one mbuf to the end of
- * the other.. if result is too big for one mbuf, malloc()
+ * the other.. if result is too big for one mbuf, allocate
  * an M_EXT data segment
  */
 void
@@ -153,16 +282,23 @@ m_inc(m, size)
         if(m->m_size>size) return;
 
         if (m->m_flags & M_EXT) {
-         datasize = m->m_data - m->m_ext;
-	  m->m_ext = (char *)realloc(m->m_ext,size);
-/*		if (m->m_ext == NULL)
+	  /* If the segment has room to spare, just use more of it */
+	  if (!slab_resize(m->m_size, size)) {
+	    char *dat;
+	    datasize = m->m_data - m->m_ext;
+	    dat = (char *)slab_alloc(size);
+/*		if (dat == NULL)
  *			return (struct mbuf *)NULL;
- */		
-         m->m_data = m->m_ext + datasize;
+ */
+	    memcpy(dat, m->m_ext, m->m_size);
+	    slab_free(m->m_ext, m->m_size);
+	    m->m_ext = dat;
+	    m->m_data = m->m_ext + datasize;
+	  }
         } else {
 	  char *dat;
 	  datasize = m->m_data - m->m_dat;
-	  dat = (char *)malloc(size);
+	  dat = (char *)slab_alloc(size);
 /*		if (dat == NULL)
  *			return (struct mbuf *)NULL;
  */
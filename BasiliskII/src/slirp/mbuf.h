@@ -110,11 +110,9 @@ struct mbuf {
 #define ifs_next m_nextpkt
 #define ifq_so m_so
 
-#define M_EXT			0x01	/* m_ext points to more (malloced) data */
+#define M_EXT			0x01	/* m_ext points to more (slab_alloc()ed) data */
 #define M_FREELIST		0x02	/* mbuf is on free list */
 #define M_USEDLIST		0x04	/* XXX mbuf is on used list (for dtom()) */
-#define M_DOFREE		0x08	/* when m_free is called on the mbuf, free()
-					 * it rather than putting it on the free list */
 
 /*
  * Mbuf statistics. XXX
@@ -127,11 +125,39 @@ struct mbstat {
 
 extern struct	mbstat mbstat;
 extern int mbuf_alloced;
-extern struct mbuf m_freelist, m_usedlist;
+extern struct mbuf m_usedlist;
 extern int mbuf_max;
 
+/*
+ * Slab allocator size classes.  Class 0 holds the mbufs themselves
+ * (msize bytes, i.e. for standard MTU packets), the others hold
+ * M_EXT data segments for larger (jumbo or reassembled) packets and
+ * socket buffers, in power of 2 sizes from SLAB_MIN_DATA up.
+ */
+#define SLAB_MBUF	0
+#define SLAB_NCLASSES	9	/* Data classes up to 256K (TCP_MAXSPACE) */
+#define SLAB_MIN_DATA	2048	/* Size of smallest data class */
+#define SLAB_CHUNK	65536	/* Size of chunks that objects are carved from */
+
+struct slab_class {
+	int	sc_size;		/* Size of objects */
+	void	*sc_free;		/* Free objects, linked through their first word */
+	int	sc_total;		/* Objects carved from chunks */
+	int	sc_inuse;		/* Objects handed out */
+	int	sc_peak;		/* Max. value of sc_inuse */
+	u_long	sc_allocs;		/* Number of allocations */
+	u_long	sc_requested;		/* Bytes actually requested by objects in use */
+};
+
+extern struct slab_class slab_classes[SLAB_NCLASSES];
+extern int slab_large_inuse;
+extern u_long slab_large_allocs;
+
 void m_init _P((void));
 void msize_init _P((void));
+void *slab_alloc _P((int));
+void slab_free _P((void *, int));
+int slab_resize _P((int, int));
 struct mbuf * m_get _P((void));
 void m_free _P((struct mbuf *));
 void m_cat _P((register struct mbuf *, register struct mbuf *));
@@ -20,7 +20,7 @@ void
 sbfree(sb)
 	struct sbuf *sb;
 {
-	free(sb->sb_data);
+	slab_free(sb->sb_data, sb->sb_datalen);
 }
 
 void
@@ -49,7 +49,11 @@ sbreserve(sb, size)
 	if (sb->sb_data) {
 		/* Already alloced, realloc if necessary */
 		if (sb->sb_datalen != size) {
-			sb->sb_wptr = sb->sb_rptr = sb->sb_data = (char *)realloc(sb->sb_data, size);
+			if (!slab_resize(sb->sb_datalen, size)) {
+				slab_free(sb->sb_data, sb->sb_datalen);
+				sb->sb_data = (char *)slab_alloc(size);
+			}
+			sb->sb_wptr = sb->sb_rptr = sb->sb_data;
 			sb->sb_cc = 0;
 			if (sb->sb_wptr)
 			   sb->sb_datalen = size;
@@ -57,7 +61,7 @@ sbreserve(sb, size)
 			   sb->sb_datalen = 0;
 		}
 	} else {
-		sb->sb_wptr = sb->sb_rptr = sb->sb_data = (char *)malloc(size);
+		sb->sb_wptr = sb->sb_rptr = sb->sb_data = (char *)slab_alloc(size);
 		sb->sb_cc = 0;
 		if (sb->sb_wptr)
 		   sb->sb_datalen = size;
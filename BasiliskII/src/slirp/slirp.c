@@ -27,9 +27,6 @@ struct timeval tt;
 FILE *lfd;
 struct ex_list *exec_list;
 
-/* XXX: suppress those select globals */
-fd_set *global_readfds, *global_writefds, *global_xfds;
-
 char slirp_hostname[33];
 
 #ifdef _WIN32
@@ -128,6 +125,7 @@ void slirp_cleanup(void)
 {
     WSACleanup();
 	unload_host_domains();
+	dns_proxy_cleanup();
 }
 #endif
 
@@ -152,12 +150,18 @@ int slirp_init(void)
 
     /* Initialise mbufs *after* setting the MTU */
     m_init();
+    cksum_init();
 
     /* set default addresses */
     inet_aton("127.0.0.1", &loopback_addr);
 
-    if (get_dns_addr(&dns_addr) < 0)
-        return -1;
+    /* Without a host name server, the "dnsstatic" names still resolve */
+    if (get_dns_addr(&dns_addr) < 0) {
+        if (dns_proxy_init() == 0)
+            return -1;
+        dns_addr = loopback_addr;
+    } else
+        dns_proxy_init();
 
     inet_aton(CTL_SPECIAL, &special_addr);
 	alias_addr.s_addr = special_addr.s_addr | htonl(CTL_ALIAS);
@@ -167,7 +171,13 @@ int slirp_init(void)
 
 #define CONN_CANFSEND(so) (((so)->so_state & (SS_FCANTSENDMORE|SS_ISFCONNECTED)) == SS_ISFCONNECTED)
 #define CONN_CANFRCV(so) (((so)->so_state & (SS_FCANTRCVMORE|SS_ISFCONNECTED)) == SS_ISFCONNECTED)
-#define UPD_NFDS(x) if (nfds < (x)) nfds = (x)
+
+/*
+ * If a slowtimo is needed, poll again 5ms after the last slow timeout,
+ * a requested fast timeout is run within 2ms
+ */
+#define SLOW_TIMO 5
+#define FAST_TIMO 2
 
 /*
  * curtime kept to an accuracy of 1ms
@@ -194,119 +204,165 @@ static void updtime(void)
 }
 #endif
 
-int slirp_select_fill(int *pnfds, 
-					  fd_set *readfds, fd_set *writefds, fd_set *xfds)
+/*
+ * Sockets whose poll interest may have changed since the last fill,
+ * and sockets with events pending from the last epoll_wait()
+ */
+static struct socket *so_changed_list;
+static struct socket *so_ready_list;
+
+#ifdef HAVE_SYS_EPOLL_H
+/* Socket registered with epoll, indexed by fd */
+static struct socket **epoll_sockets;
+static int epoll_sockets_size;
+#endif
+
+/* When the next UDP socket expires, 0 if none will */
+static u_int udp_expire_due;
+
+/*
+ * Note that so's state changed, so that the epoll interface
+ * re-evaluates its poll interest on the next fill
+ */
+void sochanged(struct socket *so)
 {
-    struct socket *so, *so_next;
-    int nfds;
-    int timeout, tmp_time;
+	if (!(so->so_pollstate & SO_PS_CHANGED)) {
+		so->so_pollstate |= SO_PS_CHANGED;
+		so->so_changed_next = so_changed_list;
+		so_changed_list = so;
+	}
+}
+
+/*
+ * Forget about so before it is freed
+ */
+void so_poll_free(struct socket *so)
+{
+    struct socket **p;
+
+	if (so->so_pollstate & SO_PS_CHANGED) {
+		for (p = &so_changed_list; *p != so; p = &(*p)->so_changed_next)
+			;
+		*p = so->so_changed_next;
+	}
+	if (so->so_pollstate & SO_PS_READY) {
+		for (p = &so_ready_list; *p != so; p = &(*p)->so_ready_next)
+			;
+		*p = so->so_ready_next;
+	}
+	so->so_pollstate = 0;
+#ifdef HAVE_SYS_EPOLL_H
+	if (so->so_pollfd >= 0 && so->so_pollfd < epoll_sockets_size &&
+	    epoll_sockets[so->so_pollfd] == so)
+		epoll_sockets[so->so_pollfd] = NULL;
+#endif
+}
+
+/*
+ * Work out which events a TCP socket needs polling for (SO_POLL_*)
+ */
+static int tcp_want(struct socket *so)
+{
+    int events = 0;
 
-    /* fail safe */
-    global_readfds = NULL;
-    global_writefds = NULL;
-    global_xfds = NULL;
-    
-    nfds = *pnfds;
 	/*
-	 * First, TCP sockets
+	 * See if we need a tcp_fasttimo
 	 */
-	do_slowtimo = 0;
-	if (link_up) {
-		/* 
-		 * *_slowtimo needs calling if there are IP fragments
-		 * in the fragment queue, or there are TCP connections active
-		 */
-		do_slowtimo = ((tcb.so_next != &tcb) ||
-			 (&ipq.ip_link != ipq.ip_link.next));
+	if (time_fasttimo == 0 && so->so_tcpcb->t_flags & TF_DELACK)
+	   time_fasttimo = curtime; /* Flag when we want a fasttimo */
 	
-		for (so = tcb.so_next; so != &tcb; so = so_next) {
-			so_next = so->so_next;
-			
-			/*
-			 * See if we need a tcp_fasttimo
-			 */
-			if (time_fasttimo == 0 && so->so_tcpcb->t_flags & TF_DELACK)
-			   time_fasttimo = curtime; /* Flag when we want a fasttimo */
-			
-			/*
-			 * NOFDREF can include still connecting to local-host,
-			 * newly socreated() sockets etc. Don't want to select these.
-	 		 */
-			if (so->so_state & SS_NOFDREF || so->s == -1)
-			   continue;
-			
-			/*
-			 * Set for reading sockets which are accepting
-			 */
-			if (so->so_state & SS_FACCEPTCONN) {
-                                FD_SET(so->s, readfds);
-				UPD_NFDS(so->s);
-				continue;
-			}
-			
-			/*
-			 * Set for writing sockets which are connecting
-			 */
-			if (so->so_state & SS_ISFCONNECTING) {
-				FD_SET(so->s, writefds);
-				UPD_NFDS(so->s);
-				continue;
-			}
-			
-			/*
-			 * Set for writing if we are connected, can send more, and
-			 * we have something to send
-			 */
-			if (CONN_CANFSEND(so) && so->so_rcv.sb_cc) {
-				FD_SET(so->s, writefds);
-				UPD_NFDS(so->s);
-			}
-			
-			/*
-			 * Set for reading (and urgent data) if we are connected, can
-			 * receive more, and we have room for it XXX /2 ?
-			 */
-			if (CONN_CANFRCV(so) && (so->so_snd.sb_cc < (so->so_snd.sb_datalen/2))) {
-				FD_SET(so->s, readfds);
-				FD_SET(so->s, xfds);
-				UPD_NFDS(so->s);
-			}
-		}
-		
-		/*
-		 * UDP sockets
-		 */
-		for (so = udb.so_next; so != &udb; so = so_next) {
-			so_next = so->so_next;
-			
-			/*
-			 * See if it's timed out
-			 */
-			if (so->so_expire) {
-				if (so->so_expire <= curtime) {
-					udp_detach(so);
-					continue;
-				} else
-					do_slowtimo = 1; /* Let socket expire */
-			}
-			
-			/*
-			 * When UDP packets are received from over the
-			 * link, they're sendto()'d straight away, so
-			 * no need for setting for writing
-			 * Limit the number of packets queued by this session
-			 * to 4.  Note that even though we try and limit this
-			 * to 4 packets, the session could have more queued
-			 * if the packets needed to be fragmented
-			 * (XXX <= 4 ?)
-			 */
-			if ((so->so_state & SS_ISFCONNECTED) && so->so_queued <= 4) {
-				FD_SET(so->s, readfds);
-				UPD_NFDS(so->s);
-			}
-		}
-	}
+	/*
+	 * NOFDREF can include still connecting to local-host,
+	 * newly socreated() sockets etc. Don't want to select these.
+	 */
+	if (so->s == -1 || (so->so_state & SS_NOFDREF))
+	   return 0;
+
+	/*
+	 * Set for reading sockets which are accepting
+	 */
+	if (so->so_state & SS_FACCEPTCONN)
+	   return SO_POLL_READ;
 	
+	/*
+	 * Set for writing sockets which are connecting
+	 */
+	if (so->so_state & SS_ISFCONNECTING)
+	   return SO_POLL_WRITE;
+
+	/*
+	 * Set for writing if we are connected, can send more, and
+	 * we have something to send
+	 */
+	if (CONN_CANFSEND(so) && so->so_rcv.sb_cc)
+		events |= SO_POLL_WRITE;
+
+	/*
+	 * Set for reading (and urgent data) if we are connected, can
+	 * receive more, and we have room for it XXX /2 ?
+	 */
+	if (CONN_CANFRCV(so) && (so->so_snd.sb_cc < (so->so_snd.sb_datalen/2)))
+		events |= SO_POLL_READ | SO_POLL_URG;
+	return events;
+}
+
+/*
+ * Work out which events a UDP socket needs polling for (SO_POLL_*)
+ */
+static int udp_want(struct socket *so)
+{
+	if (so->s == -1)
+	   return 0;
+
+	/*
+	 * When UDP packets are received from over the
+	 * link, they're sendto()'d straight away, so
+	 * no need for setting for writing
+	 * Limit the number of packets queued by this session
+	 * to 4.  Note that even though we try and limit this
+	 * to 4 packets, the session could have more queued
+	 * if the packets needed to be fragmented
+	 * (XXX <= 4 ?)
+	 */
+	return ((so->so_state & SS_ISFCONNECTED) && so->so_queued <= 4) ? SO_POLL_READ : 0;
+}
+
+/*
+ * Detach the UDP sockets that have timed out and note when
+ * the next one expires
+ */
+static void udp_expire(void)
+{
+    struct socket *so, *so_next;
+
+	udp_expire_due = 0;
+	for (so = udb.so_next; so != &udb; so = so_next) {
+		so_next = so->so_next;
+		if (so->so_expire == 0)
+		   continue;
+		if (so->so_expire <= curtime)
+		   udp_detach(so);
+		else if (udp_expire_due == 0 || so->so_expire < udp_expire_due)
+		   udp_expire_due = so->so_expire;
+	}
+}
+
+/*
+ * Returns the timeout in usecs until the next TCP/IP timer is due,
+ * or -1 if no timer is pending
+ */
+static int slirp_timeout(void)
+{
+    int timeout, tmp_time;
+
+	/*
+	 * *_slowtimo needs calling if there are IP fragments
+	 * in the fragment queue, or there are TCP connections active,
+	 * or there are UDP sockets that have to expire
+	 */
+	do_slowtimo = link_up && ((tcb.so_next != &tcb) ||
+		 (&ipq.ip_link != ipq.ip_link.next) || udp_expire_due);
+
 	/*
 	 * Setup timeout to use minimum CPU usage, especially when idle
 	 */
@@ -318,8 +374,6 @@ int slirp_select_fill(int *pnfds,
 	 * slow timeout. If a fast timeout is needed, set timeout within
 	 * 2ms of when it was requested.
 	 */
-#	define SLOW_TIMO 5
-#	define FAST_TIMO 2
 	if (do_slowtimo) {
 		timeout = (SLOW_TIMO - (curtime - last_slowtimo)) * 1000;
 		if (timeout < 0)
@@ -338,27 +392,41 @@ int slirp_select_fill(int *pnfds,
 			   timeout = tmp_time;
 		}
 	}
-	*pnfds = nfds;
-
-	/*
-	 * Adjust the timeout to make the minimum timeout
-	 * 2ms (XXX?) to lessen the CPU load
-	 */
-	if (timeout < (FAST_TIMO * 1000))
-		timeout = FAST_TIMO * 1000;
-
 	return timeout;
-}	
+}
 
-void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds)
+/*
+ * Walk all sockets, handle UDP expiry and pass the events each socket
+ * needs polling for (SO_POLL_* flags) to want(), events == 0 if none.
+ * Returns the timeout in usecs until the next TCP/IP timer is due,
+ * or -1 if no timer is pending.
+ */
+static int slirp_fill(void (*want)(struct socket *so, int events))
 {
-    struct socket *so, *so_next;
-    int ret;
+    struct socket *so;
+
+	/* All sockets are looked at below */
+	while ((so = so_changed_list) != NULL) {
+		so_changed_list = so->so_changed_next;
+		so->so_pollstate &= ~SO_PS_CHANGED;
+	}
 
-    global_readfds = readfds;
-    global_writefds = writefds;
-    global_xfds = xfds;
+	if (link_up) {
+		for (so = tcb.so_next; so != &tcb; so = so->so_next)
+			want(so, tcp_want(so));
 
+		udp_expire();
+		for (so = udb.so_next; so != &udb; so = so->so_next)
+			want(so, udp_want(so));
+	}
+	return slirp_timeout();
+}
+
+/*
+ * Run the TCP/IP timers that are due
+ */
+static void slirp_timers(void)
+{
 	/* Update time */
 	updtime();
 	
@@ -376,152 +444,397 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds)
 			last_slowtimo = curtime;
 		}
 	}
+}
+
+/*
+ * Handle the events pending on a TCP socket (so_revents, cleared afterwards)
+ */
+static void slirp_poll_tcp(struct socket *so)
+{
+    int ret;
+
+	/*
+	 * FD_ISSET is meaningless on these sockets
+	 * (and they can crash the program)
+	 */
+	if (so->so_state & SS_NOFDREF || so->s == -1) {
+	   so->so_revents = 0;
+	   return;
+	}
+	if (so->so_revents == 0)
+	   return;
 	
 	/*
-	 * Check sockets
+	 * Check for URG data
+	 * This will soread as well, so no need to
+	 * test for readfds below if this succeeds
 	 */
-	if (link_up) {
+	if (so->so_revents & SO_POLL_URG)
+	   sorecvoob(so);
+	/*
+	 * Check sockets for reading
+	 */
+	else if (so->so_revents & SO_POLL_READ) {
 		/*
-		 * Check TCP sockets
+		 * Check for incoming connections
 		 */
-		for (so = tcb.so_next; so != &tcb; so = so_next) {
-			so_next = so->so_next;
-			
-			/*
-			 * FD_ISSET is meaningless on these sockets
-			 * (and they can crash the program)
-			 */
-			if (so->so_state & SS_NOFDREF || so->s == -1)
-			   continue;
-			
-			/*
-			 * Check for URG data
-			 * This will soread as well, so no need to
-			 * test for readfds below if this succeeds
-			 */
-			if (FD_ISSET(so->s, xfds))
-			   sorecvoob(so);
-			/*
-			 * Check sockets for reading
-			 */
-			else if (FD_ISSET(so->s, readfds)) {
-				/*
-				 * Check for incoming connections
-				 */
-				if (so->so_state & SS_FACCEPTCONN) {
-					tcp_connect(so);
-					continue;
-				} /* else */
-				ret = soread(so);
-				
-				/* Output it if we read something */
-				if (ret > 0)
-				   tcp_output(sototcpcb(so));
-			}
-			
-			/*
-			 * Check sockets for writing
-			 */
-			if (FD_ISSET(so->s, writefds)) {
-			  /*
-			   * Check for non-blocking, still-connecting sockets
-			   */
-			  if (so->so_state & SS_ISFCONNECTING) {
-			    /* Connected */
-			    so->so_state &= ~SS_ISFCONNECTING;
-			    
-			    ret = send(so->s, NULL, 0, 0);
-			    if (ret < 0) {
-			      /* XXXXX Must fix, zero bytes is a NOP */
-			      if (errno == EAGAIN || errno == EWOULDBLOCK ||
-				  errno == EINPROGRESS || errno == ENOTCONN)
-				continue;
-			      
-			      /* else failed */
-			      so->so_state = SS_NOFDREF;
-			    }
-			    /* else so->so_state &= ~SS_ISFCONNECTING; */
-			    
-			    /*
-			     * Continue tcp_input
-			     */
-			    tcp_input((struct mbuf *)NULL, sizeof(struct ip), so);
-			    /* continue; */
-			  } else
-			    ret = sowrite(so);
-			  /*
-			   * XXXXX If we wrote something (a lot), there 
-			   * could be a need for a window update.
-			   * In the worst case, the remote will send
-			   * a window probe to get things going again
-			   */
-			}
-			
-			/*
-			 * Probe a still-connecting, non-blocking socket
-			 * to check if it's still alive
-	 	 	 */
+		if (so->so_state & SS_FACCEPTCONN) {
+			so->so_revents = 0;
+			tcp_connect(so);
+			return;
+		} /* else */
+		ret = soread(so);
+		
+		/* Output it if we read something */
+		if (ret > 0)
+		   tcp_output(sototcpcb(so));
+	}
+	
+	/*
+	 * Check sockets for writing
+	 */
+	if (so->so_revents & SO_POLL_WRITE) {
+	  so->so_revents = 0;
+	  /*
+	   * Check for non-blocking, still-connecting sockets
+	   */
+	  if (so->so_state & SS_ISFCONNECTING) {
+	    /* Connected */
+	    so->so_state &= ~SS_ISFCONNECTING;
+	    
+	    ret = send(so->s, NULL, 0, 0);
+	    if (ret < 0) {
+	      /* XXXXX Must fix, zero bytes is a NOP */
+	      if (errno == EAGAIN || errno == EWOULDBLOCK ||
+		  errno == EINPROGRESS || errno == ENOTCONN)
+		return;
+	      
+	      /* else failed */
+	      so->so_state = SS_NOFDREF;
+	    }
+	    /* else so->so_state &= ~SS_ISFCONNECTING; */
+	    
+	    /*
+	     * Continue tcp_input
+	     */
+	    tcp_input((struct mbuf *)NULL, sizeof(struct ip), so);
+	    /* continue; */
+	  } else
+	    ret = sowrite(so);
+	  /*
+	   * XXXXX If we wrote something (a lot), there 
+	   * could be a need for a window update.
+	   * In the worst case, the remote will send
+	   * a window probe to get things going again
+	   */
+	}
+	so->so_revents = 0;
+	
+	/*
+	 * Probe a still-connecting, non-blocking socket
+	 * to check if it's still alive
+ 	 */
 #ifdef PROBE_CONN
-			if (so->so_state & SS_ISFCONNECTING) {
-			  ret = recv(so->s, (char *)&ret, 0,0);
-			  
-			  if (ret < 0) {
-			    /* XXX */
-			    if (errno == EAGAIN || errno == EWOULDBLOCK ||
-				errno == EINPROGRESS || errno == ENOTCONN)
-			      continue; /* Still connecting, continue */
-			    
-			    /* else failed */
-			    so->so_state = SS_NOFDREF;
-			    
-			    /* tcp_input will take care of it */
-			  } else {
-			    ret = send(so->s, &ret, 0,0);
-			    if (ret < 0) {
-			      /* XXX */
-			      if (errno == EAGAIN || errno == EWOULDBLOCK ||
-				  errno == EINPROGRESS || errno == ENOTCONN)
-				continue;
-			      /* else failed */
-			      so->so_state = SS_NOFDREF;
-			    } else
-			      so->so_state &= ~SS_ISFCONNECTING;
-			    
-			  }
-			  tcp_input((struct mbuf *)NULL, sizeof(struct ip),so);
-			} /* SS_ISFCONNECTING */
+	if (so->so_state & SS_ISFCONNECTING) {
+	  ret = recv(so->s, (char *)&ret, 0,0);
+	  
+	  if (ret < 0) {
+	    /* XXX */
+	    if (errno == EAGAIN || errno == EWOULDBLOCK ||
+		errno == EINPROGRESS || errno == ENOTCONN)
+	      return; /* Still connecting, continue */
+	    
+	    /* else failed */
+	    so->so_state = SS_NOFDREF;
+	    
+	    /* tcp_input will take care of it */
+	  } else {
+	    ret = send(so->s, &ret, 0,0);
+	    if (ret < 0) {
+	      /* XXX */
+	      if (errno == EAGAIN || errno == EWOULDBLOCK ||
+		  errno == EINPROGRESS || errno == ENOTCONN)
+		return;
+	      /* else failed */
+	      so->so_state = SS_NOFDREF;
+	    } else
+	      so->so_state &= ~SS_ISFCONNECTING;
+	    
+	  }
+	  tcp_input((struct mbuf *)NULL, sizeof(struct ip),so);
+	} /* SS_ISFCONNECTING */
 #endif
+}
+
+/*
+ * Handle the events pending on a UDP socket (so_revents, cleared afterwards).
+ * Incoming packets are sent straight away, they're not buffered.
+ * Incoming UDP data isn't buffered either.
+ */
+static void slirp_poll_udp(struct socket *so)
+{
+	if (so->s != -1 && (so->so_revents & SO_POLL_READ)) {
+		so->so_revents = 0;
+		sorecvfrom(so);
+	} else
+		so->so_revents = 0;
+}
+
+/*
+ * Run TCP/IP timers and handle the events pending on each socket
+ * (so_revents, cleared afterwards)
+ */
+static void slirp_poll(void)
+{
+    struct socket *so, *so_next;
+
+	/*
+	 * Collect the segments generated for all sockets and send
+	 * them in one go, interleaved by if_start
+	 */
+	if_hold++;
+
+	slirp_timers();
+	
+	/*
+	 * Check sockets
+	 */
+	if (link_up) {
+		for (so = tcb.so_next; so != &tcb; so = so_next) {
+			so_next = so->so_next;
+			slirp_poll_tcp(so);
 		}
-		
-		/*
-		 * Now UDP sockets.
-		 * Incoming packets are sent straight away, they're not buffered.
-		 * Incoming UDP data isn't buffered either.
-		 */
 		for (so = udb.so_next; so != &udb; so = so_next) {
 			so_next = so->so_next;
-			
-			if (so->s != -1 && FD_ISSET(so->s, readfds)) {
-                            sorecvfrom(so);
-                        }
+			slirp_poll_udp(so);
 		}
 	}
 	
 	/*
 	 * See if we can start outputting
 	 */
+	if_hold--;
 	if (if_queued && link_up)
 	   if_start();
+}
+
+/*
+ * select() interface
+ */
+
+static fd_set *fill_readfds, *fill_writefds, *fill_xfds;
+static int fill_nfds;
+
+static void select_want(struct socket *so, int events)
+{
+	if (events & SO_POLL_READ)
+		FD_SET(so->s, fill_readfds);
+	if (events & SO_POLL_WRITE)
+		FD_SET(so->s, fill_writefds);
+	if (events & SO_POLL_URG)
+		FD_SET(so->s, fill_xfds);
+	if (events && so->s > fill_nfds)
+		fill_nfds = so->s;
+}
+
+int slirp_select_fill(int *pnfds, 
+					  fd_set *readfds, fd_set *writefds, fd_set *xfds)
+{
+    int timeout;
+
+	fill_readfds = readfds;
+	fill_writefds = writefds;
+	fill_xfds = xfds;
+	fill_nfds = *pnfds;
+	timeout = slirp_fill(select_want);
+	*pnfds = fill_nfds;
+
+	/*
+	 * Adjust the timeout to make the minimum timeout
+	 * 2ms (XXX?) to lessen the CPU load
+	 */
+	if (timeout < (FAST_TIMO * 1000))
+		timeout = FAST_TIMO * 1000;
+
+	return timeout;
+}	
+
+void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds)
+{
+    struct socket *so;
+
+	for (so = tcb.so_next; so != &tcb; so = so->so_next) {
+		so->so_revents = 0;
+		if (so->s == -1)
+			continue;
+		if (FD_ISSET(so->s, readfds))
+			so->so_revents |= SO_POLL_READ;
+		if (FD_ISSET(so->s, writefds))
+			so->so_revents |= SO_POLL_WRITE;
+		if (FD_ISSET(so->s, xfds))
+			so->so_revents |= SO_POLL_URG;
+	}
+	for (so = udb.so_next; so != &udb; so = so->so_next)
+		so->so_revents = (so->s != -1 && FD_ISSET(so->s, readfds)) ? SO_POLL_READ : 0;
+
+	slirp_poll();
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/*
+ * epoll() interface: sockets stay registered with the epoll instance.
+ * After the first fill only the sockets on so_changed_list (sochanged())
+ * have their interest set re-evaluated, and only the sockets epoll
+ * reported events for are handled, so idle sockets cost nothing per
+ * iteration and there is no FD_SETSIZE limit.
+ */
+
+static int fill_epfd;
+
+/* Walk all sockets on the next fill: initially, and after the link was down */
+static int epoll_rescan = 1;
+
+static void epoll_want(struct socket *so, int events)
+{
+	struct epoll_event ev;
+	int op;
+
+	/*
+	 * A socket whose fd changed was removed from the epoll set when
+	 * its old fd was closed
+	 */
+	if (so->so_pollfd != so->s) {
+		if (so->so_pollfd != -1 && epoll_sockets[so->so_pollfd] == so)
+			epoll_sockets[so->so_pollfd] = NULL;
+		so->so_pollfd = -1;
+		so->so_events = 0;
+	}
+
+	if (events == 0) {
+		/* Don't keep idle sockets registered, they would still report errors and hangups */
+		if (so->so_pollfd != -1) {
+			epoll_ctl(fill_epfd, EPOLL_CTL_DEL, so->s, NULL);
+			epoll_sockets[so->so_pollfd] = NULL;
+		}
+		so->so_pollfd = -1;
+		so->so_events = 0;
+		return;
+	}
+	if (so->so_pollfd != -1 && so->so_events == events)
+		return;
+
+	if (so->s >= epoll_sockets_size) {
+		int size = so->s + 64;
+		struct socket **p = (struct socket **)realloc(epoll_sockets, size * sizeof(*p));
+		if (p == NULL)
+			return;
+		memset(p + epoll_sockets_size, 0, (size - epoll_sockets_size) * sizeof(*p));
+		epoll_sockets = p;
+		epoll_sockets_size = size;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	if (events & SO_POLL_READ)
+		ev.events |= EPOLLIN;
+	if (events & SO_POLL_WRITE)
+		ev.events |= EPOLLOUT;
+	if (events & SO_POLL_URG)
+		ev.events |= EPOLLPRI;
+	ev.data.fd = so->s;
+
+	op = (so->so_pollfd != -1) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	if (epoll_ctl(fill_epfd, op, so->s, &ev) < 0) {
+		if (op == EPOLL_CTL_ADD && errno == EEXIST)
+			epoll_ctl(fill_epfd, EPOLL_CTL_MOD, so->s, &ev);
+		else if (op == EPOLL_CTL_MOD && errno == ENOENT)
+			epoll_ctl(fill_epfd, EPOLL_CTL_ADD, so->s, &ev);
+	}
+	epoll_sockets[so->s] = so;
+	so->so_pollfd = so->s;
+	so->so_events = events;
+}
+
+int slirp_epoll_fill(int epfd)
+{
+    struct socket *so;
+
+	fill_epfd = epfd;
+	if (epoll_rescan || !link_up) {
+		epoll_rescan = !link_up;
+		return slirp_fill(epoll_want);
+	}
+
+	while ((so = so_changed_list) != NULL) {
+		so_changed_list = so->so_changed_next;
+		so->so_pollstate &= ~SO_PS_CHANGED;
+		if (so->so_tcpcb)
+			epoll_want(so, tcp_want(so));
+		else {
+			if (so->so_expire && (udp_expire_due == 0 || so->so_expire < udp_expire_due))
+				udp_expire_due = so->so_expire;
+			epoll_want(so, udp_want(so));
+		}
+	}
 
-	/* clear global file descriptor sets.
-	 * these reside on the stack in vl.c
-	 * so they're unusable if we're not in
-	 * slirp_select_fill or slirp_select_poll.
+	/* Only walk the UDP sockets when one of them is due to expire */
+	if (udp_expire_due && udp_expire_due <= curtime)
+		udp_expire();
+
+	return slirp_timeout();
+}
+
+void slirp_epoll_poll(const struct epoll_event *events, int nevents)
+{
+    struct socket *so;
+    int i;
+
+	for (i = 0; i < nevents; i++) {
+		int fd = events[i].data.fd;
+		int revents = 0;
+		if (fd < 0 || fd >= epoll_sockets_size || (so = epoll_sockets[fd]) == NULL)
+			continue;
+		if (events[i].events & EPOLLIN)
+			revents |= SO_POLL_READ;
+		if (events[i].events & EPOLLOUT)
+			revents |= SO_POLL_WRITE;
+		if (events[i].events & (EPOLLHUP | EPOLLERR))
+			revents |= SO_POLL_READ | SO_POLL_WRITE;	/* let soread()/sowrite() pick up the error */
+		if (events[i].events & EPOLLPRI)
+			revents |= SO_POLL_URG;
+		so->so_revents = revents & so->so_events;
+		if (so->so_revents && !(so->so_pollstate & SO_PS_READY)) {
+			so->so_pollstate |= SO_PS_READY;
+			so->so_ready_next = so_ready_list;
+			so_ready_list = so;
+		}
+	}
+
+	if_hold++;
+	slirp_timers();
+
+	/*
+	 * Handle the sockets with events pending; sockets freed meanwhile
+	 * have dropped off the list (so_poll_free())
 	 */
-	 global_readfds = NULL;
-	 global_writefds = NULL;
-	 global_xfds = NULL;
+	while ((so = so_ready_list) != NULL) {
+		so_ready_list = so->so_ready_next;
+		so->so_pollstate &= ~SO_PS_READY;
+		if (!link_up) {
+			so->so_revents = 0;
+			continue;
+		}
+		sochanged(so);
+		if (so->so_tcpcb)
+			slirp_poll_tcp(so);
+		else
+			slirp_poll_udp(so);
+	}
+
+	if_hold--;
+	if (if_queued && link_up)
+	   if_start();
 }
+#endif
 
 #define ETH_ALEN 6
 #define ETH_HLEN 14
@@ -628,7 +941,12 @@ void slirp_input(const uint8_t *pkt, int pkt_len)
         m->m_data += 2 + ETH_HLEN;
         m->m_len -= 2 + ETH_HLEN;
 
+        /* An ACK may release a whole window of segments, queue them first */
+        if_hold++;
         ip_input(m);
+        if_hold--;
+        if (if_queued && link_up)
+            if_start();
         break;
     default:
         break;
@@ -198,6 +198,10 @@ int inet_aton _P((const char *cp, struct in_addr *ia));
 # include <sys/select.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+
 #ifdef HAVE_SYS_WAIT_H
 # include <sys/wait.h>
 #endif
@@ -264,6 +268,7 @@ int inet_aton _P((const char *cp, struct in_addr *ia));
 
 #include "bootp.h"
 #include "tftp.h"
+#include "dnsproxy.h"
 #include "libslirp.h"
 
 extern struct ttys *ttys_unit[MAX_INTERFACES];
@@ -323,7 +328,14 @@ extern int do_echo;
 #define DEFAULT_BAUD 115200
 
 /* cksum.c */
+extern int cksum_verify;
+void cksum_init _P((void));
 int cksum(struct mbuf *m, int len);
+u_int16_t cksum_adjust _P((u_int16_t, u_int16_t, u_int16_t));
+
+/* slirp.c */
+void sochanged _P((struct socket *));
+void so_poll_free _P((struct socket *));
 
 /* if.c */
 void if_init _P((void));
@@ -160,6 +160,7 @@ socreate()
     memset(so, 0, sizeof(struct socket));
     so->so_state = SS_NOFDREF;
     so->s = -1;
+    so->so_pollfd = -1;
   }
   return(so);
 }
@@ -181,6 +182,7 @@ sofree(so)
     udp_last_so = &udb;
 	
   m_free(so->so_m);
+  so_poll_free(so);
 	
   if(so->so_next && so->so_prev) 
     remque(so);  /* crashes if so is not in a queue */
@@ -573,6 +575,11 @@ sorecvfrom(so)
 	     *		}
 	     */
 	    
+	    /* Let the DNS proxy cache replies of the host's name server */
+	    if (so->so_fport == htons(DNS_PORT) &&
+		so->so_faddr.s_addr == (special_addr.s_addr | htonl(CTL_DNS)))
+		dns_proxy_reply(so, m);
+
 	    /* 
 	     * If this packet was destined for CTL_ADDR,
 	     * make it look like that's where it came from, done by udp_output
@@ -891,6 +898,7 @@ sosendto(so, m)
 	DEBUG_ARG("so = %lx", (long)so);
 	DEBUG_ARG("m = %lx", (long)m);
 	
+	sochanged(so);	/* so_expire and so_state may change */
         addr.sin_family = AF_INET;
 	if ((so->so_faddr.s_addr & htonl(0xffffff00)) == special_addr.s_addr) {
 	  /* It's an alias */
@@ -901,6 +909,12 @@ sosendto(so, m)
 			if (resolve_dns_request(so, addr, m->m_data, m->m_len))
 			return 0;
 		}
+		if (dns_proxy_query(so, m)) {
+			/* Answered without the host's name server, nothing to wait for */
+			if (so->so_expire)
+				so->so_expire = curtime + SO_EXPIREFAST;
+			return 0;
+		}
 	    break;
 	  case CTL_ALIAS:
 	  default:
@@ -962,6 +976,7 @@ solisten(port, laddr, lport, flags)
 		return NULL;
 	}
 	insque(so,&tcb);
+	sochanged(so);
 	
 	/* 
 	 * SS_FACCEPTONCE sockets must time out.
@@ -1061,9 +1076,7 @@ sofcantrcvmore(so)
 {
 	if ((so->so_state & SS_NOFDREF) == 0) {
 		shutdown(so->s,0);
-		if(global_writefds) {
-		  FD_CLR(so->s,global_writefds);
-		}
+		so->so_revents &= ~SO_POLL_WRITE;
 	}
 	so->so_state &= ~(SS_ISFCONNECTING);
 	if (so->so_state & SS_FCANTSENDMORE)
@@ -1078,12 +1091,7 @@ sofcantsendmore(so)
 {
 	if ((so->so_state & SS_NOFDREF) == 0) {
             shutdown(so->s,1);           /* send FIN to fhost */
-            if (global_readfds) {
-                FD_CLR(so->s,global_readfds);
-            }
-            if (global_xfds) {
-                FD_CLR(so->s,global_xfds);
-            }
+            so->so_revents &= ~(SO_POLL_READ | SO_POLL_URG);
 	}
 	so->so_state &= ~(SS_ISFCONNECTING);
 	if (so->so_state & SS_FCANTRCVMORE)
@@ -51,8 +51,28 @@ struct socket {
   struct sbuf so_rcv;		/* Receive buffer */
   struct sbuf so_snd;		/* Send buffer */
   void * extra;			/* Extra pointer */
+
+  int	so_revents;		/* Events pending on the socket (SO_POLL_*) */
+  int	so_events;		/* Events registered with epoll (SO_POLL_*) */
+  int	so_pollfd;		/* fd registered with epoll, or -1 */
+  int	so_pollstate;		/* SO_PS_* flags, below */
+  struct socket *so_changed_next;	/* Next socket on the changed list (sochanged()) */
+  struct socket *so_ready_next;	/* Next socket with epoll events pending */
 };
 
+/*
+ * Socket poll events
+ */
+#define SO_POLL_READ		0x01
+#define SO_POLL_WRITE		0x02
+#define SO_POLL_URG		0x04
+
+/*
+ * Socket poll list membership
+ */
+#define SO_PS_CHANGED		0x01	/* On the changed list */
+#define SO_PS_READY		0x02	/* On the ready list */
+
 
 /*
  * Socket state bits. (peer means the host on the Internet,
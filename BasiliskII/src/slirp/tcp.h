@@ -40,10 +40,16 @@ typedef	u_int32_t	tcp_seq;
 
 extern int tcp_rcvspace;
 extern int tcp_sndspace;
+extern int tcp_do_winscale;
 extern struct socket *tcp_last_so;
 
-#define TCP_SNDSPACE 8192
-#define TCP_RCVSPACE 8192
+/*
+ * Socket buffers are sized like the host socket's buffers, but never
+ * smaller than TCP_{SND,RCV}SPACE nor larger than TCP_MAXSPACE
+ */
+#define TCP_SNDSPACE 32768
+#define TCP_RCVSPACE 32768
+#define TCP_MAXSPACE 262144
 
 /*
  * TCP header.
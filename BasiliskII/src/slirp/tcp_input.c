@@ -266,7 +266,14 @@ tcp_input(m, iphlen, inso)
 		ti = so->so_ti;
 		tiwin = ti->ti_win;
 		tiflags = ti->ti_flags;
-		
+
+		/* The SYN options (MSS, window scale) are still in the saved segment */
+		off = ti->ti_off << 2;
+		if (off > sizeof(struct tcphdr)) {
+			optlen = off - sizeof(struct tcphdr);
+			optp = (caddr_t)(ti + 1);
+		}
+
 		goto cont_conn;
 	}
 	
@@ -304,7 +311,7 @@ tcp_input(m, iphlen, inso)
 	/* keep checksum for ICMP reply
 	 * ti->ti_sum = cksum(m, len); 
 	 * if (ti->ti_sum) { */
-	if(cksum(m, len)) {
+	if(cksum_verify && cksum(m, len)) {
 	  tcpstat.tcps_rcvbadsum++;
 	  goto drop;
 	}
@@ -374,6 +381,8 @@ findso:
 			tcp_last_so = so;
 		++tcpstat.tcps_socachemiss;
 	}
+	if (so)
+		sochanged(so);
 
 	/*
 	 * If the state is CLOSED (i.e., TCB does not exist) then
@@ -434,10 +443,9 @@ findso:
 		goto drop;
 	
 	/* Unscale the window into a 32-bit value. */
-/*	if ((tiflags & TH_SYN) == 0)
- *		tiwin = ti->ti_win << tp->snd_scale;
- *	else
- */
+	if ((tiflags & TH_SYN) == 0)
+		tiwin = ti->ti_win << tp->snd_scale;
+	else
 		tiwin = ti->ti_win;
 
 	/*
@@ -769,12 +777,11 @@ findso:
 			tp->t_state = TCPS_ESTABLISHED;
 			
 			/* Do window scaling on this connection? */
-/*			if ((tp->t_flags & (TF_RCVD_SCALE|TF_REQ_SCALE)) ==
- *				(TF_RCVD_SCALE|TF_REQ_SCALE)) {
- * 				tp->snd_scale = tp->requested_s_scale;
- *				tp->rcv_scale = tp->request_r_scale;
- *			}
- */
+			if ((tp->t_flags & (TF_RCVD_SCALE|TF_REQ_SCALE)) ==
+				(TF_RCVD_SCALE|TF_REQ_SCALE)) {
+				tp->snd_scale = tp->requested_s_scale;
+				tp->rcv_scale = tp->request_r_scale;
+			}
 			(void) tcp_reass(tp, (struct tcpiphdr *)0,
 				(struct mbuf *)0);
 			/*
@@ -1039,12 +1046,11 @@ trimthenstep6:
 		}
 		
 		/* Do window scaling? */
-/*		if ((tp->t_flags & (TF_RCVD_SCALE|TF_REQ_SCALE)) ==
- *			(TF_RCVD_SCALE|TF_REQ_SCALE)) {
- *			tp->snd_scale = tp->requested_s_scale;
- *			tp->rcv_scale = tp->request_r_scale;
- *		}
- */
+		if ((tp->t_flags & (TF_RCVD_SCALE|TF_REQ_SCALE)) ==
+			(TF_RCVD_SCALE|TF_REQ_SCALE)) {
+			tp->snd_scale = tp->requested_s_scale;
+			tp->rcv_scale = tp->request_r_scale;
+		}
 		(void) tcp_reass(tp, (struct tcpiphdr *)0, (struct mbuf *)0);
 		tp->snd_wl1 = ti->ti_seq - 1;
 		/* Avoid ack processing; snd_una==ti_ack  =>  dup ack */
@@ -1526,15 +1532,15 @@ tcp_dooptions(tp, cp, cnt, ti)
 			(void) tcp_mss(tp, mss);	/* sets t_maxseg */
 			break;
 
-/*		case TCPOPT_WINDOW:
- *			if (optlen != TCPOLEN_WINDOW)
- *				continue;
- *			if (!(ti->ti_flags & TH_SYN))
- *				continue;
- *			tp->t_flags |= TF_RCVD_SCALE;
- *			tp->requested_s_scale = min(cp[2], TCP_MAX_WINSHIFT);
- *			break;
- */
+		case TCPOPT_WINDOW:
+			if (optlen != TCPOLEN_WINDOW)
+				continue;
+			if (!(ti->ti_flags & TH_SYN))
+				continue;
+			tp->t_flags |= TF_RCVD_SCALE;
+			tp->requested_s_scale = min(cp[2], TCP_MAX_WINSHIFT);
+			break;
+
 /*		case TCPOPT_TIMESTAMP:
  *			if (optlen != TCPOLEN_TIMESTAMP)
  *				continue;
@@ -1676,6 +1682,26 @@ tcp_xmit_timer(tp, rtt)
 	tp->t_softerror = 0;
 }
 
+/*
+ * Size a socket buffer after the host socket's buffer opt (SO_RCVBUF
+ * or SO_SNDBUF), within space and TCP_MAXSPACE.  Round it down to
+ * whole segments, so it does not spill into the next slab class.
+ */
+static int
+tcp_sbsize(s, opt, space, mss)
+	int s, opt, space, mss;
+{
+	int size = space, hostsize;
+	socklen_t optlen = sizeof(hostsize);
+
+	if (s >= 0 && getsockopt(s, SOL_SOCKET, opt, (char *)&hostsize, &optlen) == 0 &&
+	    hostsize > size)
+		size = min(hostsize, TCP_MAXSPACE);
+	if (size > 2 * mss)
+		size -= size % mss;
+	return size;
+}
+
 /*
  * Determine a reasonable value for maxseg size.
  * If the route is known, check route for mtu.
@@ -1713,8 +1739,12 @@ tcp_mss(tp, offer)
 	
 	tp->snd_cwnd = mss;
 	
-	sbreserve(&so->so_snd, tcp_sndspace+((tcp_sndspace%mss)?(mss-(tcp_sndspace%mss)):0));
-	sbreserve(&so->so_rcv, tcp_rcvspace+((tcp_rcvspace%mss)?(mss-(tcp_rcvspace%mss)):0));
+	/*
+	 * so_snd buffers what the host socket receives, so_rcv what
+	 * we will send through it
+	 */
+	sbreserve(&so->so_snd, tcp_sbsize(so->s, SO_RCVBUF, tcp_sndspace, mss));
+	sbreserve(&so->so_rcv, tcp_sbsize(so->s, SO_SNDBUF, tcp_rcvspace, mss));
 	
 	DEBUG_MISC((dfd, " returning mss = %d\n", mss));
 	
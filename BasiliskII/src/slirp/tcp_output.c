@@ -285,17 +285,23 @@ send:
 			memcpy((caddr_t)(opt + 2), (caddr_t)&mss, sizeof(mss));
 			optlen = 4;
 
-/*			if ((tp->t_flags & TF_REQ_SCALE) &&
- *			    ((flags & TH_ACK) == 0 ||
- *			    (tp->t_flags & TF_RCVD_SCALE))) {
- *				*((u_int32_t *) (opt + optlen)) = htonl(
- *					TCPOPT_NOP << 24 |
- *					TCPOPT_WINDOW << 16 |
- *					TCPOLEN_WINDOW << 8 |
- *					tp->request_r_scale);
- *				optlen += 4;
- *			}
- */
+			if ((tp->t_flags & TF_REQ_SCALE) &&
+			    ((flags & TH_ACK) == 0 ||
+			    (tp->t_flags & TF_RCVD_SCALE))) {
+				/*
+				 * Ask for the smallest scale that lets us
+				 * advertise the whole receive buffer
+				 */
+				tp->request_r_scale = 0;
+				while (tp->request_r_scale < TCP_MAX_WINSHIFT &&
+				    ((u_int32_t)TCP_MAXWIN << tp->request_r_scale) <
+				    so->so_rcv.sb_datalen)
+					tp->request_r_scale++;
+				opt[optlen++] = TCPOPT_NOP;
+				opt[optlen++] = TCPOPT_WINDOW;
+				opt[optlen++] = TCPOLEN_WINDOW;
+				opt[optlen++] = tp->request_r_scale;
+			}
 		}
  	}
  
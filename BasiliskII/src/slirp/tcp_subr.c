@@ -46,6 +46,7 @@
 int 	tcp_mssdflt = TCP_MSS;
 int 	tcp_rttdflt = TCPTV_SRTTDFLT / PR_SLOWHZ;
 int	tcp_do_rfc1323 = 0;	/* Don't do rfc1323 performance enhancements */
+int	tcp_do_winscale = 1;	/* ... except for window scaling */
 int	tcp_rcvspace;	/* You may want to change this */
 int	tcp_sndspace;	/* Keep small if you have an error prone link */
 
@@ -208,6 +209,8 @@ tcp_newtcpcb(so)
 	tp->t_maxseg = tcp_mssdflt;
 	
 	tp->t_flags = tcp_do_rfc1323 ? (TF_REQ_SCALE|TF_REQ_TSTMP) : 0;
+	if (tcp_do_winscale)
+		tp->t_flags |= TF_REQ_SCALE;
 	tp->t_socket = so;
 	
 	/*
@@ -547,6 +550,7 @@ tcp_attach(so)
 	   return -1;
 	
 	insque(so, &tcb);
+	sochanged(so);
 
 	return 0;
 }
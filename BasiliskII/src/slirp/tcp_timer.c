@@ -138,6 +138,8 @@ tcp_timers(tp, timer)
 	
 	DEBUG_CALL("tcp_timers");
 	
+	sochanged(tp->t_socket);
+
 	switch (timer) {
 
 	/*
@@ -135,7 +135,7 @@ udp_input(m, iphlen)
 	   * uh->uh_sum = cksum(m, len + sizeof (struct ip)); 
 	   * if (uh->uh_sum) { 
 	   */
-	  if(cksum(m, len + sizeof(struct ip))) {
+	  if(cksum_verify && cksum(m, len + sizeof(struct ip))) {
 	    udpstat.udps_badsum++;
 	    goto bad;
 	  }
@@ -349,6 +349,7 @@ udp_attach(so)
       /* success, insert in queue */
       so->so_expire = curtime + SO_EXPIRE;
       insque(so,&udb);
+      sochanged(so);
     }
   }
   return(so->s);
@@ -644,6 +645,7 @@ udp_listen(port, laddr, lport, flags)
 	so->s = socket(AF_INET,SOCK_DGRAM,0);
 	so->so_expire = curtime + SO_EXPIRE;
 	insque(so,&udb);
+	sochanged(so);
 
 	memset(&addr, 0, sizeof(struct sockaddr_in));
 	addr.sin_family = AF_INET;
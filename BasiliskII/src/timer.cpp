@@ -23,11 +23,12 @@
 #include "macos_util.h"
 #include "main.h"
 #include "cpu_emulation.h"
+#include "snapshot.h"
+
+#include <vector>
 
 #ifdef PRECISE_TIMING_POSIX
 #include <pthread.h>
-#include <semaphore.h>
-#include <signal.h>
 #endif
 
 #ifdef PRECISE_TIMING_MACH
@@ -54,10 +55,24 @@ enum {	// TMTask struct
 struct TMDesc {
 	uint32 task;		// Mac address of associated TMTask
 	tm_time_t wakeup;	// Time this task is scheduled for execution
-	TMDesc *next;
+	uint32 seq;			// Value of prime_seq when the task was last primed
+	int heap_index;		// Position in tm_heap, -1 if not primed, TM_DEFERRED if in tm_deferred
+	TMDesc *next;		// Next descriptor in the same hash bucket
 };
 
-static TMDesc *tmDescList;
+// Descriptors are looked up by TMTask address in a hash table, primed
+// tasks are kept in a min-heap ordered by wakeup time
+const int TM_HASH_SIZE = 256;
+static TMDesc *tm_hash[TM_HASH_SIZE];
+static std::vector<TMDesc *> tm_heap;
+static std::vector<TMDesc *> tm_deferred;	// Expired, but primed during the current TimerInterrupt()
+static uint32 prime_seq = 0;
+const int TM_DEFERRED = -2;
+
+static inline int tm_hash_index(uint32 tm)
+{
+	return ((tm >> 2) ^ (tm >> 10)) & (TM_HASH_SIZE - 1);
+}
 
 #if PRECISE_TIMING
 #ifdef PRECISE_TIMING_BEOS
@@ -75,6 +90,7 @@ static volatile bool timer_thread_cancel = false;
 static tm_time_t wakeup_time_max = { 0x7fffffff, 999999999 };
 static tm_time_t wakeup_time = wakeup_time_max;
 static pthread_mutex_t wakeup_time_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup_time_cond = PTHREAD_COND_INITIALIZER;
 static void *timer_func(void *arg);
 #endif
 #ifdef PRECISE_TIMING_MACH
@@ -89,35 +105,106 @@ static void *timer_func(void *arg);
 #endif
 
 
-inline static void free_desc(TMDesc *desc)
+/*
+ *  Task descriptor management
+ */
+
+// Find descriptor associated with given TMTask
+static TMDesc *find_desc(uint32 tm)
+{
+	for (TMDesc *desc = tm_hash[tm_hash_index(tm)]; desc; desc = desc->next)
+		if (desc->task == tm)
+			return desc;
+	return NULL;
+}
+
+// Create descriptor for given TMTask
+static TMDesc *new_desc(uint32 tm)
 {
-	if (desc == tmDescList) {
-		tmDescList = desc->next;
-	} else {
-		for (TMDesc *d = tmDescList; d; d = d->next) {
-			if (d->next == desc) {
-				d->next = desc->next;
+	TMDesc *desc = new TMDesc;
+	desc->task = tm;
+	desc->seq = 0;
+	desc->heap_index = -1;
+	int i = tm_hash_index(tm);
+	desc->next = tm_hash[i];
+	tm_hash[i] = desc;
+	return desc;
+}
+
+// Move heap entry up or down until the heap property holds again
+static void heap_sift(int i)
+{
+	TMDesc *desc = tm_heap[i];
+	int n = (int)tm_heap.size();
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (timer_cmp_time(tm_heap[parent]->wakeup, desc->wakeup) <= 0)
+			break;
+		tm_heap[i] = tm_heap[parent];
+		tm_heap[i]->heap_index = i;
+		i = parent;
+	}
+	for (;;) {
+		int child = 2 * i + 1;
+		if (child >= n)
+			break;
+		if (child + 1 < n && timer_cmp_time(tm_heap[child + 1]->wakeup, tm_heap[child]->wakeup) < 0)
+			child++;
+		if (timer_cmp_time(desc->wakeup, tm_heap[child]->wakeup) <= 0)
+			break;
+		tm_heap[i] = tm_heap[child];
+		tm_heap[i]->heap_index = i;
+		i = child;
+	}
+	tm_heap[i] = desc;
+	desc->heap_index = i;
+}
+
+// Remove descriptor from heap
+static void heap_remove(TMDesc *desc)
+{
+	int i = desc->heap_index;
+	if (i == TM_DEFERRED) {
+		for (size_t j = 0; j < tm_deferred.size(); j++)
+			if (tm_deferred[j] == desc) {
+				tm_deferred.erase(tm_deferred.begin() + j);
 				break;
 			}
-		}
 	}
-	delete desc;
+	desc->heap_index = -1;
+	if (i < 0)
+		return;
+	TMDesc *last = tm_heap.back();
+	tm_heap.pop_back();
+	if (last != desc) {
+		tm_heap[i] = last;
+		heap_sift(i);
+	}
 }
 
-/*
- *  Find descriptor associated with given TMTask
- */
+// Add descriptor to heap, or reposition it if its wakeup time changed
+static void heap_insert(TMDesc *desc)
+{
+	if (desc->heap_index == TM_DEFERRED)
+		heap_remove(desc);
+	if (desc->heap_index < 0) {
+		desc->heap_index = (int)tm_heap.size();
+		tm_heap.push_back(desc);
+	}
+	heap_sift(desc->heap_index);
+}
 
-inline static TMDesc *find_desc(uint32 tm)
+// Remove descriptor from heap and hash table and free it
+static void free_desc(TMDesc *desc)
 {
-	TMDesc *desc = tmDescList;
-	while (desc) {
-		if (desc->task == tm) {
-			return desc;
+	heap_remove(desc);
+	for (TMDesc **p = &tm_hash[tm_hash_index(desc->task)]; *p; p = &(*p)->next) {
+		if (*p == desc) {
+			*p = desc->next;
+			break;
 		}
-		desc = desc->next;
 	}
-	return NULL;
+	delete desc;
 }
 
 
@@ -159,102 +246,60 @@ static void dequeue_tm(uint32 tm)
  */
 
 #ifdef PRECISE_TIMING_POSIX
-const int SIGSUSPEND = SIGRTMIN + 6;
-const int SIGRESUME  = SIGRTMIN + 7;
-static struct sigaction sigsuspend_action;
-static struct sigaction sigresume_action;
-
-static int suspend_count = 0;
-static pthread_mutex_t suspend_count_lock = PTHREAD_MUTEX_INITIALIZER;
-static sem_t suspend_ack_sem;
-static sigset_t suspend_handler_mask;
-
-// Signal handler for suspended thread
-static void sigsuspend_handler(int sig)
-{
-	sem_post(&suspend_ack_sem);
-	sigsuspend(&suspend_handler_mask);
-}
-
-// Signal handler for resumed thread
-static void sigresume_handler(int sig)
-{
-	/* simply trigger a signal to stop clock_nanosleep() */
-}
-
 // Initialize timer thread
 static bool timer_thread_init(void)
 {
-	// Install suspend signal handler
-	sigemptyset(&sigsuspend_action.sa_mask);
-	sigaddset(&sigsuspend_action.sa_mask, SIGRESUME);
-	sigsuspend_action.sa_handler = sigsuspend_handler;
-	sigsuspend_action.sa_flags = SA_RESTART;
-#ifdef HAVE_SIGNAL_SA_RESTORER
-	sigsuspend_action.sa_restorer = NULL;
-#endif
-	if (sigaction(SIGSUSPEND, &sigsuspend_action, NULL) < 0)
-		return false;
-
-	// Install resume signal handler
-	sigemptyset(&sigresume_action.sa_mask);
-	sigresume_action.sa_handler = sigresume_handler;
-	sigresume_action.sa_flags = SA_RESTART;
-#ifdef HAVE_SIGNAL_SA_RESTORER
-	sigresume_action.sa_restorer = NULL;
-#endif
-	if (sigaction(SIGRESUME, &sigresume_action, NULL) < 0)
-		return false;
-
-	// Initialize semaphore
-	if (sem_init(&suspend_ack_sem, 0, 0) < 0)
-		return false;
-
-	// Initialize suspend_handler_mask, it excludes SIGRESUME
-	if (sigfillset(&suspend_handler_mask) != 0)
-		return false;
-	if (sigdelset(&suspend_handler_mask, SIGRESUME) != 0)
-		return false;
-
-	// Create thread in running state
-	suspend_count = 0;
+	timer_thread_cancel = false;
 	return (pthread_create(&timer_thread, NULL, timer_func, NULL) == 0);
 }
 
 // Kill timer thread
 static void timer_thread_kill(void)
 {
+	pthread_mutex_lock(&wakeup_time_lock);
 	timer_thread_cancel = true;
-#ifdef HAVE_PTHREAD_CANCEL
-	pthread_cancel(timer_thread);
-#endif
+	pthread_cond_signal(&wakeup_time_cond);
+	pthread_mutex_unlock(&wakeup_time_lock);
 	pthread_join(timer_thread, NULL);
 }
+#endif
 
-// Suspend timer thread
-static void timer_thread_suspend(void)
-{
-	pthread_mutex_lock(&suspend_count_lock);
-	if (suspend_count == 0) {
-		suspend_count ++;
-		if (pthread_kill(timer_thread, SIGSUSPEND) == 0)
-			sem_wait(&suspend_ack_sem);
-	}
-	pthread_mutex_unlock(&suspend_count_lock);
-}
-
-// Resume timer thread
-static void timer_thread_resume(void)
+// Tell the timer thread when the next task is due
+static void set_wakeup_time(void)
 {
-	pthread_mutex_lock(&suspend_count_lock);
-	assert(suspend_count > 0);
-	if (suspend_count == 1) {
-		suspend_count = 0;
-		pthread_kill(timer_thread, SIGRESUME);
-	}
-	pthread_mutex_unlock(&suspend_count_lock);
-}
+#if PRECISE_TIMING
+	const tm_time_t &next = tm_heap.empty() ? wakeup_time_max : tm_heap[0]->wakeup;
+#if PRECISE_TIMING_BEOS
+	while (acquire_sem(wakeup_time_sem) == B_INTERRUPTED) ;
+	suspend_thread(timer_thread);
+	wakeup_time = next;
+	release_sem(wakeup_time_sem);
+	thread_info info;
+	do {
+		resume_thread(timer_thread);			// This will unblock the thread
+		get_thread_info(timer_thread, &info);
+	} while (info.state == B_THREAD_SUSPENDED);	// Sometimes, resume_thread() doesn't work (BeOS bug?)
+#endif
+#ifdef PRECISE_TIMING_MACH
+	semaphore_wait(wakeup_time_sem);
+	thread_suspend(timer_thread);
+	wakeup_time = next;
+	semaphore_signal(wakeup_time_sem);
+	thread_abort(timer_thread);
+	thread_resume(timer_thread);
+#endif
+#ifdef PRECISE_TIMING_POSIX
+	// The thread only needs to be woken up if the deadline moved closer,
+	// otherwise it notices the change when its current wait times out
+	pthread_mutex_lock(&wakeup_time_lock);
+	bool earlier = timer_cmp_time(next, wakeup_time) < 0;
+	wakeup_time = next;
+	if (earlier)
+		pthread_cond_signal(&wakeup_time_cond);
+	pthread_mutex_unlock(&wakeup_time_lock);
+#endif
 #endif
+}
 
 
 /*
@@ -308,7 +353,9 @@ void TimerExit(void)
 		semaphore_destroy(mach_task_self(), wakeup_time_sem);
 #endif
 #ifdef PRECISE_TIMING_POSIX
-		timer_thread_kill();
+		if (timer_thread_active)
+			timer_thread_kill();
+		timer_thread_active = false;
 #endif
 	}
 #endif
@@ -321,13 +368,80 @@ void TimerExit(void)
 
 void TimerReset(void)
 {
-	TMDesc *desc = tmDescList;
-	while (desc) {
-		TMDesc *next = desc->next;
-		delete desc;
-		desc = next;
+	for (int i = 0; i < TM_HASH_SIZE; i++) {
+		TMDesc *desc = tm_hash[i];
+		while (desc) {
+			TMDesc *next = desc->next;
+			delete desc;
+			desc = next;
+		}
+		tm_hash[i] = NULL;
+	}
+	tm_heap.clear();
+	tm_deferred.clear();
+}
+
+
+/*
+ *  Save/restore timer tasks (wakeup times are stored relative to the
+ *  current time, in Mac format)
+ */
+
+void TimerSaveState(snapshot_data &s)
+{
+	tm_time_t now;
+	timer_current_time(now);
+	std::vector<TMDesc *> descs;
+	for (int i = 0; i < TM_HASH_SIZE; i++)
+		for (TMDesc *desc = tm_hash[i]; desc; desc = desc->next)
+			descs.push_back(desc);
+	s.put32(descs.size());
+	for (size_t i = 0; i < descs.size(); i++) {
+		TMDesc *desc = descs[i];
+		int32 delay = 0;
+		if (timer_cmp_time(desc->wakeup, now) > 0) {
+			tm_time_t remaining;
+			timer_sub_time(remaining, desc->wakeup, now);
+			delay = timer_host2mac_time(remaining);
+		}
+		s.put32(desc->task);
+		s.put32(delay);
+		s.put8(desc->heap_index != -1);
 	}
-	tmDescList = NULL;
+}
+
+bool TimerRestoreState(snapshot_data &s)
+{
+	TimerReset();
+	tm_time_t now;
+	timer_current_time(now);
+	uint32 num = s.get32();
+	for (uint32 i = 0; i < num && s.ok(); i++) {
+		TMDesc *desc = new_desc(s.get32());
+		tm_time_t delay;
+		timer_mac2host_time(delay, s.get32());
+		timer_add_time(desc->wakeup, now, delay);
+		if (s.get8()) {
+			desc->seq = ++prime_seq;
+			heap_insert(desc);
+		}
+	}
+	set_wakeup_time();
+	return s.ok();
+}
+
+
+/*
+ *  Get wakeup time of the earliest active timer task, returns false if
+ *  there is none (must be called from the emulator thread)
+ */
+
+bool timer_next_wakeup(tm_time_t &t)
+{
+	if (tm_heap.empty())
+		return false;
+	t = tm_heap[0]->wakeup;
+	return true;
 }
 
 
@@ -339,14 +453,12 @@ int16 InsTime(uint32 tm, uint16 trap)
 {
 	D(bug("InsTime %08lx, trap %04x\n", tm, trap));
 	WriteMacInt16(tm + qType, (ReadMacInt16(tm + qType) & 0x1fff) | ((trap << 4) & 0x6000));
-	if (find_desc(tm))
+	TMDesc *desc = find_desc(tm);
+	if (desc) {
 		printf("WARNING: InsTime(%08x): Task re-inserted\n", tm);
-	else {
-		TMDesc *desc = new TMDesc;
-		desc->task = tm;
-		desc->next = tmDescList;
-		tmDescList = desc;
-	}
+		heap_remove(desc);	// qType says it's inactive now
+	} else
+		new_desc(tm);
 	return 0;
 }
 
@@ -367,31 +479,15 @@ int16 RmvTime(uint32 tm)
 	}
 
 	// Task active?
-#if PRECISE_TIMING_BEOS
-	while (acquire_sem(wakeup_time_sem) == B_INTERRUPTED) ;
-	suspend_thread(timer_thread);
-#endif
-#ifdef PRECISE_TIMING_MACH
-	semaphore_wait(wakeup_time_sem);
-	thread_suspend(timer_thread);
-#endif
-#if PRECISE_TIMING_POSIX
-	pthread_mutex_lock(&wakeup_time_lock);
-	timer_thread_suspend();
-#endif
 	if (ReadMacInt16(tm + qType) & 0x8000) {
 
 		// Yes, make task inactive and remove it from the Time Manager queue
 		WriteMacInt16(tm + qType, ReadMacInt16(tm + qType) & 0x7fff);
 		dequeue_tm(tm);
-#if PRECISE_TIMING
-		// Look for next task to be called and set wakeup_time
-		wakeup_time = wakeup_time_max;
-		for (TMDesc *d = tmDescList; d; d = d->next)
-			if ((ReadMacInt16(d->task + qType) & 0x8000))
-				if (timer_cmp_time(d->wakeup, wakeup_time) < 0)
-					wakeup_time = d->wakeup;
-#endif
+		bool was_next = desc->heap_index == 0;
+		heap_remove(desc);
+		if (was_next)
+			set_wakeup_time();
 
 		// Compute remaining time
 		tm_time_t remaining, current;
@@ -401,24 +497,6 @@ int16 RmvTime(uint32 tm)
 	} else
 		WriteMacInt32(tm + tmCount, 0);
 	D(bug(" tmCount %d\n", ReadMacInt32(tm + tmCount)));
-#if PRECISE_TIMING_BEOS
-	release_sem(wakeup_time_sem);
-	thread_info info;
-	do {
-		resume_thread(timer_thread);			// This will unblock the thread
-		get_thread_info(timer_thread, &info);
-	} while (info.state == B_THREAD_SUSPENDED);	// Sometimes, resume_thread() doesn't work (BeOS bug?)
-#endif
-#ifdef PRECISE_TIMING_MACH
-	semaphore_signal(wakeup_time_sem);
-	thread_abort(timer_thread);
-	thread_resume(timer_thread);
-#endif
-#if PRECISE_TIMING_POSIX
-	pthread_mutex_unlock(&wakeup_time_lock);
-	timer_thread_resume();
-	assert(suspend_count == 0);
-#endif
 
 	// Free descriptor
 	free_desc(desc);
@@ -484,46 +562,14 @@ int16 PrimeTime(uint32 tm, int32 time)
 	}
 
 	// Make task active and enqueue it in the Time Manager queue
-#if PRECISE_TIMING_BEOS
-	while (acquire_sem(wakeup_time_sem) == B_INTERRUPTED) ;
-	suspend_thread(timer_thread);
-#endif
-#ifdef PRECISE_TIMING_MACH
-	semaphore_wait(wakeup_time_sem);
-	thread_suspend(timer_thread);
-#endif
-#if PRECISE_TIMING_POSIX
-	pthread_mutex_lock(&wakeup_time_lock);
-	timer_thread_suspend();
-#endif
 	WriteMacInt16(tm + qType, ReadMacInt16(tm + qType) | 0x8000);
 	enqueue_tm(tm);
-#if PRECISE_TIMING
-	// Look for next task to be called and set wakeup_time
-	wakeup_time = wakeup_time_max;
-	for (TMDesc *d = tmDescList; d; d = d->next)
-		if ((ReadMacInt16(d->task + qType) & 0x8000))
-			if (timer_cmp_time(d->wakeup, wakeup_time) < 0)
-				wakeup_time = d->wakeup;
-#ifdef PRECISE_TIMING_BEOS
-	release_sem(wakeup_time_sem);
-	thread_info info;
-	do {
-		resume_thread(timer_thread);			// This will unblock the thread
-		get_thread_info(timer_thread, &info);
-	} while (info.state == B_THREAD_SUSPENDED);	// Sometimes, resume_thread() doesn't work (BeOS bug?)
-#endif
-#ifdef PRECISE_TIMING_MACH
-	semaphore_signal(wakeup_time_sem);
-	thread_abort(timer_thread);
-	thread_resume(timer_thread);
-#endif
-#ifdef PRECISE_TIMING_POSIX
-	pthread_mutex_unlock(&wakeup_time_lock);
-	timer_thread_resume();
-	assert(suspend_count == 0);
-#endif
-#endif
+	desc->seq = ++prime_seq;
+	heap_insert(desc);
+
+	// Wake up timer thread earlier if this is the next task to be called
+	if (desc->heap_index == 0)
+		set_wakeup_time();
 	return 0;
 }
 
@@ -581,22 +627,25 @@ static void *timer_func(void *arg)
 #ifdef PRECISE_TIMING_POSIX
 static void *timer_func(void *arg)
 {
+	pthread_mutex_lock(&wakeup_time_lock);
 	while (!timer_thread_cancel) {
-		// Wait until time specified by wakeup_time
-		clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &wakeup_time, NULL);
 
+		// Wait until time specified by wakeup_time, or until it changes
 		tm_time_t system_time;
 		timer_current_time(system_time);
-		if (timer_cmp_time(wakeup_time, system_time) < 0) {
-
-			// Timer expired, trigger interrupt
-			pthread_mutex_lock(&wakeup_time_lock);
-			wakeup_time = wakeup_time_max;
-			pthread_mutex_unlock(&wakeup_time_lock);
-			SetInterruptFlag(INTFLAG_TIMER);
-			TriggerInterrupt();
+		if (timer_cmp_time(wakeup_time, system_time) > 0) {
+			pthread_cond_timedwait(&wakeup_time_cond, &wakeup_time_lock, &wakeup_time);
+			continue;
 		}
+
+		// Timer expired, trigger interrupt
+		wakeup_time = wakeup_time_max;
+		pthread_mutex_unlock(&wakeup_time_lock);
+		SetInterruptFlag(INTFLAG_TIMER);
+		TriggerInterrupt();
+		pthread_mutex_lock(&wakeup_time_lock);
 	}
+	pthread_mutex_unlock(&wakeup_time_lock);
 	return NULL;
 }
 #endif
@@ -608,14 +657,21 @@ static void *timer_func(void *arg)
 
 void TimerInterrupt(void)
 {
-	// Look for active TMTasks that have expired
+	// Call active TMTasks that have expired. Tasks primed again by one of
+	// the timer functions are left for the next interrupt.
 	tm_time_t now;
 	timer_current_time(now);
-	TMDesc *desc = tmDescList;
-	while (desc) {
-		TMDesc *next = desc->next;
+	uint32 seq_limit = prime_seq;
+	while (!tm_heap.empty() && timer_cmp_time(tm_heap[0]->wakeup, now) <= 0) {
+		TMDesc *desc = tm_heap[0];
+		heap_remove(desc);
+		if ((int32)(desc->seq - seq_limit) > 0) {
+			desc->heap_index = TM_DEFERRED;
+			tm_deferred.push_back(desc);
+			continue;
+		}
 		uint32 tm = desc->task;
-		if ((ReadMacInt16(tm + qType) & 0x8000) && timer_cmp_time(desc->wakeup, now) <= 0) {
+		if (ReadMacInt16(tm + qType) & 0x8000) {
 
 			// Found one, mark as inactive and remove it from the Time Manager queue
 			WriteMacInt16(tm + qType, ReadMacInt16(tm + qType) & 0x7fff);
@@ -632,45 +688,10 @@ void TimerInterrupt(void)
 				D(bug(" returned from TimeTask\n"));
 			}
 		}
-		desc = next;
 	}
+	while (!tm_deferred.empty())
+		heap_insert(tm_deferred.back());
 
-#if PRECISE_TIMING
 	// Look for next task to be called and set wakeup_time
-#if PRECISE_TIMING_BEOS
-	while (acquire_sem(wakeup_time_sem) == B_INTERRUPTED) ;
-	suspend_thread(timer_thread);
-#endif
-#if PRECISE_TIMING_MACH
-	semaphore_wait(wakeup_time_sem);
-	thread_suspend(timer_thread);
-#endif
-#if PRECISE_TIMING_POSIX
-	pthread_mutex_lock(&wakeup_time_lock);
-	timer_thread_suspend();
-#endif
-	wakeup_time = wakeup_time_max;
-	for (TMDesc *d = tmDescList; d; d = d->next)
-		if ((ReadMacInt16(d->task + qType) & 0x8000))
-			if (timer_cmp_time(d->wakeup, wakeup_time) < 0)
-				wakeup_time = d->wakeup;
-#if PRECISE_TIMING_BEOS
-	release_sem(wakeup_time_sem);
-	thread_info info;
-	do {
-		resume_thread(timer_thread);			// This will unblock the thread
-		get_thread_info(timer_thread, &info);
-	} while (info.state == B_THREAD_SUSPENDED);	// Sometimes, resume_thread() doesn't work (BeOS bug?)
-#endif
-#if PRECISE_TIMING_MACH
-	semaphore_signal(wakeup_time_sem);
-	thread_abort(timer_thread);
-	thread_resume(timer_thread);
-#endif
-#if PRECISE_TIMING_POSIX
-	pthread_mutex_unlock(&wakeup_time_lock);
-	timer_thread_resume();
-	assert(suspend_count == 0);
-#endif
-#endif
+	set_wakeup_time();
 }
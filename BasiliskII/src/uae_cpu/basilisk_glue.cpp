@@ -147,6 +147,49 @@ void Start680x0(void)
 }
 
 
+/*
+ *  Start 680x0 emulation with the state loaded by Restore680x0State() (doesn't return)
+ */
+
+void Resume680x0(void)
+{
+#if USE_JIT
+    if (UseJIT)
+	m68k_compile_execute();
+    else
+#endif
+	m68k_execute();
+}
+
+
+/*
+ *  Save/restore 680x0 state
+ */
+
+void Save680x0State(snapshot_data &s)
+{
+	m68k_save_state(s);
+}
+
+bool Restore680x0State(snapshot_data &s)
+{
+	return m68k_restore_state(s);
+}
+
+
+/*
+ *  Call func on the emulator thread as soon as the CPU is at an instruction
+ *  boundary outside of any EMUL_OP (i.e. its complete state is in regs)
+ */
+
+void Checkpoint680x0(void (*func)(void))
+{
+	m68k_checkpoint_func = func;
+	idle_resume();
+	SPCFLAGS_SET( SPCFLAG_CHECKPOINT );
+}
+
+
 /*
  *  Trigger interrupt
  */
@@ -99,4 +99,12 @@ extern "C" void Execute68kTrap(uint16 trap, M68kRegisters *r);	// Execute MacOS
 extern void TriggerInterrupt(void);								// Trigger interrupt level 1 (InterruptFlag must be set first)
 extern void TriggerNMI(void);									// Trigger interrupt level 7
 
+// Snapshot support
+#define HAVE_680X0_SNAPSHOTS 1
+class snapshot_data;
+extern void Checkpoint680x0(void (*func)(void));				// Call func from the emulator thread at a clean instruction boundary
+extern void Save680x0State(snapshot_data &s);
+extern bool Restore680x0State(snapshot_data &s);
+extern void Resume680x0(void);									// Start 680x0 with restored state
+
 #endif
@@ -242,6 +242,10 @@ static inline void set_fpiar(uae_u32 new_fpiar);
 extern void fpu_init(bool integral_68040);
 extern void fpu_exit(void);
 extern void fpu_reset(void);
+
+/* FPCR, FPSR and FPIAR in m68k format (snapshots) */
+extern void fpu_get_control(uae_u32 *ctrl);
+extern void fpu_set_control(const uae_u32 *ctrl);
 	
 /* Floating-point arithmetic instructions */
 void fpuop_arithmetic(uae_u32 opcode, uae_u32 extra) REGPARAM;
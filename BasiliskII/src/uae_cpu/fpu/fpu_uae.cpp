@@ -2367,3 +2367,17 @@ void FFPU fpu_reset (void)
 	fpu_exit();
 	fpu_init(FPU is_integral);
 }
+
+void FFPU fpu_get_control (uae_u32 *ctrl)
+{
+	ctrl[0] = get_fpcr();
+	ctrl[1] = get_fpsr();
+	ctrl[2] = FPU instruction_address;
+}
+
+void FFPU fpu_set_control (const uae_u32 *ctrl)
+{
+	set_fpcr(ctrl[0]);
+	set_fpsr(ctrl[1]);
+	FPU instruction_address = ctrl[2];
+}
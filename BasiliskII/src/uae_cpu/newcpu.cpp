@@ -38,6 +38,7 @@ extern int intlev(void);	// From baisilisk_glue.cpp
 #include "newcpu.h"
 #include "compiler/compemu.h"
 #include "fpu/fpu.h"
+#include "snapshot.h"
 
 #if defined(ENABLE_EXCLUSIVE_SPCFLAGS) && !defined(HAVE_HARDWARE_LOCKS)
 B2_mutex *spcflags_lock = NULL;
@@ -1180,9 +1181,13 @@ static const char* ccnames[] =
 
 // If value is greater than zero, this means we are still processing an EmulOp
 // because the counter is incremented only in m68k_execute(), i.e. interpretive
-// execution only
+// execution only (without JIT, the top level m68k_execute() counts as 1)
 static int m68k_execute_depth = 0;
 
+// Called on the next instruction boundary outside of EmulOps after
+// SPCFLAG_CHECKPOINT was set
+void (*m68k_checkpoint_func)(void) = NULL;
+
 void m68k_reset (void)
 {
 	m68k_areg (regs, 7) = 0x2000;
@@ -1334,6 +1339,14 @@ int m68k_do_specialties (void)
 		SPCFLAGS_CLEAR( SPCFLAG_JIT_EXEC_RETURN );
 #endif
 
+	// Only take checkpoints at the top level, the host stack of a nested
+	// execution can't be saved
+	if (SPCFLAGS_TEST( SPCFLAG_CHECKPOINT ) && m68k_execute_depth == (UseJIT ? 0 : 1)) {
+		SPCFLAGS_CLEAR( SPCFLAG_CHECKPOINT );
+		if (m68k_checkpoint_func)
+			m68k_checkpoint_func();
+	}
+
 	if (SPCFLAGS_TEST( SPCFLAG_DOTRACE )) {
 		Exception (9,last_trace_ad);
 	}
@@ -1388,17 +1401,108 @@ void m68k_do_execute (void)
 
 void m68k_execute (void)
 {
-#if USE_JIT
 	++m68k_execute_depth;
-#endif
 	for (;;) {
 		if (quit_program)
 			break;
 		m68k_do_execute();
 	}
-#if USE_JIT
 	--m68k_execute_depth;
-#endif
+}
+
+/*
+ *  Save/restore CPU and FPU state at an instruction boundary (snapshots)
+ */
+
+void m68k_save_state(snapshot_data &s)
+{
+	MakeSR();
+	for (int i = 0; i < 16; i++)
+		s.put32(regs.regs[i]);
+	s.put32(m68k_getpc());
+	s.put16(regs.sr);
+	s.put32(regs.usp);
+	s.put32(regs.isp);
+	s.put32(regs.msp);
+	s.put32(regs.vbr);
+	s.put32(regs.sfc);
+	s.put32(regs.dfc);
+	s.put8(regs.stopped);
+	s.put32(caar);
+	s.put32(cacr);
+	s.put32(tc);
+	s.put32(itt0);
+	s.put32(itt1);
+	s.put32(dtt0);
+	s.put32(dtt1);
+	s.put32(mmusr);
+	s.put32(urp);
+	s.put32(srp);
+
+	// FPU data registers are stored in host format, so snapshots can only
+	// be restored by a build using the same FPU core
+	uae_u32 fpu_ctrl[3];
+	fpu_get_control(fpu_ctrl);
+	for (int i = 0; i < 3; i++)
+		s.put32(fpu_ctrl[i]);
+	s.put32(sizeof(fpu_register));
+	s.put_bytes(fpu.registers, sizeof(fpu.registers));
+}
+
+bool m68k_restore_state(snapshot_data &s)
+{
+	uae_u32 r[16];
+	for (int i = 0; i < 16; i++)
+		r[i] = s.get32();
+	uaecptr pc = s.get32();
+	uae_u16 sr = s.get16();
+	uae_u32 usp = s.get32(), isp = s.get32(), msp = s.get32();
+	uae_u32 vbr = s.get32(), sfc = s.get32(), dfc = s.get32();
+	uae_u8 stopped = s.get8();
+	uae_u32 mmu[10];
+	for (int i = 0; i < 10; i++)
+		mmu[i] = s.get32();
+	uae_u32 fpu_ctrl[3];
+	for (int i = 0; i < 3; i++)
+		fpu_ctrl[i] = s.get32();
+	if (s.get32() != sizeof(fpu_register))
+		return false;
+	fpu_register fp[8];
+	s.get_bytes(fp, sizeof(fp));
+	if (!s.ok())
+		return false;
+
+	for (int i = 0; i < 16; i++)
+		regs.regs[i] = r[i];
+	regs.usp = usp;
+	regs.isp = isp;
+	regs.msp = msp;
+	regs.vbr = vbr;
+	regs.sfc = sfc;
+	regs.dfc = dfc;
+	regs.stopped = stopped;
+	SPCFLAGS_INIT( stopped ? SPCFLAG_STOP : 0 );
+	regs.sr = sr;
+	regs.s = (sr >> 13) & 1;	// A7 is already the right stack pointer, MakeFromSR() must not switch
+	regs.m = (sr >> 12) & 1;
+	MakeFromSR();
+	caar = mmu[0];
+	cacr = mmu[1];
+	tc = mmu[2];
+	itt0 = mmu[3];
+	itt1 = mmu[4];
+	dtt0 = mmu[5];
+	dtt1 = mmu[6];
+	mmusr = mmu[7];
+	urp = mmu[8];
+	srp = mmu[9];
+
+	fpu_set_control(fpu_ctrl);
+	memcpy(fpu.registers, fp, sizeof(fp));
+
+	m68k_setpc(pc);
+	fill_prefetch_0();
+	return true;
 }
 
 static void m68k_verify (uaecptr addr, uaecptr *nextpc)
@@ -308,6 +308,11 @@ extern void m68k_reset (void);
 extern void m68k_enter_debugger(void);
 extern int m68k_do_specialties(void);
 
+class snapshot_data;
+extern void (*m68k_checkpoint_func)(void);
+extern void m68k_save_state(snapshot_data &s);
+extern bool m68k_restore_state(snapshot_data &s);
+
 extern void mmu_op (uae_u32, uae_u16);
 
 /* Opcode of faulting instruction */
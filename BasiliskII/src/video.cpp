@@ -36,6 +36,7 @@
 #include "slot_rom.h"
 #include "video.h"
 #include "video_defs.h"
+#include "snapshot.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -967,3 +968,92 @@ int16 VideoDriverStatus(uint32 pb, uint32 dce)
 	else
 		return nsDrvErr;
 }
+
+
+/*
+ *  Save/restore driver state and frame buffer contents (the frame buffer
+ *  must be at the same Mac address on restore)
+ */
+
+void monitor_desc::save_state(snapshot_data &s) const
+{
+	s.put16(current_apple_mode);
+	s.put32(current_id);
+	s.put16(preferred_apple_mode);
+	s.put32(preferred_id);
+	s.put32(mac_frame_base);
+	s.put_bytes(palette, sizeof(palette));
+	s.put8(luminance_mapping);
+	s.put8(interrupts_enabled);
+	s.put8(dm_present);
+	s.put32(gamma_table);
+	s.put32(alloc_gamma_table_size);
+	s.put32(slot_param);
+
+	uint32 size = current_mode->bytes_per_row * current_mode->y;
+	s.put32(size);
+	s.put_bytes(Mac2HostAddr(mac_frame_base), size);
+}
+
+bool monitor_desc::restore_state(snapshot_data &s)
+{
+	uint16 apple_mode = s.get16();
+	uint32 id = s.get32();
+	preferred_apple_mode = s.get16();
+	preferred_id = s.get32();
+	uint32 frame_base = s.get32();
+	s.get_bytes(palette, sizeof(palette));
+	luminance_mapping = s.get8();
+	interrupts_enabled = s.get8();
+	dm_present = s.get8();
+	gamma_table = s.get32();
+	alloc_gamma_table_size = s.get32();
+	slot_param = s.get32();
+	if (!s.ok())
+		return false;
+
+	// Switch to saved mode
+	vector<video_mode>::const_iterator it = find_mode(apple_mode, id);
+	if (it == invalid_mode()) {
+		D(bug("Saved video mode %04x/%08x not available\n", apple_mode, id));
+		return false;
+	}
+	if (it != current_mode) {
+		current_mode = it;
+		switch_to_current_mode();
+	}
+	current_apple_mode = apple_mode;
+	current_id = id;
+	if (mac_frame_base != frame_base) {
+		D(bug("Frame buffer moved from %08x to %08x\n", frame_base, mac_frame_base));
+		return false;
+	}
+
+	// Restore frame buffer contents and colors
+	uint32 size = s.get32();
+	if (size != current_mode->bytes_per_row * current_mode->y)
+		return false;
+	s.get_bytes(Mac2HostAddr(mac_frame_base), size);
+	if (IsDirectMode(*current_mode))
+		load_gamma_ramp();
+	else
+		set_palette(palette, palette_size(current_mode->depth));
+	return s.ok();
+}
+
+void VideoSaveState(snapshot_data &s)
+{
+	s.put32(VideoMonitors.size());
+	for (vector<monitor_desc *>::const_iterator i = VideoMonitors.begin(); i != VideoMonitors.end(); ++i)
+		(*i)->save_state(s);
+}
+
+bool VideoRestoreState(snapshot_data &s)
+{
+	if (s.get32() != VideoMonitors.size())
+		return false;
+	for (vector<monitor_desc *>::const_iterator i = VideoMonitors.begin(); i != VideoMonitors.end(); ++i)
+		if (!(*i)->restore_state(s))
+			return false;
+	return true;
+}
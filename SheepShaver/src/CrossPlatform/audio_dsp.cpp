@@ -0,0 +1 @@
+../../../BasiliskII/src/CrossPlatform/audio_dsp.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../../BasiliskII/src/CrossPlatform/audio_dsp.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../../BasiliskII/src/Unix/disk_vhd.cpp
\ No newline at end of file
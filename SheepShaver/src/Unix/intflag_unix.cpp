@@ -0,0 +1 @@
+../../../BasiliskII/src/Unix/intflag_unix.cpp
\ No newline at end of file
@@ -232,12 +232,8 @@ static EmulatorData *emulator_data;
 
 static uint8 last_xpram[XPRAM_SIZE];		// Buffer for monitoring XPRAM changes
 
-static bool nvram_thread_active = false;	// Flag: NVRAM watchdog installed
-static volatile bool nvram_thread_cancel;	// Flag: Cancel NVRAM thread
-static pthread_t nvram_thread;				// NVRAM watchdog
 static bool tick_thread_active = false;		// Flag: MacOS thread installed
-static volatile bool tick_thread_cancel;	// Flag: Cancel 60Hz thread
-static pthread_t tick_thread;				// 60Hz thread
+bool tick_inhibit;							// Flag: Don't deliver ticks (set during MacOS reset)
 static pthread_t emul_thread;				// MacOS thread
 static int use_gui = -1;   					// Override prefs and show gui
 
@@ -273,8 +269,7 @@ static bool shm_map_address(int kernel_area, uint32 addr);
 #endif
 static void Quit(void);
 static void *emul_func(void *arg);
-static void *nvram_func(void *arg);
-static void *tick_func(void *arg);
+static void ticks_elapsed(int elapsed);
 #if EMULATED_PPC
 extern void emul_ppc(uint32 start);
 extern void init_emul_ppc(void);
@@ -316,45 +311,6 @@ uintptr SignalStackBase(void)
 {
 	return sig_stack + SIG_STACK_SIZE;
 }
-
-
-/*
- *  Atomic operations
- */
-
-#if HAVE_SPINLOCKS
-static spinlock_t atomic_ops_lock = SPIN_LOCK_UNLOCKED;
-#else
-#define spin_lock(LOCK)
-#define spin_unlock(LOCK)
-#endif
-
-int atomic_add(int *var, int v)
-{
-	spin_lock(&atomic_ops_lock);
-	int ret = *var;
-	*var += v;
-	spin_unlock(&atomic_ops_lock);
-	return ret;
-}
-
-int atomic_and(int *var, int v)
-{
-	spin_lock(&atomic_ops_lock);
-	int ret = *var;
-	*var &= v;
-	spin_unlock(&atomic_ops_lock);
-	return ret;
-}
-
-int atomic_or(int *var, int v)
-{
-	spin_lock(&atomic_ops_lock);
-	int ret = *var;
-	*var |= v;
-	spin_unlock(&atomic_ops_lock);
-	return ret;
-}
 #endif
 
 
@@ -367,9 +323,9 @@ static inline uint8 *vm_mac_acquire(uint32 size)
 	return (uint8 *)vm_acquire(size);
 }
 
-static inline int vm_mac_acquire_fixed(uint32 addr, uint32 size)
+static inline int vm_mac_acquire_fixed(uint32 addr, uint32 size, int options = VM_MAP_DEFAULT)
 {
-	return vm_acquire_fixed(Mac2HostAddr(addr), size);
+	return vm_acquire_fixed(Mac2HostAddr(addr), size, options);
 }
 
 static inline int vm_mac_release(uint32 addr, uint32 size)
@@ -965,6 +921,7 @@ int main(int argc, char **argv)
 
 	// Initialize VM system
 	vm_init();
+	vm_set_huge_pages(PrefsFindBool("hugepages"), PrefsFindBool("prefault"));
 
 	// Get system info
 	get_system_info();
@@ -1051,7 +1008,7 @@ int main(int argc, char **argv)
 	memory_mapped_from_zero = false;
 	ram_rom_areas_contiguous = false;
 #if REAL_ADDRESSING && HAVE_LINKER_SCRIPT
-	if (vm_mac_acquire_fixed(0, RAMSize) == 0) {
+	if (vm_mac_acquire_fixed(0, RAMSize, VM_MAP_DEFAULT | VM_MAP_HUGE) == 0) {
 		D(bug("Could allocate RAM from 0x0000\n"));
 		RAMBase = 0;
 		RAMBaseHost = Mac2HostAddr(RAMBase);
@@ -1084,7 +1041,7 @@ int main(int argc, char **argv)
 
 		ram_rom_areas_contiguous = true;
 #else
-		if (vm_mac_acquire_fixed(RAM_BASE, RAMSize) < 0) {
+		if (vm_mac_acquire_fixed(RAM_BASE, RAMSize, VM_MAP_DEFAULT | VM_MAP_HUGE) < 0) {
 			sprintf(str, GetString(STR_RAM_MMAP_ERR), strerror(errno));
 			ErrorAlert(str);
 			goto quit;
@@ -1150,22 +1107,24 @@ int main(int argc, char **argv)
 		goto quit;
 	D(bug("Initialization complete\n"));
 
-	// Clear caches (as we loaded and patched code) and write protect ROM
+	// Clear caches (as we loaded and patched code) and write protect ROM,
+	// possibly sharing it with other instances using the same one
 #if !EMULATED_PPC
 	flush_icache_range(ROMBase, ROMBase + ROM_AREA_SIZE);
 #endif
-	vm_protect(ROMBaseHost, ROM_AREA_SIZE, VM_PAGE_READ | VM_PAGE_EXECUTE);
-
-	// Start 60Hz thread
-	tick_thread_cancel = false;
-	tick_thread_active = (pthread_create(&tick_thread, NULL, tick_func, NULL) == 0);
-	D(bug("Tick thread installed (%ld)\n", tick_thread));
+	{
+		const char *rom_cache_dir = PrefsFindString("romcachedir");
+		if (rom_cache_dir == NULL || vm_share_contents(ROMBaseHost, ROM_AREA_SIZE, rom_cache_dir, VM_PAGE_READ | VM_PAGE_EXECUTE) < 0) {
+			if (rom_cache_dir)
+				printf("WARNING: Cannot share ROM through %s\n", rom_cache_dir);
+			vm_protect(ROMBaseHost, ROM_AREA_SIZE, VM_PAGE_READ | VM_PAGE_EXECUTE);
+		}
+	}
 
-	// Start NVRAM watchdog thread
+	// Start 60Hz thread, it also takes care of the NVRAM watchdog
 	memcpy(last_xpram, XPRAM, XPRAM_SIZE);
-	nvram_thread_cancel = false;
-	nvram_thread_active = (pthread_create(&nvram_thread, NULL, nvram_func, NULL) == 0);
-	D(bug("NVRAM thread installed (%ld)\n", nvram_thread));
+	tick_thread_active = tick_source_start(ticks_elapsed, &tick_inhibit, NULL);
+	D(bug("Tick thread installed\n"));
 
 #if !EMULATED_PPC
 	// Install SIGILL handler
@@ -1222,16 +1181,13 @@ static void Quit(void)
 
 	// Stop 60Hz thread
 	if (tick_thread_active) {
-		tick_thread_cancel = true;
-		pthread_cancel(tick_thread);
-		pthread_join(tick_thread, NULL);
+		tick_source_stop();
+		if (PrefsFindBool("timingstats"))
+			tick_report();
 	}
-
-	// Stop NVRAM watchdog thread
-	if (nvram_thread_active) {
-		nvram_thread_cancel = true;
-		pthread_cancel(nvram_thread);
-		pthread_join(nvram_thread, NULL);
+	if (PrefsFindBool("timingstats")) {
+		idle_report();
+		intflag_report();
 	}
 
 #if !EMULATED_PPC
@@ -1262,8 +1218,13 @@ static void Quit(void)
 	SheepMem::Exit();
 
 	// Delete RAM area
-	if (ram_area_mapped)
+	if (ram_area_mapped) {
+#if DEBUG
+		size_t huge_bytes, page_size = vm_get_mapping_page_size(RAMBaseHost, &huge_bytes);
+		bug("RAM area used %d KB pages, %d KB in transparent huge pages\n", (int)(page_size / 1024), (int)(huge_bytes / 1024));
+#endif
 		vm_mac_release(RAMBase, RAMSize);
+	}
 
 	// Delete ROM area
 	if (rom_area_mapped)
@@ -1490,101 +1451,87 @@ static void nvram_watchdog(void)
 	}
 }
 
-static void *nvram_func(void *arg)
-{
-	while (!nvram_thread_cancel) {
-		for (int i=0; i<60 && !nvram_thread_cancel; i++)
-			Delay_usec(999999);		// Only wait 1 second so we quit promptly when nvram_thread_cancel becomes true
-		nvram_watchdog();
-	}
-	return NULL;
-}
-
 
 /*
  *  60Hz thread (really 60.15Hz)
  */
 
-bool tick_inhibit;
-static void *tick_func(void *arg)
+// All periodic work is done from one wakeup; elapsed > 1 after the tick
+// source skipped, held back or batched ticks (while the emulator is idle).
+// MacOS gets one interrupt for them, the others are added to Ticks.
+static void ticks_elapsed(int elapsed)
 {
-	int tick_counter = 0;
-	uint64 start = GetTicks_usec();
-	int64 ticks = 0;
-	uint64 next = start;
-
-	while (!tick_thread_cancel) {
-
-		// Wait
-		next += 16625;
-		int64 delay = next - GetTicks_usec();
-		if (delay > 0)
-			Delay_usec(delay);
-		else if (delay < -16625)
-			next = GetTicks_usec();
-		if (tick_inhibit) continue;
-		ticks++;
+	static int tick_counter = 0;
+	static int second_counter = 0;
 
 #if !EMULATED_PPC
-		// Did we crash?
-		if (emul_thread_fatal) {
+	// Did we crash?
+	static bool crashed = false;
+	if (crashed)
+		return;
+	if (emul_thread_fatal) {
+		crashed = true;
 
-			// Yes, dump registers
-			sigregs *r = &sigsegv_regs;
-			char str[256];
-			if (crash_reason == NULL)
-				crash_reason = "SIGSEGV";
-			sprintf(str, "%s\n"
-				"   pc %08lx     lr %08lx    ctr %08lx    msr %08lx\n"
-				"  xer %08lx     cr %08lx  \n"
-				"   r0 %08lx     r1 %08lx     r2 %08lx     r3 %08lx\n"
-				"   r4 %08lx     r5 %08lx     r6 %08lx     r7 %08lx\n"
-				"   r8 %08lx     r9 %08lx    r10 %08lx    r11 %08lx\n"
-				"  r12 %08lx    r13 %08lx    r14 %08lx    r15 %08lx\n"
-				"  r16 %08lx    r17 %08lx    r18 %08lx    r19 %08lx\n"
-				"  r20 %08lx    r21 %08lx    r22 %08lx    r23 %08lx\n"
-				"  r24 %08lx    r25 %08lx    r26 %08lx    r27 %08lx\n"
-				"  r28 %08lx    r29 %08lx    r30 %08lx    r31 %08lx\n",
-				crash_reason,
-				r->nip, r->link, r->ctr, r->msr,
-				r->xer, r->ccr,
-				r->gpr[0], r->gpr[1], r->gpr[2], r->gpr[3],
-				r->gpr[4], r->gpr[5], r->gpr[6], r->gpr[7],
-				r->gpr[8], r->gpr[9], r->gpr[10], r->gpr[11],
-				r->gpr[12], r->gpr[13], r->gpr[14], r->gpr[15],
-				r->gpr[16], r->gpr[17], r->gpr[18], r->gpr[19],
-				r->gpr[20], r->gpr[21], r->gpr[22], r->gpr[23],
-				r->gpr[24], r->gpr[25], r->gpr[26], r->gpr[27],
-				r->gpr[28], r->gpr[29], r->gpr[30], r->gpr[31]);
-			printf(str);
-			VideoQuitFullScreen();
+		// Yes, dump registers
+		sigregs *r = &sigsegv_regs;
+		char str[256];
+		if (crash_reason == NULL)
+			crash_reason = "SIGSEGV";
+		sprintf(str, "%s\n"
+			"   pc %08lx     lr %08lx    ctr %08lx    msr %08lx\n"
+			"  xer %08lx     cr %08lx  \n"
+			"   r0 %08lx     r1 %08lx     r2 %08lx     r3 %08lx\n"
+			"   r4 %08lx     r5 %08lx     r6 %08lx     r7 %08lx\n"
+			"   r8 %08lx     r9 %08lx    r10 %08lx    r11 %08lx\n"
+			"  r12 %08lx    r13 %08lx    r14 %08lx    r15 %08lx\n"
+			"  r16 %08lx    r17 %08lx    r18 %08lx    r19 %08lx\n"
+			"  r20 %08lx    r21 %08lx    r22 %08lx    r23 %08lx\n"
+			"  r24 %08lx    r25 %08lx    r26 %08lx    r27 %08lx\n"
+			"  r28 %08lx    r29 %08lx    r30 %08lx    r31 %08lx\n",
+			crash_reason,
+			r->nip, r->link, r->ctr, r->msr,
+			r->xer, r->ccr,
+			r->gpr[0], r->gpr[1], r->gpr[2], r->gpr[3],
+			r->gpr[4], r->gpr[5], r->gpr[6], r->gpr[7],
+			r->gpr[8], r->gpr[9], r->gpr[10], r->gpr[11],
+			r->gpr[12], r->gpr[13], r->gpr[14], r->gpr[15],
+			r->gpr[16], r->gpr[17], r->gpr[18], r->gpr[19],
+			r->gpr[20], r->gpr[21], r->gpr[22], r->gpr[23],
+			r->gpr[24], r->gpr[25], r->gpr[26], r->gpr[27],
+			r->gpr[28], r->gpr[29], r->gpr[30], r->gpr[31]);
+		printf(str);
+		VideoQuitFullScreen();
 
 #ifdef ENABLE_MON
-			// Start up mon in real-mode
-			printf("Welcome to the sheep factory.\n");
-			const char *arg[4] = {"mon", "-m", "-r", NULL};
-			mon(3, arg);
+		// Start up mon in real-mode
+		printf("Welcome to the sheep factory.\n");
+		const char *arg[4] = {"mon", "-m", "-r", NULL};
+		mon(3, arg);
 #endif
-			return NULL;
-		}
+		return;
+	}
 #endif
 
-		// Pseudo Mac 1Hz interrupt, update local time
-		if (++tick_counter > 60) {
-			tick_counter = 0;
-			WriteMacInt32(0x20c, TimerDateTime());
-		}
+	// Pseudo Mac 1Hz interrupt, update local time
+	tick_counter += elapsed;
+	while (tick_counter >= 60) {
+		tick_counter -= 60;
+		WriteMacInt32(0x20c, TimerDateTime());
 
-		// Trigger 60Hz interrupt
-		if (ReadMacInt32(XLM_IRQ_NEST) == 0) {
-			SetInterruptFlag(INTFLAG_VIA);
-			TriggerInterrupt();
+		// Save NVRAM to disk once a minute if it has changed
+		if (++second_counter >= 60) {
+			second_counter = 0;
+			nvram_watchdog();
 		}
 	}
 
-	D(uint64 end = GetTicks_usec());
-	D(bug("%lld ticks in %lld usec = %f ticks/sec\n", ticks, end - start, ticks * 1000000.0 / (end - start)));
-	return NULL;
+	// Trigger 60Hz interrupt, or count the ticks for the next one
+	if (ReadMacInt32(XLM_IRQ_NEST) == 0) {
+		ExtraTicks += elapsed - 1;
+		SetInterruptFlag(INTFLAG_VIA);
+		TriggerInterrupt();
+	} else
+		ExtraTicks += elapsed;
 }
 
 
@@ -1716,21 +1663,11 @@ void TriggerInterrupt(void)
 
 
 /*
- *  Interrupt flags (must be handled atomically!)
+ *  Interrupt flags (must be handled atomically!), see intflag_unix.cpp
  */
 
 volatile uint32 InterruptFlags = 0;
 
-void SetInterruptFlag(uint32 flag)
-{
-	atomic_or((int *)&InterruptFlags, flag);
-}
-
-void ClearInterruptFlag(uint32 flag)
-{
-	atomic_and((int *)&InterruptFlags, ~flag);
-}
-
 
 /*
  *  Disable interrupts
@@ -54,6 +54,10 @@ extern bool tick_inhibit;
 
 void PlayStartupSound();
 
+// Written by the tick source only; the 60Hz interrupt adds the ticks that
+// came on top since it last ran to Ticks
+volatile uint32 ExtraTicks = 0;
+
 // TVector of MakeExecutable
 static uint32 MakeExecutableTvec;
 
@@ -309,20 +313,33 @@ void EmulOp(M68kRegisters *r, uint32 pc, int selector)
 			tick_inhibit = false;
 			break;
 
-		case OP_IRQ:			// Level 1 interrupt
+		case OP_IRQ: {			// Level 1 interrupt
 			WriteMacInt16(ReadMacInt32(KernelDataAddr + 0x67c), 0);	// Clear interrupt
 			r->d[0] = 0;
 			if (HasMacStarted()) {
-				if (InterruptFlags & INTFLAG_VIA) {
-					ClearInterruptFlag(INTFLAG_VIA);
+
+				// Take all pending interrupts at once, anything raised while
+				// they are handled is left for the next interrupt
+				uint32 pending = InterruptFlags;
+				ClearInterruptFlag(pending);
+
+				if (pending & INTFLAG_VIA) {
 #if !PRECISE_TIMING
 					TimerInterrupt();
 #endif
 					ExecuteNative(NATIVE_VIDEO_VBL);
 
-					static int tick_counter = 0;
-					if (++tick_counter >= 60) {
-						tick_counter = 0;
+					// MacOS increments Ticks for the interrupt itself, add the
+					// ticks that didn't get an interrupt
+					static uint32 extra_ticks_seen = 0;
+					uint32 extra = ExtraTicks - extra_ticks_seen;
+					extra_ticks_seen += extra;
+					WriteMacInt32(0x16a, ReadMacInt32(0x16a) + extra);
+
+					static uint32 tick_counter = 0;
+					tick_counter += 1 + extra;
+					if (tick_counter >= 60) {
+						tick_counter %= 60;
 						SonyInterrupt();
 						DiskInterrupt();
 						CDROMInterrupt();
@@ -330,29 +347,25 @@ void EmulOp(M68kRegisters *r, uint32 pc, int selector)
 
 					r->d[0] = 1;		// Flag: 68k interrupt routine executes VBLTasks etc.
 				}
-				if (InterruptFlags & INTFLAG_SERIAL) {
-					ClearInterruptFlag(INTFLAG_SERIAL);
+				if (pending & INTFLAG_SERIAL) {
 					SerialInterrupt();
 				}
-				if (InterruptFlags & INTFLAG_ETHER) {
-					ClearInterruptFlag(INTFLAG_ETHER);
+				if (pending & INTFLAG_ETHER) {
 					ExecuteNative(NATIVE_ETHER_IRQ);
 				}
-				if (InterruptFlags & INTFLAG_TIMER) {
-					ClearInterruptFlag(INTFLAG_TIMER);
+				if (pending & INTFLAG_TIMER) {
 					TimerInterrupt();
 				}
-				if (InterruptFlags & INTFLAG_AUDIO) {
-					ClearInterruptFlag(INTFLAG_AUDIO);
+				if (pending & INTFLAG_AUDIO) {
 					AudioInterrupt();
 				}
-				if (InterruptFlags & INTFLAG_ADB) {
-					ClearInterruptFlag(INTFLAG_ADB);
+				if (pending & INTFLAG_ADB) {
 					ADBInterrupt();
 				}
 			} else
 				r->d[0] = 1;
 			break;
+		}
 
 		case OP_SCSI_DISPATCH: {	// SCSIDispatch() replacement
 			uint32 ret = ReadMacInt32(r->a[7]);
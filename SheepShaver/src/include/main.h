@@ -71,6 +71,7 @@ enum {
 };
 
 extern volatile uint32 InterruptFlags;						// Currently pending interrupts
+extern volatile uint32 ExtraTicks;							// 60Hz ticks without an interrupt of their own (only grows)
 extern void SetInterruptFlag(uint32);
 extern void ClearInterruptFlag(uint32);
 extern void TriggerInterrupt(void);							// Trigger SIGUSR1 interrupt in emulator thread
@@ -0,0 +1 @@
+../../../BasiliskII/src/include/snapshot.h
\ No newline at end of file
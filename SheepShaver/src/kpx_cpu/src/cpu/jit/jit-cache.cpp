@@ -67,7 +67,7 @@ basic_jit_cache::init_translation_cache(uint32 size)
 	cache_size = (size + JIT_CACHE_SIZE_GUARD + roundup - 1) & -roundup;
 	assert(cache_size > 0);
 
-	tcode_start = (uint8 *)vm_acquire(cache_size, VM_MAP_PRIVATE | VM_MAP_32BIT);
+	tcode_start = (uint8 *)vm_acquire(cache_size, VM_MAP_PRIVATE | VM_MAP_32BIT | VM_MAP_HUGE);
 	if (tcode_start == VM_MAP_FAILED) {
 		tcode_start = NULL;
 		return false;
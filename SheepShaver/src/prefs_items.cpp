@@ -69,9 +69,11 @@ prefs_desc common_prefs_items[] = {
 	{"gammaramp", TYPE_STRING, false,	"gamma ramp (on, off or fullscreen)"},
 	{"swap_opt_cmd", TYPE_BOOLEAN, false,	"swap option and command key"},
 	{"host_domain", TYPE_STRING, true,	"handle DNS requests for this domain on the host (slirp only)"},
+	{"dnsstatic", TYPE_STRING, true,	"address and names answered by the slirp DNS proxy itself"},
 	{"redir", TYPE_STRING, true,		"port forwarding for slirp"},
 	{"title", TYPE_STRING, false,	"window title"},
 	{"sound_buffer", TYPE_INT32, false,	"sound buffer length"},
+	{"sound_null", TYPE_BOOLEAN, false,	"discard sound output at real-time pace (no audio device needed)"},
 	{"name_encoding", TYPE_INT32, false,	"file name encoding"},
 	{"init_grab", TYPE_BOOLEAN, false,	"initially grabbing mouse"},
 	{NULL, TYPE_END, false, NULL} // End of list